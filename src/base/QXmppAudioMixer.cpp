@@ -0,0 +1,392 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QTimer>
+#include <QVector>
+
+#include "QXmppAudioMixer.h"
+#include "QXmppJingleIq.h"
+#include "QXmppRtpChannel.h"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QXMPP_MIXER_SSE2
+#include <emmintrin.h>
+#endif
+
+#define SAMPLE_BYTES 2
+
+// mean absolute amplitude above which a channel is considered to be
+// speaking, about -50 dBFS
+#define DEFAULT_SPEECH_THRESHOLD 100
+
+/// Adds \a count samples from \a src to the 32-bit sums in \a dst.
+
+static void accumulateSamples(qint32 *dst, const qint16 *src, int count)
+{
+    int i = 0;
+#ifdef QXMPP_MIXER_SSE2
+    for (; i + 8 <= count; i += 8) {
+        // sign extend the samples to 32 bits
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+        const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+        __m128i *d = reinterpret_cast<__m128i*>(dst + i);
+        _mm_storeu_si128(d, _mm_add_epi32(_mm_loadu_si128(d), lo));
+        _mm_storeu_si128(d + 1, _mm_add_epi32(_mm_loadu_si128(d + 1), hi));
+    }
+#endif
+    for (; i < count; ++i)
+        dst[i] += src[i];
+}
+
+/// Writes \a count sums from \a total to \a dst, minus the samples in
+/// \a exclude if it is not null, saturating the result.
+
+static void mixdownSamples(qint16 *dst, const qint32 *total, const qint16 *exclude, int count)
+{
+    int i = 0;
+#ifdef QXMPP_MIXER_SSE2
+    for (; i + 8 <= count; i += 8) {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(total + i));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(total + i + 4));
+        if (exclude) {
+            const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(exclude + i));
+            lo = _mm_sub_epi32(lo, _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+            hi = _mm_sub_epi32(hi, _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packs_epi32(lo, hi));
+    }
+#endif
+    for (; i < count; ++i)
+        dst[i] = qBound(-32768, total[i] - (exclude ? exclude[i] : 0), 32767);
+}
+
+/// Returns the mean absolute amplitude of \a count samples.
+
+static int sampleLevel(const qint16 *samples, int count)
+{
+    if (!count)
+        return 0;
+    qint64 sum = 0;
+    for (int i = 0; i < count; ++i)
+        sum += qAbs(int(samples[i]));
+    return int(sum / count);
+}
+
+class QXmppAudioMixerParticipant
+{
+public:
+    QXmppAudioMixerParticipant(QXmppRtpAudioChannel *channel);
+
+    QXmppRtpAudioChannel *channel;
+    QByteArray input;
+    QByteArray output;
+    int level;
+    bool speaking;
+    bool warned;
+};
+
+QXmppAudioMixerParticipant::QXmppAudioMixerParticipant(QXmppRtpAudioChannel *channel)
+    : channel(channel)
+    , level(0)
+    , speaking(false)
+    , warned(false)
+{
+}
+
+static bool levelGreaterThan(const QXmppAudioMixerParticipant *p1, const QXmppAudioMixerParticipant *p2)
+{
+    return p1->level > p2->level;
+}
+
+class QXmppAudioMixerPrivate
+{
+public:
+    QXmppAudioMixerPrivate();
+
+    QList<QXmppAudioMixerParticipant*> participants;
+    QList<QXmppRtpAudioChannel*> speakers;
+    QByteArray mixBuffer;
+    QVector<qint32> mixTotal;
+    QTimer *timer;
+    int maximumSpeakers;
+    int speechThreshold;
+};
+
+QXmppAudioMixerPrivate::QXmppAudioMixerPrivate()
+    : timer(0)
+    , maximumSpeakers(0)
+    , speechThreshold(DEFAULT_SPEECH_THRESHOLD)
+{
+}
+
+/// Constructs a new audio mixer.
+///
+/// \param parent
+
+QXmppAudioMixer::QXmppAudioMixer(QObject *parent)
+    : QXmppLoggable(parent)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d = new QXmppAudioMixerPrivate;
+    d->timer = new QTimer(this);
+    d->timer->setInterval(20);
+    d->timer->setTimerType(Qt::PreciseTimer);
+    check = connect(d->timer, SIGNAL(timeout()),
+                    this, SLOT(mix()));
+    Q_ASSERT(check);
+}
+
+QXmppAudioMixer::~QXmppAudioMixer()
+{
+    qDeleteAll(d->participants);
+    delete d;
+}
+
+/// Adds an audio channel to the mixer.
+///
+/// \param channel
+
+void QXmppAudioMixer::addChannel(QXmppRtpAudioChannel *channel)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (!channel || channels().contains(channel))
+        return;
+
+    d->participants << new QXmppAudioMixerParticipant(channel);
+    check = connect(channel, SIGNAL(destroyed(QObject*)),
+                    this, SLOT(_q_channelDestroyed(QObject*)));
+    Q_ASSERT(check);
+
+    if (!d->timer->isActive())
+        d->timer->start();
+}
+
+/// Removes an audio channel from the mixer.
+///
+/// \param channel
+
+void QXmppAudioMixer::removeChannel(QXmppRtpAudioChannel *channel)
+{
+    for (int i = 0; i < d->participants.size(); ++i) {
+        if (d->participants.at(i)->channel == channel) {
+            disconnect(channel, SIGNAL(destroyed(QObject*)),
+                       this, SLOT(_q_channelDestroyed(QObject*)));
+            delete d->participants.takeAt(i);
+            break;
+        }
+    }
+    d->speakers.removeAll(channel);
+
+    if (d->participants.isEmpty())
+        d->timer->stop();
+}
+
+/// Returns the audio channels attached to the mixer.
+
+QList<QXmppRtpAudioChannel*> QXmppAudioMixer::channels() const
+{
+    QList<QXmppRtpAudioChannel*> channels;
+    foreach (QXmppAudioMixerParticipant *participant, d->participants)
+        channels << participant->channel;
+    return channels;
+}
+
+/// Returns the channels which were mixed during the last tick, loudest
+/// first.
+
+QList<QXmppRtpAudioChannel*> QXmppAudioMixer::activeSpeakers() const
+{
+    return d->speakers;
+}
+
+/// Returns the duration of the mixed frames in milliseconds.
+
+int QXmppAudioMixer::interval() const
+{
+    return d->timer->interval();
+}
+
+/// Sets the duration of the mixed frames in milliseconds.
+///
+/// The default is 20 milliseconds.
+///
+/// \param msecs
+
+void QXmppAudioMixer::setInterval(int msecs)
+{
+    d->timer->setInterval(msecs);
+}
+
+/// Returns the maximum number of channels which are mixed together.
+///
+/// A value of 0, which is the default, means all channels are mixed.
+
+int QXmppAudioMixer::maximumSpeakers() const
+{
+    return d->maximumSpeakers;
+}
+
+/// Sets the maximum number of channels which are mixed together, the
+/// loudest channels are selected.
+///
+/// \param speakers
+
+void QXmppAudioMixer::setMaximumSpeakers(int speakers)
+{
+    d->maximumSpeakers = qMax(speakers, 0);
+}
+
+/// Returns the level above which a channel is considered to be speaking,
+/// as a mean absolute amplitude of its 16-bit samples.
+
+int QXmppAudioMixer::speechThreshold() const
+{
+    return d->speechThreshold;
+}
+
+/// Sets the level above which a channel is considered to be speaking, as a
+/// mean absolute amplitude of its 16-bit samples.
+///
+/// Channels below the threshold, for instance carrying background noise or
+/// comfort noise, are not mixed. The default is 100, about -50 dBFS.
+///
+/// \param level
+
+void QXmppAudioMixer::setSpeechThreshold(int level)
+{
+    d->speechThreshold = qMax(level, 0);
+}
+
+/// Reads a frame from every channel, mixes them and writes the mixes back
+/// to the channels.
+///
+/// This is called on every tick of the mixer's clock.
+
+void QXmppAudioMixer::mix()
+{
+    // the channels are mixed at the sample rate of the first open channel
+    int sampleRate = 0;
+    QList<QXmppAudioMixerParticipant*> active;
+    foreach (QXmppAudioMixerParticipant *participant, d->participants) {
+        participant->speaking = false;
+        QXmppRtpAudioChannel *channel = participant->channel;
+        if ((channel->openMode() & QIODevice::ReadWrite) != QIODevice::ReadWrite)
+            continue;
+
+        const int channelSampleRate = channel->sampleRate();
+        if (!sampleRate)
+            sampleRate = channelSampleRate;
+        if (channelSampleRate != sampleRate || channel->payloadType().channels() > 1) {
+            if (!participant->warned) {
+                warning(QString("Audio mixer cannot mix channel with sample rate %1 and %2 channels").arg(
+                    QString::number(channelSampleRate),
+                    QString::number(channel->payloadType().channels())));
+                participant->warned = true;
+            }
+            continue;
+        }
+        active << participant;
+    }
+
+    d->speakers.clear();
+    if (active.isEmpty())
+        return;
+
+    // read a frame from every channel and measure its level
+    const int samples = sampleRate * interval() / 1000;
+    const int bytes = samples * SAMPLE_BYTES;
+    foreach (QXmppAudioMixerParticipant *participant, active) {
+        participant->input.resize(bytes);
+        const qint64 length = participant->channel->read(participant->input.data(), bytes);
+        if (length < bytes)
+            memset(participant->input.data() + qMax(length, qint64(0)), 0, bytes - qMax(length, qint64(0)));
+
+        // smooth the level so that the speakers do not flap
+        const int level = sampleLevel(reinterpret_cast<const qint16*>(participant->input.constData()), samples);
+        participant->level = (3 * participant->level + level) / 4;
+    }
+
+    // select the loudest speakers
+    QList<QXmppAudioMixerParticipant*> speakers;
+    foreach (QXmppAudioMixerParticipant *participant, active) {
+        if (participant->level > d->speechThreshold)
+            speakers << participant;
+    }
+    qStableSort(speakers.begin(), speakers.end(), levelGreaterThan);
+    if (d->maximumSpeakers > 0 && speakers.size() > d->maximumSpeakers)
+        speakers = speakers.mid(0, d->maximumSpeakers);
+    foreach (QXmppAudioMixerParticipant *participant, speakers) {
+        participant->speaking = true;
+        d->speakers << participant->channel;
+    }
+
+    // sum the speakers once, without saturating so that each speaker's own
+    // input can be subtracted exactly
+    d->mixTotal.fill(0, samples);
+    foreach (QXmppAudioMixerParticipant *speaker, speakers) {
+        accumulateSamples(d->mixTotal.data(),
+                          reinterpret_cast<const qint16*>(speaker->input.constData()),
+                          samples);
+    }
+
+    // the participants who are not speaking all hear every speaker
+    d->mixBuffer.resize(bytes);
+    mixdownSamples(reinterpret_cast<qint16*>(d->mixBuffer.data()), d->mixTotal.constData(), 0, samples);
+
+    // the speakers hear every speaker but themselves
+    foreach (QXmppAudioMixerParticipant *participant, active) {
+        if (!participant->speaking) {
+            participant->channel->write(d->mixBuffer);
+            continue;
+        }
+
+        participant->output.resize(bytes);
+        mixdownSamples(reinterpret_cast<qint16*>(participant->output.data()),
+                       d->mixTotal.constData(),
+                       reinterpret_cast<const qint16*>(participant->input.constData()),
+                       samples);
+        participant->channel->write(participant->output);
+    }
+}
+
+void QXmppAudioMixer::_q_channelDestroyed(QObject *object)
+{
+    for (int i = 0; i < d->participants.size(); ++i) {
+        if (d->participants.at(i)->channel == object) {
+            delete d->participants.takeAt(i);
+            break;
+        }
+    }
+    d->speakers.removeAll(static_cast<QXmppRtpAudioChannel*>(object));
+
+    if (d->participants.isEmpty())
+        d->timer->stop();
+}
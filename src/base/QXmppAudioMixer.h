@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPAUDIOMIXER_H
+#define QXMPPAUDIOMIXER_H
+
+#include "QXmppLogger.h"
+
+class QXmppAudioMixerPrivate;
+class QXmppRtpAudioChannel;
+
+/// \brief The QXmppAudioMixer class mixes the audio of several RTP audio
+/// channels, for instance to run a conference bridge.
+///
+/// On each tick of a common clock, the mixer reads one frame of decoded
+/// audio from every channel, and writes back to each channel the mix of
+/// all the other channels, so that participants do not hear themselves.
+///
+/// Only the channels whose level exceeds speechThreshold() are mixed, and
+/// when maximumSpeakers() is set, only the loudest of them, which limits the
+/// noise added by idle participants.
+///
+/// Once a channel has been added to the mixer, the application must not
+/// read from it or write to it. All the channels must use the same sample
+/// rate, channels with a different sample rate are ignored. Use
+/// QXmppRtpAudioChannel::setSampleRate() to mix channels whose codecs have
+/// different clock rates.
+
+class QXMPP_EXPORT QXmppAudioMixer : public QXmppLoggable
+{
+    Q_OBJECT
+
+public:
+    QXmppAudioMixer(QObject *parent = 0);
+    ~QXmppAudioMixer();
+
+    void addChannel(QXmppRtpAudioChannel *channel);
+    void removeChannel(QXmppRtpAudioChannel *channel);
+    QList<QXmppRtpAudioChannel*> channels() const;
+
+    QList<QXmppRtpAudioChannel*> activeSpeakers() const;
+
+    int interval() const;
+    void setInterval(int msecs);
+
+    int maximumSpeakers() const;
+    void setMaximumSpeakers(int speakers);
+
+    int speechThreshold() const;
+    void setSpeechThreshold(int level);
+
+public slots:
+    void mix();
+
+private slots:
+    void _q_channelDestroyed(QObject *object);
+
+private:
+    QXmppAudioMixerPrivate *d;
+};
+
+#endif
@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <cmath>
+#include <cstring>
+
+#include "QXmppAudioResampler_p.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QXMPP_AUDIO_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846264338327950288
+#endif
+
+// number of filter taps per phase, for a conversion ratio of one
+static const int RESAMPLER_TAPS = 16;
+
+// the filter's cutoff as a fraction of the lower Nyquist frequency
+static const double RESAMPLER_CUTOFF = 0.9;
+
+static int greatestCommonDivisor(int a, int b)
+{
+    while (b) {
+        const int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/// Returns the dot product of two vectors of samples, whose length is a
+/// multiple of 8.
+
+static int dotProduct(const qint16 *a, const qint16 *b, int count)
+{
+#ifdef QXMPP_AUDIO_SSE2
+    __m128i sum = _mm_setzero_si128();
+    for (int i = 0; i < count; i += 8) {
+        const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(va, vb));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+#else
+    int sum = 0;
+    for (int i = 0; i < count; ++i)
+        sum += int(a[i]) * int(b[i]);
+    return sum;
+#endif
+}
+
+/// Constructs a resampler which passes samples through unchanged.
+
+QXmppAudioResampler::QXmppAudioResampler()
+    : m_inputRate(0)
+    , m_outputRate(0)
+    , m_interpolation(1)
+    , m_decimation(1)
+    , m_taps(0)
+    , m_next(0)
+    , m_phase(0)
+{
+}
+
+/// Returns the sample rate of the input, in Hz.
+
+int QXmppAudioResampler::inputRate() const
+{
+    return m_inputRate;
+}
+
+/// Returns the sample rate of the output, in Hz.
+
+int QXmppAudioResampler::outputRate() const
+{
+    return m_outputRate;
+}
+
+/// Sets the sample rates of the input and output, in Hz, and resets the
+/// resampler.
+///
+/// \param inputRate
+/// \param outputRate
+
+void QXmppAudioResampler::setRates(int inputRate, int outputRate)
+{
+    m_inputRate = inputRate;
+    m_outputRate = outputRate;
+    m_coefficients.clear();
+    m_interpolation = 1;
+    m_decimation = 1;
+    m_taps = 0;
+
+    if (inputRate > 0 && outputRate > 0 && inputRate != outputRate) {
+        const int divisor = greatestCommonDivisor(inputRate, outputRate);
+        m_interpolation = outputRate / divisor;
+        m_decimation = inputRate / divisor;
+
+        // when decimating, the filter spans more input samples to keep
+        // the same transition band
+        const int factor = qMax(m_interpolation, m_decimation);
+        const int taps = (RESAMPLER_TAPS * factor + m_interpolation - 1) / m_interpolation;
+        m_taps = (taps + 7) & ~7;
+
+        // windowed sinc prototype at the interpolated rate
+        const int length = m_interpolation * m_taps;
+        const double cutoff = 0.5 * RESAMPLER_CUTOFF / factor;
+        const double center = 0.5 * (length - 1);
+        QVector<double> prototype(length);
+        for (int j = 0; j < length; ++j) {
+            const double x = j - center;
+            const double sinc = x ? sin(2.0 * M_PI * cutoff * x) / (M_PI * x) : 2.0 * cutoff;
+            const double window = 0.42 - 0.5 * cos(2.0 * M_PI * (j + 0.5) / length)
+                                + 0.08 * cos(4.0 * M_PI * (j + 0.5) / length);
+            prototype[j] = sinc * window;
+        }
+
+        // split the prototype into phases, each with unity gain, with
+        // the taps in the order of the input samples they multiply
+        m_coefficients.resize(length);
+        for (int phase = 0; phase < m_interpolation; ++phase) {
+            double gain = 0;
+            for (int k = 0; k < m_taps; ++k)
+                gain += prototype[phase + k * m_interpolation];
+
+            qint16 *coefficients = m_coefficients.data() + phase * m_taps;
+            int total = 0;
+            int largest = 0;
+            for (int k = 0; k < m_taps; ++k) {
+                const int value = qBound(-32767, qRound(prototype[phase + k * m_interpolation] * 32768.0 / gain), 32767);
+                coefficients[m_taps - 1 - k] = value;
+                total += value;
+                if (qAbs(value) > qAbs(int(coefficients[m_taps - 1 - largest])))
+                    largest = k;
+            }
+
+            // absorb the rounding error in the largest tap
+            const int index = m_taps - 1 - largest;
+            coefficients[index] = qBound(-32767, coefficients[index] + 32768 - total, 32767);
+        }
+    }
+
+    reset();
+}
+
+/// Returns true if the input and output rates are the same, in which case
+/// samples are copied unchanged.
+
+bool QXmppAudioResampler::isPassthrough() const
+{
+    return !m_taps;
+}
+
+/// Returns the number of input samples required to produce the given
+/// number of output samples.
+///
+/// \param outputSamples
+
+int QXmppAudioResampler::inputSamples(int outputSamples) const
+{
+    if (outputSamples <= 0)
+        return 0;
+    if (isPassthrough())
+        return outputSamples;
+
+    const qint64 offset = m_phase + qint64(outputSamples - 1) * m_decimation;
+    return qMax(0, int(m_next + offset / m_interpolation + 1));
+}
+
+/// Returns the number of output samples produced from the given number of
+/// input samples.
+///
+/// \param inputSamples
+
+int QXmppAudioResampler::outputSamples(int inputSamples) const
+{
+    if (isPassthrough())
+        return qMax(inputSamples, 0);
+
+    const qint64 span = inputSamples - m_next;
+    if (span <= 0)
+        return 0;
+    return int((span * m_interpolation - m_phase + m_decimation - 1) / m_decimation);
+}
+
+/// Resamples the given input samples and returns the number of output
+/// samples written.
+///
+/// The whole input is consumed, at most \a maxOutputSamples are written.
+/// Use outputSamples() to determine the space required for the output.
+///
+/// \param input
+/// \param inputSamples
+/// \param output
+/// \param maxOutputSamples
+
+int QXmppAudioResampler::process(const qint16 *input, int inputSamples, qint16 *output, int maxOutputSamples)
+{
+    if (isPassthrough()) {
+        const int count = qMax(0, qMin(inputSamples, maxOutputSamples));
+        memcpy(output, input, count * sizeof(qint16));
+        return count;
+    }
+    if (inputSamples <= 0)
+        return 0;
+
+    // the buffer holds the last m_taps samples of the previous input,
+    // followed by the new input
+    m_buffer.resize(m_taps + inputSamples);
+    qint16 *buffer = m_buffer.data();
+    memcpy(buffer + m_taps, input, inputSamples * sizeof(qint16));
+
+    int produced = 0;
+    while (produced < maxOutputSamples && m_next < inputSamples) {
+        const int sum = dotProduct(m_coefficients.constData() + m_phase * m_taps,
+                                   buffer + m_next + 1,
+                                   m_taps);
+        output[produced++] = qBound(-32768, (sum + (1 << 14)) >> 15, 32767);
+
+        m_phase += m_decimation;
+        m_next += m_phase / m_interpolation;
+        m_phase %= m_interpolation;
+    }
+
+    memmove(buffer, buffer + inputSamples, m_taps * sizeof(qint16));
+    m_buffer.resize(m_taps);
+
+    // output which did not fit refers to samples which are gone
+    m_next = qMax(m_next - inputSamples, -1);
+    return produced;
+}
+
+/// Clears the resampler's history.
+
+void QXmppAudioResampler::reset()
+{
+    m_buffer.fill(0, m_taps);
+    m_next = 0;
+    m_phase = 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPAUDIORESAMPLER_P_H
+#define QXMPPAUDIORESAMPLER_P_H
+
+#include <QVector>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppAudioResampler class converts a stream of signed 16-bit mono
+/// samples between two sample rates using a polyphase FIR filter.
+///
+/// The rates are reduced to an interpolation factor L and a decimation
+/// factor M, and each output sample is the dot product of one of the L
+/// filter phases with the most recent input samples. The dot products use
+/// SSE2 when the processor supports it.
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppAudioResampler
+{
+public:
+    QXmppAudioResampler();
+
+    int inputRate() const;
+    int outputRate() const;
+    void setRates(int inputRate, int outputRate);
+    bool isPassthrough() const;
+
+    int inputSamples(int outputSamples) const;
+    int outputSamples(int inputSamples) const;
+
+    int process(const qint16 *input, int inputSamples, qint16 *output, int maxOutputSamples);
+    void reset();
+
+private:
+    QVector<qint16> m_buffer;
+    QVector<qint16> m_coefficients;
+    int m_inputRate;
+    int m_outputRate;
+    int m_interpolation;
+    int m_decimation;
+    int m_taps;
+    int m_next;
+    int m_phase;
+};
+
+#endif
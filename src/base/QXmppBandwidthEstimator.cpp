@@ -0,0 +1,379 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <cmath>
+
+#include "QXmppBandwidthEstimator_p.h"
+
+// packets sent within this time form a group, in microseconds
+static const qint64 BURST_TIME = 5000;
+
+// default bitrate limits, in bits per second
+static const int DEFAULT_BITRATE = 300000;
+static const int DEFAULT_MINIMUM_BITRATE = 30000;
+static const int DEFAULT_MAXIMUM_BITRATE = 2500000;
+
+// multiplicative decrease applied to the acknowledged bitrate on overuse
+static const double DECREASE_FACTOR = 0.85;
+
+// multiplicative increase per second while the path is not overused
+static const double INCREASE_FACTOR = 1.08;
+
+// loss fractions below and above which the loss-based estimate changes
+static const double LOSS_LOW = 0.02;
+static const double LOSS_HIGH = 0.1;
+
+// minimum number of packets before acting on a loss fraction
+static const int LOSS_MINIMUM_PACKETS = 20;
+
+// number of sent packets remembered for feedback
+static const int SENT_HISTORY = 1024;
+
+// overuse detector parameters, delays are in milliseconds
+static const double THRESHOLD_INITIAL = 12.5;
+static const double THRESHOLD_MINIMUM = 6.0;
+static const double THRESHOLD_MAXIMUM = 600.0;
+static const double THRESHOLD_DOWN = 0.039;
+static const double THRESHOLD_UP = 0.0087;
+static const double OVERUSE_TIME = 10.0;
+
+// trendline filter parameters
+static const int TREND_WINDOW = 20;
+static const double TREND_SMOOTHING = 0.9;
+static const double TREND_GAIN = 4.0;
+static const int TREND_MAXIMUM_DELTAS = 60;
+
+// window over which the acknowledged bitrate is measured, in microseconds
+static const qint64 ACKED_WINDOW = 500000;
+
+QXmppBandwidthEstimator::QXmppBandwidthEstimator()
+    : m_delayBitrate(DEFAULT_BITRATE)
+    , m_lossBitrate(DEFAULT_BITRATE)
+    , m_minimumBitrate(DEFAULT_MINIMUM_BITRATE)
+    , m_maximumBitrate(DEFAULT_MAXIMUM_BITRATE)
+    , m_delayBased(false)
+    , m_delayUpdateTime(-1)
+    , m_lossUpdateTime(-1)
+    , m_lossTotal(0)
+    , m_lost(0)
+    , m_sent(SENT_HISTORY)
+    , m_firstArrivalTime(-1)
+    , m_accumulatedDelay(0)
+    , m_smoothedDelay(0)
+    , m_deltaCount(0)
+    , m_usage(Normal)
+    , m_threshold(THRESHOLD_INITIAL)
+    , m_previousTrend(0)
+    , m_overuseTime(-1)
+    , m_overuseCount(0)
+    , m_thresholdUpdateTime(-1)
+{
+    for (int i = 0; i < SENT_HISTORY; ++i)
+        m_sent[i].sequence = -1;
+    m_currentGroup.valid = false;
+    m_previousGroup.valid = false;
+}
+
+/// Returns the estimated bitrate in bits per second.
+
+int QXmppBandwidthEstimator::bitrate() const
+{
+    double estimate = m_lossBitrate;
+    if (m_delayBased)
+        estimate = qMin(estimate, m_delayBitrate);
+    return qBound(m_minimumBitrate, int(estimate), m_maximumBitrate);
+}
+
+/// Restarts the estimation from the given bitrate.
+///
+/// \param bitrate The bitrate in bits per second.
+
+void QXmppBandwidthEstimator::setBitrate(int bitrate)
+{
+    m_delayBitrate = bitrate;
+    m_lossBitrate = bitrate;
+    m_delayUpdateTime = -1;
+    m_lossUpdateTime = -1;
+}
+
+/// Returns the lowest bitrate the estimate can reach, in bits per second.
+
+int QXmppBandwidthEstimator::minimumBitrate() const
+{
+    return m_minimumBitrate;
+}
+
+/// Sets the lowest bitrate the estimate can reach, in bits per second.
+///
+/// \param bitrate
+
+void QXmppBandwidthEstimator::setMinimumBitrate(int bitrate)
+{
+    m_minimumBitrate = bitrate;
+}
+
+/// Returns the highest bitrate the estimate can reach, in bits per second.
+
+int QXmppBandwidthEstimator::maximumBitrate() const
+{
+    return m_maximumBitrate;
+}
+
+/// Sets the highest bitrate the estimate can reach, in bits per second.
+///
+/// \param bitrate
+
+void QXmppBandwidthEstimator::setMaximumBitrate(int bitrate)
+{
+    m_maximumBitrate = bitrate;
+}
+
+/// Returns the state of the path detected from the last feedback.
+
+QXmppBandwidthEstimator::Usage QXmppBandwidthEstimator::usage() const
+{
+    return m_usage;
+}
+
+/// Records an outgoing packet, so that it can be matched with feedback.
+///
+/// \param sequence The transport-wide sequence number of the packet.
+/// \param size The size of the packet in bytes.
+/// \param sendTime The local time at which the packet was sent.
+
+void QXmppBandwidthEstimator::packetSent(quint16 sequence, int size, qint64 sendTime)
+{
+    SentPacket &packet = m_sent[sequence % SENT_HISTORY];
+    packet.sequence = sequence;
+    packet.size = size;
+    packet.sendTime = sendTime;
+}
+
+/// Handles transport-wide feedback from the receiver.
+///
+/// \param baseSequence The sequence number of the first reported packet.
+/// \param arrivalTimes The remote arrival times of consecutive packets,
+/// or -1 for packets which were not received.
+/// \param now The local time.
+
+void QXmppBandwidthEstimator::feedbackReceived(quint16 baseSequence, const QList<qint64> &arrivalTimes, qint64 now)
+{
+    int lost = 0;
+    int total = 0;
+    for (int i = 0; i < arrivalTimes.size(); ++i) {
+        const quint16 sequence = baseSequence + i;
+        const SentPacket &packet = m_sent[sequence % SENT_HISTORY];
+        if (packet.sequence != sequence)
+            continue;
+
+        total++;
+        if (arrivalTimes.at(i) < 0)
+            lost++;
+        else
+            packetArrived(packet.sendTime, arrivalTimes.at(i), packet.size, now);
+    }
+    if (!total)
+        return;
+
+    m_delayBased = true;
+    updateDelayBitrate(now);
+    lossReported(lost, total, now);
+}
+
+/// Handles a loss report from the receiver, such as the packet loss of an
+/// RTCP receiver report or the number of packets for which retransmission
+/// was requested.
+///
+/// \param lost The number of lost packets.
+/// \param total The number of packets covered by the report.
+/// \param now The local time.
+
+void QXmppBandwidthEstimator::lossReported(int lost, int total, qint64 now)
+{
+    m_lost += lost;
+    m_lossTotal += total;
+    if (m_lossTotal < LOSS_MINIMUM_PACKETS)
+        return;
+
+    const double fraction = double(m_lost) / double(m_lossTotal);
+    m_lost = 0;
+    m_lossTotal = 0;
+
+    if (fraction > LOSS_HIGH) {
+        m_lossBitrate *= 1.0 - 0.5 * fraction;
+        m_lossUpdateTime = now;
+    } else if (fraction < LOSS_LOW) {
+        // increase at most once per second
+        if (m_lossUpdateTime < 0 || now - m_lossUpdateTime >= 1000000) {
+            if (m_lossUpdateTime >= 0)
+                m_lossBitrate *= INCREASE_FACTOR;
+            m_lossUpdateTime = now;
+        }
+    }
+    m_lossBitrate = qBound(double(m_minimumBitrate), m_lossBitrate, double(m_maximumBitrate));
+}
+
+/// Returns the bitrate acknowledged by the receiver over the last window,
+/// or 0 if not enough feedback was received.
+
+int QXmppBandwidthEstimator::ackedBitrate() const
+{
+    if (m_acked.size() < 2 || m_acked.last().first - m_acked.first().first < ACKED_WINDOW / 2)
+        return 0;
+
+    qint64 bytes = 0;
+    for (int i = 0; i < m_acked.size(); ++i)
+        bytes += m_acked.at(i).second;
+    return int(bytes * 8 * 1000000 / ACKED_WINDOW);
+}
+
+/// Compares the delay trend to the adaptive threshold.
+
+void QXmppBandwidthEstimator::detectUsage(double trend, double groupDelta, qint64 now)
+{
+    if (trend > m_threshold) {
+        if (m_overuseTime < 0)
+            m_overuseTime = groupDelta / 2;
+        else
+            m_overuseTime += groupDelta;
+        m_overuseCount++;
+        if (m_overuseTime > OVERUSE_TIME && m_overuseCount > 1 && trend >= m_previousTrend) {
+            m_overuseTime = 0;
+            m_overuseCount = 0;
+            m_usage = Overuse;
+        }
+    } else if (trend < -m_threshold) {
+        m_overuseTime = -1;
+        m_overuseCount = 0;
+        m_usage = Underuse;
+    } else {
+        m_overuseTime = -1;
+        m_overuseCount = 0;
+        m_usage = Normal;
+    }
+    m_previousTrend = trend;
+
+    // adapt the threshold, ignoring sudden spikes
+    const double absolute = std::fabs(trend);
+    if (m_thresholdUpdateTime < 0)
+        m_thresholdUpdateTime = now;
+    if (absolute <= m_threshold + 15.0) {
+        const double k = absolute < m_threshold ? THRESHOLD_DOWN : THRESHOLD_UP;
+        const double elapsed = qMin(double(now - m_thresholdUpdateTime) / 1000.0, 100.0);
+        m_threshold += k * (absolute - m_threshold) * elapsed;
+        m_threshold = qBound(THRESHOLD_MINIMUM, m_threshold, THRESHOLD_MAXIMUM);
+    }
+    m_thresholdUpdateTime = now;
+}
+
+/// Feeds a received packet to the delay trend.
+
+void QXmppBandwidthEstimator::packetArrived(qint64 sendTime, qint64 arrivalTime, int size, qint64 now)
+{
+    // acknowledged bitrate
+    m_acked.append(qMakePair(arrivalTime, size));
+    while (m_acked.first().first < arrivalTime - ACKED_WINDOW)
+        m_acked.removeFirst();
+
+    if (!m_currentGroup.valid) {
+        m_currentGroup.firstSendTime = sendTime;
+        m_currentGroup.lastSendTime = sendTime;
+        m_currentGroup.arrivalTime = arrivalTime;
+        m_currentGroup.valid = true;
+        return;
+    }
+
+    // ignore reordered packets
+    if (sendTime < m_currentGroup.firstSendTime)
+        return;
+
+    if (sendTime - m_currentGroup.firstSendTime <= BURST_TIME) {
+        m_currentGroup.lastSendTime = qMax(m_currentGroup.lastSendTime, sendTime);
+        m_currentGroup.arrivalTime = qMax(m_currentGroup.arrivalTime, arrivalTime);
+        return;
+    }
+
+    // the current group is complete
+    if (m_previousGroup.valid) {
+        const double sendDelta = double(m_currentGroup.lastSendTime - m_previousGroup.lastSendTime) / 1000.0;
+        const double arrivalDelta = double(m_currentGroup.arrivalTime - m_previousGroup.arrivalTime) / 1000.0;
+
+        if (m_firstArrivalTime < 0)
+            m_firstArrivalTime = m_currentGroup.arrivalTime;
+        m_accumulatedDelay += arrivalDelta - sendDelta;
+        m_smoothedDelay = TREND_SMOOTHING * m_smoothedDelay + (1 - TREND_SMOOTHING) * m_accumulatedDelay;
+        m_deltaCount = qMin(m_deltaCount + 1, TREND_MAXIMUM_DELTAS);
+
+        m_trendWindow.append(qMakePair(double(m_currentGroup.arrivalTime - m_firstArrivalTime) / 1000.0, m_smoothedDelay));
+        if (m_trendWindow.size() > TREND_WINDOW)
+            m_trendWindow.removeFirst();
+
+        if (m_trendWindow.size() == TREND_WINDOW) {
+            // least squares slope of the smoothed delay over arrival time
+            double meanX = 0, meanY = 0;
+            for (int i = 0; i < m_trendWindow.size(); ++i) {
+                meanX += m_trendWindow.at(i).first;
+                meanY += m_trendWindow.at(i).second;
+            }
+            meanX /= m_trendWindow.size();
+            meanY /= m_trendWindow.size();
+
+            double numerator = 0, denominator = 0;
+            for (int i = 0; i < m_trendWindow.size(); ++i) {
+                const double dx = m_trendWindow.at(i).first - meanX;
+                numerator += dx * (m_trendWindow.at(i).second - meanY);
+                denominator += dx * dx;
+            }
+            const double slope = denominator > 0 ? numerator / denominator : 0;
+            detectUsage(slope * m_deltaCount * TREND_GAIN, sendDelta, now);
+        }
+    }
+    m_previousGroup = m_currentGroup;
+    m_currentGroup.firstSendTime = sendTime;
+    m_currentGroup.lastSendTime = sendTime;
+    m_currentGroup.arrivalTime = arrivalTime;
+}
+
+/// Updates the delay-based estimate from the detected usage.
+
+void QXmppBandwidthEstimator::updateDelayBitrate(qint64 now)
+{
+    const int acked = ackedBitrate();
+
+    if (m_usage == Overuse) {
+        const double decreased = acked > 0 ? DECREASE_FACTOR * acked : DECREASE_FACTOR * m_delayBitrate;
+        if (decreased < m_delayBitrate)
+            m_delayBitrate = decreased;
+    } else if (m_usage == Normal && m_delayUpdateTime >= 0) {
+        const double elapsed = qMin(double(now - m_delayUpdateTime) / 1000000.0, 1.0);
+        double increased = m_delayBitrate * std::pow(INCREASE_FACTOR, elapsed);
+
+        // do not grow far beyond what is actually being sent
+        if (acked > 0)
+            increased = qMin(increased, 1.5 * acked + 10000);
+        m_delayBitrate = qMax(m_delayBitrate, increased);
+    }
+    m_delayBitrate = qBound(double(m_minimumBitrate), m_delayBitrate, double(m_maximumBitrate));
+    m_delayUpdateTime = now;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPBANDWIDTHESTIMATOR_P_H
+#define QXMPPBANDWIDTHESTIMATOR_P_H
+
+#include <QList>
+#include <QPair>
+#include <QVector>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppBandwidthEstimator class estimates the bitrate available to an
+/// outgoing RTP stream from the feedback of the receiver.
+///
+/// The delay-based estimate follows Google Congestion Control: packets are
+/// grouped by send time, the variation of the one-way delay between groups
+/// is smoothed by a trendline filter and compared to an adaptive threshold
+/// to detect whether the path is overused. The loss-based estimate
+/// decreases the bitrate when more than 10% of the packets are lost and
+/// increases it when less than 2% are lost.
+///
+/// The estimate is the lower of both, the delay-based estimate is only used
+/// once transport-wide feedback has been received.
+///
+/// All times are in microseconds.
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppBandwidthEstimator
+{
+public:
+    /// This enum describes the state of the path detected from delays.
+    enum Usage {
+        Normal = 0,
+        Underuse,
+        Overuse
+    };
+
+    QXmppBandwidthEstimator();
+
+    int bitrate() const;
+    void setBitrate(int bitrate);
+
+    int minimumBitrate() const;
+    void setMinimumBitrate(int bitrate);
+
+    int maximumBitrate() const;
+    void setMaximumBitrate(int bitrate);
+
+    Usage usage() const;
+
+    void packetSent(quint16 sequence, int size, qint64 sendTime);
+    void feedbackReceived(quint16 baseSequence, const QList<qint64> &arrivalTimes, qint64 now);
+    void lossReported(int lost, int total, qint64 now);
+
+private:
+    struct SentPacket
+    {
+        qint64 sendTime;
+        int sequence;
+        int size;
+    };
+
+    struct PacketGroup
+    {
+        qint64 firstSendTime;
+        qint64 lastSendTime;
+        qint64 arrivalTime;
+        bool valid;
+    };
+
+    int ackedBitrate() const;
+    void detectUsage(double trend, double groupDelta, qint64 now);
+    void packetArrived(qint64 sendTime, qint64 arrivalTime, int size, qint64 now);
+    void updateDelayBitrate(qint64 now);
+
+    // rates in bits per second
+    double m_delayBitrate;
+    double m_lossBitrate;
+    int m_minimumBitrate;
+    int m_maximumBitrate;
+    bool m_delayBased;
+    qint64 m_delayUpdateTime;
+    qint64 m_lossUpdateTime;
+    int m_lossTotal;
+    int m_lost;
+
+    // sent packets, indexed by transport-wide sequence number
+    QVector<SentPacket> m_sent;
+
+    // acknowledged packets, as pairs of arrival time and size
+    QVector<QPair<qint64, int> > m_acked;
+
+    // delay trend
+    PacketGroup m_currentGroup;
+    PacketGroup m_previousGroup;
+    qint64 m_firstArrivalTime;
+    double m_accumulatedDelay;
+    double m_smoothedDelay;
+    int m_deltaCount;
+    QVector<QPair<double, double> > m_trendWindow;
+
+    // overuse detection
+    Usage m_usage;
+    double m_threshold;
+    double m_previousTrend;
+    double m_overuseTime;
+    int m_overuseCount;
+    qint64 m_thresholdUpdateTime;
+};
+
+#endif
@@ -27,12 +27,16 @@
 
 #include <QDataStream>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QSet>
 #include <QSize>
 #include <QThread>
 
 #include "QXmppCodec_p.h"
 #include "QXmppRtpChannel.h"
 #include "QXmppRtpPacket.h"
+#include "QXmppVideoConverter_p.h"
+#include "QXmppVideoFramePool_p.h"
 
 #include <cstring>
 
@@ -261,14 +265,117 @@ QXmppCodec::~QXmppCodec()
 {
 }
 
+/// Reads the encoded data following a lost packet from the input stream,
+/// recovers the given number of lost \a samples from it and writes them to
+/// the output stream.
+///
+/// The default implementation does not support recovery and returns 0.
+
+qint64 QXmppCodec::recover(QDataStream &input, QDataStream &output, int samples)
+{
+    Q_UNUSED(input);
+    Q_UNUSED(output);
+    Q_UNUSED(samples);
+    return 0;
+}
+
+/// Tells the encoder the \a percentage of packets lost by the receiver, so
+/// that it can adjust its robustness.
+///
+/// The default implementation does nothing.
+
+void QXmppCodec::setPacketLoss(int percentage)
+{
+    Q_UNUSED(percentage);
+}
+
+/// Returns true if the encoder leaves out silent frames itself.
+///
+/// The default implementation returns false.
+
+bool QXmppCodec::isDtxEnabled() const
+{
+    return false;
+}
+
+QXmppVideoDecoder::QXmppVideoDecoder()
+    : m_framePool(0)
+{
+}
+
 QXmppVideoDecoder::~QXmppVideoDecoder()
 {
 }
 
+/// Returns the pool from which decoded frames are allocated.
+
+QXmppVideoFramePool *QXmppVideoDecoder::framePool() const
+{
+    return m_framePool;
+}
+
+/// Sets the pool from which decoded frames are allocated. If no pool is
+/// set, each frame has its own buffer.
+///
+/// \param pool
+
+void QXmppVideoDecoder::setFramePool(QXmppVideoFramePool *pool)
+{
+    m_framePool = pool;
+}
+
+/// Returns the sequence numbers of the RTP packets which were detected as
+/// lost since the last call, and should be requested again from the sender.
+///
+/// The default implementation returns an empty list.
+
+QList<quint16> QXmppVideoDecoder::takeLostSequences()
+{
+    return QList<quint16>();
+}
+
+/// Returns true if the decoder lost its reference frames since the last
+/// call and needs the sender to send a key frame.
+///
+/// The default implementation returns false.
+
+bool QXmppVideoDecoder::takeKeyFrameRequest()
+{
+    return false;
+}
+
+#if defined(QXMPP_USE_THEORA) || defined(QXMPP_USE_VPX)
+static QXmppVideoFrame createFrame(QXmppVideoFramePool *pool, const QSize &size, QXmppVideoFrame::PixelFormat format)
+{
+    if (pool)
+        return pool->createFrame(size, format);
+    return QXmppVideoConverter::createFrame(size, format);
+}
+#endif
+
 QXmppVideoEncoder::~QXmppVideoEncoder()
 {
 }
 
+/// Requests that the next encoded frame be a key frame, for instance
+/// because the receiver lost its reference frames.
+///
+/// The default implementation does nothing.
+
+void QXmppVideoEncoder::requestKeyFrame()
+{
+}
+
+/// Sets the target \a bitrate of the encoded stream in bits per second,
+/// for instance to follow the estimated bandwidth of the network.
+///
+/// The default implementation does nothing.
+
+void QXmppVideoEncoder::setBitrate(int bitrate)
+{
+    Q_UNUSED(bitrate);
+}
+
 QXmppG711aCodec::QXmppG711aCodec(int clockrate)
 {
     m_frequency = clockrate;
@@ -396,6 +503,9 @@ qint64 QXmppSpeexCodec::decode(QDataStream &input, QDataStream &output)
 #endif
 
 #ifdef QXMPP_USE_OPUS
+// Maximum size of an Opus packet, as recommended by the Opus documentation.
+#define OPUS_MAX_PACKET 4000
+
 QXmppOpusCodec::QXmppOpusCodec(int clockrate, int channels):
     sampleRate(clockrate),
     nChannels(channels)
@@ -404,7 +514,8 @@ QXmppOpusCodec::QXmppOpusCodec(int clockrate, int channels):
     encoder = opus_encoder_create(clockrate, channels, OPUS_APPLICATION_VOIP, &error);
 
     if (encoder || error == OPUS_OK) {
-        // Add some options for error correction.
+        // Add some options for error correction, the expected packet loss
+        // is updated from the receiver's reports.
         opus_encoder_ctl(encoder, OPUS_SET_INBAND_FEC(1));
         opus_encoder_ctl(encoder, OPUS_SET_PACKET_LOSS_PERC(20));
         opus_encoder_ctl(encoder, OPUS_SET_DTX(1));
@@ -435,6 +546,12 @@ QXmppOpusCodec::QXmppOpusCodec(int clockrate, int channels):
 
     // Maxmimum number of samples for the audio buffer.
     nSamples = validFrameSize.last();
+
+    // Allocate the buffers once, reserving capacity keeps them allocated
+    // when they are resized.
+    sampleBuffer.reserve(2 * nSamples * nChannels * 2);
+    opusBuffer.resize(OPUS_MAX_PACKET);
+    pcmBuffer.resize(nSamples * nChannels * 2);
 }
 
 QXmppOpusCodec::~QXmppOpusCodec()
@@ -452,12 +569,11 @@ QXmppOpusCodec::~QXmppOpusCodec()
 
 qint64 QXmppOpusCodec::encode(QDataStream &input, QDataStream &output)
 {
-    // Read an audio frame.
-    QByteArray pcm_buffer(input.device()->bytesAvailable(), 0);
-    int length = input.readRawData(pcm_buffer.data(), pcm_buffer.size());
-
-    // and append it to the sample buffer.
-    sampleBuffer.append(pcm_buffer.left(length));
+    // Append the audio frame to the sample buffer.
+    const int oldSize = sampleBuffer.size();
+    sampleBuffer.resize(oldSize + input.device()->bytesAvailable());
+    int length = input.readRawData(sampleBuffer.data() + oldSize, sampleBuffer.size() - oldSize);
+    sampleBuffer.resize(oldSize + qMax(length, 0));
 
     // Get the maximum number of samples to encode. It must be a number
     // accepted by the Opus encoder
@@ -466,20 +582,18 @@ qint64 QXmppOpusCodec::encode(QDataStream &input, QDataStream &output)
     if (samples < 1)
         return 0;
 
-    // The encoded stream is supposed to be smaller than the raw stream, so
-    QByteArray opus_buffer(sampleBuffer.size(), 0);
-
     length = opus_encode(encoder,
                          (opus_int16 *) sampleBuffer.constData(),
                          samples,
-                         (uchar *) opus_buffer.data(),
-                         opus_buffer.size());
+                         (uchar *) opusBuffer.data(),
+                         opusBuffer.size());
 
+    // With DTX, packets of 2 bytes or less do not need to be transmitted.
     if (length < 1)
         qWarning() << "Opus encoding error:" << opus_strerror(length);
-    else
+    else if (length > 2 || !isDtxEnabled())
         // Write the encoded stream to the output.
-        output.writeRawData(opus_buffer.constData(), length);
+        output.writeRawData(opusBuffer.constData(), length);
 
     // Remove the frame from the sample buffer.
     sampleBuffer.remove(0, samples * nChannels * 2);
@@ -492,22 +606,17 @@ qint64 QXmppOpusCodec::encode(QDataStream &input, QDataStream &output)
 
 qint64 QXmppOpusCodec::decode(QDataStream &input, QDataStream &output)
 {
-    QByteArray opus_buffer(input.device()->bytesAvailable(), 0);
-    int length = input.readRawData(opus_buffer.data(), opus_buffer.size());
+    const int length = input.readRawData(opusBuffer.data(), opusBuffer.size());
 
     if (length < 1)
         return 0;
 
-    // Audio frame is nSamples at maximum, so
-    QByteArray pcm_buffer(nSamples * nChannels * 2, 0);
-
-    // The last argumment must be 1 to enable FEC, but I don't why it results
-    // in a SIGSEV.
+    // Audio frame is nSamples at maximum.
     int samples = opus_decode(decoder,
-                              (uchar *) opus_buffer.constData(),
+                              (uchar *) opusBuffer.constData(),
                               length,
-                              (opus_int16 *) pcm_buffer.data(),
-                              pcm_buffer.size(),
+                              (opus_int16 *) pcmBuffer.data(),
+                              nSamples,
                               0);
 
     if (samples < 1) {
@@ -517,11 +626,130 @@ qint64 QXmppOpusCodec::decode(QDataStream &input, QDataStream &output)
     }
 
     // Write the audio frame to the output.
-    output.writeRawData(pcm_buffer.constData(), samples * nChannels * 2);
+    output.writeRawData(pcmBuffer.constData(), samples * nChannels * 2);
 
     return samples;
 }
 
+qint64 QXmppOpusCodec::recover(QDataStream &input, QDataStream &output, int samples)
+{
+    const int length = input.readRawData(opusBuffer.data(), opusBuffer.size());
+
+    // The lost frame's duration must be a multiple of 2.5 ms.
+    samples = readWindow(qMin(samples, nSamples) * nChannels * 2);
+    if (length < 1 || samples < 1)
+        return 0;
+
+    // Decode the in-band FEC data, if the packet has none the decoder
+    // conceals the loss.
+    samples = opus_decode(decoder,
+                          (uchar *) opusBuffer.constData(),
+                          length,
+                          (opus_int16 *) pcmBuffer.data(),
+                          samples,
+                          1);
+
+    if (samples < 1) {
+        qWarning() << "Opus recovery error:" << opus_strerror(samples);
+
+        return 0;
+    }
+
+    output.writeRawData(pcmBuffer.constData(), samples * nChannels * 2);
+
+    return samples;
+}
+
+void QXmppOpusCodec::setPacketLoss(int percentage)
+{
+    opus_encoder_ctl(encoder, OPUS_SET_PACKET_LOSS_PERC(qBound(0, percentage, 100)));
+}
+
+/// Returns the target bitrate of the encoder in bits per second.
+
+int QXmppOpusCodec::bitrate() const
+{
+    opus_int32 value = 0;
+    opus_encoder_ctl(encoder, OPUS_GET_BITRATE(&value));
+    return value;
+}
+
+/// Sets the target bitrate of the encoder in bits per second.
+///
+/// \param bitrate The bitrate, or OPUS_AUTO to let the encoder decide.
+
+void QXmppOpusCodec::setBitrate(int bitrate)
+{
+    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(bitrate));
+}
+
+/// Returns the computational complexity of the encoder, from 0 to 10.
+
+int QXmppOpusCodec::complexity() const
+{
+    opus_int32 value = 0;
+    opus_encoder_ctl(encoder, OPUS_GET_COMPLEXITY(&value));
+    return value;
+}
+
+/// Sets the computational complexity of the encoder, from 0 to 10.
+///
+/// \param complexity
+
+void QXmppOpusCodec::setComplexity(int complexity)
+{
+    opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(qBound(0, complexity, 10)));
+}
+
+/// Returns true if discontinuous transmission is enabled.
+
+bool QXmppOpusCodec::isDtxEnabled() const
+{
+    opus_int32 value = 0;
+    opus_encoder_ctl(encoder, OPUS_GET_DTX(&value));
+    return value != 0;
+}
+
+/// Sets whether discontinuous transmission is enabled, in which case
+/// silent frames are not sent.
+///
+/// \param enabled
+
+void QXmppOpusCodec::setDtxEnabled(bool enabled)
+{
+    opus_encoder_ctl(encoder, OPUS_SET_DTX(enabled ? 1 : 0));
+}
+
+/// Returns true if in-band forward error correction is enabled.
+
+bool QXmppOpusCodec::isFecEnabled() const
+{
+    opus_int32 value = 0;
+    opus_encoder_ctl(encoder, OPUS_GET_INBAND_FEC(&value));
+    return value != 0;
+}
+
+/// Sets whether in-band forward error correction is enabled.
+///
+/// The encoder only adds redundant data when the expected packet loss,
+/// set with setPacketLoss(), is not zero.
+///
+/// \param enabled
+
+void QXmppOpusCodec::setFecEnabled(bool enabled)
+{
+    opus_encoder_ctl(encoder, OPUS_SET_INBAND_FEC(enabled ? 1 : 0));
+}
+
+/// Returns the expected packet loss percentage.
+
+int QXmppOpusCodec::packetLoss() const
+{
+    opus_int32 value = 0;
+    opus_encoder_ctl(encoder, OPUS_GET_PACKET_LOSS_PERC(&value));
+    return value;
+}
+
 int QXmppOpusCodec::readWindow(int bufferSize)
 {
     // WARNING: We are expecting 2 bytes signed samples, but this is wrong since
@@ -545,7 +773,7 @@ int QXmppOpusCodec::readWindow(int bufferSize)
 class QXmppTheoraDecoderPrivate
 {
 public:
-    bool decodeFrame(const QByteArray &buffer, QXmppVideoFrame *frame);
+    bool decodeFrame(const QByteArray &buffer, QXmppVideoFramePool *pool, QXmppVideoFrame *frame);
 
     th_comment comment;
     th_info info;
@@ -555,7 +783,7 @@ public:
     QByteArray packetBuffer;
 };
 
-bool QXmppTheoraDecoderPrivate::decodeFrame(const QByteArray &buffer, QXmppVideoFrame *frame)
+bool QXmppTheoraDecoderPrivate::decodeFrame(const QByteArray &buffer, QXmppVideoFramePool *pool, QXmppVideoFrame *frame)
 {
     if (!ctx)
         return false;
@@ -578,58 +806,20 @@ bool QXmppTheoraDecoderPrivate::decodeFrame(const QByteArray &buffer, QXmppVideo
         return false;
     }
 
+    QXmppYuvPlanes planes;
+    for (int i = 0; i < 3; ++i) {
+        planes.data[i] = ycbcr_buffer[i].data;
+        planes.stride[i] = ycbcr_buffer[i].stride;
+    }
+    const QSize size(ycbcr_buffer[0].width, ycbcr_buffer[0].height);
+
+    // pooled frames share their buffer, so each decoded frame needs its own
     if (info.pixel_fmt == TH_PF_420) {
-        if (!frame->isValid()) {
-            const int bytes = ycbcr_buffer[0].stride * ycbcr_buffer[0].height
-                            + ycbcr_buffer[1].stride * ycbcr_buffer[1].height
-                            + ycbcr_buffer[2].stride * ycbcr_buffer[2].height;
-
-            *frame = QXmppVideoFrame(bytes,
-                QSize(ycbcr_buffer[0].width, ycbcr_buffer[0].height),
-                ycbcr_buffer[0].stride,
-                QXmppVideoFrame::Format_YUV420P);
-        }
-        uchar *output = frame->bits();
-        for (int i = 0; i < 3; ++i) {
-            const int length = ycbcr_buffer[i].stride * ycbcr_buffer[i].height;
-            memcpy(output, ycbcr_buffer[i].data, length);
-            output += length;
-        }
-        return true;
+        *frame = createFrame(pool, size, QXmppVideoFrame::Format_YUV420P);
+        return QXmppVideoConverter::fromI420(planes, frame);
     } else if (info.pixel_fmt == TH_PF_422) {
-        if (!frame->isValid()) {
-            const int bytes = ycbcr_buffer[0].width * ycbcr_buffer[0].height * 2;
-
-            *frame = QXmppVideoFrame(bytes,
-                QSize(ycbcr_buffer[0].width, ycbcr_buffer[0].height),
-                ycbcr_buffer[0].width * 2,
-                QXmppVideoFrame::Format_YUYV);
-        }
-
-        // YUV 4:2:2 packing
-        const int width = ycbcr_buffer[0].width;
-        const int height = ycbcr_buffer[0].height;
-        const int y_stride = ycbcr_buffer[0].stride;
-        const int c_stride = ycbcr_buffer[1].stride;
-        const uchar *y_row = ycbcr_buffer[0].data;
-        const uchar *cb_row = ycbcr_buffer[1].data;
-        const uchar *cr_row = ycbcr_buffer[2].data;
-        uchar *output = frame->bits();
-        for (int y = 0; y < height; ++y) {
-            const uchar *y_ptr = y_row;
-            const uchar *cb_ptr = cb_row;
-            const uchar *cr_ptr = cr_row;
-            for (int x = 0; x < width; x += 2) {
-                *(output++) = *(y_ptr++);
-                *(output++) = *(cb_ptr++);
-                *(output++) = *(y_ptr++);
-                *(output++) = *(cr_ptr++);
-            }
-            y_row += y_stride;
-            cb_row += c_stride;
-            cr_row += c_stride;
-        }
-        return true;
+        *frame = createFrame(pool, size, QXmppVideoFrame::Format_YUYV);
+        return QXmppVideoConverter::fromYuv422P(planes, frame);
     } else {
         qWarning("Theora decoder received an unsupported frame format");
         return false;
@@ -671,7 +861,7 @@ QXmppVideoFormat QXmppTheoraDecoder::format() const
     return format;
 }
 
-QList<QXmppVideoFrame> QXmppTheoraDecoder::handlePacket(const QXmppRtpPacket &packet)
+QList<QXmppVideoFrame> QXmppTheoraDecoder::handlePacket(const QXmppRtpPacketView &packet)
 {
     QList<QXmppVideoFrame> frames;
 
@@ -706,7 +896,7 @@ QList<QXmppVideoFrame> QXmppTheoraDecoder::handlePacket(const QXmppRtpPacket &pa
 
             d->packetBuffer.resize(packetLength);
             stream.readRawData(d->packetBuffer.data(), packetLength);
-            if (d->decodeFrame(d->packetBuffer, &frame))
+            if (d->decodeFrame(d->packetBuffer, framePool(), &frame))
                 frames << frame;
             d->packetBuffer.resize(0);
         }
@@ -732,7 +922,7 @@ QList<QXmppVideoFrame> QXmppTheoraDecoder::handlePacket(const QXmppRtpPacket &pa
 
         if (theora_frag == EndFragment) {
             // end fragment
-            if (d->decodeFrame(d->packetBuffer, &frame))
+            if (d->decodeFrame(d->packetBuffer, framePool(), &frame))
                 frames << frame;
             d->packetBuffer.resize(0);
         }
@@ -902,8 +1092,7 @@ QXmppTheoraEncoder::~QXmppTheoraEncoder()
 bool QXmppTheoraEncoder::setFormat(const QXmppVideoFormat &format)
 {
     const QXmppVideoFrame::PixelFormat pixelFormat = format.pixelFormat();
-    if ((pixelFormat != QXmppVideoFrame::Format_YUV420P) &&
-        (pixelFormat != QXmppVideoFrame::Format_YUYV)) {
+    if (!QXmppVideoConverter::isSupported(pixelFormat)) {
         qWarning("Theora encoder does not support the given format");
         return false;
     }
@@ -923,30 +1112,26 @@ bool QXmppTheoraEncoder::setFormat(const QXmppVideoFormat &format)
     d->info.fps_numerator = format.frameRate();
     d->info.fps_denominator = 1;
 
-    if (pixelFormat == QXmppVideoFrame::Format_YUV420P) {
-        d->info.pixel_fmt = TH_PF_420;
-        d->ycbcr_buffer[0].width = d->info.frame_width;
-        d->ycbcr_buffer[0].height = d->info.frame_height;
-        d->ycbcr_buffer[1].width = d->ycbcr_buffer[0].width / 2;
-        d->ycbcr_buffer[1].height = d->ycbcr_buffer[0].height / 2;
-        d->ycbcr_buffer[2].width = d->ycbcr_buffer[1].width;
-        d->ycbcr_buffer[2].height = d->ycbcr_buffer[1].height;
-    } else if (pixelFormat == QXmppVideoFrame::Format_YUYV) {
+    d->ycbcr_buffer[0].width = d->info.frame_width;
+    d->ycbcr_buffer[0].height = d->info.frame_height;
+    d->ycbcr_buffer[1].width = d->ycbcr_buffer[0].width / 2;
+    if (pixelFormat == QXmppVideoFrame::Format_UYVY ||
+        pixelFormat == QXmppVideoFrame::Format_YUYV) {
+        // keep the chroma resolution of packed 4:2:2 frames
         d->info.pixel_fmt = TH_PF_422;
         d->buffer.resize(d->info.frame_width * d->info.frame_height * 2);
-        d->ycbcr_buffer[0].width = d->info.frame_width;
-        d->ycbcr_buffer[0].height = d->info.frame_height;
-        d->ycbcr_buffer[0].stride = d->info.frame_width;
-        d->ycbcr_buffer[0].data = (uchar*) d->buffer.data();
-        d->ycbcr_buffer[1].width = d->ycbcr_buffer[0].width / 2;
         d->ycbcr_buffer[1].height = d->ycbcr_buffer[0].height;
-        d->ycbcr_buffer[1].stride = d->ycbcr_buffer[0].stride / 2;
-        d->ycbcr_buffer[1].data = d->ycbcr_buffer[0].data + d->ycbcr_buffer[0].stride * d->ycbcr_buffer[0].height;
-        d->ycbcr_buffer[2].width = d->ycbcr_buffer[1].width;
-        d->ycbcr_buffer[2].height = d->ycbcr_buffer[1].height;
-        d->ycbcr_buffer[2].stride = d->ycbcr_buffer[1].stride;
-        d->ycbcr_buffer[2].data = d->ycbcr_buffer[1].data + d->ycbcr_buffer[1].stride * d->ycbcr_buffer[1].height;
+    } else {
+        // YUV420P frames are encoded in place, others are converted
+        d->info.pixel_fmt = TH_PF_420;
+        if (pixelFormat == QXmppVideoFrame::Format_YUV420P)
+            d->buffer.clear();
+        else
+            d->buffer.resize(d->info.frame_width * d->info.frame_height * 3 / 2);
+        d->ycbcr_buffer[1].height = d->ycbcr_buffer[0].height / 2;
     }
+    d->ycbcr_buffer[2].width = d->ycbcr_buffer[1].width;
+    d->ycbcr_buffer[2].height = d->ycbcr_buffer[1].height;
 
     // create encoder
     if (d->ctx) {
@@ -1013,31 +1198,31 @@ QList<QByteArray> QXmppTheoraEncoder::handleFrame(const QXmppVideoFrame &frame)
     if (!d->ctx)
         return packets;
 
-    if (d->info.pixel_fmt == TH_PF_420) {
+    if (d->info.pixel_fmt == TH_PF_420 && frame.pixelFormat() == QXmppVideoFrame::Format_YUV420P) {
         d->ycbcr_buffer[0].stride = frame.bytesPerLine();
         d->ycbcr_buffer[0].data = (unsigned char*) frame.bits();
         d->ycbcr_buffer[1].stride = d->ycbcr_buffer[0].stride / 2;
         d->ycbcr_buffer[1].data = d->ycbcr_buffer[0].data + d->ycbcr_buffer[0].stride * d->ycbcr_buffer[0].height;
         d->ycbcr_buffer[2].stride = d->ycbcr_buffer[1].stride;
         d->ycbcr_buffer[2].data = d->ycbcr_buffer[1].data + d->ycbcr_buffer[1].stride * d->ycbcr_buffer[1].height;
-    } else if (d->info.pixel_fmt == TH_PF_422) {
-        // YUV 4:2:2 unpacking
-        const int width = frame.width();
-        const int height = frame.height();
-        const int stride = frame.bytesPerLine();
-        const uchar *row = frame.bits();
-        uchar *y_out = d->ycbcr_buffer[0].data;
-        uchar *cb_out = d->ycbcr_buffer[1].data;
-        uchar *cr_out = d->ycbcr_buffer[2].data;
-        for (int y = 0; y < height; ++y) {
-            const uchar *ptr = row;
-            for (int x = 0; x < width; x += 2) {
-                *(y_out++) = *(ptr++);
-                *(cb_out++) = *(ptr++);
-                *(y_out++) = *(ptr++);
-                *(cr_out++) = *(ptr++);
-            }
-            row += stride;
+    } else if (!d->buffer.isEmpty()) {
+        // convert the frame into the encoder's buffer
+        QXmppYuvPlanes planes;
+        uchar *data = (uchar*) d->buffer.data();
+        for (int i = 0; i < 3; ++i) {
+            d->ycbcr_buffer[i].stride = d->ycbcr_buffer[i].width;
+            d->ycbcr_buffer[i].data = data;
+            planes.data[i] = data;
+            planes.stride[i] = d->ycbcr_buffer[i].stride;
+            data += d->ycbcr_buffer[i].stride * d->ycbcr_buffer[i].height;
+        }
+
+        const bool converted = (d->info.pixel_fmt == TH_PF_422)
+            ? QXmppVideoConverter::toYuv422P(frame, planes)
+            : QXmppVideoConverter::toI420(frame, planes);
+        if (!converted) {
+            qWarning("Theora encoder received an unsupported frame format");
+            return packets;
         }
     } else {
         qWarning("Theora encoder received an unsupported frame format");
@@ -1097,16 +1282,185 @@ QMap<QString, QString> QXmppTheoraEncoder::parameters() const
 
 #ifdef QXMPP_USE_VPX
 
+// Number of packets the VPX decoder waits for a missing packet before
+// giving up on it.
+#define VPX_REORDER_WINDOW 64
+
+// Time in milliseconds the VPX decoder waits for a missing packet before
+// giving up on it, so that low rate streams do not stall for a whole window.
+#define VPX_REORDER_TIMEOUT 200
+
 class QXmppVpxDecoderPrivate
 {
 public:
-    bool decodeFrame(const QByteArray &buffer, QXmppVideoFrame *frame);
+    /// A received VP8 payload, without its payload descriptor.
+    class Fragment
+    {
+    public:
+        QByteArray data;
+        quint8 type;
+    };
+
+    QXmppVpxDecoderPrivate();
+    QList<QXmppVideoFrame> assembleFrames(QXmppVideoFramePool *pool);
+    bool decodeFrame(const QByteArray &buffer, QXmppVideoFramePool *pool, QXmppVideoFrame *frame);
+    bool keepWaiting();
+    void skipFrames();
 
     vpx_codec_ctx_t codec;
-    QByteArray packetBuffer;
+
+    // packets waiting to be assembled, by extended sequence number
+    QMap<qint64, Fragment> fragments;
+    QSet<qint64> nacked;
+    QList<quint16> lostSequences;
+    qint64 highestSequence;
+    qint64 nextSequence;
+
+    // when the decoder started waiting for the packet at waitSequence
+    QElapsedTimer clock;
+    qint64 waitSequence;
+    qint64 waitStart;
+
+    bool started;
+    bool keyFrameRequested;
+    bool waitingForKeyFrame;
 };
 
-bool QXmppVpxDecoderPrivate::decodeFrame(const QByteArray &buffer, QXmppVideoFrame *frame)
+QXmppVpxDecoderPrivate::QXmppVpxDecoderPrivate()
+    : highestSequence(0)
+    , nextSequence(0)
+    , waitSequence(-1)
+    , waitStart(0)
+    , started(false)
+    , keyFrameRequested(false)
+    , waitingForKeyFrame(true)
+{
+    clock.start();
+}
+
+/// Decodes the complete frames at the head of the reordering buffer.
+
+QList<QXmppVideoFrame> QXmppVpxDecoderPrivate::assembleFrames(QXmppVideoFramePool *pool)
+{
+    QList<QXmppVideoFrame> frames;
+
+    forever {
+        QMap<qint64, Fragment>::iterator it = fragments.begin();
+        if (it == fragments.end())
+            break;
+
+        // wait for the missing packets, until the window is exceeded
+        if (it.key() != nextSequence) {
+            if (keepWaiting())
+                break;
+            skipFrames();
+            continue;
+        }
+
+        // drop the remains of a frame whose start was skipped
+        if (it->type != NoFragment && it->type != StartFragment) {
+            fragments.erase(it);
+            nextSequence++;
+            continue;
+        }
+
+        // find the end of the frame
+        QMap<qint64, Fragment>::iterator end = it;
+        if (it->type == StartFragment) {
+            qint64 sequence = it.key();
+            ++end;
+            while (end != fragments.end() && end.key() == sequence + 1 && end->type == MiddleFragment) {
+                sequence++;
+                ++end;
+            }
+            if (end == fragments.end() || end.key() != sequence + 1) {
+                if (keepWaiting())
+                    break;
+                skipFrames();
+                continue;
+            }
+            if (end->type != EndFragment) {
+                // a new frame started, this one is incomplete
+                nextSequence = end.key();
+                while (it != end)
+                    it = fragments.erase(it);
+                waitingForKeyFrame = true;
+                keyFrameRequested = true;
+                continue;
+            }
+        }
+        nextSequence = end.key() + 1;
+        ++end;
+
+        QByteArray buffer;
+        while (it != end) {
+            buffer += it->data;
+            it = fragments.erase(it);
+        }
+
+        // without its reference frames, only a key frame can be decoded
+        const bool keyFrame = !buffer.isEmpty() && (buffer.at(0) & 0x1) == 0;
+        if (waitingForKeyFrame && !keyFrame) {
+            keyFrameRequested = true;
+            continue;
+        }
+
+        QXmppVideoFrame frame;
+        if (decodeFrame(buffer, pool, &frame)) {
+            waitingForKeyFrame = false;
+            if (frame.isValid())
+                frames << frame;
+        } else {
+            waitingForKeyFrame = true;
+            keyFrameRequested = true;
+        }
+    }
+    return frames;
+}
+
+/// Returns true if the decoder should keep waiting for the packet at
+/// nextSequence, i.e. neither the reordering window nor the reordering
+/// timeout has been exceeded.
+
+bool QXmppVpxDecoderPrivate::keepWaiting()
+{
+    if (highestSequence - nextSequence >= VPX_REORDER_WINDOW)
+        return false;
+
+    const qint64 now = clock.elapsed();
+    if (waitSequence != nextSequence) {
+        waitSequence = nextSequence;
+        waitStart = now;
+        return true;
+    }
+    return now - waitStart < VPX_REORDER_TIMEOUT;
+}
+
+/// Gives up on the frame at the head of the reordering buffer, and skips
+/// to the start of the next frame.
+
+void QXmppVpxDecoderPrivate::skipFrames()
+{
+    QMap<qint64, Fragment>::iterator it = fragments.begin();
+    if (it != fragments.end() && it.key() == nextSequence)
+        it = fragments.erase(it);
+    while (it != fragments.end() && it->type != NoFragment && it->type != StartFragment)
+        it = fragments.erase(it);
+    nextSequence = (it != fragments.end()) ? it.key() : highestSequence + 1;
+
+    QSet<qint64>::iterator nack = nacked.begin();
+    while (nack != nacked.end()) {
+        if (*nack < nextSequence)
+            nack = nacked.erase(nack);
+        else
+            ++nack;
+    }
+
+    waitingForKeyFrame = true;
+    keyFrameRequested = true;
+}
+
+bool QXmppVpxDecoderPrivate::decodeFrame(const QByteArray &buffer, QXmppVideoFramePool *pool, QXmppVideoFrame *frame)
 {
     // With the VPX_DL_REALTIME option, tries to decode the frame as quick as
     // possible, if not possible discard it.
@@ -1123,25 +1477,14 @@ bool QXmppVpxDecoderPrivate::decodeFrame(const QByteArray &buffer, QXmppVideoFra
     vpx_image_t *img;
     while ((img = vpx_codec_get_frame(&codec, &iter))) {
         if (img->fmt == VPX_IMG_FMT_I420) {
-            if (!frame->isValid()) {
-                const int bytes = img->d_w * img->d_h * 3 / 2;
-
-                *frame = QXmppVideoFrame(bytes,
-                    QSize(img->d_w, img->d_h),
-                    img->d_w,
-                    QXmppVideoFrame::Format_YUV420P);
-            }
-            uchar *output = frame->bits();
+            *frame = createFrame(pool, QSize(img->d_w, img->d_h), QXmppVideoFrame::Format_YUV420P);
 
+            QXmppYuvPlanes planes;
             for (int i = 0; i < 3; ++i) {
-                uchar *input = img->planes[i];
-                const int div = (i == 0) ? 1 : 2;
-                for (unsigned int y = 0; y < img->d_h / div; ++y) {
-                    memcpy(output, input, img->d_w / div);
-                    input += img->stride[i];
-                    output += img->d_w / div;
-                }
+                planes.data[i] = img->planes[i];
+                planes.stride[i] = img->stride[i];
             }
+            QXmppVideoConverter::fromI420(planes, frame);
         } else {
             qWarning("Vpx decoder received an unsupported frame format: %d", img->fmt);
         }
@@ -1182,80 +1525,62 @@ QXmppVideoFormat QXmppVpxDecoder::format() const
     return format;
 }
 
-QList<QXmppVideoFrame> QXmppVpxDecoder::handlePacket(const QXmppRtpPacket &packet)
+QList<QXmppVideoFrame> QXmppVpxDecoder::handlePacket(const QXmppRtpPacketView &packet)
 {
-    QList<QXmppVideoFrame> frames;
     const QByteArray payload = packet.payload();
 
     // vp8 deframing: http://tools.ietf.org/html/draft-westin-payload-vp8-00
-    QDataStream stream(payload);
-    quint8 vpx_header;
-    stream >> vpx_header;
-
+    if (payload.isEmpty())
+        return QList<QXmppVideoFrame>();
+    const quint8 vpx_header = payload.at(0);
     const bool have_id = (vpx_header & 0x10) != 0;
-    const quint8 frag_type = (vpx_header & 0x6) >> 1;
+
+    QXmppVpxDecoderPrivate::Fragment fragment;
+    fragment.type = (vpx_header & 0x6) >> 1;
+
+    // skip the picture ID, which is 15 bits long if its first bit is set
+    int offset = 1;
     if (have_id) {
-        qWarning("Vpx decoder does not support pictureId yet");
-        return frames;
+        if (payload.size() < 2)
+            return QList<QXmppVideoFrame>();
+        offset += (payload.at(1) & 0x80) ? 2 : 1;
     }
+    fragment.data = payload.mid(offset);
 
-    const int packetLength = payload.size() - 1;
 #ifdef QXMPP_DEBUG_VPX
-    qDebug("Vpx fragment FI: %d, size %d", frag_type, packetLength);
+    qDebug("Vpx fragment FI: %d, size %d", fragment.type, fragment.data.size());
 #endif
 
-    QXmppVideoFrame frame;
-    static quint16 sequence = 0;
-
-    // If the incomming packet sequence is wrong discard all packets until a
-    // complete keyframe arrives.
-    // If a partition of a keyframe is missing, discard it until a next
-    // keyframe.
-    //
-    // NOTE: https://tools.ietf.org/html/draft-ietf-payload-vp8-13#section-4.3
-    // Sections: 4.3, 4.5, 4.5.1
-
-    if (frag_type == NoFragment) {
-        // unfragmented packet
-        if ((payload[1] & 0x1) == 0 // is key frame
-            || packet.sequence() == sequence) {
-            if (d->decodeFrame(payload.mid(1), &frame))
-                frames << frame;
-
-            sequence = packet.sequence() + 1;
-        }
-
-        d->packetBuffer.resize(0);
+    // extend the sequence number so that it does not wrap around
+    qint64 sequence = packet.sequence();
+    if (!d->started) {
+        d->started = true;
+        d->highestSequence = sequence;
+        d->nextSequence = sequence;
     } else {
-        // fragments
-        if (frag_type == StartFragment) {
-            // start fragment
-            if ((payload[1] & 0x1) == 0 // is key frame
-                || packet.sequence() == sequence) {
-                d->packetBuffer = payload.mid(1);
-                sequence = packet.sequence() + 1;
-            }
-        } else {
-            // continuation or end fragment
-            if (packet.sequence() == sequence) {
-                const int packetPos = d->packetBuffer.size();
-                d->packetBuffer.resize(packetPos + packetLength);
-                stream.readRawData(d->packetBuffer.data() + packetPos, packetLength);
-
-                if (frag_type == EndFragment) {
-                    // end fragment
-                    if (d->decodeFrame(d->packetBuffer, &frame)) {
-                        frames << frame;
-                        d->packetBuffer.resize(0);
-                    }
-                }
+        sequence = d->highestSequence + qint16(packet.sequence() - quint16(d->highestSequence));
+    }
 
-                sequence++;
+    // drop duplicates and packets which arrive too late
+    if (sequence < d->nextSequence || d->fragments.contains(sequence))
+        return QList<QXmppVideoFrame>();
+    d->fragments.insert(sequence, fragment);
+    d->nacked.remove(sequence);
+
+    // request the packets which are missing once
+    if (sequence > d->highestSequence) {
+        for (qint64 missing = qMax(d->highestSequence + 1, sequence - VPX_REORDER_WINDOW); missing < sequence; ++missing) {
+            if (!d->fragments.contains(missing) && !d->nacked.contains(missing)) {
+                d->nacked.insert(missing);
+                d->lostSequences << quint16(missing);
             }
         }
+        d->highestSequence = sequence;
     }
 
-    return frames;
+    // NOTE: https://tools.ietf.org/html/draft-ietf-payload-vp8-13#section-4.3
+    // Sections: 4.3, 4.5, 4.5.1
+    return d->assembleFrames(framePool());
 }
 
 bool QXmppVpxDecoder::setParameters(const QMap<QString, QString> &parameters)
@@ -1264,25 +1589,136 @@ bool QXmppVpxDecoder::setParameters(const QMap<QString, QString> &parameters)
     return true;
 }
 
+QList<quint16> QXmppVpxDecoder::takeLostSequences()
+{
+    const QList<quint16> sequences = d->lostSequences;
+    d->lostSequences.clear();
+    return sequences;
+}
+
+bool QXmppVpxDecoder::takeKeyFrameRequest()
+{
+    const bool requested = d->keyFrameRequested;
+    d->keyFrameRequested = false;
+    return requested;
+}
+
+/// Returns the temporal layer of a VP8 RTP payload, as set by
+/// QXmppVpxEncoder in the reserved bits of the payload descriptor, or -1 if
+/// the payload is empty.
+///
+/// A relay may drop the payloads of the upper layers without decoding them.
+///
+/// \param payload
+
+int QXmppVpxDecoder::temporalLayerId(const QByteArray &payload)
+{
+    if (payload.isEmpty())
+        return -1;
+    return quint8(payload.at(0)) >> 6;
+}
+
+// Reference buffers updated by a VP8 frame.
+#define VPX_NO_UPDATES (VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF)
+
+/// A temporal scalability pattern, from the libvpx examples: the frames of
+/// each layer only reference frames of lower layers, so that the frames of
+/// the upper layers can be dropped.
+
+struct QXmppVpxLayerPattern
+{
+    unsigned int periodicity;
+    unsigned int layerIds[4];
+    unsigned int rateDecimators[3];
+    // cumulative share of the bitrate up to each layer, in percent
+    unsigned int bitrateShares[3];
+    vpx_enc_frame_flags_t flags[4];
+};
+
+static const QXmppVpxLayerPattern vpxLayerPatterns[3] = {
+    // one layer
+    { 1, { 0 }, { 1 }, { 100 }, { 0 } },
+
+    // two layers, the upper layer predicts from both layers
+    { 2, { 0, 1 }, { 2, 1 }, { 60, 100 }, {
+        VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF,
+        VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_ARF } },
+
+    // three layers, the frames of the upper layer are not referenced
+    { 4, { 0, 2, 1, 2 }, { 4, 2, 1 }, { 40, 60, 100 }, {
+        VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF,
+        VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | VPX_NO_UPDATES,
+        VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_ARF,
+        VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | VPX_NO_UPDATES } }
+};
+
 class QXmppVpxEncoderPrivate
 {
 public:
-    void writeFragment(QDataStream &stream, FragmentType frag_type, const char *data, quint16 length);
+    bool initCodec();
+    void setLayerBitrates();
+    void writeFragment(QDataStream &stream, FragmentType frag_type, quint8 layerBits, const char *data, quint16 length);
 
     vpx_codec_ctx_t codec;
     vpx_codec_enc_cfg_t cfg;
     vpx_image_t *imageBuffer;
+    bool initialized;
+    unsigned int initialWidth;
+    unsigned int initialHeight;
     int frameCount;
+    bool keyFrameRequested;
+
+    int cpuUsed;
+    int tokenPartitions;
+
+    // temporal scalability
+    int layerCount;
+    unsigned int layerIndex;
+    int framesSinceKeyFrame;
 };
 
-void QXmppVpxEncoderPrivate::writeFragment(QDataStream &stream, FragmentType frag_type, const char *data, quint16 length)
+/// Initialises the codec with the current configuration, destroying the
+/// previous instance if needed.
+
+bool QXmppVpxEncoderPrivate::initCodec()
+{
+    if (initialized) {
+        vpx_codec_destroy(&codec);
+        initialized = false;
+    }
+    if (vpx_codec_enc_init(&codec, vpx_codec_vp8_cx(), &cfg, 0) != VPX_CODEC_OK) {
+        qWarning("Vpx encoder could not be initialised");
+        return false;
+    }
+    initialized = true;
+    initialWidth = cfg.g_w;
+    initialHeight = cfg.g_h;
+    layerIndex = 0;
+    framesSinceKeyFrame = 0;
+
+    vpx_codec_control(&codec, VP8E_SET_CPUUSED, cpuUsed);
+    vpx_codec_control(&codec, VP8E_SET_TOKEN_PARTITIONS, vp8e_token_partitions(tokenPartitions));
+    return true;
+}
+
+/// Splits the target bitrate between the temporal layers.
+
+void QXmppVpxEncoderPrivate::setLayerBitrates()
+{
+    const QXmppVpxLayerPattern &pattern = vpxLayerPatterns[layerCount - 1];
+    for (int i = 0; i < layerCount; ++i)
+        cfg.ts_target_bitrate[i] = cfg.rc_target_bitrate * pattern.bitrateShares[i] / 100;
+}
+
+void QXmppVpxEncoderPrivate::writeFragment(QDataStream &stream, FragmentType frag_type, quint8 layerBits, const char *data, quint16 length)
 {
     // vp8 framing: http://tools.ietf.org/html/draft-westin-payload-vp8-00
 #ifdef QXMPP_DEBUG_VPX
     qDebug("Vpx encoder writing packet frag: %i, size: %u", frag_type, length);
 #endif
-    stream << quint8(((frag_type << 1) & 0x6) |
-                      (frag_type == NoFragment || frag_type == StartFragment));
+    stream << quint8(layerBits |
+                     ((frag_type << 1) & 0x6) |
+                     (frag_type == NoFragment || frag_type == StartFragment));
     stream.writeRawData(data, length);
 }
 
@@ -1291,6 +1727,15 @@ QXmppVpxEncoder::QXmppVpxEncoder(uint clockrate)
     d = new QXmppVpxEncoderPrivate;
     d->frameCount = 0;
     d->imageBuffer = 0;
+    d->initialized = false;
+    d->initialWidth = 0;
+    d->initialHeight = 0;
+    d->keyFrameRequested = false;
+    d->cpuUsed = 0;
+    d->tokenPartitions = 0;
+    d->layerCount = 1;
+    d->layerIndex = 0;
+    d->framesSinceKeyFrame = 0;
     vpx_codec_enc_config_default(vpx_codec_vp8_cx(), &d->cfg, 0);
 
     // Set the encoding threads number to use
@@ -1303,6 +1748,9 @@ QXmppVpxEncoder::QXmppVpxEncoder(uint clockrate)
     d->cfg.g_error_resilient = VPX_ERROR_RESILIENT_DEFAULT
                                | VPX_ERROR_RESILIENT_PARTITIONS;
 
+    // Do not buffer frames, which also allows the resolution to change
+    // without initialising the codec again
+    d->cfg.g_lag_in_frames = 0;
     d->cfg.g_pass = VPX_RC_ONE_PASS;
     d->cfg.kf_mode = VPX_KF_AUTO;
 
@@ -1316,81 +1764,93 @@ QXmppVpxEncoder::QXmppVpxEncoder(uint clockrate)
 
 QXmppVpxEncoder::~QXmppVpxEncoder()
 {
-    vpx_codec_destroy(&d->codec);
+    if (d->initialized)
+        vpx_codec_destroy(&d->codec);
     if (d->imageBuffer)
         vpx_img_free(d->imageBuffer);
     delete d;
 }
 
+/// Sets the format of the video stream.
+///
+/// Once the encoder is initialised, frame sizes up to the initial size are
+/// applied without initialising the codec again.
+///
+/// \param format
+
 bool QXmppVpxEncoder::setFormat(const QXmppVideoFormat &format)
 {
     const QXmppVideoFrame::PixelFormat pixelFormat = format.pixelFormat();
-    if (pixelFormat != QXmppVideoFrame::Format_YUYV) {
+    if (!QXmppVideoConverter::isSupported(pixelFormat)) {
         qWarning("Vpx encoder does not support the given format");
         return false;
     }
-    d->cfg.g_w = format.frameSize().width();
-    d->cfg.g_h = format.frameSize().height();
-    if (vpx_codec_enc_init(&d->codec, vpx_codec_vp8_cx(), &d->cfg, 0) != VPX_CODEC_OK) {
-        qWarning("Vpx encoder could not be initialised");
-        return false;
+    const unsigned int width = format.frameSize().width();
+    const unsigned int height = format.frameSize().height();
+
+    if (!d->imageBuffer || d->imageBuffer->d_w != width || d->imageBuffer->d_h != height) {
+        if (d->imageBuffer)
+            vpx_img_free(d->imageBuffer);
+        d->imageBuffer = vpx_img_alloc(NULL, VPX_IMG_FMT_I420, width, height, 1);
     }
+    if (d->initialized && d->cfg.g_w == width && d->cfg.g_h == height)
+        return true;
 
-    d->imageBuffer = vpx_img_alloc(NULL, VPX_IMG_FMT_I420,
-            format.frameSize().width(), format.frameSize().height(), 1);
-    return true;
+    d->cfg.g_w = width;
+    d->cfg.g_h = height;
+    if (d->initialized && width <= d->initialWidth && height <= d->initialHeight &&
+        vpx_codec_enc_config_set(&d->codec, &d->cfg) == VPX_CODEC_OK)
+        return true;
+    return d->initCodec();
 }
 
 QList<QByteArray> QXmppVpxEncoder::handleFrame(const QXmppVideoFrame &frame)
 {
     const int PACKET_MAX = 1388;
     QList<QByteArray> packets;
+    if (!d->initialized)
+        return packets;
 
-    // try to encode frame
-    if (frame.pixelFormat() == QXmppVideoFrame::Format_YUYV) {
-        // YUYV -> YUV420P
-        const int width = frame.width();
-        const int height = frame.height();
-        const int stride = frame.bytesPerLine();
-        const uchar *row = frame.bits();
-        uchar *y_row = d->imageBuffer->planes[VPX_PLANE_Y];
-        uchar *cb_row = d->imageBuffer->planes[VPX_PLANE_U];
-        uchar *cr_row = d->imageBuffer->planes[VPX_PLANE_V];
-        for (int y = 0; y < height; y += 2) {
-            // odd row
-            const uchar *ptr = row;
-            uchar *y_out = y_row;
-            uchar *cb_out = cb_row;
-            uchar *cr_out = cr_row;
-            for (int x = 0; x < width; x += 2) {
-                *(y_out++) = *(ptr++);
-                *(cb_out++) = *(ptr++);
-                *(y_out++) = *(ptr++);
-                *(cr_out++) = *(ptr++);
-            }
-            row += stride;
-            y_row += d->imageBuffer->stride[VPX_PLANE_Y];
-            cb_row += d->imageBuffer->stride[VPX_PLANE_U];
-            cr_row += d->imageBuffer->stride[VPX_PLANE_V];
-
-            // even row
-            ptr = row;
-            y_out = y_row;
-            for (int x = 0; x < width; x += 2) {
-                *(y_out++) = *(ptr++);
-                ptr++;
-                *(y_out++) = *(ptr++);
-                ptr++;
-            }
-            row += stride;
-            y_row += d->imageBuffer->stride[VPX_PLANE_Y];
-        }
-    } else {
+    // convert frame to YUV420P
+    QXmppYuvPlanes planes;
+    planes.data[0] = d->imageBuffer->planes[VPX_PLANE_Y];
+    planes.data[1] = d->imageBuffer->planes[VPX_PLANE_U];
+    planes.data[2] = d->imageBuffer->planes[VPX_PLANE_V];
+    planes.stride[0] = d->imageBuffer->stride[VPX_PLANE_Y];
+    planes.stride[1] = d->imageBuffer->stride[VPX_PLANE_U];
+    planes.stride[2] = d->imageBuffer->stride[VPX_PLANE_V];
+    if (!QXmppVideoConverter::toI420(frame, planes)) {
         qWarning("Vpx encoder does not support the given format");
         return packets;
     }
 
-    if (vpx_codec_encode(&d->codec, d->imageBuffer, d->frameCount, 1,  0, VPX_DL_REALTIME) != VPX_CODEC_OK) {
+    // with temporal layers, key frames are only inserted in the base layer
+    bool keyFrame = d->keyFrameRequested;
+    d->keyFrameRequested = false;
+    vpx_enc_frame_flags_t flags = 0;
+    quint8 layerBits = 0;
+    if (d->layerCount > 1) {
+        const QXmppVpxLayerPattern &pattern = vpxLayerPatterns[d->layerCount - 1];
+        if (d->framesSinceKeyFrame >= GOPSIZE && !d->layerIndex)
+            keyFrame = true;
+        if (keyFrame)
+            d->layerIndex = 0;
+
+        const unsigned int layerId = pattern.layerIds[d->layerIndex];
+        flags = pattern.flags[d->layerIndex];
+        vpx_codec_control(&d->codec, VP8E_SET_TEMPORAL_LAYER_ID, layerId);
+        d->layerIndex = (d->layerIndex + 1) % pattern.periodicity;
+
+        // the layer is carried in the reserved bits of the payload
+        // descriptor, followed by the non-reference frame bit
+        layerBits = layerId << 6;
+        if (!keyFrame && (flags & VPX_NO_UPDATES) == VPX_NO_UPDATES)
+            layerBits |= 0x08;
+    }
+    if (keyFrame)
+        flags |= VPX_EFLAG_FORCE_KF;
+
+    if (vpx_codec_encode(&d->codec, d->imageBuffer, d->frameCount, 1, flags, VPX_DL_REALTIME) != VPX_CODEC_OK) {
         qWarning("Vpx encoder could not handle frame: %s", vpx_codec_error_detail(&d->codec));
         return packets;
     }
@@ -1404,6 +1864,9 @@ QList<QByteArray> QXmppVpxEncoder::handleFrame(const QXmppVideoFrame &frame)
 #ifdef QXMPP_DEBUG_VPX
             qDebug("Vpx encoded packet %lu bytes", pkt->data.frame.sz);
 #endif
+            if (pkt->data.frame.flags & VPX_FRAME_IS_KEY)
+                d->framesSinceKeyFrame = 0;
+
             QDataStream stream(&payload, QIODevice::WriteOnly);
             const char *data = (const char*) pkt->data.frame.buf;
             int size = pkt->data.frame.sz;
@@ -1411,7 +1874,7 @@ QList<QByteArray> QXmppVpxEncoder::handleFrame(const QXmppVideoFrame &frame)
                 // no fragmentation
                 stream.device()->reset();
                 payload.resize(0);
-                d->writeFragment(stream, NoFragment, data, size);
+                d->writeFragment(stream, NoFragment, layerBits, data, size);
                 packets << payload;
            } else {
                 // fragmentation
@@ -1420,7 +1883,7 @@ QList<QByteArray> QXmppVpxEncoder::handleFrame(const QXmppVideoFrame &frame)
                     const int length = qMin(PACKET_MAX, size);
                     stream.device()->reset();
                     payload.resize(0);
-                    d->writeFragment(stream, frag_type, data, length);
+                    d->writeFragment(stream, frag_type, layerBits, data, length);
                     data += length;
                     size -= length;
                     frag_type = (size > PACKET_MAX) ? MiddleFragment : EndFragment;
@@ -1430,6 +1893,7 @@ QList<QByteArray> QXmppVpxEncoder::handleFrame(const QXmppVideoFrame &frame)
         }
     }
     d->frameCount++;
+    d->framesSinceKeyFrame++;
 
     return packets;
 }
@@ -1439,4 +1903,133 @@ QMap<QString, QString> QXmppVpxEncoder::parameters() const
     return QMap<QString, QString>();
 }
 
+void QXmppVpxEncoder::requestKeyFrame()
+{
+    d->keyFrameRequested = true;
+}
+
+void QXmppVpxEncoder::setBitrate(int bitrate)
+{
+    const unsigned int kbps = qMax(bitrate / 1000, 1);
+    if (kbps == d->cfg.rc_target_bitrate)
+        return;
+    d->cfg.rc_target_bitrate = kbps;
+    if (d->layerCount > 1)
+        d->setLayerBitrates();
+
+    // the encoder is only initialised once the format is known
+    if (d->initialized && vpx_codec_enc_config_set(&d->codec, &d->cfg) != VPX_CODEC_OK)
+        qWarning("Vpx encoder could not change bitrate: %s", vpx_codec_error_detail(&d->codec));
+}
+
+/// Returns the speed setting of the encoder, from -16 to 16.
+
+int QXmppVpxEncoder::cpuUsed() const
+{
+    return d->cpuUsed;
+}
+
+/// Sets the speed setting of the encoder, from -16 to 16. Higher absolute
+/// values make encoding faster at the expense of quality, negative values
+/// let the encoder adjust its speed to keep up with the frame rate.
+///
+/// \param cpuUsed
+
+void QXmppVpxEncoder::setCpuUsed(int cpuUsed)
+{
+    d->cpuUsed = qBound(-16, cpuUsed, 16);
+    if (d->initialized)
+        vpx_codec_control(&d->codec, VP8E_SET_CPUUSED, d->cpuUsed);
+}
+
+/// Returns the number of temporal layers, from 1 to 3.
+
+int QXmppVpxEncoder::temporalLayers() const
+{
+    return d->layerCount;
+}
+
+/// Sets the number of temporal layers, from 1 to 3.
+///
+/// Each layer doubles the frame rate of the layers below it, and the frames
+/// of a layer never reference those of upper layers, so that a relay can
+/// drop the upper layers for receivers with less bandwidth. The layer of
+/// each payload is available from QXmppVpxDecoder::temporalLayerId().
+///
+/// Changing the number of layers initialises the codec again.
+///
+/// \param layers
+
+void QXmppVpxEncoder::setTemporalLayers(int layers)
+{
+    layers = qBound(1, layers, 3);
+    if (layers == d->layerCount)
+        return;
+    d->layerCount = layers;
+
+    const QXmppVpxLayerPattern &pattern = vpxLayerPatterns[layers - 1];
+    if (layers > 1) {
+        d->cfg.ts_number_layers = layers;
+        d->cfg.ts_periodicity = pattern.periodicity;
+        for (unsigned int i = 0; i < pattern.periodicity; ++i)
+            d->cfg.ts_layer_id[i] = pattern.layerIds[i];
+        for (int i = 0; i < layers; ++i)
+            d->cfg.ts_rate_decimator[i] = pattern.rateDecimators[i];
+        d->setLayerBitrates();
+
+        // key frames must not be inserted in the upper layers
+        d->cfg.kf_mode = VPX_KF_DISABLED;
+    } else {
+        d->cfg.ts_number_layers = 1;
+        d->cfg.ts_periodicity = 0;
+        d->cfg.kf_mode = VPX_KF_AUTO;
+    }
+
+    if (d->initialized)
+        d->initCodec();
+}
+
+/// Returns the number of threads used for encoding.
+
+int QXmppVpxEncoder::threadCount() const
+{
+    return qMax(d->cfg.g_threads, 1u);
+}
+
+/// Sets the number of threads used for encoding.
+///
+/// Changing the number of threads initialises the codec again.
+///
+/// \param threads
+
+void QXmppVpxEncoder::setThreadCount(int threads)
+{
+    threads = qMax(threads, 1);
+    if (unsigned(threads) == qMax(d->cfg.g_threads, 1u))
+        return;
+    d->cfg.g_threads = threads;
+    if (d->initialized)
+        d->initCodec();
+}
+
+/// Returns the base 2 logarithm of the number of token partitions.
+
+int QXmppVpxEncoder::tokenPartitions() const
+{
+    return d->tokenPartitions;
+}
+
+/// Sets the base 2 logarithm of the number of token partitions, from 0 to
+/// 3. Several partitions allow the receiver to decode a frame using several
+/// threads.
+///
+/// \param partitions
+
+void QXmppVpxEncoder::setTokenPartitions(int partitions)
+{
+    d->tokenPartitions = qBound(0, partitions, 3);
+    if (d->initialized)
+        vpx_codec_control(&d->codec, VP8E_SET_TOKEN_PARTITIONS, vp8e_token_partitions(d->tokenPartitions));
+}
+
 #endif
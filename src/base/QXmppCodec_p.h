@@ -28,9 +28,10 @@
 
 #include "QXmppGlobal.h"
 
-class QXmppRtpPacket;
+class QXmppRtpPacketView;
 class QXmppVideoFormat;
 class QXmppVideoFrame;
+class QXmppVideoFramePool;
 
 /// \brief The QXmppCodec class is the base class for audio codecs capable of
 /// encoding and decoding audio samples.
@@ -49,6 +50,10 @@ public:
     /// Reads encoded data from the input stream, decodes it and writes the
     /// decoded samples to the output stream.
     virtual qint64 decode(QDataStream &input, QDataStream &output) = 0;
+
+    virtual qint64 recover(QDataStream &input, QDataStream &output, int samples);
+    virtual void setPacketLoss(int percentage);
+    virtual bool isDtxEnabled() const;
 };
 
 /// \internal
@@ -124,6 +129,22 @@ public:
 
     qint64 encode(QDataStream &input, QDataStream &output);
     qint64 decode(QDataStream &input, QDataStream &output);
+    qint64 recover(QDataStream &input, QDataStream &output, int samples);
+    void setPacketLoss(int percentage);
+
+    int bitrate() const;
+    void setBitrate(int bitrate);
+
+    int complexity() const;
+    void setComplexity(int complexity);
+
+    bool isDtxEnabled() const;
+    void setDtxEnabled(bool enabled);
+
+    bool isFecEnabled() const;
+    void setFecEnabled(bool enabled);
+
+    int packetLoss() const;
 
 private:
     OpusEncoder *encoder;
@@ -134,6 +155,10 @@ private:
     int nSamples;
     QByteArray sampleBuffer;
 
+    // buffers reused across calls
+    QByteArray opusBuffer;
+    QByteArray pcmBuffer;
+
     int readWindow(int bufferSize);
 };
 #endif
@@ -144,16 +169,26 @@ private:
 class QXMPP_AUTOTEST_EXPORT QXmppVideoDecoder
 {
 public:
+    QXmppVideoDecoder();
     virtual ~QXmppVideoDecoder();
 
+    QXmppVideoFramePool *framePool() const;
+    void setFramePool(QXmppVideoFramePool *pool);
+
     /// Returns the format of the video stream.
     virtual QXmppVideoFormat format() const = 0;
 
     /// Handles an RTP \a packet and returns a list of decoded video frames.
-    virtual QList<QXmppVideoFrame> handlePacket(const QXmppRtpPacket &packet) = 0;
+    virtual QList<QXmppVideoFrame> handlePacket(const QXmppRtpPacketView &packet) = 0;
 
     /// Sets the video stream's \a parameters.
     virtual bool setParameters(const QMap<QString, QString> &parameters) = 0;
+
+    virtual QList<quint16> takeLostSequences();
+    virtual bool takeKeyFrameRequest();
+
+private:
+    QXmppVideoFramePool *m_framePool;
 };
 
 /// \brief The QXmppVideoEncoder class is the base class for video encoders.
@@ -172,6 +207,9 @@ public:
 
     /// Returns the video stream's parameters.
     virtual QMap<QString, QString> parameters() const = 0;
+
+    virtual void requestKeyFrame();
+    virtual void setBitrate(int bitrate);
 };
 
 #ifdef QXMPP_USE_THEORA
@@ -185,7 +223,7 @@ public:
     ~QXmppTheoraDecoder();
 
     QXmppVideoFormat format() const;
-    QList<QXmppVideoFrame> handlePacket(const QXmppRtpPacket &packet);
+    QList<QXmppVideoFrame> handlePacket(const QXmppRtpPacketView &packet);
     bool setParameters(const QMap<QString, QString> &parameters);
 
 private:
@@ -218,9 +256,14 @@ public:
     ~QXmppVpxDecoder();
 
     QXmppVideoFormat format() const;
-    QList<QXmppVideoFrame> handlePacket(const QXmppRtpPacket &packet);
+    QList<QXmppVideoFrame> handlePacket(const QXmppRtpPacketView &packet);
     bool setParameters(const QMap<QString, QString> &parameters);
 
+    QList<quint16> takeLostSequences();
+    bool takeKeyFrameRequest();
+
+    static int temporalLayerId(const QByteArray &payload);
+
 private:
     QXmppVpxDecoderPrivate *d;
 };
@@ -235,6 +278,21 @@ public:
     QList<QByteArray> handleFrame(const QXmppVideoFrame &frame);
     QMap<QString, QString> parameters() const;
 
+    void requestKeyFrame();
+    void setBitrate(int bitrate);
+
+    int cpuUsed() const;
+    void setCpuUsed(int cpuUsed);
+
+    int temporalLayers() const;
+    void setTemporalLayers(int layers);
+
+    int threadCount() const;
+    void setThreadCount(int threads);
+
+    int tokenPartitions() const;
+    void setTokenPartitions(int partitions);
+
 private:
     QXmppVpxEncoderPrivate *d;
 };
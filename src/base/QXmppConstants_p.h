@@ -126,6 +126,8 @@ extern const char* ns_media_element;
 extern const char* ns_attention;
 // XEP-0231: Bits of Binary
 extern const char* ns_bob;
+// XEP-0237: Roster Versioning
+extern const char* ns_rosterver;
 // XEP-0249: Direct MUC Invitations
 extern const char* ns_conference;
 // XEP-0280: Message Carbons
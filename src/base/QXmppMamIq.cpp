@@ -102,7 +102,7 @@ void QXmppMamQueryIq::parseElementFromChild(const QDomElement &element)
 {
     QDomElement queryElement = element.firstChildElement("query");
     m_node = queryElement.attribute("node");
-    m_queryId = queryElement.attribute("queryId");
+    m_queryId = queryElement.attribute("queryid");
     QDomElement resultSetElement = queryElement.firstChildElement("set");
     if (!resultSetElement.isNull()) {
         m_resultSetQuery.parse(resultSetElement);
@@ -76,6 +76,8 @@ public:
     QString mucPassword;
     QList<int> mucStatusCodes;
     bool mucSupported;
+    int mucHistoryMaxStanzas;
+    QDateTime mucHistorySince;
 };
 
 /// Constructs a QXmppPresence.
@@ -89,6 +91,7 @@ QXmppPresence::QXmppPresence(QXmppPresence::Type type)
     d->priority = 0;
     d->type = type;
     d->mucSupported = false;
+    d->mucHistoryMaxStanzas = -1;
     d->vCardUpdateType = VCardUpdateNone;
 }
 
@@ -215,6 +218,14 @@ void QXmppPresence::parse(const QDomElement &element)
         if(xElement.namespaceURI() == ns_muc) {
             d->mucSupported = true;
             d->mucPassword = xElement.firstChildElement("password").text();
+
+            QDomElement historyElement = xElement.firstChildElement("history");
+            if (!historyElement.isNull()) {
+                bool ok;
+                const int maxStanzas = historyElement.attribute("maxstanzas").toInt(&ok);
+                d->mucHistoryMaxStanzas = ok ? maxStanzas : -1;
+                d->mucHistorySince = QXmppUtils::datetimeFromString(historyElement.attribute("since"));
+            }
         }
         else if(xElement.namespaceURI() == ns_muc_user)
         {
@@ -303,6 +314,14 @@ void QXmppPresence::toXml(QXmlStreamWriter *xmlWriter) const
         xmlWriter->writeAttribute("xmlns", ns_muc);
         if (!d->mucPassword.isEmpty())
             xmlWriter->writeTextElement("password", d->mucPassword);
+        if (d->mucHistoryMaxStanzas >= 0 || d->mucHistorySince.isValid()) {
+            xmlWriter->writeStartElement("history");
+            if (d->mucHistoryMaxStanzas >= 0)
+                xmlWriter->writeAttribute("maxstanzas", QString::number(d->mucHistoryMaxStanzas));
+            if (d->mucHistorySince.isValid())
+                xmlWriter->writeAttribute("since", QXmppUtils::datetimeToString(d->mucHistorySince));
+            xmlWriter->writeEndElement();
+        }
         xmlWriter->writeEndElement();
     }
 
@@ -497,6 +516,42 @@ void QXmppPresence::setMucSupported(bool supported)
     d->mucSupported = supported;
 }
 
+/// Returns the maximum number of history messages requested when joining a
+/// MUC room, or -1 if there is no limit.
+
+int QXmppPresence::mucHistoryMaxStanzas() const
+{
+    return d->mucHistoryMaxStanzas;
+}
+
+/// Sets the maximum number of history messages requested when joining a
+/// MUC room. Set it to -1 for no limit.
+///
+/// \param maxStanzas
+
+void QXmppPresence::setMucHistoryMaxStanzas(int maxStanzas)
+{
+    d->mucHistoryMaxStanzas = maxStanzas;
+}
+
+/// Returns the date from which history messages are requested when joining
+/// a MUC room.
+
+QDateTime QXmppPresence::mucHistorySince() const
+{
+    return d->mucHistorySince;
+}
+
+/// Sets the date from which history messages are requested when joining a
+/// MUC room.
+///
+/// \param since
+
+void QXmppPresence::setMucHistorySince(const QDateTime &since)
+{
+    d->mucHistorySince = since;
+}
+
 /// Indicates if the QXmppStanza is a stanza in the XMPP sence (i. e. a message,
 /// iq or presence)
 
@@ -25,6 +25,8 @@
 #ifndef QXMPPPRESENCE_H
 #define QXMPPPRESENCE_H
 
+#include <QDateTime>
+
 #include "QXmppStanza.h"
 #include "QXmppMucIq.h"
 
@@ -109,6 +111,12 @@ public:
     bool isMucSupported() const;
     void setMucSupported(bool supported);
 
+    int mucHistoryMaxStanzas() const;
+    void setMucHistoryMaxStanzas(int maxStanzas);
+
+    QDateTime mucHistorySince() const;
+    void setMucHistorySince(const QDateTime &since);
+
     /// XEP-0153: vCard-Based Avatars
     QByteArray photoHash() const;
     void setPhotoHash(const QByteArray&);
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include "QXmppProfiler_p.h"
+
+// bucket i holds durations below 2^i microseconds
+static const int HISTOGRAM_BUCKETS = 32;
+
+struct QXmppProfilerHistogram
+{
+    QXmppProfilerHistogram();
+    qint64 percentile(int percent) const;
+
+    qint64 buckets[HISTOGRAM_BUCKETS];
+    qint64 count;
+    qint64 max;
+    qint64 total;
+};
+
+QXmppProfilerHistogram::QXmppProfilerHistogram()
+    : count(0)
+    , max(0)
+    , total(0)
+{
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i)
+        buckets[i] = 0;
+}
+
+/// Returns an upper bound for the given percentile, in microseconds.
+
+qint64 QXmppProfilerHistogram::percentile(int percent) const
+{
+    const qint64 rank = (count * percent + 99) / 100;
+    qint64 seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen >= rank)
+            return qMin(qint64(1) << i, max);
+    }
+    return max;
+}
+
+static QAtomicInt profilerEnabled(0);
+static QAtomicInt profilerInterval(100);
+static QAtomicInt profilerTicket(0);
+static QMutex profilerMutex;
+static QHash<QString, QXmppProfilerHistogram> profilerHistograms;
+
+/// Returns true if the profiler is enabled.
+///
+/// The profiler is disabled by default.
+
+bool QXmppProfiler::isEnabled()
+{
+    return profilerEnabled.load();
+}
+
+/// Sets whether the profiler is enabled.
+///
+/// \param enabled
+
+void QXmppProfiler::setEnabled(bool enabled)
+{
+    profilerEnabled.store(enabled);
+}
+
+/// Returns the number of events for which one event is measured.
+
+int QXmppProfiler::samplingInterval()
+{
+    return profilerInterval.load();
+}
+
+/// Sets the number of events for which one event is measured.
+///
+/// The default is to measure one event out of 100, use 1 to measure
+/// every event.
+///
+/// \param interval
+
+void QXmppProfiler::setSamplingInterval(int interval)
+{
+    profilerInterval.store(qMax(interval, 1));
+}
+
+/// Records a duration in the given histogram.
+///
+/// \param name
+/// \param usecs The duration in microseconds.
+
+void QXmppProfiler::record(const QString &name, qint64 usecs)
+{
+    usecs = qMax(usecs, qint64(0));
+    int bucket = 0;
+    while (bucket < HISTOGRAM_BUCKETS - 1 && usecs >= (qint64(1) << bucket))
+        ++bucket;
+
+    QMutexLocker locker(&profilerMutex);
+    QXmppProfilerHistogram &histogram = profilerHistograms[name];
+    histogram.buckets[bucket]++;
+    histogram.count++;
+    histogram.max = qMax(histogram.max, usecs);
+    histogram.total += usecs;
+}
+
+/// Clears all the histograms.
+
+void QXmppProfiler::reset()
+{
+    QMutexLocker locker(&profilerMutex);
+    profilerHistograms.clear();
+}
+
+/// Returns the histograms recorded so far, indexed by name.
+///
+/// Each histogram is a map with the number of samples ("count"), the
+/// total, mean and maximum durations ("total", "mean" and "max") and upper
+/// bounds for the 50th, 90th and 99th percentiles ("p50", "p90" and "p99"),
+/// all in microseconds. The "buckets" entry lists the number of samples
+/// below 1, 2, 4 ... microseconds.
+
+QVariantMap QXmppProfiler::snapshot()
+{
+    QMutexLocker locker(&profilerMutex);
+    QVariantMap result;
+    for (QHash<QString, QXmppProfilerHistogram>::const_iterator it = profilerHistograms.constBegin();
+         it != profilerHistograms.constEnd();
+         ++it) {
+        const QXmppProfilerHistogram &histogram = it.value();
+
+        // omit the empty buckets at the end
+        int bucketCount = HISTOGRAM_BUCKETS;
+        while (bucketCount > 0 && !histogram.buckets[bucketCount - 1])
+            --bucketCount;
+        QVariantList buckets;
+        for (int i = 0; i < bucketCount; ++i)
+            buckets << histogram.buckets[i];
+
+        QVariantMap map;
+        map["buckets"] = buckets;
+        map["count"] = histogram.count;
+        map["max"] = histogram.max;
+        map["mean"] = histogram.count ? histogram.total / histogram.count : 0;
+        map["p50"] = histogram.percentile(50);
+        map["p90"] = histogram.percentile(90);
+        map["p99"] = histogram.percentile(99);
+        map["total"] = histogram.total;
+        result.insert(it.key(), map);
+    }
+    return result;
+}
+
+/// Starts measuring an event if the profiler is enabled and this event
+/// is sampled.
+
+QXmppProfilerSample::QXmppProfilerSample()
+    : m_active(false)
+{
+    if (profilerEnabled.load()) {
+        m_active = !(profilerTicket.fetchAndAddRelaxed(1) % profilerInterval.load());
+        if (m_active)
+            m_timer.start();
+    }
+}
+
+/// Records the time elapsed since the sample was started or since the
+/// previous call to record(), if the sample is active.
+///
+/// \param name
+
+void QXmppProfilerSample::record(const QString &name)
+{
+    if (!m_active)
+        return;
+    QXmppProfiler::record(name, m_timer.nsecsElapsed() / 1000);
+    m_timer.restart();
+}
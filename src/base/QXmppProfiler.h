@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPPROFILER_H
+#define QXMPPPROFILER_H
+
+#include <QVariantMap>
+
+#include "QXmppGlobal.h"
+
+/// \brief The QXmppProfiler class measures where QXmpp spends time.
+///
+/// When enabled, the profiler records durations into histograms:
+///
+///  - client.handleStanza.<extension> and server.handleStanza.<extension>,
+///    the time spent by each extension's handleStanza()
+///  - stream.parse, the time spent parsing received XML
+///  - stream.serialize, the time spent serializing sent packets
+///  - client.event-loop.lag and server.event-loop.lag, how late the event
+///    loop fires a periodic timer
+///
+/// To keep its overhead low, only one event out of samplingInterval() is
+/// measured. The histograms can be retrieved using snapshot().
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppProfiler
+{
+public:
+    static bool isEnabled();
+    static void setEnabled(bool enabled);
+
+    static int samplingInterval();
+    static void setSamplingInterval(int interval);
+
+    static void record(const QString &name, qint64 usecs);
+    static void reset();
+    static QVariantMap snapshot();
+};
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#ifndef QXMPPPROFILER_P_H
+#define QXMPPPROFILER_P_H
+
+#include <QElapsedTimer>
+
+#include "QXmppProfiler.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppProfilerSample class measures one event, if the profiler
+/// decides to sample it.
+///
+/// Callers should check isActive() before building the names passed to
+/// record(), so that unsampled events cost a single check.
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppProfilerSample
+{
+public:
+    QXmppProfilerSample();
+
+    /// Returns true if this event is being measured.
+    bool isActive() const
+    {
+        return m_active;
+    }
+
+    void record(const QString &name);
+
+private:
+    bool m_active;
+    QElapsedTimer m_timer;
+};
+
+#endif
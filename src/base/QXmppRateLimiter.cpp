@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <limits>
+
+#include "QXmppRateLimiter_p.h"
+
+// tokens are counted in thousandths, so that a millisecond's worth of
+// tokens is exactly the rate
+static const qint64 TOKEN_SCALE = 1000;
+
+/// Constructs a new rate limiter, which starts with full buckets.
+///
+/// \param bytesPerSecond The maximum number of bytes per second, or 0 for no limit.
+/// \param stanzasPerSecond The maximum number of stanzas per second, or 0 for no limit.
+
+QXmppRateLimiter::QXmppRateLimiter(qint64 bytesPerSecond, qint64 stanzasPerSecond)
+    : m_lastRefill(0)
+{
+    m_bytes.rate = qMax(bytesPerSecond, qint64(0));
+    m_bytes.tokens = m_bytes.rate * TOKEN_SCALE;
+    m_stanzas.rate = qMax(stanzasPerSecond, qint64(0));
+    m_stanzas.tokens = m_stanzas.rate * TOKEN_SCALE;
+    m_clock.start();
+}
+
+/// Returns the maximum number of bytes per second, or 0 if it is unlimited.
+
+qint64 QXmppRateLimiter::bytesPerSecond() const
+{
+    return m_bytes.rate;
+}
+
+/// Returns the maximum number of stanzas per second, or 0 if it is unlimited.
+
+qint64 QXmppRateLimiter::stanzasPerSecond() const
+{
+    return m_stanzas.rate;
+}
+
+/// Returns the number of bytes which can be read right now.
+
+qint64 QXmppRateLimiter::availableBytes()
+{
+    if (!m_bytes.rate)
+        return std::numeric_limits<qint64>::max();
+
+    refill();
+    return qMax(m_bytes.tokens / TOKEN_SCALE, qint64(0));
+}
+
+/// Takes the given number of bytes and stanzas from the buckets.
+///
+/// \param bytes
+/// \param stanzas
+
+void QXmppRateLimiter::consume(qint64 bytes, qint64 stanzas)
+{
+    refill();
+    if (m_bytes.rate)
+        m_bytes.tokens -= bytes * TOKEN_SCALE;
+    if (m_stanzas.rate)
+        m_stanzas.tokens -= stanzas * TOKEN_SCALE;
+}
+
+/// Returns the number of milliseconds until reading can resume, or 0 if
+/// reading is allowed right now.
+
+int QXmppRateLimiter::delay()
+{
+    refill();
+    return qMax(waitTime(m_bytes), waitTime(m_stanzas));
+}
+
+void QXmppRateLimiter::refill()
+{
+    const qint64 now = m_clock.elapsed();
+    const qint64 elapsed = now - m_lastRefill;
+    if (elapsed <= 0)
+        return;
+    m_lastRefill = now;
+
+    Bucket *buckets[] = { &m_bytes, &m_stanzas };
+    for (Bucket *bucket : buckets) {
+        if (bucket->rate)
+            bucket->tokens = qMin(bucket->tokens + elapsed * bucket->rate,
+                                  bucket->rate * TOKEN_SCALE);
+    }
+}
+
+int QXmppRateLimiter::waitTime(const Bucket &bucket)
+{
+    // wait until at least one token is available
+    if (!bucket.rate || bucket.tokens >= TOKEN_SCALE)
+        return 0;
+    const qint64 missing = TOKEN_SCALE - bucket.tokens;
+    return int(qMin((missing + bucket.rate - 1) / bucket.rate, qint64(std::numeric_limits<int>::max())));
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPRATELIMITER_P_H
+#define QXMPPRATELIMITER_P_H
+
+#include <QElapsedTimer>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppRateLimiter class limits the rate at which data and stanzas are
+/// read from one or more streams, using a token bucket for each of them.
+///
+/// Each bucket holds at most one second worth of tokens, and can go into
+/// debt when more is consumed than was available, for instance when a
+/// single read contains many stanzas.
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppRateLimiter
+{
+public:
+    QXmppRateLimiter(qint64 bytesPerSecond, qint64 stanzasPerSecond);
+
+    qint64 bytesPerSecond() const;
+    qint64 stanzasPerSecond() const;
+
+    qint64 availableBytes();
+    void consume(qint64 bytes, qint64 stanzas);
+    int delay();
+
+private:
+    struct Bucket
+    {
+        qint64 rate;
+        qint64 tokens;
+    };
+
+    void refill();
+    static int waitTime(const Bucket &bucket);
+
+    Bucket m_bytes;
+    Bucket m_stanzas;
+    QElapsedTimer m_clock;
+    qint64 m_lastRefill;
+};
+
+#endif
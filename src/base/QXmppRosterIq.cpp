@@ -92,7 +92,8 @@ void QXmppRosterIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
     writer->writeAttribute( "xmlns", ns_roster);
 
     // XEP-0237 roster versioning - If the server does not advertise support for roster versioning, the client MUST NOT include the 'ver' attribute.
-    if(!version().isEmpty())
+    // An empty, non-null version is sent by a client which has no cached roster.
+    if(!version().isNull())
         writer->writeAttribute( "ver", version());
     for(int i = 0; i < m_items.count(); ++i)
         m_items.at(i).toXml(writer);
@@ -47,6 +47,12 @@ public:
 
     QString goodbyeReason;
     QList<quint32> goodbyeSsrcs;
+    quint8 feedbackFormat;
+    quint32 mediaSsrc;
+    QList<quint16> nackSequences;
+    QList<qint64> transportArrivalTimes;
+    quint16 transportBaseSequence;
+    quint8 transportFeedbackCount;
     QXmppRtcpSenderInfo senderInfo;
     QList<QXmppRtcpReceiverReport> receiverReports;
     QList<QXmppRtcpSourceDescription> sourceDescriptions;
@@ -115,6 +121,126 @@ static void writePadding(QDataStream &stream, int dataLength)
     }
 }
 
+// resolution of the times in transport-wide feedback, in microseconds
+static const qint64 TRANSPORT_REFERENCE_UNIT = 64000;
+static const qint64 TRANSPORT_DELTA_UNIT = 250;
+
+// status symbols of transport-wide feedback
+enum TransportStatus {
+    NotReceived = 0,
+    SmallDelta = 1,
+    LargeDelta = 2
+};
+
+static bool readTransportFeedback(QDataStream &s, quint16 *baseSequence, quint8 *feedbackCount, QList<qint64> *arrivalTimes)
+{
+    quint16 statusCount;
+    quint32 reference;
+    s >> *baseSequence;
+    s >> statusCount;
+    s >> reference;
+    if (s.status() != QDataStream::Ok)
+        return false;
+    *feedbackCount = reference & 0xff;
+
+    // packet status chunks
+    QList<quint8> symbols;
+    while (symbols.size() < statusCount) {
+        quint16 chunk;
+        s >> chunk;
+        if (s.status() != QDataStream::Ok)
+            return false;
+        if (!(chunk & 0x8000)) {
+            // run length chunk
+            const quint8 symbol = (chunk >> 13) & 0x3;
+            for (int i = 0; i < (chunk & 0x1fff); ++i)
+                symbols << symbol;
+        } else if (!(chunk & 0x4000)) {
+            // status vector chunk of 14 one-bit symbols
+            for (int i = 13; i >= 0; --i)
+                symbols << ((chunk >> i) & 0x1);
+        } else {
+            // status vector chunk of 7 two-bit symbols
+            for (int i = 6; i >= 0; --i)
+                symbols << ((chunk >> (2 * i)) & 0x3);
+        }
+    }
+
+    // receive deltas, relative to the previous packet
+    qint64 time = qint64(qint32(reference) >> 8) * TRANSPORT_REFERENCE_UNIT;
+    arrivalTimes->clear();
+    for (int i = 0; i < statusCount; ++i) {
+        if (symbols.at(i) == SmallDelta) {
+            quint8 delta;
+            s >> delta;
+            time += delta * TRANSPORT_DELTA_UNIT;
+        } else if (symbols.at(i) == LargeDelta) {
+            qint16 delta;
+            s >> delta;
+            time += delta * TRANSPORT_DELTA_UNIT;
+        } else {
+            *arrivalTimes << -1;
+            continue;
+        }
+        if (s.status() != QDataStream::Ok)
+            return false;
+        *arrivalTimes << time;
+    }
+    return true;
+}
+
+static void writeTransportFeedback(QDataStream &s, quint16 baseSequence, quint8 feedbackCount, const QList<qint64> &arrivalTimes)
+{
+    // the reference time is that of the first received packet
+    qint64 reference = 0;
+    foreach (qint64 arrival, arrivalTimes) {
+        if (arrival >= 0) {
+            reference = arrival / TRANSPORT_REFERENCE_UNIT;
+            break;
+        }
+    }
+    s << baseSequence;
+    s << quint16(arrivalTimes.size());
+    s << quint32(((reference & 0xffffff) << 8) | feedbackCount);
+
+    // compute the deltas from the quantized times, so that errors do not
+    // accumulate
+    QList<quint8> symbols;
+    QList<qint16> deltas;
+    qint64 time = reference * TRANSPORT_REFERENCE_UNIT;
+    foreach (qint64 arrival, arrivalTimes) {
+        if (arrival < 0) {
+            symbols << NotReceived;
+            continue;
+        }
+        const qint64 delta = qBound(qint64(-32768), (arrival - time + TRANSPORT_DELTA_UNIT / 2) / TRANSPORT_DELTA_UNIT, qint64(32767));
+        symbols << ((delta >= 0 && delta <= 255) ? SmallDelta : LargeDelta);
+        deltas << qint16(delta);
+        time += delta * TRANSPORT_DELTA_UNIT;
+    }
+
+    // status vector chunks of 7 two-bit symbols
+    for (int i = 0; i < symbols.size(); i += 7) {
+        quint16 chunk = 0xc000;
+        for (int j = 0; j < 7 && i + j < symbols.size(); ++j)
+            chunk |= symbols.at(i + j) << (2 * (6 - j));
+        s << chunk;
+    }
+
+    int length = 8 + 2 * ((symbols.size() + 6) / 7);
+    int index = 0;
+    foreach (quint8 symbol, symbols) {
+        if (symbol == SmallDelta) {
+            s << quint8(deltas.at(index++));
+            length += 1;
+        } else if (symbol == LargeDelta) {
+            s << deltas.at(index++);
+            length += 2;
+        }
+    }
+    writePadding(s, length);
+}
+
 /// Constructs an empty RTCP packet
 
 QXmppRtcpPacket::QXmppRtcpPacket()
@@ -182,6 +308,12 @@ bool QXmppRtcpPacket::read(QDataStream &stream)
     QDataStream s(d->payload);
     d->goodbyeReason.clear();
     d->goodbyeSsrcs.clear();
+    d->feedbackFormat = 0;
+    d->mediaSsrc = 0;
+    d->nackSequences.clear();
+    d->transportArrivalTimes.clear();
+    d->transportBaseSequence = 0;
+    d->transportFeedbackCount = 0;
     d->receiverReports.clear();
     d->senderInfo = QXmppRtcpSenderInfo();
     d->sourceDescriptions.clear();
@@ -222,6 +354,32 @@ bool QXmppRtcpPacket::read(QDataStream &stream)
                 return false;
             d->sourceDescriptions << desc;
         }
+    } else if (d->type == RtpFeedback || d->type == PayloadFeedback) {
+        // RFC 4585 feedback, the count field holds the format
+        d->feedbackFormat = d->count;
+        s >> d->ssrc;
+        s >> d->mediaSsrc;
+        if (s.status() != QDataStream::Ok)
+            return false;
+        if (d->type == RtpFeedback && d->feedbackFormat == GenericNack) {
+            // each entry holds a lost packet and a bitmask of the following
+            // 16 packets which were also lost
+            quint16 pid, blp;
+            while (!s.atEnd()) {
+                s >> pid;
+                s >> blp;
+                if (s.status() != QDataStream::Ok)
+                    return false;
+                d->nackSequences << pid;
+                for (int i = 0; i < 16; ++i) {
+                    if (blp & (1 << i))
+                        d->nackSequences << quint16(pid + i + 1);
+                }
+            }
+        } else if (d->type == RtpFeedback && d->feedbackFormat == TransportFeedback) {
+            if (!readTransportFeedback(s, &d->transportBaseSequence, &d->transportFeedbackCount, &d->transportArrivalTimes))
+                return false;
+        }
     }
     return true;
 }
@@ -253,6 +411,28 @@ void QXmppRtcpPacket::write(QDataStream &stream) const
         count = d->sourceDescriptions.size();
         foreach (const QXmppRtcpSourceDescription &desc, d->sourceDescriptions)
             desc.d->write(s);
+    } else if (d->type == RtpFeedback || d->type == PayloadFeedback) {
+        count = d->feedbackFormat;
+        s << d->ssrc;
+        s << d->mediaSsrc;
+        if (d->type == RtpFeedback && d->feedbackFormat == GenericNack) {
+            int i = 0;
+            while (i < d->nackSequences.size()) {
+                const quint16 pid = d->nackSequences.at(i++);
+                quint16 blp = 0;
+                while (i < d->nackSequences.size()) {
+                    const quint16 offset = d->nackSequences.at(i) - pid;
+                    if (offset < 1 || offset > 16)
+                        break;
+                    blp |= (1 << (offset - 1));
+                    ++i;
+                }
+                s << pid;
+                s << blp;
+            }
+        } else if (d->type == RtpFeedback && d->feedbackFormat == TransportFeedback) {
+            writeTransportFeedback(s, d->transportBaseSequence, d->transportFeedbackCount, d->transportArrivalTimes);
+        }
     } else {
         count = d->count;
         payload = d->payload;
@@ -284,6 +464,135 @@ void QXmppRtcpPacket::setGoodbyeSsrcs(const QList<quint32> &goodbyeSsrcs)
     d->goodbyeSsrcs = goodbyeSsrcs;
 }
 
+/// Returns the format of a feedback message.
+///
+/// This is only applicable for RtpFeedback or PayloadFeedback packets.
+
+quint8 QXmppRtcpPacket::feedbackFormat() const
+{
+    return d->feedbackFormat;
+}
+
+/// Sets the format of a feedback message.
+///
+/// This is only applicable for RtpFeedback or PayloadFeedback packets.
+///
+/// \param format
+
+void QXmppRtcpPacket::setFeedbackFormat(quint8 format)
+{
+    d->feedbackFormat = format;
+}
+
+/// Returns the SSRC of the media source a feedback message refers to.
+///
+/// This is only applicable for RtpFeedback or PayloadFeedback packets.
+
+quint32 QXmppRtcpPacket::mediaSsrc() const
+{
+    return d->mediaSsrc;
+}
+
+/// Sets the SSRC of the media source a feedback message refers to.
+///
+/// This is only applicable for RtpFeedback or PayloadFeedback packets.
+///
+/// \param ssrc
+
+void QXmppRtcpPacket::setMediaSsrc(quint32 ssrc)
+{
+    d->mediaSsrc = ssrc;
+}
+
+/// Returns the sequence numbers of the lost RTP packets.
+///
+/// This is only applicable for Generic NACK feedback messages.
+
+QList<quint16> QXmppRtcpPacket::nackSequences() const
+{
+    return d->nackSequences;
+}
+
+/// Sets the sequence numbers of the lost RTP packets, in increasing order.
+///
+/// This is only applicable for Generic NACK feedback messages.
+///
+/// \param sequences
+
+void QXmppRtcpPacket::setNackSequences(const QList<quint16> &sequences)
+{
+    d->nackSequences = sequences;
+}
+
+/// Returns the sequence number of the first packet described by a
+/// transport-wide feedback message.
+///
+/// This is only applicable for TransportFeedback messages.
+
+quint16 QXmppRtcpPacket::transportBaseSequence() const
+{
+    return d->transportBaseSequence;
+}
+
+/// Sets the sequence number of the first packet described by a
+/// transport-wide feedback message.
+///
+/// This is only applicable for TransportFeedback messages.
+///
+/// \param sequence
+
+void QXmppRtcpPacket::setTransportBaseSequence(quint16 sequence)
+{
+    d->transportBaseSequence = sequence;
+}
+
+/// Returns the arrival times in microseconds of the packets described by a
+/// transport-wide feedback message, starting with the base sequence
+/// number. Packets which were not received have a time of -1.
+///
+/// This is only applicable for TransportFeedback messages.
+
+QList<qint64> QXmppRtcpPacket::transportArrivalTimes() const
+{
+    return d->transportArrivalTimes;
+}
+
+/// Sets the arrival times in microseconds of the packets described by a
+/// transport-wide feedback message, starting with the base sequence
+/// number. Packets which were not received have a time of -1.
+///
+/// The times are encoded with a resolution of 250 microseconds.
+///
+/// This is only applicable for TransportFeedback messages.
+///
+/// \param times
+
+void QXmppRtcpPacket::setTransportArrivalTimes(const QList<qint64> &times)
+{
+    d->transportArrivalTimes = times;
+}
+
+/// Returns the counter of transport-wide feedback messages sent by the
+/// receiver, which allows the sender to detect lost feedback.
+///
+/// This is only applicable for TransportFeedback messages.
+
+quint8 QXmppRtcpPacket::transportFeedbackCount() const
+{
+    return d->transportFeedbackCount;
+}
+
+/// Sets the counter of transport-wide feedback messages.
+///
+/// This is only applicable for TransportFeedback messages.
+///
+/// \param count
+
+void QXmppRtcpPacket::setTransportFeedbackCount(quint8 count)
+{
+    d->transportFeedbackCount = count;
+}
+
 QList<QXmppRtcpReceiverReport> QXmppRtcpPacket::receiverReports() const
 {
     return d->receiverReports;
@@ -316,7 +625,8 @@ void QXmppRtcpPacket::setSourceDescriptions(const QList<QXmppRtcpSourceDescripti
 
 /// Returns the RTCP packet's source SSRC.
 ///
-/// This is only applicable for Sender Reports or Receiver Reports.
+/// This is only applicable for Sender Reports, Receiver Reports or feedback
+/// messages.
 
 quint32 QXmppRtcpPacket::ssrc() const
 {
@@ -325,7 +635,8 @@ quint32 QXmppRtcpPacket::ssrc() const
 
 /// Sets the RTCP packet's source SSRC.
 ///
-/// This is only applicable for Sender Reports or Receiver Reports.
+/// This is only applicable for Sender Reports, Receiver Reports or feedback
+/// messages.
 
 void QXmppRtcpPacket::setSsrc(quint32 ssrc)
 {
@@ -351,6 +662,10 @@ void QXmppRtcpPacket::setType(quint8 type)
 QXmppRtcpPacketPrivate::QXmppRtcpPacketPrivate()
     : count(0)
     , type(0)
+    , feedbackFormat(0)
+    , mediaSsrc(0)
+    , transportBaseSequence(0)
+    , transportFeedbackCount(0)
     , ssrc(0)
 {
 }
@@ -48,6 +48,15 @@ public:
         ReceiverReport      = 201,
         SourceDescription   = 202,
         Goodbye             = 203,
+        RtpFeedback         = 205,
+        PayloadFeedback     = 206,
+    };
+
+    /// This enum describes the formats of feedback messages.
+    enum FeedbackFormat {
+        GenericNack             = 1,    ///< Generic NACK, for RtpFeedback packets.
+        PictureLossIndication   = 1,    ///< Picture Loss Indication, for PayloadFeedback packets.
+        TransportFeedback       = 15,   ///< Transport-wide congestion control feedback, for RtpFeedback packets.
     };
 
     QXmppRtcpPacket();
@@ -66,6 +75,24 @@ public:
     QList<quint32> goodbyeSsrcs() const;
     void setGoodbyeSsrcs(const QList<quint32> &goodbyeSsrcs);
 
+    quint8 feedbackFormat() const;
+    void setFeedbackFormat(quint8 format);
+
+    quint32 mediaSsrc() const;
+    void setMediaSsrc(quint32 ssrc);
+
+    QList<quint16> nackSequences() const;
+    void setNackSequences(const QList<quint16> &sequences);
+
+    quint16 transportBaseSequence() const;
+    void setTransportBaseSequence(quint16 sequence);
+
+    QList<qint64> transportArrivalTimes() const;
+    void setTransportArrivalTimes(const QList<qint64> &times);
+
+    quint8 transportFeedbackCount() const;
+    void setTransportFeedbackCount(quint8 count);
+
     QList<QXmppRtcpReceiverReport> receiverReports() const;
     void setReceiverReports(const QList<QXmppRtcpReceiverReport> &reports);
 
@@ -24,13 +24,20 @@
 #include <cmath>
 
 #include <QDataStream>
+#include <QElapsedTimer>
 #include <QMetaType>
 #include <QTimer>
+#include <QtEndian>
+#include <QVector>
 
+#include "QXmppAudioResampler_p.h"
+#include "QXmppBandwidthEstimator_p.h"
 #include "QXmppCodec_p.h"
 #include "QXmppJingleIq.h"
+#include "QXmppRtcpPacket.h"
 #include "QXmppRtpChannel.h"
 #include "QXmppRtpPacket.h"
+#include "QXmppVideoFramePool_p.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846264338327950288
@@ -39,6 +46,19 @@
 //#define QXMPP_DEBUG_RTP
 //#define QXMPP_DEBUG_RTP_BUFFER
 #define SAMPLE_BYTES 2
+// DTMF tones are rendered from a sine table of 1 << TONE_TABLE_BITS entries
+#define TONE_TABLE_BITS 12
+
+// voice activity detection
+#define VAD_HANGOVER 200        // duration of speech kept after the level drops, in ms
+#define VAD_MINIMUM_LEVEL 100.0 // RMS level under which frames are silent, about -50 dBov
+#define VAD_NOISE_RISE 0.1      // rise of the noise floor per second of audio
+#define VAD_THRESHOLD 3.0       // ratio of the RMS level of speech to the noise floor
+
+// comfort noise updates are sent when the level changes by more than
+// COMFORT_NOISE_CHANGE dB, or every COMFORT_NOISE_INTERVAL ms
+#define COMFORT_NOISE_CHANGE 2
+#define COMFORT_NOISE_INTERVAL 1000
 
 /// Creates a new RTP channel.
 
@@ -117,6 +137,7 @@ enum CodecId {
     G722 = 9,
     L16Stereo = 10,
     L16Mono = 11,
+    CN = 13,
     G728 = 15,
     G729 = 18
 };
@@ -152,18 +173,39 @@ static QPair<int, int> toneFreqs(QXmppRtpAudioChannel::Tone tone)
     return qMakePair(0, 0);
 }
 
+class QXmppToneTable
+{
+public:
+    QXmppToneTable()
+    {
+        // half amplitude, so that the sum of two tones cannot overflow
+        for (int i = 0; i < (1 << TONE_TABLE_BITS); ++i)
+            samples[i] = qRound(16383.0 * sin(2.0 * M_PI * i / (1 << TONE_TABLE_BITS)));
+    }
+
+    qint16 samples[1 << TONE_TABLE_BITS];
+};
+
+Q_GLOBAL_STATIC(QXmppToneTable, toneTable)
+
 QByteArray renderTone(QXmppRtpAudioChannel::Tone tone, int clockrate, quint32 clockTick, qint64 samples)
 {
-    QPair<int,int> tf = toneFreqs(tone);
-    const float clockMult = 2.0 * M_PI / float(clockrate);
-    QByteArray chunk;
-    chunk.reserve(samples * SAMPLE_BYTES);
-    QDataStream output(&chunk, QIODevice::WriteOnly);
-    output.setByteOrder(QDataStream::LittleEndian);
-    for (quint32 i = 0; i < samples; ++i) {
-        quint16 val = 16383.0 * (sin(clockMult * clockTick * tf.first) + sin(clockMult * clockTick * tf.second));
-        output << val;
-        clockTick++;
+    const QPair<int,int> tf = toneFreqs(tone);
+    const qint16 *table = toneTable()->samples;
+
+    // the phases are fractions of a period, in units of 2^-32
+    const quint64 firstStep = (quint64(tf.first) << 32) / clockrate;
+    const quint64 secondStep = (quint64(tf.second) << 32) / clockrate;
+    quint32 firstPhase = quint32(clockTick * firstStep);
+    quint32 secondPhase = quint32(clockTick * secondStep);
+
+    QByteArray chunk(samples * SAMPLE_BYTES, Qt::Uninitialized);
+    uchar *output = reinterpret_cast<uchar*>(chunk.data());
+    for (qint64 i = 0; i < samples; ++i) {
+        const qint16 val = table[firstPhase >> (32 - TONE_TABLE_BITS)] + table[secondPhase >> (32 - TONE_TABLE_BITS)];
+        qToLittleEndian(val, output + i * SAMPLE_BYTES);
+        firstPhase += quint32(firstStep);
+        secondPhase += quint32(secondStep);
     }
     return chunk;
 }
@@ -173,6 +215,7 @@ class QXmppRtpAudioChannelPrivate
 public:
     QXmppRtpAudioChannelPrivate();
     QXmppCodec *codecForPayloadType(const QXmppJinglePayloadType &payloadType);
+    bool isSilence(const QByteArray &chunk);
 
     // signals
     bool signalsEmitted;
@@ -190,10 +233,15 @@ public:
     // position of the head of the incoming buffer, in bytes
     qint64 incomingPos;
     quint16 incomingSequence;
+    // stamp expected for the next incoming packet
+    quint32 incomingStamp;
+    QXmppAudioResampler incomingResampler;
 
     QByteArray outgoingBuffer;
     quint16 outgoingChunk;
     QXmppCodec *outgoingCodec;
+    // datagram reused for each outgoing audio packet
+    QByteArray outgoingDatagram;
     bool outgoingMarker;
     bool outgoingPayloadNumbered;
     quint16 outgoingSequence;
@@ -201,8 +249,26 @@ public:
     QTimer *outgoingTimer;
     QList<ToneInfo> outgoingTones;
     QXmppJinglePayloadType outgoingTonesType;
+    QXmppJinglePayloadType outgoingComfortNoiseType;
+    // level of the last comfort noise packet in -dBov, or -1 during speech
+    int outgoingComfortNoiseLevel;
+    // time since the last comfort noise packet, in ms
+    int outgoingComfortNoiseAge;
+    // RMS level of the last outgoing frame
+    double outgoingLevel;
+    qint64 outgoingSuppressed;
+    // trailing byte of a sample which was partially written
+    QByteArray outgoingPartial;
+    QXmppAudioResampler outgoingResampler;
 
     QXmppJinglePayloadType payloadType;
+    // sample rate used by the application, 0 for the codec's clock rate
+    int sampleRate;
+
+    // voice activity detection
+    bool vadEnabled;
+    int vadHangover;
+    double vadNoiseLevel;
 };
 
 QXmppRtpAudioChannelPrivate::QXmppRtpAudioChannelPrivate()
@@ -213,12 +279,21 @@ QXmppRtpAudioChannelPrivate::QXmppRtpAudioChannelPrivate()
     , incomingMaximum(0)
     , incomingPos(0)
     , incomingSequence(0)
+    , incomingStamp(0)
     , outgoingCodec(0)
     , outgoingMarker(true)
     , outgoingPayloadNumbered(false)
     , outgoingSequence(1)
     , outgoingStamp(0)
     , outgoingTimer(0)
+    , outgoingComfortNoiseLevel(-1)
+    , outgoingComfortNoiseAge(0)
+    , outgoingLevel(0)
+    , outgoingSuppressed(0)
+    , sampleRate(0)
+    , vadEnabled(false)
+    , vadHangover(0)
+    , vadNoiseLevel(VAD_MINIMUM_LEVEL)
 {
     qRegisterMetaType<QXmppRtpAudioChannel::Tone>("QXmppRtpAudioChannel::Tone");
 }
@@ -243,6 +318,38 @@ QXmppCodec *QXmppRtpAudioChannelPrivate::codecForPayloadType(const QXmppJinglePa
     return 0;
 }
 
+/// Returns true if the given chunk of outgoing audio holds no speech.
+///
+/// The chunk's level is compared to a noise floor which follows the
+/// quietest frames, and speech is prolonged by a hangover so that the ends
+/// of words are not cut.
+
+bool QXmppRtpAudioChannelPrivate::isSilence(const QByteArray &chunk)
+{
+    const qint16 *samples = reinterpret_cast<const qint16*>(chunk.constData());
+    const int count = chunk.size() / SAMPLE_BYTES;
+    double energy = 0;
+    for (int i = 0; i < count; ++i)
+        energy += double(samples[i]) * samples[i];
+    outgoingLevel = count ? sqrt(energy / count) : 0;
+
+    // the noise floor drops at once and rises slowly
+    if (outgoingLevel < vadNoiseLevel)
+        vadNoiseLevel = outgoingLevel;
+    else
+        vadNoiseLevel *= 1.0 + VAD_NOISE_RISE * payloadType.ptime() / 1000.0;
+    vadNoiseLevel = qMax(vadNoiseLevel, 1.0);
+
+    if (outgoingLevel > qMax(VAD_MINIMUM_LEVEL, VAD_THRESHOLD * vadNoiseLevel)) {
+        vadHangover = VAD_HANGOVER / qMax(payloadType.ptime(), 1u);
+        return false;
+    } else if (vadHangover > 0) {
+        vadHangover--;
+        return false;
+    }
+    return true;
+}
+
 /// Constructs a new RTP audio channel with the given \a parent.
 
 QXmppRtpAudioChannel::QXmppRtpAudioChannel(QObject *parent)
@@ -288,6 +395,12 @@ QXmppRtpAudioChannel::QXmppRtpAudioChannel(QObject *parent)
     payload.setClockrate(8000);
     m_outgoingPayloadTypes << payload;
 
+    payload.setId(CN);
+    payload.setChannels(1);
+    payload.setName("CN");
+    payload.setClockrate(8000);
+    m_outgoingPayloadTypes << payload;
+
     QMap<QString, QString> parameters;
     parameters.insert("events", "0-15");
     payload.setId(101);
@@ -314,7 +427,8 @@ QXmppRtpAudioChannel::~QXmppRtpAudioChannel()
 
 qint64 QXmppRtpAudioChannel::bytesAvailable() const
 {
-    return QIODevice::bytesAvailable() + d->incomingBuffer.size();
+    const int samples = d->incomingResampler.outputSamples(d->incomingBuffer.size() / SAMPLE_BYTES);
+    return QIODevice::bytesAvailable() + samples * SAMPLE_BYTES + d->incomingBuffer.size() % SAMPLE_BYTES;
 }
 
 /// Closes the RTP audio channel.
@@ -331,7 +445,7 @@ void QXmppRtpAudioChannel::close()
 
 void QXmppRtpAudioChannel::datagramReceived(const QByteArray &ba)
 {
-    QXmppRtpPacket packet;
+    QXmppRtpPacketView packet;
     if (!packet.decode(ba))
         return;
 
@@ -346,6 +460,7 @@ void QXmppRtpAudioChannel::datagramReceived(const QByteArray &ba)
                 .arg(QString::number(packet.sequence()))
                 .arg(QString::number(d->incomingSequence)));
 #endif
+    const bool previousLost = d->incomingSequence && quint16(packet.sequence() - d->incomingSequence) == 2;
     d->incomingSequence = packet.sequence();
 
     // get or create codec
@@ -354,6 +469,9 @@ void QXmppRtpAudioChannel::datagramReceived(const QByteArray &ba)
     if (!d->incomingCodecs.contains(packetType)) {
         foreach (const QXmppJinglePayloadType &payload, m_incomingPayloadTypes) {
             if (packetType == payload.id()) {
+                // comfort noise is not rendered, the gap plays as silence
+                if (payload.name().toLower() == "cn")
+                    return;
                 codec = d->codecForPayloadType(payload);
                 break;
             }
@@ -386,14 +504,24 @@ void QXmppRtpAudioChannel::datagramReceived(const QByteArray &ba)
 
     // allocate space for new packet
     // FIXME: this is wrong, we want the decoded data size!
-    const qint64 packetLength = packet.payload().size();
+    const qint64 packetLength = packet.payloadSize();
     if (packetOffset + packetLength > d->incomingBuffer.size())
         d->incomingBuffer += QByteArray(packetOffset + packetLength - d->incomingBuffer.size(), 0);
-    QDataStream input(packet.payload());
     QDataStream output(&d->incomingBuffer, QIODevice::WriteOnly);
-    output.device()->seek(packetOffset);
     output.setByteOrder(QDataStream::LittleEndian);
-    codec->decode(input, output);
+
+    // recover a single lost packet from the redundant data of this one
+    const quint32 lostSamples = packet.stamp() - d->incomingStamp;
+    const qint64 lostOffset = packetOffset - qint64(lostSamples) * SAMPLE_BYTES;
+    if (previousLost && qint32(lostSamples) > 0 && lostOffset >= 0) {
+        QDataStream input(packet.payload());
+        output.device()->seek(lostOffset);
+        codec->recover(input, output, lostSamples);
+    }
+
+    QDataStream input(packet.payload());
+    output.device()->seek(packetOffset);
+    d->incomingStamp = packet.stamp() + codec->decode(input, output);
 
     // check whether we are running late
     if (d->incomingBuffer.size() > d->incomingMaximum)
@@ -416,6 +544,29 @@ void QXmppRtpAudioChannel::datagramReceived(const QByteArray &ba)
         emit readyRead();
 }
 
+/// Processes an incoming RTCP datagram, which may hold several RTCP
+/// packets.
+///
+/// The packet loss reported by the receiver is passed on to the encoder.
+///
+/// \param ba
+
+void QXmppRtpAudioChannel::controlDatagramReceived(const QByteArray &ba)
+{
+    QDataStream stream(ba);
+    QXmppRtcpPacket packet;
+    while (!stream.atEnd() && packet.read(stream)) {
+        if (packet.type() != QXmppRtcpPacket::ReceiverReport &&
+            packet.type() != QXmppRtcpPacket::SenderReport)
+            continue;
+
+        foreach (const QXmppRtcpReceiverReport &report, packet.receiverReports()) {
+            if (report.ssrc() == localSsrc() && d->outgoingCodec)
+                d->outgoingCodec->setPacketLoss(report.fractionLost() * 100 / 256);
+        }
+    }
+}
+
 void QXmppRtpAudioChannel::emitSignals()
 {
     emit bytesWritten(d->writtenSinceLastEmit);
@@ -440,8 +591,8 @@ QIODevice::OpenMode QXmppRtpAudioChannel::openMode() const
 
 /// Returns the RTP channel's payload type.
 ///
-/// You can use this to determine the QAudioFormat to use with your
-/// QAudioInput/QAudioOutput.
+/// Unless you set a sample rate with setSampleRate(), you can use this to
+/// determine the QAudioFormat to use with your QAudioInput/QAudioOutput.
 
 QXmppJinglePayloadType QXmppRtpAudioChannel::payloadType() const
 {
@@ -460,30 +611,53 @@ qint64 QXmppRtpAudioChannel::readData(char * data, qint64 maxSize)
         return maxSize;
     }
 
-    qint64 readSize = qMin(maxSize, qint64(d->incomingBuffer.size()));
-    memcpy(data, d->incomingBuffer.constData(), readSize);
-    d->incomingBuffer.remove(0, readSize);
-    if (readSize < maxSize)
-    {
+    // number of bytes consumed from the incoming buffer
+    qint64 readSize = maxSize;
+    if (d->incomingResampler.isPassthrough()) {
+        const qint64 copySize = qMin(maxSize, qint64(d->incomingBuffer.size()));
+        memcpy(data, d->incomingBuffer.constData(), copySize);
+        d->incomingBuffer.remove(0, copySize);
+        if (copySize < maxSize)
+        {
+#ifdef QXMPP_DEBUG_RTP
+            debug(QString("QXmppRtpAudioChannel::readData missing %1 bytes").arg(QString::number(maxSize - copySize)));
+#endif
+            memset(data + copySize, 0, maxSize - copySize);
+        }
+    } else {
+        // convert whole samples to the application's sample rate
+        const int outputSamples = maxSize / SAMPLE_BYTES;
+        readSize = d->incomingResampler.inputSamples(outputSamples) * SAMPLE_BYTES;
+        if (readSize > d->incomingBuffer.size())
+        {
 #ifdef QXMPP_DEBUG_RTP
-        debug(QString("QXmppRtpAudioChannel::readData missing %1 bytes").arg(QString::number(maxSize - readSize)));
+            debug(QString("QXmppRtpAudioChannel::readData missing %1 bytes").arg(QString::number(readSize - d->incomingBuffer.size())));
 #endif
-        memset(data + readSize, 0, maxSize - readSize);
+            d->incomingBuffer.append(QByteArray(readSize - d->incomingBuffer.size(), 0));
+        }
+        d->incomingResampler.process(reinterpret_cast<const qint16*>(d->incomingBuffer.constData()),
+                                     readSize / SAMPLE_BYTES,
+                                     reinterpret_cast<qint16*>(data),
+                                     outputSamples);
+        d->incomingBuffer.remove(0, readSize);
+        if (maxSize % SAMPLE_BYTES)
+            data[maxSize - 1] = 0;
     }
 
     // add local DTMF echo
     if (!d->outgoingTones.isEmpty()) {
         const int headOffset = d->incomingPos % SAMPLE_BYTES;
         const int samples = (headOffset + maxSize + SAMPLE_BYTES - 1) / SAMPLE_BYTES;
+        const quint64 elapsed = quint32(d->incomingPos / SAMPLE_BYTES - d->outgoingTones[0].incomingStart);
         const QByteArray chunk = renderTone(
             d->outgoingTones[0].tone,
-            d->payloadType.clockrate(),
-            d->incomingPos / SAMPLE_BYTES - d->outgoingTones[0].incomingStart,
+            sampleRate(),
+            elapsed * sampleRate() / d->payloadType.clockrate(),
             samples);
         memcpy(data, chunk.constData() + headOffset, maxSize);
     }
 
-    d->incomingPos += maxSize;
+    d->incomingPos += readSize;
     return maxSize;
 }
 
@@ -506,6 +680,9 @@ void QXmppRtpAudioChannel::payloadTypesChanged()
         if (outgoingType.name() == "telephone-event") {
             d->outgoingTonesType = outgoingType;
         }
+        else if (outgoingType.name().toLower() == "cn") {
+            d->outgoingComfortNoiseType = outgoingType;
+        }
         else if (!d->outgoingCodec) {
             QXmppCodec *codec = d->codecForPayloadType(outgoingType);
             if (codec) {
@@ -522,11 +699,22 @@ void QXmppRtpAudioChannel::payloadTypesChanged()
     d->incomingMinimum = d->outgoingChunk * 5;
     d->incomingMaximum = d->outgoingChunk * 15;
 
+    // convert between the application's sample rate and the codec's
+    d->incomingResampler.setRates(d->payloadType.clockrate(), sampleRate());
+    d->outgoingResampler.setRates(sampleRate(), d->payloadType.clockrate());
+    d->outgoingPartial.clear();
+
+    // the encoded payload is at most as large as the raw chunk
+    d->outgoingDatagram.reserve(12 + d->outgoingChunk);
+
     open(QIODevice::ReadWrite | QIODevice::Unbuffered);
 }
 /// \endcond
 
 /// Returns the position in the received audio data.
+///
+/// The position is expressed in bytes of audio at the payload type's clock
+/// rate.
 
 qint64 QXmppRtpAudioChannel::pos() const
 {
@@ -551,6 +739,70 @@ bool QXmppRtpAudioChannel::seek(qint64 pos)
     return true;
 }
 
+/// Returns the sample rate in Hz of the audio which is read from and
+/// written to the channel.
+///
+/// Unless a sample rate was set with setSampleRate(), this is the clock
+/// rate of the negotiated payload type.
+
+int QXmppRtpAudioChannel::sampleRate() const
+{
+    return d->sampleRate ? d->sampleRate : d->payloadType.clockrate();
+}
+
+/// Sets the sample rate in Hz of the audio which is read from and written
+/// to the channel.
+///
+/// The audio is then converted to and from the clock rate of the
+/// negotiated payload type, so that the application can use the same
+/// QAudioFormat whatever the codec. Set it to 0 to use the payload type's
+/// clock rate.
+///
+/// \param rate
+
+void QXmppRtpAudioChannel::setSampleRate(int rate)
+{
+    d->sampleRate = qMax(rate, 0);
+    d->incomingResampler.setRates(d->payloadType.clockrate(), sampleRate());
+    d->outgoingResampler.setRates(sampleRate(), d->payloadType.clockrate());
+    d->outgoingPartial.clear();
+}
+
+/// Returns true if voice activity detection is enabled for the outgoing
+/// audio.
+
+bool QXmppRtpAudioChannel::isVoiceActivityDetectionEnabled() const
+{
+    return d->vadEnabled;
+}
+
+/// Sets whether voice activity detection is enabled for the outgoing
+/// audio.
+///
+/// When it is enabled, frames which hold no speech are not sent. If the
+/// peer supports RFC 3389 comfort noise, the level of the background noise
+/// is sent instead. The first packet of each talkspurt has the RTP marker
+/// bit set. Codecs with discontinuous transmission, such as Opus, detect
+/// silence themselves.
+///
+/// \param enabled
+
+void QXmppRtpAudioChannel::setVoiceActivityDetectionEnabled(bool enabled)
+{
+    d->vadEnabled = enabled;
+    d->vadHangover = 0;
+    d->vadNoiseLevel = VAD_MINIMUM_LEVEL;
+    d->outgoingComfortNoiseLevel = -1;
+}
+
+/// Returns the number of outgoing audio packets which were not sent because
+/// they held silence.
+
+qint64 QXmppRtpAudioChannel::suppressedPackets() const
+{
+    return d->outgoingSuppressed;
+}
+
 /// Starts sending the specified DTMF tone.
 ///
 /// \param tone
@@ -587,7 +839,25 @@ qint64 QXmppRtpAudioChannel::writeData(const char * data, qint64 maxSize)
         return -1;
     }
 
-    d->outgoingBuffer += QByteArray::fromRawData(data, maxSize);
+    if (d->outgoingResampler.isPassthrough()) {
+        d->outgoingBuffer += QByteArray::fromRawData(data, maxSize);
+    } else {
+        // complete the sample which was partially written
+        QByteArray input = QByteArray::fromRawData(data, maxSize);
+        if (!d->outgoingPartial.isEmpty())
+            input.prepend(d->outgoingPartial);
+
+        // convert whole samples to the codec's clock rate
+        const int inputSamples = input.size() / SAMPLE_BYTES;
+        const int outputSamples = d->outgoingResampler.outputSamples(inputSamples);
+        const int offset = d->outgoingBuffer.size();
+        d->outgoingBuffer.resize(offset + outputSamples * SAMPLE_BYTES);
+        d->outgoingResampler.process(reinterpret_cast<const qint16*>(input.constData()),
+                                     inputSamples,
+                                     reinterpret_cast<qint16*>(d->outgoingBuffer.data() + offset),
+                                     outputSamples);
+        d->outgoingPartial = input.mid(inputSamples * SAMPLE_BYTES);
+    }
 
     // start sending audio chunks
     if (!d->outgoingTimer->isActive())
@@ -649,6 +919,44 @@ void QXmppRtpAudioChannel::writeDatagram()
             d->outgoingTones.removeFirst();
     }
 
+    // suppress silent frames, unless the codec does it itself
+    if (sendAudio && d->vadEnabled && !d->outgoingCodec->isDtxEnabled()) {
+        if (d->isSilence(chunk)) {
+            // describe the background noise if the peer supports it
+            if (!d->outgoingComfortNoiseType.name().isEmpty() &&
+                d->outgoingComfortNoiseType.clockrate() == d->payloadType.clockrate()) {
+                const int level = qBound(0, qRound(-20.0 * log10(qMax(d->outgoingLevel, 1.0) / 32768.0)), 127);
+                if (d->outgoingComfortNoiseLevel < 0 ||
+                    qAbs(level - d->outgoingComfortNoiseLevel) > COMFORT_NOISE_CHANGE ||
+                    d->outgoingComfortNoiseAge >= COMFORT_NOISE_INTERVAL) {
+                    QXmppRtpPacket packet;
+                    packet.setMarker(false);
+                    packet.setType(d->outgoingComfortNoiseType.id());
+                    packet.setSequence(d->outgoingSequence);
+                    packet.setStamp(d->outgoingStamp);
+                    packet.setSsrc(localSsrc());
+                    packet.setPayload(QByteArray(1, char(level)));
+#ifdef QXMPP_DEBUG_RTP
+                    logSent(packet.toString());
+#endif
+                    emit sendDatagram(packet.encode());
+                    d->outgoingSequence++;
+                    d->outgoingComfortNoiseLevel = level;
+                    d->outgoingComfortNoiseAge = 0;
+                }
+                d->outgoingComfortNoiseAge += d->payloadType.ptime();
+            }
+
+            // the next packet with speech starts a talkspurt
+            d->outgoingMarker = true;
+            d->outgoingStamp += d->outgoingChunk / SAMPLE_BYTES;
+            d->outgoingSuppressed++;
+            sendAudio = false;
+        } else {
+            d->outgoingComfortNoiseLevel = -1;
+        }
+    }
+
     if (sendAudio) {
         // send audio data
         QXmppRtpPacket packet;
@@ -664,24 +972,33 @@ void QXmppRtpAudioChannel::writeDatagram()
         packet.setStamp(d->outgoingStamp);
         packet.setSsrc(localSsrc());
 
-        // encode audio chunk
+        // encode audio chunk directly after the RTP header
+        const int headerSize = packet.headerSize();
         QDataStream input(chunk);
         input.setByteOrder(QDataStream::LittleEndian);
-        QByteArray payload;
-        QDataStream output(&payload, QIODevice::WriteOnly);
+        d->outgoingDatagram.resize(headerSize);
+        QDataStream output(&d->outgoingDatagram, QIODevice::WriteOnly | QIODevice::Append);
         const qint64 packetTicks = d->outgoingCodec->encode(input, output);
-        packet.setPayload(payload);
 
+        if (d->outgoingDatagram.size() == headerSize && packetTicks) {
+            // discontinuous transmission, the next packet starts a talkspurt
+            d->outgoingMarker = true;
+            d->outgoingSuppressed++;
+        } else {
+            packet.encodeHeader(d->outgoingDatagram.data(), headerSize);
 #ifdef QXMPP_DEBUG_RTP
-        logSent(packet.toString());
+            QXmppRtpPacketView view;
+            view.decode(d->outgoingDatagram);
+            logSent(view.toString());
 #endif
-        emit sendDatagram(packet.encode());
-        d->outgoingSequence++;
+            emit sendDatagram(d->outgoingDatagram);
+            d->outgoingSequence++;
+        }
         d->outgoingStamp += packetTicks;
     }
 
-    // queue signals
-    d->writtenSinceLastEmit += chunk.size();
+    // queue signals, counting bytes at the application's sample rate
+    d->writtenSinceLastEmit += qint64(chunk.size() / SAMPLE_BYTES) * sampleRate() / d->payloadType.clockrate() * SAMPLE_BYTES;
     if (!d->signalsEmitted && !signalsBlocked()) {
         d->signalsEmitted = true;
         QMetaObject::invokeMethod(this, "emitSignals", Qt::QueuedConnection);
@@ -716,10 +1033,44 @@ QXmppVideoFrame::QXmppVideoFrame(int bytes, const QSize &size, int bytesPerLine,
     m_data.resize(bytes);
 }
 
+/** Constructs a video frame of the given pixel format and size in pixels,
+ *  using the given data without copying it.
+ *
+ * The data must remain valid as long as the frame or any of its copies
+ * exist.
+ *
+ * @param data
+ * @param bytes
+ * @param size
+ * @param bytesPerLine
+ * @param format
+ */
+QXmppVideoFrame::QXmppVideoFrame(uchar *data, int bytes, const QSize &size, int bytesPerLine, PixelFormat format)
+    : m_buffer(new QXmppVideoFrameBuffer(data, bytes, false), QXmppVideoFrameBuffer::release),
+    m_bytesPerLine(bytesPerLine),
+    m_height(size.height()),
+    m_mappedBytes(bytes),
+    m_pixelFormat(format),
+    m_width(size.width())
+{
+}
+
+QXmppVideoFrame::QXmppVideoFrame(const QSharedPointer<QXmppVideoFrameBuffer> &buffer, int bytes, const QSize &size, int bytesPerLine, PixelFormat format)
+    : m_buffer(buffer),
+    m_bytesPerLine(bytesPerLine),
+    m_height(size.height()),
+    m_mappedBytes(bytes),
+    m_pixelFormat(format),
+    m_width(size.width())
+{
+}
+
 /// Returns a pointer to the start of the frame data buffer.
 
 uchar *QXmppVideoFrame::bits()
 {
+    if (m_buffer)
+        return m_buffer->data;
     return (uchar*)m_data.data();
 }
 
@@ -727,6 +1078,8 @@ uchar *QXmppVideoFrame::bits()
 
 const uchar *QXmppVideoFrame::bits() const
 {
+    if (m_buffer)
+        return m_buffer->data;
     return (const uchar*)m_data.constData();
 }
 
@@ -781,27 +1134,245 @@ int QXmppVideoFrame::width() const
     return m_width;
 }
 
+// Number of sent video packets kept for retransmission.
+static const int VIDEO_HISTORY_SIZE = 256;
+
+// Minimum interval in milliseconds between two key frame requests.
+static const int KEYFRAME_REQUEST_INTERVAL = 500;
+
+// Bitrate in bits per second used until the receiver sends feedback.
+static const int VIDEO_INITIAL_BITRATE = 256000;
+
+// Relative change of the estimated bitrate which updates the encoder.
+static const double VIDEO_BITRATE_CHANGE = 0.05;
+
+// Interval in milliseconds between two transport-wide feedback messages,
+// and maximum number of packets they report.
+static const int TRANSPORT_FEEDBACK_INTERVAL = 100;
+static const int TRANSPORT_FEEDBACK_PACKETS = 1024;
+
+// Interval in milliseconds between two loss reports derived from
+// retransmission requests.
+static const int LOSS_REPORT_INTERVAL = 1000;
+
+// Packets are sent at this multiple of the estimated bitrate, every few
+// milliseconds, and never wait more than the maximum delay in the queue.
+static const double PACING_FACTOR = 2.5;
+static const int PACING_INTERVAL = 5;
+static const int PACING_MAX_DELAY = 250;
+
+// Profile of RTP header extensions using the one-byte form.
+static const quint16 ONE_BYTE_EXTENSION_PROFILE = 0xbede;
+
 class QXmppRtpVideoChannelPrivate
 {
 public:
     QXmppRtpVideoChannelPrivate();
+    void enqueue(QXmppRtpVideoChannel *q, const QByteArray &datagram, int transportSequence, bool urgent);
+    qint64 now() const;
+    void receiveTransportSequence(QXmppRtpVideoChannel *q, const QXmppRtpPacketView &packet);
+    void sendFeedback(QXmppRtpVideoChannel *q, QXmppVideoDecoder *decoder, quint32 mediaSsrc);
+    void updateBitrate();
+
     QMap<int, QXmppVideoDecoder*> decoders;
     QXmppVideoEncoder *encoder;
     QList<QXmppVideoFrame> frames;
+    QXmppVideoFramePool framePool;
+    QElapsedTimer keyFrameRequestTimer;
+
+    // congestion control
+    QElapsedTimer clock;
+    QXmppBandwidthEstimator estimator;
+    int encoderBitrate;
+    bool hasLossReports;
+    int lossReportNacked;
+    int lossReportSent;
+    qint64 lossReportTime;
+    int transportExtensionId;
+
+    // pacing, the queue holds datagrams and their transport-wide sequence
+    // number, or -1 for retransmissions
+    QList<QPair<QByteArray, int> > pacingQueue;
+    qint64 pacingQueueBytes;
+    double pacingBudget;
+    qint64 pacingTime;
+    QTimer *pacingTimer;
+
+    // remote
+    QMap<qint64, qint64> incomingArrivals;
+    quint8 incomingFeedbackCount;
+    qint64 incomingFeedbackSequence;
+    qint64 incomingFeedbackTime;
+    qint64 incomingTransportSequence;
 
     // local
     QXmppVideoFormat outgoingFormat;
     quint8 outgoingId;
     quint16 outgoingSequence;
     quint32 outgoingStamp;
+    quint16 outgoingTransportSequence;
+    QVector<QByteArray> outgoingHistory;
 };
 
 QXmppRtpVideoChannelPrivate::QXmppRtpVideoChannelPrivate()
     : encoder(0),
+    encoderBitrate(VIDEO_INITIAL_BITRATE),
+    hasLossReports(false),
+    lossReportNacked(0),
+    lossReportSent(0),
+    lossReportTime(0),
+    transportExtensionId(0),
+    pacingQueueBytes(0),
+    pacingBudget(0),
+    pacingTime(0),
+    pacingTimer(0),
+    incomingFeedbackCount(0),
+    incomingFeedbackSequence(-1),
+    incomingFeedbackTime(0),
+    incomingTransportSequence(-1),
     outgoingId(0),
     outgoingSequence(1),
-    outgoingStamp(0)
+    outgoingStamp(0),
+    outgoingTransportSequence(0),
+    outgoingHistory(VIDEO_HISTORY_SIZE)
 {
+    clock.start();
+    estimator.setBitrate(VIDEO_INITIAL_BITRATE);
+}
+
+/// Queues an outgoing datagram for pacing, retransmissions are sent first.
+
+void QXmppRtpVideoChannelPrivate::enqueue(QXmppRtpVideoChannel *q, const QByteArray &datagram, int transportSequence, bool urgent)
+{
+    if (urgent)
+        pacingQueue.prepend(qMakePair(datagram, transportSequence));
+    else
+        pacingQueue.append(qMakePair(datagram, transportSequence));
+    pacingQueueBytes += datagram.size();
+
+    if (!pacingTimer->isActive()) {
+        // send right away what the budget allows
+        q->sendQueuedDatagrams();
+        if (!pacingQueue.isEmpty())
+            pacingTimer->start();
+    }
+}
+
+/// Returns the time elapsed since the channel was created, in microseconds.
+
+qint64 QXmppRtpVideoChannelPrivate::now() const
+{
+    return clock.nsecsElapsed() / 1000;
+}
+
+/// Records the arrival of a packet carrying a transport-wide sequence
+/// number, and sends feedback about the packets received since the last
+/// feedback.
+
+void QXmppRtpVideoChannelPrivate::receiveTransportSequence(QXmppRtpVideoChannel *q, const QXmppRtpPacketView &packet)
+{
+    if (!transportExtensionId || !packet.hasExtension() ||
+        packet.extensionProfile() != ONE_BYTE_EXTENSION_PROFILE)
+        return;
+
+    // find the element holding the sequence number
+    const QByteArray extension = packet.extension();
+    int sequence = -1;
+    int pos = 0;
+    while (pos < extension.size()) {
+        const quint8 header = extension.at(pos);
+        const int id = header >> 4;
+        if (id == 0) {
+            // padding
+            pos++;
+            continue;
+        } else if (id == 15) {
+            break;
+        }
+        const int length = (header & 0xf) + 1;
+        if (pos + 1 + length > extension.size())
+            break;
+        if (id == transportExtensionId && length == 2)
+            sequence = (quint8(extension.at(pos + 1)) << 8) | quint8(extension.at(pos + 2));
+        pos += 1 + length;
+    }
+    if (sequence < 0)
+        return;
+
+    // extend the sequence number to 64 bits
+    qint64 extended = sequence;
+    if (incomingTransportSequence >= 0) {
+        const qint16 delta = qint16(quint16(sequence) - quint16(incomingTransportSequence));
+        extended = incomingTransportSequence + delta;
+    }
+    const qint64 arrival = now();
+    if (extended > incomingTransportSequence)
+        incomingTransportSequence = extended;
+    if (incomingFeedbackSequence < 0)
+        incomingFeedbackSequence = extended;
+    if (extended >= incomingFeedbackSequence)
+        incomingArrivals.insert(extended, arrival);
+
+    if (arrival - incomingFeedbackTime < TRANSPORT_FEEDBACK_INTERVAL * 1000 || incomingArrivals.isEmpty())
+        return;
+
+    const qint64 base = qMax(incomingFeedbackSequence, incomingTransportSequence - TRANSPORT_FEEDBACK_PACKETS + 1);
+    QList<qint64> times;
+    for (qint64 i = base; i <= incomingTransportSequence; ++i)
+        times << incomingArrivals.value(i, -1);
+
+    QXmppRtcpPacket feedback;
+    feedback.setType(QXmppRtcpPacket::RtpFeedback);
+    feedback.setFeedbackFormat(QXmppRtcpPacket::TransportFeedback);
+    feedback.setSsrc(q->localSsrc());
+    feedback.setMediaSsrc(packet.ssrc());
+    feedback.setTransportBaseSequence(quint16(base));
+    feedback.setTransportArrivalTimes(times);
+    feedback.setTransportFeedbackCount(incomingFeedbackCount++);
+    emit q->sendControlDatagram(feedback.encode());
+
+    incomingArrivals.clear();
+    incomingFeedbackSequence = incomingTransportSequence + 1;
+    incomingFeedbackTime = arrival;
+}
+
+/// Sends the retransmission and key frame requests of the given decoder.
+
+void QXmppRtpVideoChannelPrivate::sendFeedback(QXmppRtpVideoChannel *q, QXmppVideoDecoder *decoder, quint32 mediaSsrc)
+{
+    const QList<quint16> lost = decoder->takeLostSequences();
+    if (!lost.isEmpty()) {
+        QXmppRtcpPacket nack;
+        nack.setType(QXmppRtcpPacket::RtpFeedback);
+        nack.setFeedbackFormat(QXmppRtcpPacket::GenericNack);
+        nack.setSsrc(q->localSsrc());
+        nack.setMediaSsrc(mediaSsrc);
+        nack.setNackSequences(lost);
+        emit q->sendControlDatagram(nack.encode());
+    }
+
+    if (decoder->takeKeyFrameRequest() &&
+        (!keyFrameRequestTimer.isValid() || keyFrameRequestTimer.elapsed() >= KEYFRAME_REQUEST_INTERVAL)) {
+        QXmppRtcpPacket pli;
+        pli.setType(QXmppRtcpPacket::PayloadFeedback);
+        pli.setFeedbackFormat(QXmppRtcpPacket::PictureLossIndication);
+        pli.setSsrc(q->localSsrc());
+        pli.setMediaSsrc(mediaSsrc);
+        emit q->sendControlDatagram(pli.encode());
+        keyFrameRequestTimer.start();
+    }
+}
+
+/// Applies the estimated bitrate to the encoder, unless it barely changed.
+
+void QXmppRtpVideoChannelPrivate::updateBitrate()
+{
+    const int bitrate = estimator.bitrate();
+    if (qAbs(bitrate - encoderBitrate) < VIDEO_BITRATE_CHANGE * encoderBitrate)
+        return;
+    encoderBitrate = bitrate;
+    if (encoder)
+        encoder->setBitrate(bitrate);
 }
 
 /// Constructs a new RTP video channel with the given \a parent.
@@ -814,6 +1385,16 @@ QXmppRtpVideoChannel::QXmppRtpVideoChannel(QObject *parent)
     d->outgoingFormat.setFrameSize(QSize(320, 240));
     d->outgoingFormat.setPixelFormat(QXmppVideoFrame::Format_YUYV);
 
+    bool check;
+    Q_UNUSED(check);
+
+    d->pacingTimer = new QTimer(this);
+    d->pacingTimer->setInterval(PACING_INTERVAL);
+    d->pacingTimer->setTimerType(Qt::PreciseTimer);
+    check = connect(d->pacingTimer, SIGNAL(timeout()),
+                    this, SLOT(sendQueuedDatagrams()));
+    Q_ASSERT(check);
+
     // set supported codecs
     QXmppVideoEncoder *encoder;
     QXmppJinglePayloadType payload;
@@ -864,7 +1445,7 @@ void QXmppRtpVideoChannel::close()
 
 void QXmppRtpVideoChannel::datagramReceived(const QByteArray &ba)
 {
-    QXmppRtpPacket packet;
+    QXmppRtpPacketView packet;
     if (!packet.decode(ba))
         return;
 
@@ -876,7 +1457,126 @@ void QXmppRtpVideoChannel::datagramReceived(const QByteArray &ba)
     QXmppVideoDecoder *decoder = d->decoders.value(packet.type());
     if (!decoder)
         return;
+    d->receiveTransportSequence(this, packet);
     d->frames << decoder->handlePacket(packet);
+    d->sendFeedback(this, decoder, packet.ssrc());
+}
+
+/// Processes an incoming RTCP datagram, which may hold several RTCP
+/// packets.
+///
+/// Retransmission requests are answered with the requested packets, and
+/// picture loss indications make the encoder send a key frame.
+///
+/// Receiver reports, transport-wide feedback and retransmission requests
+/// update the estimated bitrate.
+///
+/// \param ba
+
+void QXmppRtpVideoChannel::controlDatagramReceived(const QByteArray &ba)
+{
+    QDataStream stream(ba);
+    QXmppRtcpPacket packet;
+    while (!stream.atEnd() && packet.read(stream)) {
+        if (packet.type() == QXmppRtcpPacket::ReceiverReport ||
+            packet.type() == QXmppRtcpPacket::SenderReport) {
+            foreach (const QXmppRtcpReceiverReport &report, packet.receiverReports()) {
+                if (report.ssrc() == localSsrc()) {
+                    d->hasLossReports = true;
+                    d->estimator.lossReported(report.fractionLost(), 256, d->now());
+                }
+            }
+            continue;
+        }
+
+        if (packet.mediaSsrc() != localSsrc())
+            continue;
+
+        if (packet.type() == QXmppRtcpPacket::RtpFeedback &&
+            packet.feedbackFormat() == QXmppRtcpPacket::GenericNack) {
+            foreach (quint16 sequence, packet.nackSequences()) {
+                // the sequence number is held in bytes 2 and 3 of the header
+                const QByteArray sent = d->outgoingHistory.at(sequence % VIDEO_HISTORY_SIZE);
+                if (sent.size() >= 4 &&
+                    ((quint8(sent.at(2)) << 8) | quint8(sent.at(3))) == sequence)
+                    d->enqueue(this, sent, -1, true);
+                d->lossReportNacked++;
+            }
+        } else if (packet.type() == QXmppRtcpPacket::RtpFeedback &&
+                   packet.feedbackFormat() == QXmppRtcpPacket::TransportFeedback) {
+            d->hasLossReports = true;
+            d->estimator.feedbackReceived(packet.transportBaseSequence(), packet.transportArrivalTimes(), d->now());
+        } else if (packet.type() == QXmppRtcpPacket::PayloadFeedback &&
+                   packet.feedbackFormat() == QXmppRtcpPacket::PictureLossIndication) {
+            if (d->encoder)
+                d->encoder->requestKeyFrame();
+        }
+    }
+    d->updateBitrate();
+}
+
+/// Returns the estimated bitrate of the outgoing stream, in bits per second.
+
+int QXmppRtpVideoChannel::bitrate() const
+{
+    return d->estimator.bitrate();
+}
+
+/// Returns the lowest bitrate of the outgoing stream, in bits per second.
+
+int QXmppRtpVideoChannel::minimumBitrate() const
+{
+    return d->estimator.minimumBitrate();
+}
+
+/// Sets the lowest bitrate of the outgoing stream, in bits per second.
+///
+/// \param bitrate
+
+void QXmppRtpVideoChannel::setMinimumBitrate(int bitrate)
+{
+    d->estimator.setMinimumBitrate(bitrate);
+    d->updateBitrate();
+}
+
+/// Returns the highest bitrate of the outgoing stream, in bits per second.
+
+int QXmppRtpVideoChannel::maximumBitrate() const
+{
+    return d->estimator.maximumBitrate();
+}
+
+/// Sets the highest bitrate of the outgoing stream, in bits per second.
+///
+/// \param bitrate
+
+void QXmppRtpVideoChannel::setMaximumBitrate(int bitrate)
+{
+    d->estimator.setMaximumBitrate(bitrate);
+    d->updateBitrate();
+}
+
+/// Returns the identifier of the RTP header extension carrying
+/// transport-wide sequence numbers, or 0 if it is disabled.
+
+int QXmppRtpVideoChannel::transportSequenceExtensionId() const
+{
+    return d->transportExtensionId;
+}
+
+/// Sets the identifier of the RTP header extension carrying transport-wide
+/// sequence numbers, as agreed with the remote party.
+///
+/// When enabled, outgoing packets carry the extension and the delays
+/// reported by the receiver are used to estimate the available bitrate.
+/// Incoming packets carrying the extension are acknowledged with
+/// transport-wide feedback.
+///
+/// \param id The identifier between 1 and 14, or 0 to disable the extension.
+
+void QXmppRtpVideoChannel::setTransportSequenceExtensionId(int id)
+{
+    d->transportExtensionId = (id >= 1 && id <= 14) ? id : 0;
 }
 
 /// Returns the video format used by the encoder.
@@ -937,6 +1637,7 @@ void QXmppRtpVideoChannel::payloadTypesChanged()
             decoder = new QXmppVpxDecoder;
 #endif
         if (decoder) {
+            decoder->setFramePool(&d->framePool);
             decoder->setParameters(payload.parameters());
             d->decoders.insert(payload.id(), decoder);
         }
@@ -962,6 +1663,7 @@ void QXmppRtpVideoChannel::payloadTypesChanged()
 #endif
         if (encoder) {
             encoder->setFormat(d->outgoingFormat);
+            encoder->setBitrate(d->encoderBitrate);
             d->encoder = encoder;
             d->outgoingId = payload.id();
             break;
@@ -971,6 +1673,9 @@ void QXmppRtpVideoChannel::payloadTypesChanged()
 /// \endcond
 
 /// Decodes buffered RTP packets and returns a list of video frames.
+///
+/// The frames' buffers are reused for later frames once all the copies of
+/// the frames have been destroyed.
 
 QList<QXmppVideoFrame> QXmppRtpVideoChannel::readFrames()
 {
@@ -980,6 +1685,9 @@ QList<QXmppVideoFrame> QXmppRtpVideoChannel::readFrames()
 }
 
 /// Encodes a video \a frame and sends RTP packets.
+///
+/// The packets are paced according to the estimated bitrate, so that the
+/// packets of large frames do not leave in a single burst.
 
 void QXmppRtpVideoChannel::writeFrame(const QXmppVideoFrame &frame)
 {
@@ -988,19 +1696,70 @@ void QXmppRtpVideoChannel::writeFrame(const QXmppVideoFrame &frame)
         return;
     }
 
+    // without other reports, packet loss is derived from retransmission
+    // requests
+    const qint64 now = d->now();
+    if (now - d->lossReportTime >= LOSS_REPORT_INTERVAL * 1000) {
+        if (!d->hasLossReports && d->lossReportSent)
+            d->estimator.lossReported(qMin(d->lossReportNacked, d->lossReportSent), d->lossReportSent, now);
+        d->lossReportNacked = 0;
+        d->lossReportSent = 0;
+        d->lossReportTime = now;
+        d->updateBitrate();
+    }
+
     QXmppRtpPacket packet;
     packet.setMarker(false);
     packet.setType(d->outgoingId);
     packet.setSsrc(localSsrc());
     foreach (const QByteArray &payload, d->encoder->handleFrame(frame)) {
+        int transportSequence = -1;
+        if (d->transportExtensionId) {
+            transportSequence = d->outgoingTransportSequence++;
+            QByteArray extension(3, 0);
+            extension[0] = char((d->transportExtensionId << 4) | 1);
+            extension[1] = char(transportSequence >> 8);
+            extension[2] = char(transportSequence & 0xff);
+            packet.setExtension(ONE_BYTE_EXTENSION_PROFILE, extension);
+        }
         packet.setSequence(d->outgoingSequence++);
         packet.setStamp(d->outgoingStamp);
         packet.setPayload(payload);
 #ifdef QXMPP_DEBUG_RTP
         logSent(packet.toString());
 #endif
-        emit sendDatagram(packet.encode());
+        const QByteArray datagram = packet.encode();
+        d->outgoingHistory[packet.sequence() % VIDEO_HISTORY_SIZE] = datagram;
+        d->lossReportSent++;
+        d->enqueue(this, datagram, transportSequence, false);
     }
     d->outgoingStamp += 1;
 }
 
+void QXmppRtpVideoChannel::sendQueuedDatagrams()
+{
+    const qint64 now = d->now();
+    const double elapsed = double(now - d->pacingTime) / 1000000.0;
+    d->pacingTime = now;
+
+    // the rate in bits per second, increased to empty the queue in time
+    const double rate = qMax(PACING_FACTOR * d->estimator.bitrate(),
+                             d->pacingQueueBytes * 8000.0 / PACING_MAX_DELAY);
+    d->pacingBudget = qMin(d->pacingBudget + rate * elapsed / 8.0,
+                           rate * 2 * PACING_INTERVAL / 8000.0);
+
+    while (!d->pacingQueue.isEmpty() && d->pacingBudget >= 0) {
+        const QPair<QByteArray, int> queued = d->pacingQueue.takeFirst();
+        d->pacingQueueBytes -= queued.first.size();
+        d->pacingBudget -= queued.first.size();
+        if (queued.second >= 0)
+            d->estimator.packetSent(queued.second, queued.first.size(), now);
+        emit sendDatagram(queued.first);
+    }
+
+    // do not save up budget while idle
+    if (d->pacingQueue.isEmpty()) {
+        d->pacingBudget = qMin(d->pacingBudget, 0.0);
+        d->pacingTimer->stop();
+    }
+}
@@ -25,6 +25,7 @@
 #define QXMPPRTPCHANNEL_H
 
 #include <QIODevice>
+#include <QSharedPointer>
 #include <QSize>
 
 #include "QXmppJingleIq.h"
@@ -34,6 +35,7 @@ class QXmppCodec;
 class QXmppJinglePayloadType;
 class QXmppRtpAudioChannelPrivate;
 class QXmppRtpVideoChannelPrivate;
+class QXmppVideoFrameBuffer;
 
 class QXMPP_EXPORT QXmppRtpChannel
 {
@@ -109,6 +111,13 @@ public:
     qint64 pos() const;
     bool seek(qint64 pos);
 
+    int sampleRate() const;
+    void setSampleRate(int rate);
+
+    bool isVoiceActivityDetectionEnabled() const;
+    void setVoiceActivityDetectionEnabled(bool enabled);
+    qint64 suppressedPackets() const;
+
 signals:
     /// \brief This signal is emitted when a datagram needs to be sent.
     void sendDatagram(const QByteArray &ba);
@@ -118,6 +127,7 @@ signals:
 
 public slots:
     void datagramReceived(const QByteArray &ba);
+    void controlDatagramReceived(const QByteArray &ba);
     void startTone(QXmppRtpAudioChannel::Tone tone);
     void stopTone(QXmppRtpAudioChannel::Tone tone);
 
@@ -159,6 +169,9 @@ private:
 
 /// \brief The QXmppVideoFrame class provides a representation of a frame of video data.
 ///
+/// Frames which wrap external data or which are returned by
+/// QXmppRtpVideoChannel::readFrames() share their data with their copies.
+///
 /// \note THIS API IS NOT FINALIZED YET
 
 class QXMPP_EXPORT QXmppVideoFrame
@@ -178,15 +191,20 @@ public:
                                 ///< sub-sampled (U-Y-V-Y), i.e. two horizontally adjacent
                                 ///< pixels are stored as a 32-bit macropixel which has a Y
                                 ///< value for each pixel and common U and V values.
-        Format_YUYV = 21        ///< The frame is stored using an 8-bit per component packed
+        Format_YUYV = 21,       ///< The frame is stored using an 8-bit per component packed
                                 ///< YUV format with the U and V planes horizontally
                                 ///< sub-sampled (Y-U-Y-V), i.e. two horizontally adjacent
                                 ///< pixels are stored as a 32-bit macropixel which has a Y
                                 ///< value for each pixel and common U and V values.
+        Format_NV12 = 22        ///< The frame is stored using an 8-bit per component
+                                ///< semi-planar YUV format with a Y plane followed by a
+                                ///< plane of interleaved U and V values, horizontally and
+                                ///< vertically sub-sampled.
     };
 
     QXmppVideoFrame();
     QXmppVideoFrame(int bytes, const QSize &size, int bytesPerLine, PixelFormat format);
+    QXmppVideoFrame(uchar *data, int bytes, const QSize &size, int bytesPerLine, PixelFormat format);
     uchar *bits();
     const uchar *bits() const;
     int bytesPerLine() const;
@@ -198,6 +216,10 @@ public:
     int width() const;
 
 private:
+    friend class QXmppVideoFramePool;
+    QXmppVideoFrame(const QSharedPointer<QXmppVideoFrameBuffer> &buffer, int bytes, const QSize &size, int bytesPerLine, PixelFormat format);
+
+    QSharedPointer<QXmppVideoFrameBuffer> m_buffer;
     int m_bytesPerLine;
     QByteArray m_data;
     int m_height;
@@ -278,18 +300,37 @@ public:
     void setEncoderFormat(const QXmppVideoFormat &format);
     void writeFrame(const QXmppVideoFrame &frame);
 
+    // congestion control
+    int bitrate() const;
+
+    int minimumBitrate() const;
+    void setMinimumBitrate(int bitrate);
+
+    int maximumBitrate() const;
+    void setMaximumBitrate(int bitrate);
+
+    int transportSequenceExtensionId() const;
+    void setTransportSequenceExtensionId(int id);
+
 signals:
     /// \brief This signal is emitted when a datagram needs to be sent.
     void sendDatagram(const QByteArray &ba);
 
+    /// \brief This signal is emitted when an RTCP datagram needs to be sent.
+    void sendControlDatagram(const QByteArray &ba);
+
 public slots:
     void datagramReceived(const QByteArray &ba);
+    void controlDatagramReceived(const QByteArray &ba);
 
 protected:
     /// \cond
     void payloadTypesChanged();
     /// \endcond
 
+private slots:
+    void sendQueuedDatagrams();
+
 private:
     friend class QXmppRtpVideoChannelPrivate;
     QXmppRtpVideoChannelPrivate * d;
@@ -21,11 +21,13 @@
  *
  */
 
-#include <QDataStream>
 #include <QSharedData>
+#include <QtEndian>
 
 #include "QXmppRtpPacket.h"
 
+#include <cstring>
+
 #define RTP_VERSION 2
 
 class QXmppRtpPacketPrivate : public QSharedData
@@ -45,6 +47,10 @@ public:
     quint16 sequence;
     /// Timestamp.
     quint32 stamp;
+    /// Header extension.
+    bool hasExtension;
+    quint16 extensionProfile;
+    QByteArray extension;
     /// Raw payload data.
     QByteArray payload;
 };
@@ -55,6 +61,8 @@ QXmppRtpPacketPrivate::QXmppRtpPacketPrivate()
     , ssrc(0)
     , sequence(0)
     , stamp(0)
+    , hasExtension(false)
+    , extensionProfile(0)
 {
 }
 
@@ -94,60 +102,108 @@ QXmppRtpPacket& QXmppRtpPacket::operator=(const QXmppRtpPacket& other)
 
 bool QXmppRtpPacket::decode(const QByteArray &ba)
 {
-    if (ba.isEmpty())
+    QXmppRtpPacketView view;
+    if (!view.decode(ba))
         return false;
 
-    // fixed header
-    quint8 tmp;
-    QDataStream stream(ba);
-    stream >> tmp;
-    const quint8 cc = (tmp & 0xf);
-    const int hlen = 12 + 4 * cc;
-    if ((tmp >> 6) != RTP_VERSION || ba.size() < hlen)
-        return false;
-    stream >> tmp;
-    d->marker = (tmp >> 7);
-    d->type = tmp & 0x7f;
-    stream >> d->sequence;
-    stream >> d->stamp;
-    stream >> d->ssrc;
+    d->marker = view.marker();
+    d->type = view.type();
+    d->sequence = view.sequence();
+    d->stamp = view.stamp();
+    d->ssrc = view.ssrc();
 
     // contributing source IDs
     d->csrc.clear();
-    quint32 src;
-    for (int i = 0; i < cc; ++i) {
-        stream >> src;
-        d->csrc << src;
-    }
+    for (int i = 0; i < view.csrcCount(); ++i)
+        d->csrc << view.csrc(i);
+
+    // header extension
+    d->hasExtension = view.hasExtension();
+    d->extensionProfile = view.extensionProfile();
+    d->extension = view.extension();
+    d->extension.detach();
 
     // retrieve payload
-    d->payload = ba.right(ba.size() - hlen);
+    d->payload = QByteArray(view.payloadData(), view.payloadSize());
     return true;
 }
 
 /// Encodes an RTP packet.
 
 QByteArray QXmppRtpPacket::encode() const
+{
+    QByteArray ba(headerSize() + d->payload.size(), Qt::Uninitialized);
+    encode(ba.data(), ba.size());
+    return ba;
+}
+
+/// Encodes an RTP packet into the given buffer.
+///
+/// Returns the number of bytes written, or -1 if the buffer is too small.
+///
+/// \param data
+/// \param size
+
+int QXmppRtpPacket::encode(char *data, int size) const
+{
+    const int length = encodeHeader(data, size);
+    if (length < 0 || size < length + d->payload.size())
+        return -1;
+
+    memcpy(data + length, d->payload.constData(), d->payload.size());
+    return length + d->payload.size();
+}
+
+/// Encodes the RTP header into the given buffer, so that the payload can
+/// be written after it.
+///
+/// Returns the number of bytes written, or -1 if the buffer is too small.
+///
+/// \param data
+/// \param size
+
+int QXmppRtpPacket::encodeHeader(char *data, int size) const
 {
     Q_ASSERT(d->csrc.size() < 16);
 
+    const int length = headerSize();
+    if (size < length)
+        return -1;
+
     // fixed header
-    QByteArray ba;
-    ba.resize(d->payload.size() + 12 + 4 * d->csrc.size());
-    QDataStream stream(&ba, QIODevice::WriteOnly);
-    stream << quint8((RTP_VERSION << 6) |
-                     (d->csrc.size() & 0xf));
-    stream << quint8((d->type & 0x7f) | (d->marker << 7));
-    stream << d->sequence;
-    stream << d->stamp;
-    stream << d->ssrc;
+    uchar *ptr = reinterpret_cast<uchar*>(data);
+    ptr[0] = (RTP_VERSION << 6) | (d->hasExtension << 4) | (d->csrc.size() & 0xf);
+    ptr[1] = (d->type & 0x7f) | (d->marker << 7);
+    qToBigEndian(d->sequence, ptr + 2);
+    qToBigEndian(d->stamp, ptr + 4);
+    qToBigEndian(d->ssrc, ptr + 8);
 
     // contributing source ids
-    foreach (const quint32 &src, d->csrc)
-        stream << src;
+    ptr += 12;
+    foreach (const quint32 &src, d->csrc) {
+        qToBigEndian(src, ptr);
+        ptr += 4;
+    }
 
-    stream.writeRawData(d->payload.constData(), d->payload.size());
-    return ba;
+    // header extension, padded to a multiple of 4 bytes
+    if (d->hasExtension) {
+        const int words = (d->extension.size() + 3) / 4;
+        qToBigEndian(d->extensionProfile, ptr);
+        qToBigEndian(quint16(words), ptr + 2);
+        memcpy(ptr + 4, d->extension.constData(), d->extension.size());
+        memset(ptr + 4 + d->extension.size(), 0, 4 * words - d->extension.size());
+    }
+    return length;
+}
+
+/// Returns the size of the RTP header in bytes.
+
+int QXmppRtpPacket::headerSize() const
+{
+    int size = 12 + 4 * d->csrc.size();
+    if (d->hasExtension)
+        size += 4 + 4 * ((d->extension.size() + 3) / 4);
+    return size;
 }
 
 QList<quint32> QXmppRtpPacket::csrc() const
@@ -160,6 +216,41 @@ void QXmppRtpPacket::setCsrc(const QList<quint32> &csrc)
     d->csrc = csrc;
 }
 
+/// Returns true if the packet has a header extension.
+
+bool QXmppRtpPacket::hasExtension() const
+{
+    return d->hasExtension;
+}
+
+/// Returns the profile-defined identifier of the header extension.
+
+quint16 QXmppRtpPacket::extensionProfile() const
+{
+    return d->extensionProfile;
+}
+
+/// Returns the data of the header extension.
+
+QByteArray QXmppRtpPacket::extension() const
+{
+    return d->extension;
+}
+
+/// Sets the header extension.
+///
+/// The data is padded with zeros to a multiple of 4 bytes.
+///
+/// \param profile
+/// \param extension
+
+void QXmppRtpPacket::setExtension(quint16 profile, const QByteArray &extension)
+{
+    d->hasExtension = true;
+    d->extensionProfile = profile;
+    d->extension = extension;
+}
+
 bool QXmppRtpPacket::marker() const
 {
     return d->marker;
@@ -231,3 +322,167 @@ QString QXmppRtpPacket::toString() const
         QString::number(d->type),
         QString::number(d->payload.size()));
 }
+
+/// Constructs an invalid RTP packet view.
+
+QXmppRtpPacketView::QXmppRtpPacketView()
+    : m_data(0)
+    , m_extensionOffset(0)
+    , m_extensionSize(0)
+    , m_payloadOffset(0)
+    , m_payloadSize(0)
+{
+}
+
+/// Parses the header of an RTP packet, including its contributing sources,
+/// header extension and padding.
+///
+/// Returns false if the datagram is not a valid RTP packet.
+///
+/// \param ba
+
+bool QXmppRtpPacketView::decode(const QByteArray &ba)
+{
+    m_data = 0;
+    m_extensionOffset = 0;
+    m_extensionSize = 0;
+
+    // fixed header
+    const uchar *data = reinterpret_cast<const uchar*>(ba.constData());
+    const int size = ba.size();
+    if (size < 12 || (data[0] >> 6) != RTP_VERSION)
+        return false;
+
+    // contributing source IDs
+    int offset = 12 + 4 * (data[0] & 0xf);
+    if (size < offset)
+        return false;
+
+    // header extension
+    if (data[0] & 0x10) {
+        if (size < offset + 4)
+            return false;
+        m_extensionOffset = offset + 4;
+        m_extensionSize = 4 * qFromBigEndian<quint16>(data + offset + 2);
+        offset = m_extensionOffset + m_extensionSize;
+        if (size < offset)
+            return false;
+    }
+
+    // padding
+    int end = size;
+    if (data[0] & 0x20) {
+        const int padding = data[size - 1];
+        if (!padding || end - padding < offset)
+            return false;
+        end -= padding;
+    }
+
+    m_data = data;
+    m_payloadOffset = offset;
+    m_payloadSize = end - offset;
+    return true;
+}
+
+/// Returns true if the view refers to a valid RTP packet.
+
+bool QXmppRtpPacketView::isValid() const
+{
+    return m_data != 0;
+}
+
+/// Returns the number of contributing sources.
+
+int QXmppRtpPacketView::csrcCount() const
+{
+    return m_data[0] & 0xf;
+}
+
+/// Returns the contributing source at the given \a index.
+
+quint32 QXmppRtpPacketView::csrc(int index) const
+{
+    Q_ASSERT(index >= 0 && index < csrcCount());
+    return qFromBigEndian<quint32>(m_data + 12 + 4 * index);
+}
+
+/// Returns true if the packet has a header extension.
+
+bool QXmppRtpPacketView::hasExtension() const
+{
+    return m_extensionOffset != 0;
+}
+
+/// Returns the profile-defined identifier of the header extension.
+
+quint16 QXmppRtpPacketView::extensionProfile() const
+{
+    if (!m_extensionOffset)
+        return 0;
+    return qFromBigEndian<quint16>(m_data + m_extensionOffset - 4);
+}
+
+/// Returns the data of the header extension, without copying it.
+
+QByteArray QXmppRtpPacketView::extension() const
+{
+    return QByteArray::fromRawData(reinterpret_cast<const char*>(m_data) + m_extensionOffset, m_extensionSize);
+}
+
+bool QXmppRtpPacketView::marker() const
+{
+    return (m_data[1] >> 7) != 0;
+}
+
+/// Returns the payload, without copying it.
+
+QByteArray QXmppRtpPacketView::payload() const
+{
+    return QByteArray::fromRawData(payloadData(), m_payloadSize);
+}
+
+/// Returns a pointer to the payload's data.
+
+const char *QXmppRtpPacketView::payloadData() const
+{
+    return reinterpret_cast<const char*>(m_data) + m_payloadOffset;
+}
+
+/// Returns the size of the payload in bytes, excluding any padding.
+
+int QXmppRtpPacketView::payloadSize() const
+{
+    return m_payloadSize;
+}
+
+quint16 QXmppRtpPacketView::sequence() const
+{
+    return qFromBigEndian<quint16>(m_data + 2);
+}
+
+quint32 QXmppRtpPacketView::ssrc() const
+{
+    return qFromBigEndian<quint32>(m_data + 8);
+}
+
+quint32 QXmppRtpPacketView::stamp() const
+{
+    return qFromBigEndian<quint32>(m_data + 4);
+}
+
+quint8 QXmppRtpPacketView::type() const
+{
+    return m_data[1] & 0x7f;
+}
+
+/// Returns a string representation of the RTP header.
+
+QString QXmppRtpPacketView::toString() const
+{
+    return QString("RTP packet seq %1 stamp %2 marker %3 type %4 size %5").arg(
+        QString::number(sequence()),
+        QString::number(stamp()),
+        QString::number(marker()),
+        QString::number(type()),
+        QString::number(m_payloadSize));
+}
@@ -45,11 +45,19 @@ public:
 
     bool decode(const QByteArray &ba);
     QByteArray encode() const;
+    int encode(char *data, int size) const;
+    int encodeHeader(char *data, int size) const;
+    int headerSize() const;
     QString toString() const;
 
     QList<quint32> csrc() const;
     void setCsrc(const QList<quint32> &csrc);
 
+    bool hasExtension() const;
+    quint16 extensionProfile() const;
+    QByteArray extension() const;
+    void setExtension(quint16 profile, const QByteArray &extension);
+
     bool marker() const;
     void setMarker(bool marker);
 
@@ -72,4 +80,44 @@ private:
     QSharedDataPointer<QXmppRtpPacketPrivate> d;
 };
 
+/// \internal
+///
+/// The QXmppRtpPacketView class parses the header of an RTP packet in place,
+/// without copying the datagram's payload.
+///
+/// The view refers to the datagram's data, which must outlive it.
+
+class QXMPP_EXPORT QXmppRtpPacketView
+{
+public:
+    QXmppRtpPacketView();
+
+    bool decode(const QByteArray &ba);
+    bool isValid() const;
+    QString toString() const;
+
+    int csrcCount() const;
+    quint32 csrc(int index) const;
+
+    bool hasExtension() const;
+    quint16 extensionProfile() const;
+    QByteArray extension() const;
+
+    bool marker() const;
+    QByteArray payload() const;
+    const char *payloadData() const;
+    int payloadSize() const;
+    quint16 sequence() const;
+    quint32 ssrc() const;
+    quint32 stamp() const;
+    quint8 type() const;
+
+private:
+    const uchar *m_data;
+    int m_extensionOffset;
+    int m_extensionSize;
+    int m_payloadOffset;
+    int m_payloadSize;
+};
+
 #endif
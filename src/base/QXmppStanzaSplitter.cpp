@@ -0,0 +1,424 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <cstring>
+
+#include "QXmppStanzaSplitter_p.h"
+
+static inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/// Decodes the entity and character references of an attribute value.
+
+static QString decodeValue(const char *data, int size)
+{
+    if (!memchr(data, '&', size))
+        return QString::fromUtf8(data, size);
+
+    QByteArray decoded;
+    decoded.reserve(size);
+    for (int i = 0; i < size; ++i) {
+        const char *semicolon = data[i] == '&' ? static_cast<const char*>(memchr(data + i, ';', size - i)) : 0;
+        if (!semicolon) {
+            decoded.append(data[i]);
+            continue;
+        }
+
+        const QByteArray name = QByteArray::fromRawData(data + i + 1, int(semicolon - data) - i - 1);
+        bool ok = true;
+        if (name == "lt")
+            decoded.append('<');
+        else if (name == "gt")
+            decoded.append('>');
+        else if (name == "amp")
+            decoded.append('&');
+        else if (name == "quot")
+            decoded.append('"');
+        else if (name == "apos")
+            decoded.append('\'');
+        else if (name.startsWith("#x")) {
+            const uint code = name.mid(2).toUInt(&ok, 16);
+            if (ok)
+                decoded.append(QString::fromUcs4(&code, 1).toUtf8());
+        } else if (name.startsWith('#')) {
+            const uint code = name.mid(1).toUInt(&ok, 10);
+            if (ok)
+                decoded.append(QString::fromUcs4(&code, 1).toUtf8());
+        } else {
+            ok = false;
+        }
+
+        if (ok)
+            i = int(semicolon - data);
+        else
+            decoded.append(data[i]);
+    }
+    return QString::fromUtf8(decoded);
+}
+
+/// Parses a start tag, given without its delimiters.
+///
+/// Returns false if the tag is malformed. If the element or its attributes
+/// use namespace prefixes, or if \a topLevel is true and the element
+/// declares namespaces, \a standalone is set to false as the element's
+/// meaning depends on where it appears.
+///
+/// \param data The tag's data, without the '<' and the '>' or '/>'.
+/// \param size The size of the tag's data.
+/// \param name Receives the element's name, may be 0.
+/// \param attributes Receives the element's attributes, may be 0.
+/// \param standalone Set to false if the element is not standalone.
+/// \param topLevel Whether this is the start tag of a stanza.
+
+static bool parseStartTag(const char *data, int size, QString *name, QXmlStreamAttributes *attributes, bool *standalone, bool topLevel)
+{
+    int pos = 0;
+    while (pos < size && !isSpace(data[pos]))
+        ++pos;
+    if (!pos)
+        return false;
+    if (memchr(data, ':', pos))
+        *standalone = false;
+    if (name)
+        *name = QString::fromUtf8(data, pos);
+
+    forever {
+        while (pos < size && isSpace(data[pos]))
+            ++pos;
+        if (pos >= size)
+            return true;
+
+        // attribute name
+        const int nameStart = pos;
+        while (pos < size && data[pos] != '=' && !isSpace(data[pos]))
+            ++pos;
+        const int nameEnd = pos;
+        while (pos < size && isSpace(data[pos]))
+            ++pos;
+        if (nameEnd == nameStart || pos >= size || data[pos] != '=')
+            return false;
+        ++pos;
+
+        // attribute value
+        while (pos < size && isSpace(data[pos]))
+            ++pos;
+        if (pos >= size || (data[pos] != '"' && data[pos] != '\''))
+            return false;
+        const char quote = data[pos++];
+        const int valueStart = pos;
+        while (pos < size && data[pos] != quote)
+            ++pos;
+        if (pos >= size)
+            return false;
+        const int valueEnd = pos++;
+
+        const QByteArray attributeName = QByteArray::fromRawData(data + nameStart, nameEnd - nameStart);
+        if (attributeName == "xmlns" || attributeName.startsWith("xmlns:")) {
+            if (topLevel)
+                *standalone = false;
+        } else if (attributeName.contains(':') && !attributeName.startsWith("xml:")) {
+            *standalone = false;
+        }
+        if (attributes)
+            attributes->append(QString::fromUtf8(data + nameStart, nameEnd - nameStart),
+                               decodeValue(data + valueStart, valueEnd - valueStart));
+    }
+}
+
+/// Constructs a new stanza splitter.
+
+QXmppStanzaSplitter::QXmppStanzaSplitter()
+{
+    clear();
+}
+
+/// Appends received data.
+///
+/// The data of the tokens which were read so far is dropped, so data()
+/// must not be called until the next token is read.
+///
+/// \param data
+
+void QXmppStanzaSplitter::append(const QByteArray &data)
+{
+    if (m_start > 0) {
+        m_buffer.remove(0, m_start);
+        m_pos -= m_start;
+        m_markupStart -= m_start;
+        if (m_unitStart >= 0)
+            m_unitStart -= m_start;
+        if (m_elementStart >= 0)
+            m_elementStart -= m_start;
+        m_start = 0;
+        m_type = NoToken;
+    }
+    m_buffer.append(data);
+}
+
+/// Discards all data and starts expecting a new stream.
+
+void QXmppStanzaSplitter::clear()
+{
+    m_buffer.clear();
+    m_start = 0;
+    m_pos = 0;
+    m_depth = 0;
+    m_state = TextState;
+    m_quote = 0;
+    m_markupStart = 0;
+    m_unitStart = -1;
+    m_elementStart = -1;
+    m_error = false;
+
+    m_type = NoToken;
+    m_tokenStart = 0;
+    m_tokenEnd = 0;
+    m_tagName.clear();
+    m_attributes.clear();
+    m_standalone = false;
+}
+
+/// Returns the number of bytes which were received but not returned
+/// as part of a token yet.
+
+int QXmppStanzaSplitter::pendingBytes() const
+{
+    return m_buffer.size() - m_start;
+}
+
+/// Reads the next token, and returns its type.
+///
+/// If no complete token is available, NoToken is returned and the data
+/// which was scanned is not scanned again when more data is appended.
+
+QXmppStanzaSplitter::TokenType QXmppStanzaSplitter::readNext()
+{
+    m_type = NoToken;
+    if (m_error)
+        return Invalid;
+
+    const char *data = m_buffer.constData();
+    const int size = m_buffer.size();
+    while (m_pos < size) {
+        switch (m_state) {
+        case TextState:
+            if (m_depth >= 2) {
+                // character data inside a stanza
+                const char *next = static_cast<const char*>(memchr(data + m_pos, '<', size - m_pos));
+                if (!next) {
+                    m_pos = size;
+                    break;
+                }
+                m_pos = int(next - data);
+            } else if (data[m_pos] != '<') {
+                // only whitespace is allowed between top-level elements
+                if (!isSpace(data[m_pos])) {
+                    m_error = true;
+                    return Invalid;
+                }
+                ++m_pos;
+                break;
+            } else if (m_unitStart < 0) {
+                m_unitStart = m_pos;
+            }
+            m_markupStart = m_pos++;
+            m_state = MarkupState;
+            break;
+
+        case MarkupState:
+            if (data[m_pos] == '/') {
+                m_state = EndTagState;
+                ++m_pos;
+            } else if (data[m_pos] == '?') {
+                m_state = InstructionState;
+                ++m_pos;
+            } else if (data[m_pos] == '!') {
+                m_state = DeclarationState;
+                ++m_pos;
+            } else {
+                m_state = StartTagState;
+                m_quote = 0;
+            }
+            break;
+
+        case DeclarationState: {
+            // comments and CDATA sections, DTDs are not allowed
+            const int available = size - m_pos;
+            if (available >= 2 && !qstrncmp(data + m_pos, "--", 2)) {
+                m_state = CommentState;
+                m_pos += 2;
+            } else if (m_depth >= 2 && !qstrncmp(data + m_pos, "[CDATA[", qMin(available, 7))) {
+                if (available < 7)
+                    return NoToken;
+                m_state = CDataState;
+                m_pos += 7;
+            } else if (available < 2 && data[m_pos] == '-') {
+                return NoToken;
+            } else {
+                m_error = true;
+                return Invalid;
+            }
+            break;
+        }
+
+        case CommentState:
+        case CDataState:
+        case InstructionState: {
+            const char *terminator = m_state == CommentState ? "-->" : (m_state == CDataState ? "]]>" : "?>");
+            const int length = int(qstrlen(terminator));
+            const int end = m_buffer.indexOf(terminator, m_pos);
+            if (end < 0) {
+                m_pos = qMax(m_pos, size - length + 1);
+                return NoToken;
+            }
+            m_pos = end + length;
+            m_state = TextState;
+            break;
+        }
+
+        case EndTagState: {
+            const int end = m_buffer.indexOf('>', m_pos);
+            if (end < 0) {
+                m_pos = size;
+                return NoToken;
+            }
+            m_pos = end + 1;
+            m_state = TextState;
+            if (m_depth == 0) {
+                m_error = true;
+                return Invalid;
+            } else if (m_depth == 1) {
+                m_depth = 0;
+                return token(StreamEnd, m_markupStart, m_pos);
+            } else if (--m_depth == 1) {
+                return token(Stanza, m_elementStart, m_pos);
+            }
+            break;
+        }
+
+        case StartTagState: {
+            const char c = data[m_pos++];
+            if (m_quote) {
+                if (c == m_quote)
+                    m_quote = 0;
+            } else if (c == '"' || c == '\'') {
+                m_quote = c;
+            } else if (c == '>') {
+                m_state = TextState;
+                const TokenType type = startTag();
+                if (type != NoToken)
+                    return type;
+            }
+            break;
+        }
+        }
+    }
+
+    // report whitespace pings once all the received data was scanned
+    if (m_depth == 1 && m_state == TextState && m_unitStart < 0 && m_pos > m_start)
+        return token(Whitespace, m_start, m_pos);
+    return NoToken;
+}
+
+/// Returns the current token's data.
+
+QByteArray QXmppStanzaSplitter::data() const
+{
+    if (m_type == NoToken || m_type == Invalid)
+        return QByteArray();
+    return m_buffer.mid(m_tokenStart, m_tokenEnd - m_tokenStart);
+}
+
+/// Returns the name of the current stanza's element.
+
+QString QXmppStanzaSplitter::tagName() const
+{
+    return m_type == Stanza ? m_tagName : QString();
+}
+
+/// Returns the attributes of the current stanza's element, with their
+/// references decoded.
+
+QXmlStreamAttributes QXmppStanzaSplitter::attributes() const
+{
+    return m_type == Stanza ? m_attributes : QXmlStreamAttributes();
+}
+
+/// Returns true if the current stanza's data has the same meaning
+/// wherever it appears, because it does not use namespace prefixes or
+/// declare namespaces on its element.
+
+bool QXmppStanzaSplitter::isStandalone() const
+{
+    return m_type == Stanza && m_standalone;
+}
+
+QXmppStanzaSplitter::TokenType QXmppStanzaSplitter::token(TokenType type, int begin, int end)
+{
+    m_type = type;
+    m_tokenStart = begin;
+    m_tokenEnd = end;
+    m_start = end;
+    m_unitStart = -1;
+    m_elementStart = -1;
+    return type;
+}
+
+/// Handles a start tag, which ends right before the current position.
+
+QXmppStanzaSplitter::TokenType QXmppStanzaSplitter::startTag()
+{
+    const int end = m_pos - 1;
+    const bool selfClosing = end > m_markupStart + 1 && m_buffer.at(end - 1) == '/';
+    const char *tag = m_buffer.constData() + m_markupStart + 1;
+    const int tagSize = end - m_markupStart - 1 - (selfClosing ? 1 : 0);
+
+    if (m_depth == 0) {
+        // the stream's start tag
+        if (selfClosing) {
+            m_error = true;
+            return Invalid;
+        }
+        m_depth = 1;
+        return token(StreamStart, m_unitStart, m_pos);
+    } else if (m_depth == 1) {
+        // a stanza's start tag, if the tag is malformed the stanza is
+        // handed over as is so that the parser reports the error
+        m_elementStart = m_markupStart;
+        m_standalone = true;
+        m_attributes.clear();
+        if (!parseStartTag(tag, tagSize, &m_tagName, &m_attributes, &m_standalone, true))
+            m_standalone = false;
+        if (selfClosing)
+            return token(Stanza, m_elementStart, m_pos);
+        m_depth = 2;
+    } else {
+        if (m_standalone && !parseStartTag(tag, tagSize, 0, 0, &m_standalone, false))
+            m_standalone = false;
+        if (!selfClosing)
+            ++m_depth;
+    }
+    return NoToken;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSTANZASPLITTER_P_H
+#define QXMPPSTANZASPLITTER_P_H
+
+#include <QByteArray>
+#include <QXmlStreamAttributes>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppStanzaSplitter class splits the data received on an XMPP stream
+/// into the stream's start tag, its top-level elements and its end tag.
+///
+/// Data is scanned as it arrives, so each byte is only looked at once no
+/// matter how many reads a stanza spans. Only the start tag of top-level
+/// elements is decoded, which is enough to route a stanza without building
+/// a DOM for it.
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppStanzaSplitter
+{
+public:
+    enum TokenType
+    {
+        NoToken = 0,    ///< More data is needed.
+        StreamStart,    ///< The stream's start tag, with any XML declaration.
+        Stanza,         ///< A complete top-level element.
+        Whitespace,     ///< Whitespace between top-level elements.
+        StreamEnd,      ///< The stream's end tag.
+        Invalid         ///< The data is not a valid XMPP stream.
+    };
+
+    QXmppStanzaSplitter();
+
+    void append(const QByteArray &data);
+    void clear();
+    int pendingBytes() const;
+    TokenType readNext();
+
+    QByteArray data() const;
+    QString tagName() const;
+    QXmlStreamAttributes attributes() const;
+    bool isStandalone() const;
+
+private:
+    enum State
+    {
+        TextState,
+        MarkupState,
+        DeclarationState,
+        CommentState,
+        CDataState,
+        InstructionState,
+        EndTagState,
+        StartTagState
+    };
+
+    TokenType startTag();
+    TokenType token(TokenType type, int begin, int end);
+
+    QByteArray m_buffer;
+    int m_start;
+    int m_pos;
+    int m_depth;
+    State m_state;
+    char m_quote;
+    int m_markupStart;
+    int m_unitStart;
+    int m_elementStart;
+    bool m_error;
+
+    // current token
+    TokenType m_type;
+    int m_tokenStart;
+    int m_tokenEnd;
+    QString m_tagName;
+    QXmlStreamAttributes m_attributes;
+    bool m_standalone;
+};
+
+#endif
@@ -25,16 +25,19 @@
 
 #include "QXmppConstants_p.h"
 #include "QXmppLogger.h"
+#include "QXmppProfiler_p.h"
+#include "QXmppRateLimiter_p.h"
 #include "QXmppStanza.h"
+#include "QXmppStanzaSplitter_p.h"
 #include "QXmppStream.h"
 #include "QXmppStreamManagement_p.h"
+#include "QXmppTimerWheel_p.h"
 #include "QXmppUtils.h"
 
 #include <QBuffer>
 #include <QDomDocument>
 #include <QHostAddress>
 #include <QMap>
-#include <QRegExp>
 #include <QSslSocket>
 #include <QStringList>
 #include <QTime>
@@ -43,14 +46,24 @@
 static bool randomSeeded = false;
 static const QByteArray streamRootElementEnd = "</stream:stream>";
 
+// minimum size of the socket's read buffer when reading is rate limited,
+// so that the peer is slowed down by TCP flow control
+static const qint64 LIMITED_READ_BUFFER_SIZE = 65536;
+
 class QXmppStreamPrivate
 {
 public:
     QXmppStreamPrivate();
 
-    QByteArray dataBuffer;
+    QXmppStanzaSplitter splitter;
     QSslSocket* socket;
 
+    // inbound scheduling and rate limiting
+    int readBudget;
+    bool readScheduled;
+    QSharedPointer<QXmppRateLimiter> rateLimiter;
+    QXmppCoarseTimer *resumeTimer;
+
     // incoming stream state
     QByteArray streamStart;
 
@@ -61,7 +74,7 @@ public:
 };
 
 QXmppStreamPrivate::QXmppStreamPrivate()
-    : socket(0), streamManagementEnabled(false), lastOutgoingSequenceNumber(0), lastIncomingSequenceNumber(0)
+    : socket(0), readBudget(0), readScheduled(false), resumeTimer(0), streamManagementEnabled(false), lastOutgoingSequenceNumber(0), lastIncomingSequenceNumber(0)
 {
 }
 
@@ -73,6 +86,16 @@ QXmppStream::QXmppStream(QObject *parent)
     : QXmppLoggable(parent),
     d(new QXmppStreamPrivate)
 {
+    bool check;
+    Q_UNUSED(check);
+
+    // resumes reading once the rate limiter allows it
+    d->resumeTimer = new QXmppCoarseTimer(this);
+    d->resumeTimer->setSingleShot(true);
+    check = connect(d->resumeTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_socketReadyRead()));
+    Q_ASSERT(check);
+
     // Make sure the random number generator is seeded
     if (!randomSeeded)
     {
@@ -113,7 +136,7 @@ void QXmppStream::disconnectFromHost()
 void QXmppStream::handleStart()
 {
     d->streamManagementEnabled = false;
-    d->dataBuffer.clear();
+    d->splitter.clear();
     d->streamStart.clear();
 }
 
@@ -145,9 +168,11 @@ bool QXmppStream::sendData(const QByteArray &data)
 bool QXmppStream::sendPacket(const QXmppStanza &packet)
 {
     // prepare packet
+    QXmppProfilerSample sample;
     QByteArray data;
     QXmlStreamWriter xmlStream(&data);
     packet.toXml(&xmlStream);
+    sample.record(QStringLiteral("stream.serialize"));
 
     bool isXmppStanza = packet.isXmppStanza();
     if (isXmppStanza && d->streamManagementEnabled)
@@ -160,6 +185,62 @@ bool QXmppStream::sendPacket(const QXmppStanza &packet)
     return success;
 }
 
+/// Returns the maximum number of bytes which are read from the socket and
+/// processed at once, or 0 if there is no limit.
+
+int QXmppStream::readBudget() const
+{
+    return d->readBudget;
+}
+
+/// Sets the maximum number of bytes which are read from the socket and
+/// processed at once.
+///
+/// When more data is available, reading continues on a later iteration of
+/// the event loop, so that a peer sending a large burst does not delay the
+/// processing of other streams.
+///
+/// \param bytes The maximum number of bytes, or 0 for no limit.
+
+void QXmppStream::setReadBudget(int bytes)
+{
+    d->readBudget = qMax(bytes, 0);
+}
+
+/// Returns the limiter for the rate at which data and stanzas are read
+/// from the stream, if any.
+
+QSharedPointer<QXmppRateLimiter> QXmppStream::rateLimiter() const
+{
+    return d->rateLimiter;
+}
+
+/// Sets the limiter for the rate at which data and stanzas are read from
+/// the stream.
+///
+/// When the limit is exceeded, reading from the socket is paused instead of
+/// buffering the data, and the throttled() signal is emitted. A limiter
+/// can be shared by several streams.
+///
+/// \param limiter The limiter, or a null pointer to disable rate limiting.
+
+void QXmppStream::setRateLimiter(const QSharedPointer<QXmppRateLimiter> &limiter)
+{
+    d->rateLimiter = limiter;
+    if (!d->socket)
+        return;
+
+    if (d->rateLimiter) {
+        d->socket->setReadBufferSize(qMax(LIMITED_READ_BUFFER_SIZE, d->rateLimiter->bytesPerSecond()));
+    } else {
+        d->socket->setReadBufferSize(0);
+        if (d->resumeTimer->isActive()) {
+            d->resumeTimer->stop();
+            QMetaObject::invokeMethod(this, "_q_socketReadyRead", Qt::QueuedConnection);
+        }
+    }
+}
+
 /// Returns the QSslSocket used for this stream.
 ///
 
@@ -180,6 +261,9 @@ void QXmppStream::setSocket(QSslSocket *socket)
     if (!d->socket)
         return;
 
+    if (d->rateLimiter)
+        d->socket->setReadBufferSize(qMax(LIMITED_READ_BUFFER_SIZE, d->rateLimiter->bytesPerSecond()));
+
     // socket events
     check = connect(socket, SIGNAL(connected()),
                     this, SLOT(_q_socketConnected()));
@@ -218,74 +302,165 @@ void QXmppStream::_q_socketError(QAbstractSocket::SocketError socketError)
     warning(QString("Socket error: " + socket()->errorString()));
 }
 
+void QXmppStream::_q_continueReading()
+{
+    d->readScheduled = false;
+    _q_socketReadyRead();
+}
+
 void QXmppStream::_q_socketReadyRead()
 {
-    d->dataBuffer.append(d->socket->readAll());
+    // leave the data in the socket until our turn comes
+    if (!d->socket || d->readScheduled)
+        return;
 
-    // handle whitespace pings
-    if (!d->dataBuffer.isEmpty() && d->dataBuffer.trimmed().isEmpty()) {
-        d->dataBuffer.clear();
-        handleStanza(QDomElement());
+    qint64 maxSize = d->socket->bytesAvailable();
+    if (d->readBudget > 0)
+        maxSize = qMin(maxSize, qint64(d->readBudget));
+
+    if (d->rateLimiter) {
+        // leave the data in the socket until the rate limiter allows reading
+        if (d->resumeTimer->isActive())
+            return;
+        const int delay = d->rateLimiter->delay();
+        if (delay > 0) {
+            d->resumeTimer->start(delay);
+            emit throttled();
+            return;
+        }
+        maxSize = qMin(maxSize, d->rateLimiter->availableBytes());
     }
 
-    // FIXME : maybe these QRegExps could be static?
-    QRegExp startStreamRegex("^(<\\?xml.*\\?>)?\\s*<stream:stream.*>");
-    startStreamRegex.setMinimal(true);
-    QRegExp endStreamRegex("</stream:stream>$");
-    endStreamRegex.setMinimal(true);
-
-    // check whether we need to add stream start / end elements
-    //
-    // NOTE: as we may only have partial XML content, do not alter the stream's
-    // state until we have a valid XML document!
-    QByteArray completeXml = d->dataBuffer;
-    const QString strData = QString::fromUtf8(d->dataBuffer);
-    bool streamStart = false;
-    if (d->streamStart.isEmpty() && strData.contains(startStreamRegex))
-        streamStart = true;
-    else
-        completeXml.prepend(d->streamStart);
-    bool streamEnd = false;
-    if (strData.contains(endStreamRegex))
-        streamEnd = true;
-    else
-        completeXml.append(streamRootElementEnd);
-
-    // check whether we have a valid XML document
-    QDomDocument doc;
-    if (!doc.setContent(completeXml, true))
-        return;
+    const QByteArray data = d->socket->read(maxSize);
+    d->splitter.append(data);
+    const int stanzaCount = processData();
+    if (d->rateLimiter)
+        d->rateLimiter->consume(data.size(), stanzaCount);
+
+    // come back for the data which was left in the socket, after the
+    // other streams which are ready have had their turn
+    if (d->socket && d->socket->bytesAvailable() > 0) {
+        const int delay = d->rateLimiter ? d->rateLimiter->delay() : 0;
+        if (delay > 0) {
+            d->resumeTimer->start(delay);
+            emit throttled();
+        } else {
+            d->readScheduled = true;
+            QMetaObject::invokeMethod(this, "_q_continueReading", Qt::QueuedConnection);
+        }
+    }
+}
 
-    // remove data from buffer
-    logReceived(strData);
-    d->dataBuffer.clear();
+/// Handles the raw data of an incoming XMPP stanza, before it is parsed.
+///
+/// This is only called for stanzas whose data has the same meaning outside
+/// of the stream, i.e. which do not rely on namespace declarations made by
+/// the stream. If you return true, the stanza is not parsed and
+/// handleStanza() is not called for it.
+///
+/// The default implementation returns false.
+///
+/// \param data The stanza's data, as it was received.
+/// \param tagName The name of the stanza's element.
+/// \param attributes The attributes of the stanza's element.
 
-    // process stream start
-    if (streamStart) {
-        d->streamStart = startStreamRegex.cap(0).toUtf8();
-        handleStream(doc.documentElement());
-    }
+bool QXmppStream::handleStanzaData(const QByteArray &data, const QString &tagName, const QXmlStreamAttributes &attributes)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(tagName);
+    Q_UNUSED(attributes);
+    return false;
+}
+
+/// Processes the complete elements which were received, and returns the
+/// number of stanzas which were handled.
+///
+/// Elements are only parsed once they have been received in full, so that
+/// a large stanza which arrives in several reads is parsed once.
+
+int QXmppStream::processData()
+{
+    int stanzaCount = 0;
+
+    forever {
+        const QXmppStanzaSplitter::TokenType token = d->splitter.readNext();
+        if (token == QXmppStanzaSplitter::NoToken) {
+            break;
+        } else if (token == QXmppStanzaSplitter::Invalid) {
+            warning("Received invalid XML, closing stream");
+            disconnectFromHost();
+            break;
+        } else if (token == QXmppStanzaSplitter::Whitespace) {
+            // handle whitespace pings
+            handleStanza(QDomElement());
+            continue;
+        }
+
+        const QByteArray data = d->splitter.data();
+        logReceived(QString::fromUtf8(data));
+
+        if (token == QXmppStanzaSplitter::StreamEnd) {
+            disconnectFromHost();
+            break;
+        }
+
+        const bool isXmppStanza = token == QXmppStanzaSplitter::Stanza &&
+            (d->splitter.tagName() == QLatin1String("message") ||
+             d->splitter.tagName() == QLatin1String("presence") ||
+             d->splitter.tagName() == QLatin1String("iq"));
+
+        // skip parsing if the stanza can be handled using its data
+        if (isXmppStanza && d->splitter.isStandalone() &&
+            handleStanzaData(data, d->splitter.tagName(), d->splitter.attributes())) {
+            ++stanzaCount;
+            ++d->lastIncomingSequenceNumber;
+            continue;
+        }
+
+        // parse the element within the stream's start tag, so that the
+        // namespace declarations made by the stream apply to it
+        QByteArray completeXml;
+        if (token == QXmppStanzaSplitter::StreamStart) {
+            completeXml = data + streamRootElementEnd;
+        } else {
+            completeXml.reserve(d->streamStart.size() + data.size() + streamRootElementEnd.size());
+            completeXml.append(d->streamStart);
+            completeXml.append(data);
+            completeXml.append(streamRootElementEnd);
+        }
+
+        QXmppProfilerSample sample;
+        QDomDocument doc;
+        const bool valid = doc.setContent(completeXml, true);
+        sample.record(QStringLiteral("stream.parse"));
+        if (!valid) {
+            warning("Received invalid XML, closing stream");
+            disconnectFromHost();
+            break;
+        }
+
+        // process stream start
+        if (token == QXmppStanzaSplitter::StreamStart) {
+            d->streamStart = data;
+            handleStream(doc.documentElement());
+            continue;
+        }
 
-    // process stanzas
-    QDomElement nodeRecv = doc.documentElement().firstChildElement();
-    while (!nodeRecv.isNull()) {
+        // process stanza
+        QDomElement nodeRecv = doc.documentElement().firstChildElement();
+        ++stanzaCount;
         if (QXmppStreamManagementAck::isStreamManagementAck(nodeRecv))
             handleAcknowledgement(nodeRecv);
         else if (QXmppStreamManagementReq::isStreamManagementReq(nodeRecv))
             sendAcknowledgement();
         else {
             handleStanza(nodeRecv);
-            if(nodeRecv.tagName() == QLatin1String("message") ||
-               nodeRecv.tagName() == QLatin1String("presence") ||
-               nodeRecv.tagName() == QLatin1String("iq"))
+            if (isXmppStanza)
                 ++d->lastIncomingSequenceNumber;
         }
-        nodeRecv = nodeRecv.nextSiblingElement();
     }
 
-    // process stream end
-    if (streamEnd)
-        disconnectFromHost();
+    return stanzaCount;
 }
 
 /// Enables Stream Management acks / reqs (XEP-0198).
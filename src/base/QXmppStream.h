@@ -28,10 +28,13 @@
 
 #include <QAbstractSocket>
 #include <QObject>
+#include <QSharedPointer>
+#include <QXmlStreamAttributes>
 #include "QXmppLogger.h"
 
 class QDomElement;
 class QSslSocket;
+class QXmppRateLimiter;
 class QXmppStanza;
 class QXmppStreamPrivate;
 
@@ -49,6 +52,9 @@ public:
     virtual bool isConnected() const;
     bool sendPacket(const QXmppStanza&);
 
+    int readBudget() const;
+    void setReadBudget(int bytes);
+
 signals:
     /// This signal is emitted when the stream is connected.
     void connected();
@@ -56,6 +62,10 @@ signals:
     /// This signal is emitted when the stream is disconnected.
     void disconnected();
 
+    /// This signal is emitted when reading from the stream is paused
+    /// because its rate limit was exceeded.
+    void throttled();
+
 protected:
     // Access to underlying socket
     QSslSocket *socket() const;
@@ -63,6 +73,7 @@ protected:
 
     // Overridable methods
     virtual void handleStart();
+    virtual bool handleStanzaData(const QByteArray &data, const QString &tagName, const QXmlStreamAttributes &attributes);
 
     /// Handles an incoming XMPP stanza.
     ///
@@ -87,6 +98,12 @@ protected:
     void setAcknowledgedSequenceNumber(unsigned sequenceNumber);
 
 private:
+    // Rate limiting, which is managed by the server
+    QSharedPointer<QXmppRateLimiter> rateLimiter() const;
+    void setRateLimiter(const QSharedPointer<QXmppRateLimiter> &limiter);
+
+    int processData();
+
     /// Handles an incoming acknowledgement from XEP-0198.
     ///
     /// \param element
@@ -103,6 +120,7 @@ public slots:
     virtual bool sendData(const QByteArray&);
 
 private slots:
+    void _q_continueReading();
     void _q_socketConnected();
     void _q_socketEncrypted();
     void _q_socketError(QAbstractSocket::SocketError error);
@@ -110,6 +128,7 @@ private slots:
 
 private:
     QXmppStreamPrivate * const d;
+    friend class QXmppServer;
 };
 
 #endif // QXMPPSTREAM_H
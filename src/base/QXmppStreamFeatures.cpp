@@ -31,7 +31,8 @@ QXmppStreamFeatures::QXmppStreamFeatures()
     m_sessionMode(Disabled),
     m_nonSaslAuthMode(Disabled),
     m_tlsMode(Disabled),
-    m_streamManagementMode(Disabled)
+    m_streamManagementMode(Disabled),
+    m_rosterVersioningMode(Disabled)
 {
 }
 
@@ -105,6 +106,22 @@ void QXmppStreamFeatures::setStreamManagementMode(QXmppStreamFeatures::Mode mode
     m_streamManagementMode = mode;
 }
 
+/// Returns the mode (disabled or enabled) for XEP-0237: Roster Versioning
+
+QXmppStreamFeatures::Mode QXmppStreamFeatures::rosterVersioningMode() const
+{
+    return m_rosterVersioningMode;
+}
+
+/// Sets the mode for XEP-0237: Roster Versioning
+///
+/// \param mode The mode to set.
+
+void QXmppStreamFeatures::setRosterVersioningMode(QXmppStreamFeatures::Mode mode)
+{
+    m_rosterVersioningMode = mode;
+}
+
 /// \cond
 bool QXmppStreamFeatures::isStreamFeatures(const QDomElement &element)
 {
@@ -136,6 +153,7 @@ void QXmppStreamFeatures::parse(const QDomElement &element)
     m_nonSaslAuthMode = readFeature(element, "auth", ns_authFeature);
     m_tlsMode = readFeature(element, "starttls", ns_tls);
     m_streamManagementMode = readFeature(element, "sm", ns_stream_management);
+    m_rosterVersioningMode = readFeature(element, "ver", ns_rosterver);
 
     // parse advertised compression methods
     QDomElement compression = element.firstChildElement("compression");
@@ -181,6 +199,7 @@ void QXmppStreamFeatures::toXml(QXmlStreamWriter *writer) const
     writeFeature(writer, "auth", ns_authFeature, m_nonSaslAuthMode);
     writeFeature(writer, "starttls", ns_tls, m_tlsMode);
     writeFeature(writer, "sm", ns_stream_management, m_streamManagementMode);
+    writeFeature(writer, "ver", ns_rosterver, m_rosterVersioningMode);
 
     if (!m_compressionMethods.isEmpty())
     {
@@ -31,6 +31,7 @@
 #include <QTimer>
 
 #include "QXmppStun_p.h"
+#include "QXmppTimerWheel_p.h"
 #include "QXmppUtils.h"
 
 #define STUN_ID_SIZE 12
@@ -1122,13 +1123,13 @@ QXmppStunTransaction::QXmppStunTransaction(const QXmppStunMessage &request, QObj
     Q_ASSERT(check);
 
     // RTO timer
-    m_retryTimer = new QTimer(this);
+    m_retryTimer = new QXmppCoarseTimer(this);
     m_retryTimer->setSingleShot(true);
     check = connect(m_retryTimer, SIGNAL(timeout()),
                     this, SLOT(retry()));
 
-    // send packet immediately
-    m_retryTimer->start(0);
+    // send packet as soon as the receiver is ready
+    QMetaObject::invokeMethod(this, "retry", Qt::QueuedConnection);
 }
 
 void QXmppStunTransaction::readStun(const QXmppStunMessage &response)
@@ -28,6 +28,7 @@
 
 class QUdpSocket;
 class QTimer;
+class QXmppCoarseTimer;
 
 //
 //  W A R N I N G
@@ -68,7 +69,7 @@ private slots:
 private:
     QXmppStunMessage m_request;
     QXmppStunMessage m_response;
-    QTimer *m_retryTimer;
+    QXmppCoarseTimer *m_retryTimer;
     int m_tries;
 };
 
@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QThreadStorage>
+#include <QTimer>
+
+#include "QXmppTimerWheel_p.h"
+
+// resolution of the per-thread wheel in milliseconds
+static const int WHEEL_RESOLUTION = 100;
+
+static QThreadStorage<QXmppTimerWheel*> wheelStorage;
+
+/// Constructs a new inactive timer.
+///
+/// \param parent
+
+QXmppCoarseTimer::QXmppCoarseTimer(QObject *parent)
+    : QObject(parent)
+    , m_wheel(0)
+    , m_next(0)
+    , m_prev(0)
+    , m_expires(0)
+    , m_bucket(-1)
+    , m_interval(0)
+    , m_singleShot(false)
+{
+}
+
+QXmppCoarseTimer::~QXmppCoarseTimer()
+{
+    stop();
+}
+
+/// Returns the timeout interval in milliseconds.
+
+int QXmppCoarseTimer::interval() const
+{
+    return m_interval;
+}
+
+/// Sets the timeout interval in milliseconds.
+///
+/// If the timer is active, it is restarted with the new interval.
+///
+/// \param msecs
+
+void QXmppCoarseTimer::setInterval(int msecs)
+{
+    m_interval = msecs;
+    if (isActive())
+        start();
+}
+
+/// Returns true if the timer is running.
+
+bool QXmppCoarseTimer::isActive() const
+{
+    return m_wheel != 0;
+}
+
+/// Returns true if the timer only fires once.
+
+bool QXmppCoarseTimer::isSingleShot() const
+{
+    return m_singleShot;
+}
+
+/// Sets whether the timer only fires once.
+///
+/// \param singleShot
+
+void QXmppCoarseTimer::setSingleShot(bool singleShot)
+{
+    m_singleShot = singleShot;
+}
+
+/// Starts or restarts the timer with its current interval.
+
+void QXmppCoarseTimer::start()
+{
+    stop();
+    QXmppTimerWheel::instance()->schedule(this, m_interval);
+}
+
+/// Starts or restarts the timer with the given interval.
+///
+/// \param msecs
+
+void QXmppCoarseTimer::start(int msecs)
+{
+    m_interval = msecs;
+    start();
+}
+
+/// Stops the timer.
+
+void QXmppCoarseTimer::stop()
+{
+    if (m_wheel)
+        m_wheel->remove(this);
+}
+
+/// Constructs a new timer wheel.
+///
+/// \param resolution The duration of a tick in milliseconds.
+/// \param parent
+
+QXmppTimerWheel::QXmppTimerWheel(int resolution, QObject *parent)
+    : QObject(parent)
+    , m_tick(0)
+    , m_wake(0)
+    , m_count(0)
+    , m_resolution(qMax(resolution, 1))
+{
+    bool check;
+    Q_UNUSED(check);
+
+    for (int i = 0; i < BucketCount; ++i)
+        m_buckets[i] = 0;
+    m_clock.start();
+
+    m_timer = new QTimer(this);
+    m_timer->setSingleShot(true);
+    check = connect(m_timer, SIGNAL(timeout()),
+                    this, SLOT(_q_tick()));
+    Q_ASSERT(check);
+}
+
+QXmppTimerWheel::~QXmppTimerWheel()
+{
+    // detach the remaining timers
+    for (int i = 0; i < BucketCount; ++i) {
+        QXmppCoarseTimer *timer = m_buckets[i];
+        while (timer) {
+            QXmppCoarseTimer *next = timer->m_next;
+            timer->m_wheel = 0;
+            timer->m_next = 0;
+            timer->m_prev = 0;
+            timer->m_bucket = -1;
+            timer = next;
+        }
+    }
+}
+
+/// Returns the number of active timers.
+
+int QXmppTimerWheel::count() const
+{
+    return m_count;
+}
+
+/// Returns the duration of a tick in milliseconds.
+
+int QXmppTimerWheel::resolution() const
+{
+    return m_resolution;
+}
+
+/// Returns the timer wheel for the current thread.
+
+QXmppTimerWheel *QXmppTimerWheel::instance()
+{
+    if (!wheelStorage.hasLocalData())
+        wheelStorage.setLocalData(new QXmppTimerWheel(WHEEL_RESOLUTION));
+    return wheelStorage.localData();
+}
+
+/// Moves the timers of the current slot of the given level to lower levels.
+
+void QXmppTimerWheel::cascade(int level)
+{
+    const int bucket = level * SlotCount + int((m_tick >> (level * SlotBits)) & SlotMask);
+    QXmppCoarseTimer *timer = m_buckets[bucket];
+    m_buckets[bucket] = 0;
+    while (timer) {
+        QXmppCoarseTimer *next = timer->m_next;
+        insert(timer);
+        timer = next;
+    }
+}
+
+/// Adds a timer to the bucket matching its expiry tick.
+
+void QXmppTimerWheel::insert(QXmppCoarseTimer *timer)
+{
+    // timers beyond the wheel's span wait in the last level
+    const quint64 span = quint64(1) << (LevelCount * SlotBits);
+    const quint64 delta = qMin(timer->m_expires - m_tick, span - 1);
+    const quint64 when = m_tick + delta;
+
+    int level = 0;
+    while (level < LevelCount - 1 && delta >= (quint64(1) << ((level + 1) * SlotBits)))
+        ++level;
+
+    const int bucket = level * SlotCount + int((when >> (level * SlotBits)) & SlotMask);
+    timer->m_bucket = bucket;
+    timer->m_prev = 0;
+    timer->m_next = m_buckets[bucket];
+    if (timer->m_next)
+        timer->m_next->m_prev = timer;
+    m_buckets[bucket] = timer;
+}
+
+/// Arms the driving timer for the next tick which has due timers or
+/// requires a cascade.
+
+void QXmppTimerWheel::rearm()
+{
+    if (!m_count) {
+        m_timer->stop();
+        return;
+    }
+
+    quint64 next = m_tick;
+    while ((next & SlotMask) && !m_buckets[next & SlotMask])
+        ++next;
+
+    m_wake = next;
+    const qint64 delay = qint64(next) * m_resolution - m_clock.elapsed();
+    m_timer->start(int(qMax(delay, qint64(0))));
+}
+
+/// Stops the given timer.
+
+void QXmppTimerWheel::remove(QXmppCoarseTimer *timer)
+{
+    unlink(timer);
+    timer->m_wheel = 0;
+    m_count--;
+}
+
+/// Starts the given timer, which must not be active.
+
+void QXmppTimerWheel::schedule(QXmppCoarseTimer *timer, int msecs)
+{
+    const qint64 elapsed = m_clock.elapsed();
+
+    // an empty wheel can skip the ticks which elapsed while it was idle
+    if (!m_count)
+        m_tick = quint64(elapsed / m_resolution) + 1;
+
+    // never fire early, the timer fires at most one tick late
+    const quint64 expires = quint64(elapsed + qMax(msecs, 0) + m_resolution - 1) / m_resolution;
+    timer->m_expires = qMax(expires, m_tick);
+    timer->m_wheel = this;
+    insert(timer);
+    m_count++;
+
+    if (!m_timer->isActive() || timer->m_expires < m_wake)
+        rearm();
+}
+
+void QXmppTimerWheel::unlink(QXmppCoarseTimer *timer)
+{
+    if (timer->m_prev)
+        timer->m_prev->m_next = timer->m_next;
+    else
+        m_buckets[timer->m_bucket] = timer->m_next;
+    if (timer->m_next)
+        timer->m_next->m_prev = timer->m_prev;
+    timer->m_next = 0;
+    timer->m_prev = 0;
+    timer->m_bucket = -1;
+}
+
+void QXmppTimerWheel::_q_tick()
+{
+    const quint64 now = quint64(m_clock.elapsed() / m_resolution);
+    while (m_count && m_tick <= now) {
+        // refill the lower levels when their slots wrap around
+        for (int level = 1; level < LevelCount; ++level) {
+            if (m_tick & ((quint64(1) << (level * SlotBits)) - 1))
+                break;
+            cascade(level);
+        }
+
+        // move the timers which are due out of the wheel, so that timers
+        // started from a timeout() handler wait for a later tick
+        const int bucket = int(m_tick & SlotMask);
+        m_buckets[DueBucket] = m_buckets[bucket];
+        m_buckets[bucket] = 0;
+        for (QXmppCoarseTimer *timer = m_buckets[DueBucket]; timer; timer = timer->m_next)
+            timer->m_bucket = DueBucket;
+        ++m_tick;
+
+        while (QXmppCoarseTimer *timer = m_buckets[DueBucket]) {
+            remove(timer);
+            if (!timer->m_singleShot)
+                schedule(timer, timer->m_interval);
+            emit timer->timeout();
+        }
+    }
+    rearm();
+}
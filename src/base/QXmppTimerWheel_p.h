@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPTIMERWHEEL_P_H
+#define QXMPPTIMERWHEEL_P_H
+
+#include <QElapsedTimer>
+#include <QObject>
+
+#include "QXmppGlobal.h"
+
+class QTimer;
+class QXmppTimerWheel;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppCoarseTimer class is a timer with the same interface as QTimer,
+/// which is scheduled on the current thread's QXmppTimerWheel instead of
+/// being registered with the event dispatcher.
+///
+/// It fires at most one wheel resolution after its interval has elapsed,
+/// which suits inactivity timeouts, keepalives and retransmissions. Use
+/// QTimer when precise timing is required.
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppCoarseTimer : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppCoarseTimer(QObject *parent = 0);
+    ~QXmppCoarseTimer();
+
+    int interval() const;
+    void setInterval(int msecs);
+
+    bool isActive() const;
+
+    bool isSingleShot() const;
+    void setSingleShot(bool singleShot);
+
+signals:
+    void timeout();
+
+public slots:
+    void start();
+    void start(int msecs);
+    void stop();
+
+private:
+    friend class QXmppTimerWheel;
+
+    QXmppTimerWheel *m_wheel;
+    QXmppCoarseTimer *m_next;
+    QXmppCoarseTimer *m_prev;
+    quint64 m_expires;
+    int m_bucket;
+    int m_interval;
+    bool m_singleShot;
+};
+
+/// \internal
+///
+/// The QXmppTimerWheel class schedules QXmppCoarseTimer instances using a
+/// hierarchical timing wheel, so that starting, restarting and stopping a
+/// timer take constant time however many timers are active.
+///
+/// A single QTimer drives the wheel, and only runs while timers are active.
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppTimerWheel : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppTimerWheel(int resolution, QObject *parent = 0);
+    ~QXmppTimerWheel();
+
+    int count() const;
+    int resolution() const;
+
+    static QXmppTimerWheel *instance();
+
+private slots:
+    void _q_tick();
+
+private:
+    friend class QXmppCoarseTimer;
+
+    void cascade(int level);
+    void insert(QXmppCoarseTimer *timer);
+    void rearm();
+    void remove(QXmppCoarseTimer *timer);
+    void schedule(QXmppCoarseTimer *timer, int msecs);
+    void unlink(QXmppCoarseTimer *timer);
+
+    enum {
+        LevelCount = 4,
+        SlotBits = 6,
+        SlotCount = 1 << SlotBits,
+        SlotMask = SlotCount - 1,
+        DueBucket = LevelCount * SlotCount,
+        BucketCount = DueBucket + 1
+    };
+
+    QXmppCoarseTimer *m_buckets[BucketCount];
+    QElapsedTimer m_clock;
+    QTimer *m_timer;
+    quint64 m_tick;
+    quint64 m_wake;
+    int m_count;
+    int m_resolution;
+};
+
+#endif
@@ -0,0 +1,727 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QAtomicInt>
+#include <QSize>
+
+#include "QXmppVideoConverter_p.h"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QXMPP_VIDEO_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 kernels are compiled for the target with function attributes and
+// only used if the processor supports them
+#if defined(QXMPP_VIDEO_SSE2) && (defined(__clang__) || \
+    (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define QXMPP_VIDEO_AVX2
+#include <immintrin.h>
+#endif
+
+// All kernels take an even number of pixels. Chroma is subsampled by
+// averaging, with the same rounding as _mm_avg_epu8 so that all the kernels
+// produce the same output.
+
+static inline int average(int a, int b)
+{
+    return (a + b + 1) >> 1;
+}
+
+static inline uchar clampByte(int value)
+{
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+static void copyPlane(const uchar *src, int srcStride, uchar *dst, int dstStride, int width, int height)
+{
+    for (int row = 0; row < height; ++row) {
+        memcpy(dst, src, width);
+        src += srcStride;
+        dst += dstStride;
+    }
+}
+
+// Unpacks two rows of YUYV or UYVY pixels, averaging their chroma. The luma
+// of the second row is dropped if y1 is null.
+
+static void packed422ToPlanar_scalar(const uchar *src0, const uchar *src1, uchar *y0, uchar *y1, uchar *u, uchar *v, int width, int lumaOffset)
+{
+    const int chromaOffset = 1 - lumaOffset;
+    for (int x = 0; x < width; x += 2) {
+        const int i = 2 * x;
+        y0[x] = src0[i + lumaOffset];
+        y0[x + 1] = src0[i + 2 + lumaOffset];
+        if (y1) {
+            y1[x] = src1[i + lumaOffset];
+            y1[x + 1] = src1[i + 2 + lumaOffset];
+        }
+        u[x / 2] = average(src0[i + chromaOffset], src1[i + chromaOffset]);
+        v[x / 2] = average(src0[i + 2 + chromaOffset], src1[i + 2 + chromaOffset]);
+    }
+}
+
+static void planarToPacked422_scalar(const uchar *y, const uchar *u, const uchar *v, uchar *dst, int width, int lumaOffset)
+{
+    const int chromaOffset = 1 - lumaOffset;
+    for (int x = 0; x < width; x += 2) {
+        const int i = 2 * x;
+        dst[i + lumaOffset] = y[x];
+        dst[i + 2 + lumaOffset] = y[x + 1];
+        dst[i + chromaOffset] = u[x / 2];
+        dst[i + 2 + chromaOffset] = v[x / 2];
+    }
+}
+
+static void splitChroma_scalar(const uchar *uv, uchar *u, uchar *v, int count)
+{
+    for (int x = 0; x < count; ++x) {
+        u[x] = uv[2 * x];
+        v[x] = uv[2 * x + 1];
+    }
+}
+
+static void mergeChroma_scalar(const uchar *u, const uchar *v, uchar *uv, int count)
+{
+    for (int x = 0; x < count; ++x) {
+        uv[2 * x] = u[x];
+        uv[2 * x + 1] = v[x];
+    }
+}
+
+static void rgb32ToI420_scalar(const uchar *src0, const uchar *src1, uchar *y0, uchar *y1, uchar *u, uchar *v, int width)
+{
+    const quint32 *row0 = reinterpret_cast<const quint32*>(src0);
+    const quint32 *row1 = reinterpret_cast<const quint32*>(src1);
+    for (int x = 0; x < width; ++x) {
+        const quint32 p0 = row0[x];
+        const quint32 p1 = row1[x];
+        y0[x] = ((66 * ((p0 >> 16) & 0xff) + 129 * ((p0 >> 8) & 0xff) + 25 * (p0 & 0xff) + 128) >> 8) + 16;
+        y1[x] = ((66 * ((p1 >> 16) & 0xff) + 129 * ((p1 >> 8) & 0xff) + 25 * (p1 & 0xff) + 128) >> 8) + 16;
+    }
+
+    for (int x = 0; x < width; x += 2) {
+        int rgb[3];
+        for (int c = 0; c < 3; ++c) {
+            const int shift = 16 - 8 * c;
+            rgb[c] = average(average((row0[x] >> shift) & 0xff, (row1[x] >> shift) & 0xff),
+                             average((row0[x + 1] >> shift) & 0xff, (row1[x + 1] >> shift) & 0xff));
+        }
+        u[x / 2] = ((-38 * rgb[0] - 74 * rgb[1] + 112 * rgb[2] + 128) >> 8) + 128;
+        v[x / 2] = ((112 * rgb[0] - 94 * rgb[1] - 18 * rgb[2] + 128) >> 8) + 128;
+    }
+}
+
+static void i420ToRgb32_scalar(const uchar *y, const uchar *u, const uchar *v, uchar *dst, int width)
+{
+    quint32 *row = reinterpret_cast<quint32*>(dst);
+    for (int x = 0; x < width; ++x) {
+        const int c = y[x] - 16;
+        const int d = u[x / 2] - 128;
+        const int e = v[x / 2] - 128;
+        const uchar r = clampByte((298 * c + 409 * e + 128) >> 8);
+        const uchar g = clampByte((298 * c - 100 * d - 208 * e + 128) >> 8);
+        const uchar b = clampByte((298 * c + 516 * d + 128) >> 8);
+        row[x] = 0xff000000 | (r << 16) | (g << 8) | b;
+    }
+}
+
+#ifdef QXMPP_VIDEO_SSE2
+
+static inline __m128i load32_sse2(const uchar *src)
+{
+    int value;
+    memcpy(&value, src, sizeof(value));
+    return _mm_cvtsi32_si128(value);
+}
+
+static inline void store32_sse2(uchar *dst, __m128i value)
+{
+    const int v = _mm_cvtsi128_si32(value);
+    memcpy(dst, &v, sizeof(v));
+}
+
+// Adds adjacent pairs of 32-bit integers.
+
+static inline __m128i hadd32_sse2(__m128i a, __m128i b)
+{
+    const __m128 fa = _mm_castsi128_ps(a);
+    const __m128 fb = _mm_castsi128_ps(b);
+    return _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0))),
+                         _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1))));
+}
+
+// Computes the weighted sum of the B, G and R components of 4 pixels.
+
+static inline __m128i rgb32Dot_sse2(__m128i pixels, __m128i coef)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i sum = hadd32_sse2(_mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), coef),
+                                    _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), coef));
+    return _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(128)), 8);
+}
+
+static void packed422ToPlanar_sse2(const uchar *src0, const uchar *src1, uchar *y0, uchar *y1, uchar *u, uchar *v, int width, int lumaOffset)
+{
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + 2 * x));
+        const __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + 2 * x + 16));
+        const __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + 2 * x));
+        const __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + 2 * x + 16));
+        const __m128i even0 = _mm_packus_epi16(_mm_and_si128(a0, mask), _mm_and_si128(b0, mask));
+        const __m128i odd0 = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(b0, 8));
+        const __m128i even1 = _mm_packus_epi16(_mm_and_si128(a1, mask), _mm_and_si128(b1, mask));
+        const __m128i odd1 = _mm_packus_epi16(_mm_srli_epi16(a1, 8), _mm_srli_epi16(b1, 8));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(y0 + x), lumaOffset ? odd0 : even0);
+        if (y1)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(y1 + x), lumaOffset ? odd1 : even1);
+
+        const __m128i chroma = lumaOffset ? _mm_avg_epu8(even0, even1) : _mm_avg_epu8(odd0, odd1);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(u + x / 2), _mm_packus_epi16(_mm_and_si128(chroma, mask), zero));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(v + x / 2), _mm_packus_epi16(_mm_srli_epi16(chroma, 8), zero));
+    }
+    packed422ToPlanar_scalar(src0 + 2 * x, src1 + 2 * x, y0 + x, y1 ? y1 + x : 0, u + x / 2, v + x / 2, width - x, lumaOffset);
+}
+
+static void planarToPacked422_sse2(const uchar *y, const uchar *u, const uchar *v, uchar *dst, int width, int lumaOffset)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const __m128i luma = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x));
+        const __m128i chroma = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(u + x / 2)),
+                                                 _mm_loadl_epi64(reinterpret_cast<const __m128i*>(v + x / 2)));
+        __m128i *out = reinterpret_cast<__m128i*>(dst + 2 * x);
+        if (lumaOffset) {
+            _mm_storeu_si128(out, _mm_unpacklo_epi8(chroma, luma));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi8(chroma, luma));
+        } else {
+            _mm_storeu_si128(out, _mm_unpacklo_epi8(luma, chroma));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi8(luma, chroma));
+        }
+    }
+    planarToPacked422_scalar(y + x, u + x / 2, v + x / 2, dst + 2 * x, width - x, lumaOffset);
+}
+
+static void splitChroma_sse2(const uchar *uv, uchar *u, uchar *v, int count)
+{
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    int x = 0;
+    for (; x + 16 <= count; x += 16) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(uv + 2 * x));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(uv + 2 * x + 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x), _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(v + x), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+    }
+    splitChroma_scalar(uv + 2 * x, u + x, v + x, count - x);
+}
+
+static void mergeChroma_sse2(const uchar *u, const uchar *v, uchar *uv, int count)
+{
+    int x = 0;
+    for (; x + 16 <= count; x += 16) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(u + x));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + x));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(uv + 2 * x), _mm_unpacklo_epi8(a, b));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(uv + 2 * x + 16), _mm_unpackhi_epi8(a, b));
+    }
+    mergeChroma_scalar(u + x, v + x, uv + 2 * x, count - x);
+}
+
+static void rgb32ToI420_sse2(const uchar *src0, const uchar *src1, uchar *y0, uchar *y1, uchar *u, uchar *v, int width)
+{
+    // coefficients for B, G, R and A
+    const __m128i yCoef = _mm_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0);
+    const __m128i uCoef = _mm_setr_epi16(112, -74, -38, 0, 112, -74, -38, 0);
+    const __m128i vCoef = _mm_setr_epi16(-18, -94, 112, 0, -18, -94, 112, 0);
+    const __m128i lumaBias = _mm_set1_epi16(16);
+    const __m128i chromaBias = _mm_set1_epi16(128);
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + 4 * x));
+        const __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + 4 * x + 16));
+        const __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + 4 * x));
+        const __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + 4 * x + 16));
+
+        const __m128i luma0 = _mm_add_epi16(_mm_packs_epi32(rgb32Dot_sse2(a0, yCoef), rgb32Dot_sse2(b0, yCoef)), lumaBias);
+        const __m128i luma1 = _mm_add_epi16(_mm_packs_epi32(rgb32Dot_sse2(a1, yCoef), rgb32Dot_sse2(b1, yCoef)), lumaBias);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(y0 + x), _mm_packus_epi16(luma0, zero));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(y1 + x), _mm_packus_epi16(luma1, zero));
+
+        // average vertically, then horizontally, and keep the even pixels
+        __m128i a = _mm_avg_epu8(a0, a1);
+        __m128i b = _mm_avg_epu8(b0, b1);
+        a = _mm_shuffle_epi32(_mm_avg_epu8(a, _mm_srli_si128(a, 4)), _MM_SHUFFLE(3, 1, 2, 0));
+        b = _mm_shuffle_epi32(_mm_avg_epu8(b, _mm_srli_si128(b, 4)), _MM_SHUFFLE(3, 1, 2, 0));
+        const __m128i pixels = _mm_unpacklo_epi64(a, b);
+
+        __m128i chroma = _mm_add_epi16(_mm_packs_epi32(rgb32Dot_sse2(pixels, uCoef), rgb32Dot_sse2(pixels, vCoef)), chromaBias);
+        chroma = _mm_packus_epi16(chroma, chroma);
+        store32_sse2(u + x / 2, chroma);
+        store32_sse2(v + x / 2, _mm_srli_si128(chroma, 4));
+    }
+    rgb32ToI420_scalar(src0 + 4 * x, src1 + 4 * x, y0 + x, y1 + x, u + x / 2, v + x / 2, width - x);
+}
+
+static inline __m128i yuvToComponent_sse2(__m128i ceLo, __m128i ceHi, __m128i dLo, __m128i dHi, __m128i ceCoef, __m128i dCoef)
+{
+    const __m128i lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ceLo, ceCoef), _mm_madd_epi16(dLo, dCoef)), 8);
+    const __m128i hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ceHi, ceCoef), _mm_madd_epi16(dHi, dCoef)), 8);
+    const __m128i value = _mm_packs_epi32(lo, hi);
+    return _mm_packus_epi16(value, value);
+}
+
+static void i420ToRgb32_sse2(const uchar *y, const uchar *u, const uchar *v, uchar *dst, int width)
+{
+    // coefficients for (Y - 16, V - 128) and (U - 128, 1) pairs, the
+    // latter adding the rounding term
+    const __m128i rCoefCe = _mm_setr_epi16(298, 409, 298, 409, 298, 409, 298, 409);
+    const __m128i rCoefD = _mm_setr_epi16(0, 128, 0, 128, 0, 128, 0, 128);
+    const __m128i gCoefCe = _mm_setr_epi16(298, -208, 298, -208, 298, -208, 298, -208);
+    const __m128i gCoefD = _mm_setr_epi16(-100, 128, -100, 128, -100, 128, -100, 128);
+    const __m128i bCoefCe = _mm_setr_epi16(298, 0, 298, 0, 298, 0, 298, 0);
+    const __m128i bCoefD = _mm_setr_epi16(516, 128, 516, 128, 516, 128, 516, 128);
+    const __m128i lumaBias = _mm_set1_epi16(16);
+    const __m128i chromaBias = _mm_set1_epi16(128);
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i alpha = _mm_set1_epi8(-1);
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const __m128i c = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(y + x)), zero), lumaBias);
+        __m128i d = load32_sse2(u + x / 2);
+        __m128i e = load32_sse2(v + x / 2);
+        d = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_unpacklo_epi8(d, d), zero), chromaBias);
+        e = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_unpacklo_epi8(e, e), zero), chromaBias);
+
+        const __m128i ceLo = _mm_unpacklo_epi16(c, e);
+        const __m128i ceHi = _mm_unpackhi_epi16(c, e);
+        const __m128i dLo = _mm_unpacklo_epi16(d, one);
+        const __m128i dHi = _mm_unpackhi_epi16(d, one);
+        const __m128i r = yuvToComponent_sse2(ceLo, ceHi, dLo, dHi, rCoefCe, rCoefD);
+        const __m128i g = yuvToComponent_sse2(ceLo, ceHi, dLo, dHi, gCoefCe, gCoefD);
+        const __m128i b = yuvToComponent_sse2(ceLo, ceHi, dLo, dHi, bCoefCe, bCoefD);
+
+        const __m128i bg = _mm_unpacklo_epi8(b, g);
+        const __m128i ra = _mm_unpacklo_epi8(r, alpha);
+        __m128i *out = reinterpret_cast<__m128i*>(dst + 4 * x);
+        _mm_storeu_si128(out, _mm_unpacklo_epi16(bg, ra));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(bg, ra));
+    }
+    i420ToRgb32_scalar(y + x, u + x / 2, v + x / 2, dst + 4 * x, width - x);
+}
+
+#endif
+
+#ifdef QXMPP_VIDEO_AVX2
+
+__attribute__((target("avx2")))
+static void packed422ToPlanar_avx2(const uchar *src0, const uchar *src1, uchar *y0, uchar *y1, uchar *u, uchar *v, int width, int lumaOffset)
+{
+    // packing works within 128-bit lanes, so the quadwords are reordered
+    // after each pack
+    const __m256i mask = _mm256_set1_epi16(0x00ff);
+    const __m256i zero = _mm256_setzero_si256();
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        const __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src0 + 2 * x));
+        const __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src0 + 2 * x + 32));
+        const __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src1 + 2 * x));
+        const __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src1 + 2 * x + 32));
+        const __m256i even0 = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_and_si256(a0, mask), _mm256_and_si256(b0, mask)), _MM_SHUFFLE(3, 1, 2, 0));
+        const __m256i odd0 = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_srli_epi16(a0, 8), _mm256_srli_epi16(b0, 8)), _MM_SHUFFLE(3, 1, 2, 0));
+        const __m256i even1 = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_and_si256(a1, mask), _mm256_and_si256(b1, mask)), _MM_SHUFFLE(3, 1, 2, 0));
+        const __m256i odd1 = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_srli_epi16(a1, 8), _mm256_srli_epi16(b1, 8)), _MM_SHUFFLE(3, 1, 2, 0));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(y0 + x), lumaOffset ? odd0 : even0);
+        if (y1)
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(y1 + x), lumaOffset ? odd1 : even1);
+
+        const __m256i chroma = lumaOffset ? _mm256_avg_epu8(even0, even1) : _mm256_avg_epu8(odd0, odd1);
+        const __m256i cb = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_and_si256(chroma, mask), zero), _MM_SHUFFLE(3, 1, 2, 0));
+        const __m256i cr = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_srli_epi16(chroma, 8), zero), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x / 2), _mm256_castsi256_si128(cb));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(v + x / 2), _mm256_castsi256_si128(cr));
+    }
+    packed422ToPlanar_sse2(src0 + 2 * x, src1 + 2 * x, y0 + x, y1 ? y1 + x : 0, u + x / 2, v + x / 2, width - x, lumaOffset);
+}
+
+#endif
+
+struct QXmppVideoKernels
+{
+    void (*packed422ToPlanar)(const uchar *src0, const uchar *src1, uchar *y0, uchar *y1, uchar *u, uchar *v, int width, int lumaOffset);
+    void (*planarToPacked422)(const uchar *y, const uchar *u, const uchar *v, uchar *dst, int width, int lumaOffset);
+    void (*splitChroma)(const uchar *uv, uchar *u, uchar *v, int count);
+    void (*mergeChroma)(const uchar *u, const uchar *v, uchar *uv, int count);
+    void (*rgb32ToI420)(const uchar *src0, const uchar *src1, uchar *y0, uchar *y1, uchar *u, uchar *v, int width);
+    void (*i420ToRgb32)(const uchar *y, const uchar *u, const uchar *v, uchar *dst, int width);
+};
+
+static const QXmppVideoKernels scalarKernels = {
+    packed422ToPlanar_scalar,
+    planarToPacked422_scalar,
+    splitChroma_scalar,
+    mergeChroma_scalar,
+    rgb32ToI420_scalar,
+    i420ToRgb32_scalar
+};
+
+#ifdef QXMPP_VIDEO_SSE2
+static const QXmppVideoKernels sse2Kernels = {
+    packed422ToPlanar_sse2,
+    planarToPacked422_sse2,
+    splitChroma_sse2,
+    mergeChroma_sse2,
+    rgb32ToI420_sse2,
+    i420ToRgb32_sse2
+};
+#endif
+
+#ifdef QXMPP_VIDEO_AVX2
+static const QXmppVideoKernels avx2Kernels = {
+    packed422ToPlanar_avx2,
+    planarToPacked422_sse2,
+    splitChroma_sse2,
+    mergeChroma_sse2,
+    rgb32ToI420_sse2,
+    i420ToRgb32_sse2
+};
+#endif
+
+static QBasicAtomicInt selectedInstructionSet = Q_BASIC_ATOMIC_INITIALIZER(-1);
+
+static const QXmppVideoKernels *kernels()
+{
+    switch (QXmppVideoConverter::instructionSet()) {
+#ifdef QXMPP_VIDEO_AVX2
+    case QXmppVideoConverter::AVX2:
+        return &avx2Kernels;
+#endif
+#ifdef QXMPP_VIDEO_SSE2
+    case QXmppVideoConverter::SSE2:
+        return &sse2Kernels;
+#endif
+    default:
+        return &scalarKernels;
+    }
+}
+
+static bool isConvertible(const QXmppVideoFrame &frame)
+{
+    const QXmppVideoFrame::PixelFormat format = frame.pixelFormat();
+    return frame.isValid() &&
+           QXmppVideoConverter::isSupported(format) &&
+           !(frame.width() % 2) && !(frame.height() % 2) &&
+           !(frame.bytesPerLine() % 2) &&
+           frame.bytesPerLine() >= QXmppVideoConverter::bytesPerLine(format, frame.width()) &&
+           frame.mappedBytes() >= QXmppVideoConverter::frameBytes(format, frame.bytesPerLine(), frame.height());
+}
+
+/// Returns the instruction set used by the conversions.
+
+QXmppVideoConverter::InstructionSet QXmppVideoConverter::instructionSet()
+{
+    int set = selectedInstructionSet.load();
+    if (set < 0) {
+        set = supportedInstructionSet();
+        selectedInstructionSet.store(set);
+    }
+    return InstructionSet(set);
+}
+
+/// Sets the instruction set used by the conversions.
+///
+/// If the processor does not support it, the best supported instruction set
+/// is used instead.
+///
+/// \param set
+
+void QXmppVideoConverter::setInstructionSet(InstructionSet set)
+{
+    selectedInstructionSet.store(qMin(set, supportedInstructionSet()));
+}
+
+/// Returns the best instruction set supported by the processor.
+
+QXmppVideoConverter::InstructionSet QXmppVideoConverter::supportedInstructionSet()
+{
+#if defined(QXMPP_VIDEO_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return AVX2;
+#endif
+#if defined(QXMPP_VIDEO_SSE2)
+    return SSE2;
+#else
+    return Scalar;
+#endif
+}
+
+/// Returns the number of bytes in a scan line of a frame of the given
+/// pixel format and width, without padding.
+///
+/// \param format
+/// \param width
+
+int QXmppVideoConverter::bytesPerLine(QXmppVideoFrame::PixelFormat format, int width)
+{
+    switch (format) {
+    case QXmppVideoFrame::Format_NV12:
+    case QXmppVideoFrame::Format_YUV420P:
+        return width;
+    case QXmppVideoFrame::Format_UYVY:
+    case QXmppVideoFrame::Format_YUYV:
+        return width * 2;
+    case QXmppVideoFrame::Format_RGB32:
+        return width * 4;
+    default:
+        return 0;
+    }
+}
+
+/// Returns the number of bytes occupied by a frame of the given pixel
+/// format, scan line length and height.
+///
+/// \param format
+/// \param bytesPerLine
+/// \param height
+
+int QXmppVideoConverter::frameBytes(QXmppVideoFrame::PixelFormat format, int bytesPerLine, int height)
+{
+    switch (format) {
+    case QXmppVideoFrame::Format_NV12:
+    case QXmppVideoFrame::Format_YUV420P:
+        return bytesPerLine * height * 3 / 2;
+    case QXmppVideoFrame::Format_UYVY:
+    case QXmppVideoFrame::Format_YUYV:
+    case QXmppVideoFrame::Format_RGB32:
+        return bytesPerLine * height;
+    default:
+        return 0;
+    }
+}
+
+/// Allocates a frame of the given size and pixel format, without padding.
+///
+/// \param size
+/// \param format
+
+QXmppVideoFrame QXmppVideoConverter::createFrame(const QSize &size, QXmppVideoFrame::PixelFormat format)
+{
+    const int stride = bytesPerLine(format, size.width());
+    if (!stride || size.height() <= 0)
+        return QXmppVideoFrame();
+    return QXmppVideoFrame(frameBytes(format, stride, size.height()), size, stride, format);
+}
+
+/// Returns true if frames of the given pixel format can be converted.
+///
+/// \param format
+
+bool QXmppVideoConverter::isSupported(QXmppVideoFrame::PixelFormat format)
+{
+    return format == QXmppVideoFrame::Format_NV12 ||
+           format == QXmppVideoFrame::Format_RGB32 ||
+           format == QXmppVideoFrame::Format_UYVY ||
+           format == QXmppVideoFrame::Format_YUV420P ||
+           format == QXmppVideoFrame::Format_YUYV;
+}
+
+/// Converts a frame to a planar 4:2:0 image of the same size.
+///
+/// \param frame
+/// \param planes
+
+bool QXmppVideoConverter::toI420(const QXmppVideoFrame &frame, const QXmppYuvPlanes &planes)
+{
+    if (!isConvertible(frame))
+        return false;
+
+    const QXmppVideoKernels *k = kernels();
+    const int width = frame.width();
+    const int height = frame.height();
+    const int stride = frame.bytesPerLine();
+    const uchar *bits = frame.bits();
+
+    switch (frame.pixelFormat()) {
+    case QXmppVideoFrame::Format_YUV420P: {
+        const uchar *cb = bits + stride * height;
+        const uchar *cr = cb + (stride / 2) * (height / 2);
+        copyPlane(bits, stride, planes.data[0], planes.stride[0], width, height);
+        copyPlane(cb, stride / 2, planes.data[1], planes.stride[1], width / 2, height / 2);
+        copyPlane(cr, stride / 2, planes.data[2], planes.stride[2], width / 2, height / 2);
+        return true;
+    }
+    case QXmppVideoFrame::Format_NV12: {
+        const uchar *uv = bits + stride * height;
+        copyPlane(bits, stride, planes.data[0], planes.stride[0], width, height);
+        for (int row = 0; row < height / 2; ++row)
+            k->splitChroma(uv + row * stride,
+                           planes.data[1] + row * planes.stride[1],
+                           planes.data[2] + row * planes.stride[2],
+                           width / 2);
+        return true;
+    }
+    case QXmppVideoFrame::Format_UYVY:
+    case QXmppVideoFrame::Format_YUYV: {
+        const int lumaOffset = (frame.pixelFormat() == QXmppVideoFrame::Format_UYVY) ? 1 : 0;
+        for (int row = 0; row < height; row += 2)
+            k->packed422ToPlanar(bits + row * stride,
+                                 bits + (row + 1) * stride,
+                                 planes.data[0] + row * planes.stride[0],
+                                 planes.data[0] + (row + 1) * planes.stride[0],
+                                 planes.data[1] + (row / 2) * planes.stride[1],
+                                 planes.data[2] + (row / 2) * planes.stride[2],
+                                 width, lumaOffset);
+        return true;
+    }
+    case QXmppVideoFrame::Format_RGB32:
+        for (int row = 0; row < height; row += 2)
+            k->rgb32ToI420(bits + row * stride,
+                           bits + (row + 1) * stride,
+                           planes.data[0] + row * planes.stride[0],
+                           planes.data[0] + (row + 1) * planes.stride[0],
+                           planes.data[1] + (row / 2) * planes.stride[1],
+                           planes.data[2] + (row / 2) * planes.stride[2],
+                           width);
+        return true;
+    default:
+        return false;
+    }
+}
+
+/// Converts a planar 4:2:0 image to the pixel format of the given frame,
+/// which must have the same size as the image.
+///
+/// \param planes
+/// \param frame
+
+bool QXmppVideoConverter::fromI420(const QXmppYuvPlanes &planes, QXmppVideoFrame *frame)
+{
+    if (!isConvertible(*frame))
+        return false;
+
+    const QXmppVideoKernels *k = kernels();
+    const int width = frame->width();
+    const int height = frame->height();
+    const int stride = frame->bytesPerLine();
+    uchar *bits = frame->bits();
+
+    switch (frame->pixelFormat()) {
+    case QXmppVideoFrame::Format_YUV420P: {
+        uchar *cb = bits + stride * height;
+        uchar *cr = cb + (stride / 2) * (height / 2);
+        copyPlane(planes.data[0], planes.stride[0], bits, stride, width, height);
+        copyPlane(planes.data[1], planes.stride[1], cb, stride / 2, width / 2, height / 2);
+        copyPlane(planes.data[2], planes.stride[2], cr, stride / 2, width / 2, height / 2);
+        return true;
+    }
+    case QXmppVideoFrame::Format_NV12: {
+        uchar *uv = bits + stride * height;
+        copyPlane(planes.data[0], planes.stride[0], bits, stride, width, height);
+        for (int row = 0; row < height / 2; ++row)
+            k->mergeChroma(planes.data[1] + row * planes.stride[1],
+                           planes.data[2] + row * planes.stride[2],
+                           uv + row * stride,
+                           width / 2);
+        return true;
+    }
+    case QXmppVideoFrame::Format_UYVY:
+    case QXmppVideoFrame::Format_YUYV: {
+        const int lumaOffset = (frame->pixelFormat() == QXmppVideoFrame::Format_UYVY) ? 1 : 0;
+        for (int row = 0; row < height; ++row)
+            k->planarToPacked422(planes.data[0] + row * planes.stride[0],
+                                 planes.data[1] + (row / 2) * planes.stride[1],
+                                 planes.data[2] + (row / 2) * planes.stride[2],
+                                 bits + row * stride,
+                                 width, lumaOffset);
+        return true;
+    }
+    case QXmppVideoFrame::Format_RGB32:
+        for (int row = 0; row < height; ++row)
+            k->i420ToRgb32(planes.data[0] + row * planes.stride[0],
+                           planes.data[1] + (row / 2) * planes.stride[1],
+                           planes.data[2] + (row / 2) * planes.stride[2],
+                           bits + row * stride,
+                           width);
+        return true;
+    default:
+        return false;
+    }
+}
+
+/// Converts a YUYV or UYVY frame to a planar 4:2:2 image of the same size.
+///
+/// \param frame
+/// \param planes
+
+bool QXmppVideoConverter::toYuv422P(const QXmppVideoFrame &frame, const QXmppYuvPlanes &planes)
+{
+    const QXmppVideoFrame::PixelFormat format = frame.pixelFormat();
+    if (!isConvertible(frame) ||
+        (format != QXmppVideoFrame::Format_UYVY && format != QXmppVideoFrame::Format_YUYV))
+        return false;
+
+    const QXmppVideoKernels *k = kernels();
+    const int lumaOffset = (format == QXmppVideoFrame::Format_UYVY) ? 1 : 0;
+    for (int row = 0; row < frame.height(); ++row) {
+        const uchar *src = frame.bits() + row * frame.bytesPerLine();
+        k->packed422ToPlanar(src, src,
+                             planes.data[0] + row * planes.stride[0], 0,
+                             planes.data[1] + row * planes.stride[1],
+                             planes.data[2] + row * planes.stride[2],
+                             frame.width(), lumaOffset);
+    }
+    return true;
+}
+
+/// Converts a planar 4:2:2 image to the given YUYV or UYVY frame, which
+/// must have the same size as the image.
+///
+/// \param planes
+/// \param frame
+
+bool QXmppVideoConverter::fromYuv422P(const QXmppYuvPlanes &planes, QXmppVideoFrame *frame)
+{
+    const QXmppVideoFrame::PixelFormat format = frame->pixelFormat();
+    if (!isConvertible(*frame) ||
+        (format != QXmppVideoFrame::Format_UYVY && format != QXmppVideoFrame::Format_YUYV))
+        return false;
+
+    const QXmppVideoKernels *k = kernels();
+    const int lumaOffset = (format == QXmppVideoFrame::Format_UYVY) ? 1 : 0;
+    for (int row = 0; row < frame->height(); ++row)
+        k->planarToPacked422(planes.data[0] + row * planes.stride[0],
+                             planes.data[1] + row * planes.stride[1],
+                             planes.data[2] + row * planes.stride[2],
+                             frame->bits() + row * frame->bytesPerLine(),
+                             frame->width(), lumaOffset);
+    return true;
+}
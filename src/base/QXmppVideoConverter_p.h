@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPVIDEOCONVERTER_P_H
+#define QXMPPVIDEOCONVERTER_P_H
+
+#include "QXmppRtpChannel.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppYuvPlanes class describes the three planes of a planar Y'CbCr
+/// image, such as the buffers used by the video codecs.
+///
+
+class QXmppYuvPlanes
+{
+public:
+    uchar *data[3];
+    int stride[3];
+};
+
+/// \internal
+///
+/// The QXmppVideoConverter class converts video frames between the pixel
+/// formats of QXmppVideoFrame and the planar images used by the codecs.
+///
+/// Conversions use SSE2 or AVX2 kernels when the processor supports them,
+/// which produce exactly the same output as the portable kernels. RGB
+/// conversions use ITU-R BT.601 studio swing coefficients.
+///
+/// Frames must have an even width and height.
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppVideoConverter
+{
+public:
+    /// This enum describes the instruction sets used by the kernels.
+    enum InstructionSet {
+        Scalar = 0,
+        SSE2,
+        AVX2
+    };
+
+    static InstructionSet instructionSet();
+    static void setInstructionSet(InstructionSet set);
+    static InstructionSet supportedInstructionSet();
+
+    static int bytesPerLine(QXmppVideoFrame::PixelFormat format, int width);
+    static int frameBytes(QXmppVideoFrame::PixelFormat format, int bytesPerLine, int height);
+    static QXmppVideoFrame createFrame(const QSize &size, QXmppVideoFrame::PixelFormat format);
+    static bool isSupported(QXmppVideoFrame::PixelFormat format);
+
+    static bool toI420(const QXmppVideoFrame &frame, const QXmppYuvPlanes &planes);
+    static bool fromI420(const QXmppYuvPlanes &planes, QXmppVideoFrame *frame);
+
+    static bool toYuv422P(const QXmppVideoFrame &frame, const QXmppYuvPlanes &planes);
+    static bool fromYuv422P(const QXmppYuvPlanes &planes, QXmppVideoFrame *frame);
+};
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include "QXmppVideoConverter_p.h"
+#include "QXmppVideoFramePool_p.h"
+
+// alignment of pooled buffers, suitable for the AVX2 kernels
+static const int BUFFER_ALIGNMENT = 32;
+
+class QXmppVideoFramePoolPrivate
+{
+public:
+    ~QXmppVideoFramePoolPrivate();
+    bool recycle(QXmppVideoFrameBuffer *buffer);
+
+    QMutex mutex;
+    QList<QXmppVideoFrameBuffer*> freeBuffers;
+    int maximumFree;
+};
+
+QXmppVideoFramePoolPrivate::~QXmppVideoFramePoolPrivate()
+{
+    foreach (QXmppVideoFrameBuffer *buffer, freeBuffers) {
+        qFreeAligned(buffer->data);
+        delete buffer;
+    }
+}
+
+/// Keeps a released buffer for reuse, unless enough buffers are free.
+
+bool QXmppVideoFramePoolPrivate::recycle(QXmppVideoFrameBuffer *buffer)
+{
+    QMutexLocker locker(&mutex);
+    if (freeBuffers.size() >= maximumFree)
+        return false;
+    freeBuffers << buffer;
+    return true;
+}
+
+QXmppVideoFrameBuffer::QXmppVideoFrameBuffer(uchar *data, int capacity, bool owned)
+    : data(data)
+    , capacity(capacity)
+    , owned(owned)
+{
+}
+
+/// Returns a buffer to its pool once no frame uses it, or frees it.
+
+void QXmppVideoFrameBuffer::release(QXmppVideoFrameBuffer *buffer)
+{
+    QSharedPointer<QXmppVideoFramePoolPrivate> pool = buffer->pool.toStrongRef();
+    if (pool && pool->recycle(buffer))
+        return;
+
+    if (buffer->owned)
+        qFreeAligned(buffer->data);
+    delete buffer;
+}
+
+/// Constructs a new frame pool.
+///
+/// \param maximumFree The maximum number of unused buffers kept for reuse.
+
+QXmppVideoFramePool::QXmppVideoFramePool(int maximumFree)
+    : d(new QXmppVideoFramePoolPrivate)
+{
+    d->maximumFree = maximumFree;
+}
+
+QXmppVideoFramePool::~QXmppVideoFramePool()
+{
+}
+
+/// Returns a frame of the given size and pixel format, reusing a free
+/// buffer if possible. The frame's contents are undefined.
+///
+/// \param size
+/// \param format
+
+QXmppVideoFrame QXmppVideoFramePool::createFrame(const QSize &size, QXmppVideoFrame::PixelFormat format)
+{
+    const int bytesPerLine = QXmppVideoConverter::bytesPerLine(format, size.width());
+    if (!bytesPerLine || size.height() <= 0)
+        return QXmppVideoFrame();
+    const int bytes = QXmppVideoConverter::frameBytes(format, bytesPerLine, size.height());
+
+    QXmppVideoFrameBuffer *buffer = 0;
+    {
+        QMutexLocker locker(&d->mutex);
+        while (!buffer && !d->freeBuffers.isEmpty()) {
+            buffer = d->freeBuffers.takeLast();
+
+            // the frame size grew, drop the smaller buffer
+            if (buffer->capacity < bytes) {
+                qFreeAligned(buffer->data);
+                delete buffer;
+                buffer = 0;
+            }
+        }
+    }
+
+    if (!buffer) {
+        buffer = new QXmppVideoFrameBuffer((uchar*) qMallocAligned(bytes, BUFFER_ALIGNMENT), bytes, true);
+        buffer->pool = d;
+    }
+
+    return QXmppVideoFrame(QSharedPointer<QXmppVideoFrameBuffer>(buffer, QXmppVideoFrameBuffer::release),
+                           bytes, size, bytesPerLine, format);
+}
+
+/// Returns the number of unused buffers kept for reuse.
+
+int QXmppVideoFramePool::freeCount() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->freeBuffers.size();
+}
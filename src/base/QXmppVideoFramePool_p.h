@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPVIDEOFRAMEPOOL_P_H
+#define QXMPPVIDEOFRAMEPOOL_P_H
+
+#include <QSharedPointer>
+
+#include "QXmppRtpChannel.h"
+
+class QXmppVideoFramePoolPrivate;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppVideoFrameBuffer class holds the data of a QXmppVideoFrame which
+/// is either allocated by a QXmppVideoFramePool or provided by the
+/// application.
+///
+
+class QXmppVideoFrameBuffer
+{
+public:
+    QXmppVideoFrameBuffer(uchar *data, int capacity, bool owned);
+
+    static void release(QXmppVideoFrameBuffer *buffer);
+
+    uchar *data;
+    int capacity;
+    bool owned;
+    QWeakPointer<QXmppVideoFramePoolPrivate> pool;
+};
+
+/// \internal
+///
+/// The QXmppVideoFramePool class allocates video frames whose buffers are
+/// recycled once the last copy of the frame is destroyed, so that decoding
+/// a video stream does not allocate a buffer for each frame.
+///
+/// Frames may outlive the pool and be released from any thread.
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppVideoFramePool
+{
+public:
+    QXmppVideoFramePool(int maximumFree = 4);
+    ~QXmppVideoFramePool();
+
+    QXmppVideoFrame createFrame(const QSize &size, QXmppVideoFrame::PixelFormat format);
+    int freeCount() const;
+
+private:
+    Q_DISABLE_COPY(QXmppVideoFramePool)
+    QSharedPointer<QXmppVideoFramePoolPrivate> d;
+};
+
+#endif
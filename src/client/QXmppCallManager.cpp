@@ -342,6 +342,7 @@ QXmppCallPrivate::Stream *QXmppCallPrivate::createStream(const QString &media)
 
     if (channelObject) {
         QXmppIceComponent *rtpComponent = stream->connection->component(RTP_COMPONENT);
+        QXmppIceComponent *rtcpComponent = stream->connection->component(RTCP_COMPONENT);
 
         check = QObject::connect(rtpComponent, SIGNAL(datagramReceived(QByteArray)),
                         channelObject, SLOT(datagramReceived(QByteArray)));
@@ -350,6 +351,20 @@ QXmppCallPrivate::Stream *QXmppCallPrivate::createStream(const QString &media)
         check = QObject::connect(channelObject, SIGNAL(sendDatagram(QByteArray)),
                         rtpComponent, SLOT(sendDatagram(QByteArray)));
         Q_ASSERT(check);
+
+        // receiver reports and feedback messages
+        check = QObject::connect(rtcpComponent, SIGNAL(datagramReceived(QByteArray)),
+                        channelObject, SLOT(controlDatagramReceived(QByteArray)));
+        Q_ASSERT(check);
+    }
+
+    // video feedback (retransmission and key frame requests)
+    if (media == VIDEO_MEDIA) {
+        QXmppIceComponent *rtcpComponent = stream->connection->component(RTCP_COMPONENT);
+
+        check = QObject::connect(channelObject, SIGNAL(sendControlDatagram(QByteArray)),
+                        rtcpComponent, SLOT(sendDatagram(QByteArray)));
+        Q_ASSERT(check);
     }
     return stream;
 }
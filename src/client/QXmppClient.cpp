@@ -25,11 +25,13 @@
 #include <QTimer>
 
 #include "QXmppClient.h"
+#include "QXmppClient_p.h"
 #include "QXmppClientExtension.h"
 #include "QXmppConstants_p.h"
 #include "QXmppLogger.h"
 #include "QXmppOutgoingClient.h"
 #include "QXmppMessage.h"
+#include "QXmppProfiler_p.h"
 #include "QXmppUtils.h"
 
 #include "QXmppRosterManager.h"
@@ -39,27 +41,8 @@
 #include "QXmppDiscoveryManager.h"
 #include "QXmppDiscoveryIq.h"
 
-class QXmppClientPrivate
-{
-public:
-    QXmppClientPrivate(QXmppClient *qq);
-
-    QXmppPresence clientPresence;                   ///< Current presence of the client
-    QList<QXmppClientExtension*> extensions;
-    QXmppLogger *logger;
-    QXmppOutgoingClient *stream;                    ///< Pointer to the XMPP stream
-
-    // reconnection
-    bool receivedConflict;
-    int reconnectionTries;
-    QTimer *reconnectionTimer;
-
-    void addProperCapability(QXmppPresence& presence);
-    int getNextReconnectTime() const;
-
-private:
-    QXmppClient *q;
-};
+// interval at which the event loop lag is measured, in milliseconds
+static const int LAG_INTERVAL = 1000;
 
 QXmppClientPrivate::QXmppClientPrivate(QXmppClient *qq)
     : clientPresence(QXmppPresence::Available)
@@ -68,8 +51,11 @@ QXmppClientPrivate::QXmppClientPrivate(QXmppClient *qq)
     , receivedConflict(false)
     , reconnectionTries(0)
     , reconnectionTimer(0)
+    , iqTimer(0)
+    , lagTimer(0)
     , q(qq)
 {
+    iqClock.start();
 }
 
 void QXmppClientPrivate::addProperCapability(QXmppPresence& presence)
@@ -78,20 +64,91 @@ void QXmppClientPrivate::addProperCapability(QXmppPresence& presence)
     if(ext) {
         presence.setCapabilityHash("sha-1");
         presence.setCapabilityNode(ext->clientCapabilitiesNode());
-        presence.setCapabilityVer(ext->capabilities().verificationString());
+        presence.setCapabilityVer(ext->capabilitiesVer());
     }
 }
 
-int QXmppClientPrivate::getNextReconnectTime() const
+/// Cancels all the pending IQ requests, for instance on disconnection.
+
+void QXmppClientPrivate::cancelIqs()
 {
-    if (reconnectionTries < 5)
-        return 10 * 1000;
-    else if (reconnectionTries < 10)
-        return 20 * 1000;
-    else if (reconnectionTries < 15)
-        return 40 * 1000;
-    else
-        return 60 * 1000;
+    const QHash<QString, PendingIq> pending = pendingIqs;
+    pendingIqs.clear();
+    iqDeadlines.clear();
+    if (iqTimer)
+        iqTimer->stop();
+
+    foreach (PendingIq request, pending) {
+        request.interface.reportCanceled();
+        request.interface.reportFinished();
+    }
+}
+
+/// Delivers an IQ response to the request it answers.
+///
+/// Returns true if the response matched a pending request.
+
+bool QXmppClientPrivate::handleIqResponse(const QDomElement &element)
+{
+    const QString id = element.attribute("id");
+    QHash<QString, PendingIq>::iterator it = pendingIqs.find(id);
+    if (it == pendingIqs.end())
+        return false;
+
+    // only accept the response from the entity the request was sent to,
+    // requests without a recipient are answered by our own account
+    const QString from = element.attribute("from");
+    if (from != it->to) {
+        const QString bareJid = stream->configuration().jidBare();
+        if (!it->to.isEmpty() && it->to != bareJid)
+            return false;
+        if (!from.isEmpty() && from != bareJid && from != stream->configuration().domain())
+            return false;
+    }
+
+    PendingIq request = it.value();
+    pendingIqs.erase(it);
+    removeIqDeadline(id, request.deadline);
+
+    request.interface.reportResult(element);
+    request.interface.reportFinished();
+    return true;
+}
+
+void QXmppClientPrivate::removeIqDeadline(const QString &id, qint64 deadline)
+{
+    if (deadline < 0)
+        return;
+
+    iqDeadlines.remove(deadline, id);
+    scheduleIqTimer();
+}
+
+/// Arms the timer for the earliest pending IQ deadline.
+
+void QXmppClientPrivate::scheduleIqTimer()
+{
+    if (iqDeadlines.isEmpty()) {
+        iqTimer->stop();
+        return;
+    }
+
+    const qint64 delay = iqDeadlines.firstKey() - iqClock.elapsed();
+    iqTimer->start(int(qMax(delay, qint64(0))));
+}
+
+/// Returns the delay before the next reconnection attempt, in milliseconds.
+///
+/// \param tries The number of failed attempts since the last connection.
+
+int QXmppClientPrivate::getNextReconnectTime(int tries)
+{
+    // double the delay after each failed attempt, up to one minute
+    const int delay = qMin(5000 << qMin(qMax(tries, 0), 4), 60 * 1000);
+
+    // spread reconnections over the second half of the delay, so that
+    // clients disconnected at the same time do not reconnect in lockstep
+    return delay / 2 + qrand() % (delay / 2 + 1);
 }
 
 /// Creates a QXmppClient object.
@@ -151,6 +208,21 @@ QXmppClient::QXmppClient(QObject *parent)
             this, SLOT(_q_reconnect()));
     Q_ASSERT(check);
 
+    // IQ request timeouts
+    d->iqTimer = new QTimer(this);
+    d->iqTimer->setSingleShot(true);
+    check = connect(d->iqTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_iqTimeout()));
+    Q_ASSERT(check);
+
+    // event loop lag
+    d->lagTimer = new QTimer(this);
+    d->lagTimer->setInterval(LAG_INTERVAL);
+    d->lagTimer->setTimerType(Qt::PreciseTimer);
+    check = connect(d->lagTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_lagTimeout()));
+    Q_ASSERT(check);
+
     // logging
     setLogger(QXmppLogger::getLogger());
 
@@ -166,6 +238,7 @@ QXmppClient::QXmppClient(QObject *parent)
 
 QXmppClient::~QXmppClient()
 {
+    d->cancelIqs();
     delete d;
 }
 
@@ -284,6 +357,52 @@ bool QXmppClient::sendPacket(const QXmppStanza& packet)
     return d->stream->sendPacket(packet);
 }
 
+/// Sends an IQ request and returns a future for its response.
+///
+/// The future's result is the \c result or \c error IQ which answers the
+/// request, use QFutureWatcher to be notified when it is available. If no
+/// response is received within \a timeout milliseconds, if the request could
+/// not be sent or if the client disconnects, the future is canceled.
+///
+/// Responses are matched to requests using the IQ's id, and are not
+/// delivered to the extensions nor to the iqReceived() signal.
+///
+/// \param iq A \c get or \c set IQ with a unique id.
+/// \param timeout The timeout in milliseconds, or -1 to wait indefinitely.
+///
+
+QFuture<QDomElement> QXmppClient::sendIq(const QXmppIq &iq, int timeout)
+{
+    QXmppClientPrivate::PendingIq request;
+    request.interface.reportStarted();
+
+    const QString id = iq.id();
+    if ((iq.type() != QXmppIq::Get && iq.type() != QXmppIq::Set) ||
+        id.isEmpty() || d->pendingIqs.contains(id)) {
+        warning(QString("Refusing to send IQ request with invalid type or id %1").arg(id));
+        request.interface.reportCanceled();
+        request.interface.reportFinished();
+        return request.interface.future();
+    }
+
+    if (!sendPacket(iq)) {
+        request.interface.reportCanceled();
+        request.interface.reportFinished();
+        return request.interface.future();
+    }
+
+    request.to = iq.to();
+    request.deadline = -1;
+    if (timeout >= 0) {
+        request.deadline = d->iqClock.elapsed() + timeout;
+        d->iqDeadlines.insert(request.deadline, id);
+        if (d->iqDeadlines.firstKey() == request.deadline)
+            d->scheduleIqTimer();
+    }
+    d->pendingIqs.insert(id, request);
+    return request.interface.future();
+}
+
 /// Disconnects the client and the current presence of client changes to
 /// QXmppPresence::Unavailable and status text changes to "Logged out".
 ///
@@ -320,6 +439,13 @@ bool QXmppClient::isConnected() const
     return d->stream->isConnected();
 }
 
+/// Returns true if the server supports XEP-0237: Roster Versioning.
+
+bool QXmppClient::isRosterVersioningSupported() const
+{
+    return d->stream->isRosterVersioningSupported();
+}
+
 /// Returns the reference to QXmppRosterManager object of the client.
 /// \return Reference to the roster object of the connected client. Use this to
 /// get the list of friends in the roster and their presence information.
@@ -460,9 +586,21 @@ QXmppVersionManager& QXmppClient::versionManager()
 
 void QXmppClient::_q_elementReceived(const QDomElement &element, bool &handled)
 {
+    if (element.tagName() == "iq" && !d->pendingIqs.isEmpty()) {
+        const QString type = element.attribute("type");
+        if ((type == "result" || type == "error") && d->handleIqResponse(element)) {
+            handled = true;
+            return;
+        }
+    }
+
+    QXmppProfilerSample sample;
     foreach (QXmppClientExtension *extension, d->extensions)
     {
-        if (extension->handleStanza(element))
+        const bool extensionHandled = extension->handleStanza(element);
+        if (sample.isActive())
+            sample.record(QLatin1String("client.handleStanza.") + extension->metaObject()->className());
+        if (extensionHandled)
         {
             handled = true;
             return;
@@ -470,6 +608,29 @@ void QXmppClient::_q_elementReceived(const QDomElement &element, bool &handled)
     }
 }
 
+/// Cancels the IQ requests whose deadline has passed.
+
+void QXmppClient::_q_iqTimeout()
+{
+    const qint64 now = d->iqClock.elapsed();
+    while (!d->iqDeadlines.isEmpty() && d->iqDeadlines.firstKey() <= now) {
+        const QString id = d->iqDeadlines.take(d->iqDeadlines.firstKey());
+        QXmppClientPrivate::PendingIq request = d->pendingIqs.take(id);
+        info(QString("IQ request %1 timed out").arg(id));
+        request.interface.reportCanceled();
+        request.interface.reportFinished();
+    }
+    d->scheduleIqTimer();
+}
+
+/// Records how late the event loop fired the lag timer.
+
+void QXmppClient::_q_lagTimeout()
+{
+    const qint64 lag = qMax(d->lagClock.restart() - LAG_INTERVAL, qint64(0));
+    QXmppProfiler::record("client.event-loop.lag", lag * 1000);
+}
+
 void QXmppClient::_q_reconnect()
 {
     if (d->stream->configuration().autoReconnectionEnabled()) {
@@ -491,6 +652,12 @@ void QXmppClient::_q_streamConnected()
     d->receivedConflict = false;
     d->reconnectionTries = 0;
 
+    // measure the event loop lag while profiling
+    if (QXmppProfiler::isEnabled()) {
+        d->lagTimer->start();
+        d->lagClock.start();
+    }
+
     // notify managers
     emit connected();
     emit stateChanged(QXmppClient::ConnectedState);
@@ -502,6 +669,10 @@ void QXmppClient::_q_streamConnected()
 
 void QXmppClient::_q_streamDisconnected()
 {
+    // responses to pending requests will never arrive
+    d->cancelIqs();
+    d->lagTimer->stop();
+
     // notify managers
     emit disconnected();
     emit stateChanged(QXmppClient::DisconnectedState);
@@ -516,7 +687,8 @@ void QXmppClient::_q_streamError(QXmppClient::Error err)
                 d->receivedConflict = true;
         } else if (err == QXmppClient::SocketError && !d->receivedConflict) {
             // schedule reconnect
-            d->reconnectionTimer->start(d->getNextReconnectTime());
+            d->reconnectionTimer->start(QXmppClientPrivate::getNextReconnectTime(d->reconnectionTries));
+            d->reconnectionTries++;
         } else if (err == QXmppClient::KeepAliveError) {
             // if we got a keepalive error, reconnect in one second
             d->reconnectionTimer->start(1000);
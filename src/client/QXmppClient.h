@@ -26,6 +26,8 @@
 
 #include <QObject>
 #include <QAbstractSocket>
+#include <QDomElement>
+#include <QFuture>
 
 #include "QXmppConfiguration.h"
 #include "QXmppLogger.h"
@@ -139,6 +141,7 @@ public:
 
     bool isAuthenticated() const;
     bool isConnected() const;
+    bool isRosterVersioningSupported() const;
 
     QXmppPresence clientPresence() const;
     void setClientPresence(const QXmppPresence &presence);
@@ -156,6 +159,8 @@ public:
     QXmppVCardManager& vCardManager();
     QXmppVersionManager& versionManager();
 
+    QFuture<QDomElement> sendIq(const QXmppIq &iq, int timeout = 30000);
+
 signals:
 
     /// This signal is emitted when the client connects successfully to the XMPP
@@ -230,6 +235,8 @@ public slots:
 
 private slots:
     void _q_elementReceived(const QDomElement &element, bool &handled);
+    void _q_iqTimeout();
+    void _q_lagTimeout();
     void _q_reconnect();
     void _q_socketStateChanged(QAbstractSocket::SocketState state);
     void _q_streamConnected();
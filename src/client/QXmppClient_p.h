@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPCLIENT_P_H
+#define QXMPPCLIENT_P_H
+
+#include <QDomElement>
+#include <QElapsedTimer>
+#include <QFutureInterface>
+#include <QHash>
+#include <QMultiMap>
+
+#include "QXmppPresence.h"
+
+class QTimer;
+class QXmppClient;
+class QXmppClientExtension;
+class QXmppLogger;
+class QXmppOutgoingClient;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+class QXMPP_AUTOTEST_EXPORT QXmppClientPrivate
+{
+public:
+    QXmppClientPrivate(QXmppClient *qq);
+
+    QXmppPresence clientPresence;                   ///< Current presence of the client
+    QList<QXmppClientExtension*> extensions;
+    QXmppLogger *logger;
+    QXmppOutgoingClient *stream;                    ///< Pointer to the XMPP stream
+
+    // reconnection
+    bool receivedConflict;
+    int reconnectionTries;
+    QTimer *reconnectionTimer;
+
+    // IQ requests awaiting a response, indexed by id
+    struct PendingIq
+    {
+        QFutureInterface<QDomElement> interface;
+        QString to;
+        qint64 deadline;
+    };
+    QHash<QString, PendingIq> pendingIqs;
+    QMultiMap<qint64, QString> iqDeadlines;
+    QElapsedTimer iqClock;
+    QTimer *iqTimer;
+
+    // event loop lag, measured while profiling
+    QElapsedTimer lagClock;
+    QTimer *lagTimer;
+
+    void addProperCapability(QXmppPresence& presence);
+    void cancelIqs();
+    bool handleIqResponse(const QDomElement &element);
+    void removeIqDeadline(const QString &id, qint64 deadline);
+    void scheduleIqTimer();
+
+    static int getNextReconnectTime(int tries);
+
+private:
+    QXmppClient *q;
+};
+
+#endif
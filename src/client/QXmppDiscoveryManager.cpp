@@ -23,29 +23,143 @@
 
 #include "QXmppDiscoveryManager.h"
 
+#include <QDataStream>
 #include <QDomElement>
 #include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QTimer>
 
 #include "QXmppClient.h"
 #include "QXmppConstants_p.h"
 #include "QXmppDataForm.h"
 #include "QXmppDiscoveryIq.h"
+#include "QXmppPresence.h"
 #include "QXmppStream.h"
 #include "QXmppGlobal.h"
 
+// capabilities cache file layout: a header followed by a sequence of records
+static const quint32 cacheMagic = 0x51584543;
+static const quint32 cacheVersion = 1;
+
+// number of times an unanswered capabilities request is sent again to the
+// same entity
+static const int capabilitiesRetries = 1;
+
+static QString capabilitiesKey(const QString &hash, const QByteArray &ver)
+{
+    return hash + QLatin1Char(' ') + QString::fromLatin1(ver.toBase64());
+}
+
 class QXmppDiscoveryManagerPrivate
 {
 public:
+    struct CapabilitiesRequest
+    {
+        QString hash;
+        QByteArray ver;
+        QString node;
+        QStringList jids;
+        int attempts;
+        qint64 deadline;
+    };
+
+    QXmppDiscoveryManagerPrivate(QXmppDiscoveryManager *qq);
+
+    bool appendCache(const QString &key, const QXmppDiscoveryIq &info);
+    QString sendCapabilitiesRequest(CapabilitiesRequest request);
+
     QString clientCapabilitiesNode;
     QString clientCategory;
     QString clientType;
     QString clientName;
     QXmppDataForm clientInfoForm;
+
+    // our own capabilities, which are only computed again when the
+    // extensions or the identity change
+    QXmppDiscoveryIq capabilities;
+    QByteArray capabilitiesVer;
+    QList<QXmppClientExtension*> capabilitiesExtensions;
+    bool capabilitiesValid;
+
+    // capabilities of other entities, indexed by hash and verification string
+    QHash<QString, QXmppDiscoveryIq> capabilitiesCache;
+    QString capabilitiesCachePath;
+
+    // pending capabilities requests, indexed by request id
+    QHash<QString, CapabilitiesRequest> capabilitiesRequests;
+    QHash<QString, QString> capabilitiesRequestIds;
+    QElapsedTimer capabilitiesClock;
+    QTimer *capabilitiesTimer;
+    int capabilitiesTimeout;
+
+private:
+    QXmppDiscoveryManager *q;
 };
 
+QXmppDiscoveryManagerPrivate::QXmppDiscoveryManagerPrivate(QXmppDiscoveryManager *qq)
+    : capabilitiesValid(false)
+    , capabilitiesTimer(0)
+    , capabilitiesTimeout(30000)
+    , q(qq)
+{
+    capabilitiesClock.start();
+}
+
+/// Appends an entry to the capabilities cache file.
+
+bool QXmppDiscoveryManagerPrivate::appendCache(const QString &key, const QXmppDiscoveryIq &info)
+{
+    if (capabilitiesCachePath.isEmpty())
+        return true;
+
+    QFile file(capabilitiesCachePath);
+    const bool exists = file.exists() && file.size() > 0;
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append))
+        return false;
+
+    QByteArray data;
+    QXmlStreamWriter xmlStream(&data);
+    info.toXml(&xmlStream);
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    if (!exists)
+        stream << cacheMagic << cacheVersion;
+    stream << key << data;
+    return stream.status() == QDataStream::Ok && file.flush();
+}
+
+/// Sends a capabilities request to the first of its entities and returns
+/// its id, or an empty string if it could not be sent.
+
+QString QXmppDiscoveryManagerPrivate::sendCapabilitiesRequest(CapabilitiesRequest request)
+{
+    const QString id = q->requestInfo(request.jids.first(), request.node);
+    if (id.isEmpty())
+        return id;
+
+    request.deadline = capabilitiesClock.elapsed() + capabilitiesTimeout;
+    capabilitiesRequests.insert(id, request);
+    capabilitiesRequestIds.insert(capabilitiesKey(request.hash, request.ver), id);
+    if (!capabilitiesTimer->isActive())
+        capabilitiesTimer->start(capabilitiesTimeout);
+    return id;
+}
+
 QXmppDiscoveryManager::QXmppDiscoveryManager()
-    : d(new QXmppDiscoveryManagerPrivate)
+    : d(new QXmppDiscoveryManagerPrivate(this))
 {
+    bool check;
+    Q_UNUSED(check);
+
+    d->capabilitiesTimer = new QTimer(this);
+    d->capabilitiesTimer->setSingleShot(true);
+    check = connect(d->capabilitiesTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_capabilitiesTimeout()));
+    Q_ASSERT(check);
+
     d->clientCapabilitiesNode = "https://github.com/qxmpp-project/qxmpp";
     d->clientCategory = "client";
     d->clientType = "pc";
@@ -99,9 +213,16 @@ QString QXmppDiscoveryManager::requestItems(const QString& jid, const QString& n
 }
 
 /// Returns the client's full capabilities.
+///
+/// The result is computed again only when the client's extensions or
+/// identity change.
 
 QXmppDiscoveryIq QXmppDiscoveryManager::capabilities()
 {
+    const QList<QXmppClientExtension*> extensions = client()->extensions();
+    if (d->capabilitiesValid && d->capabilitiesExtensions == extensions)
+        return d->capabilities;
+
     QXmppDiscoveryIq iq;
     iq.setType(QXmppIq::Result);
     iq.setQueryType(QXmppDiscoveryIq::InfoQuery);
@@ -118,7 +239,7 @@ QXmppDiscoveryIq QXmppDiscoveryManager::capabilities()
         << ns_attention         // XEP-0224: Attention
         << ns_chat_markers;     // XEP-0333: Chat Markers
 
-    foreach(QXmppClientExtension* extension, client()->extensions())
+    foreach(QXmppClientExtension* extension, extensions)
     {
         if(extension)
             features << extension->discoveryFeatures();
@@ -135,7 +256,7 @@ QXmppDiscoveryIq QXmppDiscoveryManager::capabilities()
     identity.setName(clientName());
     identities << identity;
 
-    foreach(QXmppClientExtension* extension, client()->extensions())
+    foreach(QXmppClientExtension* extension, extensions)
     {
         if(extension)
             identities << extension->discoveryIdentities();
@@ -147,9 +268,22 @@ QXmppDiscoveryIq QXmppDiscoveryManager::capabilities()
     if (!d->clientInfoForm.isNull())
         iq.setForm(d->clientInfoForm);
 
+    d->capabilities = iq;
+    d->capabilitiesVer = iq.verificationString();
+    d->capabilitiesExtensions = extensions;
+    d->capabilitiesValid = true;
     return iq;
 }
 
+/// Returns the verification string of the client's capabilities, as
+/// defined by XEP-0115: Entity Capabilities.
+
+QByteArray QXmppDiscoveryManager::capabilitiesVer()
+{
+    capabilities();
+    return d->capabilitiesVer;
+}
+
 /// Sets the capabilities node of the local XMPP client.
 ///
 /// \param node
@@ -169,6 +303,7 @@ void QXmppDiscoveryManager::setClientCapabilitiesNode(const QString &node)
 void QXmppDiscoveryManager::setClientCategory(const QString& category)
 {
     d->clientCategory = category;
+    d->capabilitiesValid = false;
 }
 
 /// Sets the type of the local XMPP client.
@@ -181,6 +316,7 @@ void QXmppDiscoveryManager::setClientCategory(const QString& category)
 void QXmppDiscoveryManager::setClientType(const QString& type)
 {
     d->clientType = type;
+    d->capabilitiesValid = false;
 }
 
 /// Sets the name of the local XMPP client.
@@ -190,6 +326,7 @@ void QXmppDiscoveryManager::setClientType(const QString& type)
 void QXmppDiscoveryManager::setClientName(const QString& name)
 {
     d->clientName = name;
+    d->capabilitiesValid = false;
 }
 
 /// Returns the capabilities node of the local XMPP client.
@@ -242,6 +379,154 @@ QXmppDataForm QXmppDiscoveryManager::clientInfoForm() const
 void QXmppDiscoveryManager::setClientInfoForm(const QXmppDataForm &form)
 {
     d->clientInfoForm = form;
+    d->capabilitiesValid = false;
+}
+
+/// Returns the path of the file where the capabilities of other entities
+/// are cached.
+
+QString QXmppDiscoveryManager::capabilitiesCachePath() const
+{
+    return d->capabilitiesCachePath;
+}
+
+/// Sets the path of the file where the capabilities of other entities are
+/// cached, and reads the capabilities it holds.
+///
+/// \param path
+
+void QXmppDiscoveryManager::setCapabilitiesCachePath(const QString &path)
+{
+    if (path == d->capabilitiesCachePath)
+        return;
+    d->capabilitiesCachePath = path;
+
+    QFile file(path);
+    if (path.isEmpty() || !file.exists())
+        return;
+
+    if (!file.open(QIODevice::ReadWrite)) {
+        warning(QString("Could not open capabilities cache %1").arg(path));
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic, version;
+    stream >> magic >> version;
+    if (stream.status() != QDataStream::Ok || magic != cacheMagic || version != cacheVersion) {
+        warning(QString("Invalid capabilities cache %1").arg(path));
+        return;
+    }
+
+    qint64 validSize = file.pos();
+    while (!stream.atEnd()) {
+        QString key;
+        QByteArray data;
+        stream >> key >> data;
+
+        QDomDocument doc;
+        if (stream.status() != QDataStream::Ok || !doc.setContent(data, true))
+            break;
+
+        QXmppDiscoveryIq info;
+        info.parse(doc.documentElement());
+        d->capabilitiesCache.insert(key, info);
+        validSize = file.pos();
+    }
+
+    // discard a truncated record
+    if (validSize < file.size()) {
+        warning(QString("Discarding truncated capabilities cache record in %1").arg(path));
+        file.resize(validSize);
+    }
+}
+
+/// Returns true if the capabilities for the given hash and verification
+/// string are cached.
+///
+/// \param hash The hash function, as advertised in presence.
+/// \param ver The verification string, as advertised in presence.
+
+bool QXmppDiscoveryManager::hasCachedCapabilities(const QString &hash, const QByteArray &ver) const
+{
+    return d->capabilitiesCache.contains(capabilitiesKey(hash, ver));
+}
+
+/// Returns the cached capabilities for the given hash and verification
+/// string.
+///
+/// \param hash The hash function, as advertised in presence.
+/// \param ver The verification string, as advertised in presence.
+
+QXmppDiscoveryIq QXmppDiscoveryManager::cachedCapabilities(const QString &hash, const QByteArray &ver) const
+{
+    return d->capabilitiesCache.value(capabilitiesKey(hash, ver));
+}
+
+/// Requests the capabilities advertised in a presence.
+///
+/// If the capabilities are already cached, the capabilitiesReceived() signal
+/// is emitted immediately and no request is sent. If a request for the same
+/// capabilities is already in progress, the sender of the presence is added
+/// to it. Replies which match their SHA-1 verification string are cached.
+///
+/// \param presence
+/// \return the id of the request, or an empty string if no request is needed.
+
+QString QXmppDiscoveryManager::requestCapabilities(const QXmppPresence &presence)
+{
+    const QString jid = presence.from();
+    const QByteArray ver = presence.capabilityVer();
+    if (jid.isEmpty() || ver.isEmpty())
+        return QString();
+
+    const QString hash = presence.capabilityHash();
+    const QString key = capabilitiesKey(hash, ver);
+
+    QHash<QString, QXmppDiscoveryIq>::const_iterator cached = d->capabilitiesCache.constFind(key);
+    if (cached != d->capabilitiesCache.constEnd()) {
+        QXmppDiscoveryIq info = cached.value();
+        info.setFrom(jid);
+        emit capabilitiesReceived(jid, info);
+        return QString();
+    }
+
+    // join a pending request for the same capabilities
+    const QString pendingId = d->capabilitiesRequestIds.value(key);
+    if (!pendingId.isEmpty()) {
+        d->capabilitiesRequests[pendingId].jids << jid;
+        return pendingId;
+    }
+
+    QXmppDiscoveryManagerPrivate::CapabilitiesRequest request;
+    request.hash = hash;
+    request.ver = ver;
+    request.node = presence.capabilityNode() + QLatin1Char('#') + QString::fromLatin1(ver.toBase64());
+    request.jids << jid;
+    request.attempts = 0;
+    return d->sendCapabilitiesRequest(request);
+}
+
+/// Returns the time in milliseconds after which an unanswered capabilities
+/// request is sent again.
+///
+/// The default value is 30 seconds.
+
+int QXmppDiscoveryManager::capabilitiesTimeout() const
+{
+    return d->capabilitiesTimeout;
+}
+
+/// Sets the time in milliseconds after which an unanswered capabilities
+/// request is sent again.
+///
+/// \param timeout
+
+void QXmppDiscoveryManager::setCapabilitiesTimeout(int timeout)
+{
+    d->capabilitiesTimeout = timeout;
 }
 
 /// \cond
@@ -279,6 +564,47 @@ bool QXmppDiscoveryManager::handleStanza(const QDomElement &element)
         case QXmppIq::Error:
             // handle all replies
             if (receivedIq.queryType() == QXmppDiscoveryIq::InfoQuery) {
+                QHash<QString, QXmppDiscoveryManagerPrivate::CapabilitiesRequest>::iterator it = d->capabilitiesRequests.find(receivedIq.id());
+                if (it != d->capabilitiesRequests.end()) {
+                    QXmppDiscoveryManagerPrivate::CapabilitiesRequest request = it.value();
+                    const QString key = capabilitiesKey(request.hash, request.ver);
+                    d->capabilitiesRequests.erase(it);
+                    d->capabilitiesRequestIds.remove(key);
+
+                    const QString jid = request.jids.takeFirst();
+                    if (receivedIq.type() == QXmppIq::Result) {
+                        if (request.hash == QLatin1String("sha-1") &&
+                            receivedIq.verificationString() == request.ver) {
+                            // the reply is valid for all entities advertising
+                            // the same verification string
+                            QXmppDiscoveryIq info = receivedIq;
+                            info.setId(QString());
+                            info.setFrom(QString());
+                            info.setTo(QString());
+                            d->capabilitiesCache.insert(key, info);
+                            if (!d->appendCache(key, info))
+                                warning(QString("Could not write to capabilities cache %1").arg(d->capabilitiesCachePath));
+
+                            request.jids.prepend(jid);
+                            foreach (const QString &entity, request.jids) {
+                                info.setFrom(entity);
+                                emit capabilitiesReceived(entity, info);
+                            }
+                            request.jids.clear();
+                        } else {
+                            // only trust the reply for the entity which sent it
+                            if (request.hash == QLatin1String("sha-1"))
+                                warning(QString("Capabilities of %1 do not match their verification string").arg(jid));
+                            emit capabilitiesReceived(jid, receivedIq);
+                        }
+                    }
+
+                    // ask the next entity which advertised the same capabilities
+                    if (!request.jids.isEmpty()) {
+                        request.attempts = 0;
+                        d->sendCapabilitiesRequest(request);
+                    }
+                }
                 emit infoReceived(receivedIq);
             } else if (receivedIq.queryType() == QXmppDiscoveryIq::ItemsQuery) {
                 emit itemsReceived(receivedIq);
@@ -292,4 +618,62 @@ bool QXmppDiscoveryManager::handleStanza(const QDomElement &element)
     }
     return false;
 }
+
+void QXmppDiscoveryManager::setClient(QXmppClient *client)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    QXmppClientExtension::setClient(client);
+
+    check = connect(client, SIGNAL(disconnected()),
+                    this, SLOT(_q_disconnected()));
+    Q_ASSERT(check);
+}
 /// \endcond
+
+void QXmppDiscoveryManager::_q_capabilitiesTimeout()
+{
+    const qint64 now = d->capabilitiesClock.elapsed();
+    QList<QXmppDiscoveryManagerPrivate::CapabilitiesRequest> expired;
+    QHash<QString, QXmppDiscoveryManagerPrivate::CapabilitiesRequest>::iterator it = d->capabilitiesRequests.begin();
+    while (it != d->capabilitiesRequests.end()) {
+        if (it.value().deadline <= now) {
+            d->capabilitiesRequestIds.remove(capabilitiesKey(it.value().hash, it.value().ver));
+            expired << it.value();
+            it = d->capabilitiesRequests.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // send the request again, then ask the next entity which advertised
+    // the same capabilities
+    foreach (QXmppDiscoveryManagerPrivate::CapabilitiesRequest request, expired) {
+        if (request.attempts < capabilitiesRetries) {
+            request.attempts++;
+        } else {
+            warning(QString("Capabilities request to %1 timed out").arg(request.jids.takeFirst()));
+            request.attempts = 0;
+        }
+        if (!request.jids.isEmpty())
+            d->sendCapabilitiesRequest(request);
+    }
+
+    // wait for the next request to expire
+    qint64 deadline = -1;
+    foreach (const QXmppDiscoveryManagerPrivate::CapabilitiesRequest &request, d->capabilitiesRequests) {
+        if (deadline < 0 || request.deadline < deadline)
+            deadline = request.deadline;
+    }
+    if (deadline >= 0)
+        d->capabilitiesTimer->start(int(qMax(deadline - now, qint64(0))));
+}
+
+void QXmppDiscoveryManager::_q_disconnected()
+{
+    // replies to pending requests will never arrive
+    d->capabilitiesRequests.clear();
+    d->capabilitiesRequestIds.clear();
+    d->capabilitiesTimer->stop();
+}
@@ -29,10 +29,19 @@
 class QXmppDataForm;
 class QXmppDiscoveryIq;
 class QXmppDiscoveryManagerPrivate;
+class QXmppPresence;
 
 /// \brief The QXmppDiscoveryManager class makes it possible to discover information
 /// about other entities as defined by XEP-0030: Service Discovery.
 ///
+/// It also keeps a cache of the capabilities advertised by other entities
+/// as defined by XEP-0115: Entity Capabilities. Use requestCapabilities()
+/// when a presence is received: the information is only requested once per
+/// verification string, and can optionally be stored across sessions using
+/// setCapabilitiesCachePath(). Unanswered requests are sent again once, then
+/// to the next entity which advertised the same capabilities, and pending
+/// requests are dropped when the client disconnects.
+///
 /// \ingroup Managers
 
 class QXMPP_EXPORT QXmppDiscoveryManager : public QXmppClientExtension
@@ -44,6 +53,7 @@ public:
     ~QXmppDiscoveryManager();
 
     QXmppDiscoveryIq capabilities();
+    QByteArray capabilitiesVer();
 
     QString requestInfo(const QString& jid, const QString& node = QString());
     QString requestItems(const QString& jid, const QString& node = QString());
@@ -64,6 +74,16 @@ public:
     QXmppDataForm clientInfoForm() const;
     void setClientInfoForm(const QXmppDataForm &form);
 
+    QString capabilitiesCachePath() const;
+    void setCapabilitiesCachePath(const QString &path);
+
+    bool hasCachedCapabilities(const QString &hash, const QByteArray &ver) const;
+    QXmppDiscoveryIq cachedCapabilities(const QString &hash, const QByteArray &ver) const;
+    QString requestCapabilities(const QXmppPresence &presence);
+
+    int capabilitiesTimeout() const;
+    void setCapabilitiesTimeout(int timeout);
+
     /// \cond
     QStringList discoveryFeatures() const;
     bool handleStanza(const QDomElement &element);
@@ -76,6 +96,19 @@ signals:
     /// This signal is emitted when an items response is received.
     void itemsReceived(const QXmppDiscoveryIq&);
 
+    /// This signal is emitted when the capabilities of an entity are known,
+    /// following a call to requestCapabilities().
+    void capabilitiesReceived(const QString &jid, const QXmppDiscoveryIq &info);
+
+protected:
+    /// \cond
+    void setClient(QXmppClient *client);
+    /// \endcond
+
+private slots:
+    void _q_capabilitiesTimeout();
+    void _q_disconnected();
+
 private:
     QXmppDiscoveryManagerPrivate *d;
 };
@@ -21,7 +21,12 @@
  *
  */
 
+#include <algorithm>
+
+#include <QDataStream>
 #include <QDomElement>
+#include <QFile>
+#include <QVector>
 
 #include "QXmppMamManager.h"
 #include "QXmppMamIq.h"
@@ -31,6 +36,402 @@
 #include "QXmppMessage.h"
 #include "QXmppUtils.h"
 
+// cache file layout: a header followed by a sequence of records
+static const quint32 cacheMagic = 0x51584d43;
+static const quint32 cacheVersion = 1;
+
+// number of messages requested per page when synchronizing
+static const int syncPageSize = 100;
+
+enum CacheRecord {
+    MessageRecord = 1,
+    SyncRecord = 2
+};
+
+class QXmppMamManagerPrivate
+{
+public:
+    struct CacheEntry
+    {
+        qint64 stamp;
+        qint64 offset;
+    };
+
+    QXmppMamManagerPrivate(QXmppMamManager *qq);
+
+    void applyMessage(const QString &jid, const QString &archiveId, const QString &key, qint64 stamp, qint64 offset);
+    void cacheMessage(const QString &jid, const QString &archiveId, QXmppMessage message);
+    QString conversationJid(const QXmppMessage &message) const;
+    bool load();
+    bool openCache();
+    bool readMessage(qint64 offset, QXmppMessage *message) const;
+    void setLastArchiveId(const QString &jid, const QString &archiveId);
+    bool writeRecord(const QByteArray &record);
+
+    QString cachePath;
+    QFile *cache;
+
+    // cached messages, indexed by conversation bare JID and sorted by time
+    QHash<QString, QVector<CacheEntry> > entries;
+
+    // keys used to detect duplicate messages, by conversation bare JID
+    QHash<QString, QSet<QString> > archiveIds;
+    QHash<QString, QSet<QString> > messageKeys;
+
+    QHash<QString, QString> lastArchiveIds;
+
+    // pending synchronization queries, indexed by query id
+    QHash<QString, QString> syncQueries;
+
+private:
+    QXmppMamManager *q;
+};
+
+static bool cacheEntryLessThan(qint64 stamp, const QXmppMamManagerPrivate::CacheEntry &entry)
+{
+    return stamp < entry.stamp;
+}
+
+static bool cacheEntryStampLessThan(const QXmppMamManagerPrivate::CacheEntry &entry, qint64 stamp)
+{
+    return entry.stamp < stamp;
+}
+
+/// Returns the key used to recognise the same message received live, as a
+/// carbon copy or from the archive.
+
+static QString messageKey(const QXmppMessage &message)
+{
+    if (message.id().isEmpty())
+        return QString();
+    return QXmppUtils::jidToBareJid(message.from()) + QLatin1Char(' ') + message.id();
+}
+
+QXmppMamManagerPrivate::QXmppMamManagerPrivate(QXmppMamManager *qq)
+    : cache(0)
+    , q(qq)
+{
+}
+
+/// Adds a cached message to the in-memory index.
+
+void QXmppMamManagerPrivate::applyMessage(const QString &jid, const QString &archiveId, const QString &key, qint64 stamp, qint64 offset)
+{
+    CacheEntry entry;
+    entry.stamp = stamp;
+    entry.offset = offset;
+
+    // messages mostly arrive in order, so this is usually an append
+    QVector<CacheEntry> &list = entries[jid];
+    list.insert(std::upper_bound(list.begin(), list.end(), stamp, cacheEntryLessThan), entry);
+
+    if (!archiveId.isEmpty())
+        archiveIds[jid].insert(archiveId);
+    if (!key.isEmpty())
+        messageKeys[jid].insert(key);
+}
+
+/// Stores a message in the cache, unless it is already there.
+///
+/// \param jid The bare JID of the conversation.
+/// \param archiveId The message's archive id, if known.
+/// \param message
+
+void QXmppMamManagerPrivate::cacheMessage(const QString &jid, const QString &archiveId, QXmppMessage message)
+{
+    if (!cache || jid.isEmpty())
+        return;
+
+    const QString key = messageKey(message);
+    if ((!archiveId.isEmpty() && archiveIds.value(jid).contains(archiveId)) ||
+        (!key.isEmpty() && messageKeys.value(jid).contains(key)))
+        return;
+
+    if (!message.stamp().isValid())
+        message.setStamp(QDateTime::currentDateTimeUtc());
+    const qint64 stamp = message.stamp().toMSecsSinceEpoch();
+
+    QByteArray data;
+    QXmlStreamWriter xmlStream(&data);
+    message.toXml(&xmlStream);
+
+    QByteArray record;
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << quint8(MessageRecord) << jid << archiveId << key << stamp << data;
+
+    const qint64 offset = cache->size();
+    if (writeRecord(record))
+        applyMessage(jid, archiveId, key, stamp, offset);
+}
+
+/// Returns the bare JID of the other party in a conversation.
+
+QString QXmppMamManagerPrivate::conversationJid(const QXmppMessage &message) const
+{
+    const QString ownJid = q->client() ? q->client()->configuration().jidBare() : QString();
+    const QString bareFrom = QXmppUtils::jidToBareJid(message.from());
+    if (bareFrom.isEmpty() || bareFrom == ownJid)
+        return QXmppUtils::jidToBareJid(message.to());
+    return bareFrom;
+}
+
+/// Reads the cache file to build the in-memory index.
+///
+/// A truncated record at the end of the file, for instance following a
+/// crash during a write, is discarded.
+
+bool QXmppMamManagerPrivate::load()
+{
+    entries.clear();
+    archiveIds.clear();
+    messageKeys.clear();
+    lastArchiveIds.clear();
+
+    QFile file(cachePath);
+    if (!file.exists())
+        return true;
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        q->warning(QString("Could not open message cache %1").arg(cachePath));
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic, version;
+    stream >> magic >> version;
+    if (stream.status() != QDataStream::Ok || magic != cacheMagic || version != cacheVersion) {
+        q->warning(QString("Invalid message cache %1").arg(cachePath));
+        return false;
+    }
+
+    qint64 validSize = file.pos();
+    while (!stream.atEnd()) {
+        quint8 type;
+        QString jid, archiveId;
+        stream >> type >> jid >> archiveId;
+
+        if (type == MessageRecord) {
+            QString key;
+            qint64 stamp;
+            QByteArray data;
+            stream >> key >> stamp >> data;
+            if (stream.status() != QDataStream::Ok)
+                break;
+            applyMessage(jid, archiveId, key, stamp, validSize);
+        } else if (type == SyncRecord) {
+            if (stream.status() != QDataStream::Ok)
+                break;
+            lastArchiveIds[jid] = archiveId;
+        } else {
+            stream.setStatus(QDataStream::ReadCorruptData);
+            break;
+        }
+        validSize = file.pos();
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        q->warning(QString("Discarding truncated message cache record in %1").arg(cachePath));
+        file.close();
+        file.resize(validSize);
+    }
+    return true;
+}
+
+/// Opens the cache file, creating it if needed.
+
+bool QXmppMamManagerPrivate::openCache()
+{
+    cache = new QFile(cachePath);
+
+    const bool exists = cache->exists() && cache->size() > 0;
+    if (!cache->open(QIODevice::ReadWrite)) {
+        q->warning(QString("Could not open message cache %1").arg(cachePath));
+        delete cache;
+        cache = 0;
+        return false;
+    }
+
+    if (!exists) {
+        QDataStream stream(cache);
+        stream.setVersion(QDataStream::Qt_5_0);
+        stream << cacheMagic << cacheVersion;
+        cache->flush();
+    }
+    return true;
+}
+
+/// Reads the message stored at the given offset of the cache file.
+
+bool QXmppMamManagerPrivate::readMessage(qint64 offset, QXmppMessage *message) const
+{
+    if (!cache->seek(offset))
+        return false;
+
+    QDataStream stream(cache);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint8 type;
+    QString jid, archiveId, key;
+    qint64 stamp;
+    QByteArray data;
+    stream >> type >> jid >> archiveId >> key >> stamp >> data;
+
+    QDomDocument doc;
+    if (stream.status() != QDataStream::Ok || type != MessageRecord || !doc.setContent(data, true))
+        return false;
+
+    message->parse(doc.documentElement());
+    return true;
+}
+
+/// Records the id of the last archived message received for a conversation.
+
+void QXmppMamManagerPrivate::setLastArchiveId(const QString &jid, const QString &archiveId)
+{
+    if (lastArchiveIds.value(jid) == archiveId)
+        return;
+
+    lastArchiveIds[jid] = archiveId;
+    if (!cache)
+        return;
+
+    QByteArray record;
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << quint8(SyncRecord) << jid << archiveId;
+    writeRecord(record);
+}
+
+/// Appends a record to the cache file.
+///
+/// \param record
+
+bool QXmppMamManagerPrivate::writeRecord(const QByteArray &record)
+{
+    if (!cache->seek(cache->size()) ||
+        cache->write(record) != record.size() ||
+        !cache->flush()) {
+        q->warning(QString("Could not write to message cache %1").arg(cachePath));
+        return false;
+    }
+    return true;
+}
+
+QXmppMamManager::QXmppMamManager()
+    : d(new QXmppMamManagerPrivate(this))
+{
+}
+
+QXmppMamManager::~QXmppMamManager()
+{
+    delete d->cache;
+    delete d;
+}
+
+/// Returns the path of the local message cache.
+
+QString QXmppMamManager::cachePath() const
+{
+    return d->cachePath;
+}
+
+/// Sets the path of the local message cache.
+///
+/// The cache is an append-only file, which is read when this method is
+/// called to index the cached messages. Set an empty path to disable the
+/// cache, which is the default.
+///
+/// \param path
+
+void QXmppMamManager::setCachePath(const QString &path)
+{
+    if (path == d->cachePath)
+        return;
+
+    delete d->cache;
+    d->cache = 0;
+    d->cachePath = path;
+    d->entries.clear();
+    d->archiveIds.clear();
+    d->messageKeys.clear();
+    d->lastArchiveIds.clear();
+
+    if (!path.isEmpty() && d->load())
+        d->openCache();
+}
+
+/// Returns cached messages from the conversation with the given JID, ordered
+/// by time.
+///
+/// \param jid The bare JID of the other party.
+/// \param max The maximum number of messages to return, or -1 for all.
+/// \param before If valid, only return messages older than this time.
+
+QList<QXmppMessage> QXmppMamManager::cachedMessages(const QString &jid, int max, const QDateTime &before) const
+{
+    QList<QXmppMessage> messages;
+    if (!d->cache)
+        return messages;
+
+    const QVector<QXmppMamManagerPrivate::CacheEntry> list = d->entries.value(jid);
+    QVector<QXmppMamManagerPrivate::CacheEntry>::const_iterator end = list.constEnd();
+    if (before.isValid())
+        end = std::lower_bound(list.constBegin(), list.constEnd(), before.toMSecsSinceEpoch(), cacheEntryStampLessThan);
+
+    QVector<QXmppMamManagerPrivate::CacheEntry>::const_iterator it = list.constBegin();
+    if (max >= 0 && end - it > max)
+        it = end - max;
+
+    for (; it != end; ++it) {
+        QXmppMessage message;
+        if (d->readMessage(it->offset, &message))
+            messages << message;
+    }
+    return messages;
+}
+
+/// Returns the archive id of the last message synchronized for the
+/// conversation with the given JID.
+///
+/// \param jid The bare JID of the other party.
+
+QString QXmppMamManager::lastArchiveId(const QString &jid) const
+{
+    return d->lastArchiveIds.value(jid);
+}
+
+/// Synchronizes the cached conversation with the given JID with your archive
+/// on the server.
+///
+/// Only messages newer than lastArchiveId() are requested, page by page.
+/// The messages are stored in the cache instead of being reported by the
+/// archivedMessageReceived() signal, and the archiveSynchronized() signal is
+/// emitted once the last page has been received. If the server returns an
+/// error, the archiveSynchronizationFailed() signal is emitted instead.
+///
+/// \param jid The bare JID of the other party.
+/// \return query id of the first request, or an empty string if the cache
+///         is disabled.
+
+QString QXmppMamManager::synchronizeArchive(const QString &jid)
+{
+    if (!d->cache || jid.isEmpty())
+        return QString();
+
+    QXmppResultSetQuery resultSetQuery;
+    resultSetQuery.setMax(syncPageSize);
+    resultSetQuery.setAfter(d->lastArchiveIds.value(jid));
+
+    const QString queryId = retrieveArchivedMessages(QString(), QString(), jid,
+                                                     QDateTime(), QDateTime(),
+                                                     resultSetQuery);
+    d->syncQueries.insert(queryId, jid);
+    return queryId;
+}
+
 /// \cond
 QStringList QXmppMamManager::discoveryFeatures() const
 {
@@ -55,16 +456,68 @@ bool QXmppMamManager::handleStanza(const QDomElement &element)
                         const QString stamp = delayElement.attribute("stamp");
                         message.setStamp(QXmppUtils::datetimeFromString(stamp));
                     }
-                    emit archivedMessageReceived(queryId, message);
+
+                    const QString jid = d->syncQueries.value(queryId);
+                    if (!jid.isEmpty())
+                        d->cacheMessage(jid, resultElement.attribute("id"), message);
+                    else
+                        emit archivedMessageReceived(queryId, message);
                 }
             }
             return true;
         }
+
+        // cache live messages and carbon copies
+        if (d->cache) {
+            QDomElement messageElement = element;
+            QDomElement carbonElement = element.firstChildElement("sent");
+            if (carbonElement.isNull())
+                carbonElement = element.firstChildElement("received");
+            if (!carbonElement.isNull() && carbonElement.namespaceURI() == ns_carbons) {
+                // only our own server may send carbons, reject forged ones
+                const QString from = element.attribute("from");
+                if (!from.isEmpty() && from != client()->configuration().jidBare())
+                    return false;
+                messageElement = carbonElement.firstChildElement("forwarded").firstChildElement("message");
+            }
+
+            const QString type = messageElement.attribute("type");
+            if (!messageElement.firstChildElement("body").isNull() &&
+                (type.isEmpty() || type == "chat" || type == "normal")) {
+                QXmppMessage message;
+                message.parse(messageElement);
+                d->cacheMessage(d->conversationJid(message), QString(), message);
+            }
+        }
     } else if (QXmppMamResultIq::isMamResultIq(element)) {
         QXmppMamResultIq result;
         result.parse(element);
+
+        QHash<QString, QString>::iterator it = d->syncQueries.find(result.id());
+        if (it != d->syncQueries.end()) {
+            const QString jid = it.value();
+            d->syncQueries.erase(it);
+
+            const QString last = result.resultSetReply().last();
+            if (!last.isEmpty())
+                d->setLastArchiveId(jid, last);
+            if (!result.complete() && !last.isEmpty())
+                synchronizeArchive(jid);
+            else
+                emit archiveSynchronized(jid);
+            return true;
+        }
+
         emit resultsRecieved(result.id(), result.resultSetReply(), result.complete());
         return true;
+    } else if (element.tagName() == "iq" && element.attribute("type") == "error" &&
+               d->syncQueries.contains(element.attribute("id"))) {
+        QXmppIq iq;
+        iq.parse(element);
+
+        const QString jid = d->syncQueries.take(iq.id());
+        emit archiveSynchronizationFailed(jid, iq.error());
+        return true;
     }
 
     return false;
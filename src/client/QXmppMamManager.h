@@ -28,7 +28,9 @@
 
 #include "QXmppClientExtension.h"
 #include "QXmppResultSet.h"
+#include "QXmppStanza.h"
 
+class QXmppMamManagerPrivate;
 class QXmppMessage;
 
 /// \brief The QXmppMamManager class makes it possible to access message
@@ -42,6 +44,14 @@ class QXmppMessage;
 /// client->addExtension(manager);
 /// \endcode
 ///
+/// Optionally, the manager can keep a persistent cache of your own archive
+/// by calling setCachePath(). Messages are then stored locally as they are
+/// received, synchronizeArchive() only fetches messages which are newer than
+/// the last synchronized one, and cachedMessages() reads the history of a
+/// conversation without querying the server. To cache carbon copies of
+/// messages, the manager must be added to the client before
+/// QXmppCarbonManager.
+///
 /// \ingroup Managers
 
 class QXMPP_EXPORT QXmppMamManager : public QXmppClientExtension
@@ -49,6 +59,9 @@ class QXMPP_EXPORT QXmppMamManager : public QXmppClientExtension
     Q_OBJECT
 
 public:
+    QXmppMamManager();
+    ~QXmppMamManager();
+
     QString retrieveArchivedMessages(const QString &to = QString(),
                                      const QString &node = QString(),
                                      const QString &jid = QString(),
@@ -56,6 +69,15 @@ public:
                                      const QDateTime &end = QDateTime(),
                                      const QXmppResultSetQuery &resultSetQuery = QXmppResultSetQuery());
 
+    QString cachePath() const;
+    void setCachePath(const QString &path);
+
+    QList<QXmppMessage> cachedMessages(const QString &jid,
+                                       int max = -1,
+                                       const QDateTime &before = QDateTime()) const;
+    QString lastArchiveId(const QString &jid) const;
+    QString synchronizeArchive(const QString &jid);
+
     /// \cond
     QStringList discoveryFeatures() const;
     bool handleStanza(const QDomElement &element);
@@ -70,6 +92,18 @@ signals:
     void resultsRecieved(const QString &queryId,
                          const QXmppResultSetReply &resultSetReply,
                          bool complete);
+
+    /// This signal is emitted when the cached archive for a conversation
+    /// has been synchronized with the server.
+    void archiveSynchronized(const QString &jid);
+
+    /// This signal is emitted when the server returned an error while the
+    /// cached archive for a conversation was being synchronized.
+    void archiveSynchronizationFailed(const QString &jid, const QXmppStanza::Error &error);
+
+private:
+    QXmppMamManagerPrivate *d;
+    friend class QXmppMamManagerPrivate;
 };
 
 #endif
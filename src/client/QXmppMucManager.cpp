@@ -53,6 +53,8 @@ public:
     QSet<QString> permissionsQueue;
     QString nickName;
     QString subject;
+    // whether per-occupant signals are held back during the join burst
+    bool joinBatching;
 };
 
 /// Constructs a new QXmppMucManager.
@@ -186,6 +188,7 @@ QXmppMucRoom::QXmppMucRoom(QXmppClient *client, const QString &jid, QObject *par
 
     d = new QXmppMucRoomPrivate;
     d->allowedActions = NoAction;
+    d->joinBatching = false;
     d->client = client;
     d->discoManager = client->findExtension<QXmppDiscoveryManager>();
     d->jid = jid;
@@ -275,16 +278,34 @@ QString QXmppMucRoom::jid() const
 /// \return true if the request was sent, false otherwise
 
 bool QXmppMucRoom::join()
+{
+    return join(-1);
+}
+
+/// Joins the chat room, limiting the discussion history sent by the room.
+///
+/// \param maxStanzas The maximum number of history messages, or -1 for no limit.
+/// \param since If valid, only request history messages sent since this date.
+///
+/// \return true if the request was sent, false otherwise
+
+bool QXmppMucRoom::join(int maxStanzas, const QDateTime &since)
 {
     if (isJoined() || d->nickName.isEmpty())
         return false;
 
+    // forget participants from a previous attempt, which were not reported
+    if (d->joinBatching)
+        d->participants.clear();
+
     // reflect our current presence in the chat room
     QXmppPresence packet = d->client->clientPresence();
     packet.setTo(d->ownJid());
     packet.setType(QXmppPresence::Available);
     packet.setMucPassword(d->password);
     packet.setMucSupported(true);
+    packet.setMucHistoryMaxStanzas(maxStanzas);
+    packet.setMucHistorySince(since);
     return d->client->sendPacket(packet);
 }
 
@@ -430,6 +451,28 @@ QStringList QXmppMucRoom::participants() const
     return d->participants.keys();
 }
 
+/// Returns true if the occupants already in the room are only reported by
+/// the participantsReceived() signal when joining.
+///
+/// The default value is false.
+
+bool QXmppMucRoom::isJoinBatchingEnabled() const
+{
+    return d->joinBatching;
+}
+
+/// Sets whether the occupants already in the room are only reported by the
+/// participantsReceived() signal when joining, instead of one
+/// participantAdded() or participantChanged() signal each. This saves work
+/// when joining rooms with many occupants.
+///
+/// \param enabled
+
+void QXmppMucRoom::setJoinBatchingEnabled(bool enabled)
+{
+    d->joinBatching = enabled;
+}
+
 /// Returns the chat room password.
 
 QString QXmppMucRoom::password() const
@@ -569,9 +612,11 @@ void QXmppMucRoom::_q_disconnected()
     // clear chat room participants
     const QStringList removed = d->participants.keys();
     d->participants.clear();
-    foreach (const QString &jid, removed)
-        emit participantRemoved(jid);
-    emit participantsChanged();
+    if (wasJoined || !d->joinBatching) {
+        foreach (const QString &jid, removed)
+            emit participantRemoved(jid);
+        emit participantsChanged();
+    }
 
     // update available actions
     if (d->allowedActions != NoAction) {
@@ -631,6 +676,10 @@ void QXmppMucRoom::_q_presenceReceived(const QXmppPresence &presence)
     if (QXmppUtils::jidToBareJid(jid) != d->jid)
         return;
 
+    // participants present before our own presence are part of the join
+    // burst, which may be reported at once
+    const bool notify = isJoined() || !d->joinBatching;
+
     if (presence.type() == QXmppPresence::Available) {
         const bool added = !d->participants.contains(jid);
         d->participants.insert(jid, presence);
@@ -657,17 +706,21 @@ void QXmppMucRoom::_q_presenceReceived(const QXmppPresence &presence)
             }
         }
 
-        if (added) {
-            emit participantAdded(jid);
+        if (added && jid == d->ownJid()) {
+            if (notify)
+                emit participantAdded(jid);
+            emit participantsReceived();
             emit participantsChanged();
-            if (jid == d->ownJid()) {
-                // request room information
-                if (d->discoManager)
-                    d->discoManager->requestInfo(d->jid);
 
-                emit joined();
-            }
-        } else {
+            // request room information
+            if (d->discoManager)
+                d->discoManager->requestInfo(d->jid);
+
+            emit joined();
+        } else if (added && notify) {
+            emit participantAdded(jid);
+            emit participantsChanged();
+        } else if (notify) {
             emit participantChanged(jid);
         }
     }
@@ -675,9 +728,11 @@ void QXmppMucRoom::_q_presenceReceived(const QXmppPresence &presence)
         if (d->participants.contains(jid)) {
             d->participants.insert(jid, presence);
 
-            emit participantRemoved(jid);
+            if (notify)
+                emit participantRemoved(jid);
             d->participants.remove(jid);
-            emit participantsChanged();
+            if (notify)
+                emit participantsChanged();
 
             // check whether this was our own presence
             if (jid == d->ownJid()) {
@@ -137,6 +137,9 @@ public:
     QXmppPresence participantPresence(const QString &jid) const;
     QStringList participants() const;
 
+    bool isJoinBatchingEnabled() const;
+    void setJoinBatchingEnabled(bool enabled);
+
     QString password() const;
     void setPassword(const QString &password);
 
@@ -188,6 +191,12 @@ signals:
     void participantsChanged();
     /// \endcond
 
+    /// This signal is emitted when you join the room, once the participants
+    /// who were already in the room are known. If join batching is enabled,
+    /// they are only reported by this signal instead of one
+    /// participantAdded() signal each.
+    void participantsReceived();
+
     /// This signal is emitted when the room's permissions are received.
     void permissionsReceived(const QList<QXmppMucItem> &permissions);
 
@@ -197,6 +206,7 @@ signals:
 public slots:
     bool ban(const QString &jid, const QString &reason);
     bool join();
+    bool join(int maxStanzas, const QDateTime &since = QDateTime());
     bool kick(const QString &jid, const QString &reason);
     bool leave(const QString &message = QString());
     bool requestConfiguration();
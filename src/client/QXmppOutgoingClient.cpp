@@ -39,6 +39,8 @@
 #include "QXmppStreamManagement_p.h"
 #include "QXmppNonSASLAuth.h"
 #include "QXmppSasl_p.h"
+#include "QXmppSrvCache_p.h"
+#include "QXmppTimerWheel_p.h"
 #include "QXmppUtils.h"
 
 // IQ types
@@ -53,7 +55,9 @@
 #include <QRegExp>
 #include <QHostAddress>
 #include <QXmlStreamWriter>
-#include <QTimer>
+
+// how long a failed SRV lookup is remembered, in seconds
+static const int SRV_NEGATIVE_TTL = 60;
 
 class QXmppOutgoingClientPrivate
 {
@@ -75,8 +79,14 @@ public:
 
     // DNS
     QDnsLookup dns;
+    QList<QDnsServiceRecord> srvRecords;
     int nextSrvRecordIdx;
 
+    // TLS session resumption
+    QString sessionHost;
+    QByteArray sessionTicket;
+    void storeSessionTicket();
+
     // Stream
     QString streamId;
     QString streamFrom;
@@ -91,6 +101,7 @@ public:
     QString sessionId;
     bool bindModeAvailable;
     bool sessionAvailable;
+    bool rosterVersioningAvailable;
     bool sessionStarted;
 
     // Authentication
@@ -107,8 +118,8 @@ public:
     quint16 resumePort;
 
     // Timers
-    QTimer *pingTimer;
-    QTimer *timeoutTimer;
+    QXmppCoarseTimer *pingTimer;
+    QXmppCoarseTimer *timeoutTimer;
 
 private:
     QXmppOutgoingClient *q;
@@ -119,6 +130,7 @@ QXmppOutgoingClientPrivate::QXmppOutgoingClientPrivate(QXmppOutgoingClient *qq)
     , redirectPort(0)
     , bindModeAvailable(false)
     , sessionAvailable(false)
+    , rosterVersioningAvailable(false)
     , sessionStarted(false)
     , isAuthenticated(false)
     , saslClient(0)
@@ -140,6 +152,12 @@ void QXmppOutgoingClientPrivate::connectToHost(const QString &host, quint16 port
     if (!config.caCertificates().isEmpty())
         q->socket()->setCaCertificates(config.caCertificates());
 
+    // offer to resume the previous TLS session with this host
+    QSslConfiguration sslConfig = q->socket()->sslConfiguration();
+    sslConfig.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+    sslConfig.setSessionTicket(host == sessionHost ? sessionTicket : QByteArray());
+    q->socket()->setSslConfiguration(sslConfig);
+
     // respect proxy
     q->socket()->setProxy(config.networkProxy());
 
@@ -162,12 +180,24 @@ void QXmppOutgoingClientPrivate::connectToHost(const QString &host, quint16 port
 void QXmppOutgoingClientPrivate::connectToNextDNSHost()
 {
     connectToHost(
-        dns.serviceRecords().at(nextSrvRecordIdx).target(),
-        dns.serviceRecords().at(nextSrvRecordIdx).port());
+        srvRecords.at(nextSrvRecordIdx).target(),
+        srvRecords.at(nextSrvRecordIdx).port());
 
     nextSrvRecordIdx++;
 }
 
+/// Keeps the TLS session ticket issued by the server, if any, so that the
+/// next connection can do an abbreviated handshake.
+
+void QXmppOutgoingClientPrivate::storeSessionTicket()
+{
+    const QByteArray ticket = q->socket()->sslConfiguration().sessionTicket();
+    if (!ticket.isEmpty()) {
+        sessionHost = q->socket()->peerName();
+        sessionTicket = ticket;
+    }
+}
+
 /// Constructs an outgoing client stream.
 ///
 /// \param parent
@@ -201,12 +231,12 @@ QXmppOutgoingClient::QXmppOutgoingClient(QObject *parent)
     Q_ASSERT(check);
 
     // XEP-0199: XMPP Ping
-    d->pingTimer = new QTimer(this);
+    d->pingTimer = new QXmppCoarseTimer(this);
     check = connect(d->pingTimer, SIGNAL(timeout()),
                     this, SLOT(pingSend()));
     Q_ASSERT(check);
 
-    d->timeoutTimer = new QTimer(this);
+    d->timeoutTimer = new QXmppCoarseTimer(this);
     d->timeoutTimer->setSingleShot(true);
     check = connect(d->timeoutTimer, SIGNAL(timeout()),
                     this, SLOT(pingTimeout()));
@@ -239,6 +269,9 @@ QXmppConfiguration& QXmppOutgoingClient::configuration()
 
 void QXmppOutgoingClient::connectToHost()
 {
+    d->srvRecords.clear();
+    d->nextSrvRecordIdx = 0;
+
     // if a host for resumption is available, connect to it
     if (d->canResume && !d->resumeHost.isEmpty() && d->resumePort) {
         d->connectToHost(d->resumeHost, d->resumePort);
@@ -251,13 +284,25 @@ void QXmppOutgoingClient::connectToHost()
         return;
     }
 
-    // otherwise, lookup server
+    // otherwise, lookup server, unless another client recently did
     const QString domain = configuration().domain();
+    const QString name = "_xmpp-client._tcp." + domain;
+    QList<QDnsServiceRecord> records;
+    if (QXmppSrvCache::lookup(name, records)) {
+        debug(QString("Using cached servers for domain %1").arg(domain));
+        if (records.isEmpty()) {
+            d->connectToHost(domain, d->config.port());
+        } else {
+            d->srvRecords = QXmppSrvCache::order(records);
+            d->connectToNextDNSHost();
+        }
+        return;
+    }
+
     debug(QString("Looking up server for domain %1").arg(domain));
-    d->dns.setName("_xmpp-client._tcp." + domain);
+    d->dns.setName(name);
     d->dns.setType(QDnsLookup::SRV);
     d->dns.lookup();
-    d->nextSrvRecordIdx = 0;
 }
 
 void QXmppOutgoingClient::disconnectFromHost()
@@ -270,9 +315,21 @@ void QXmppOutgoingClient::_q_dnsLookupFinished()
 {
     if (d->dns.error() == QDnsLookup::NoError &&
         !d->dns.serviceRecords().isEmpty()) {
+        // cache the records for as long as the shortest TTL
+        d->srvRecords = d->dns.serviceRecords();
+        quint32 ttl = d->srvRecords.first().timeToLive();
+        foreach (const QDnsServiceRecord &record, d->srvRecords)
+            ttl = qMin(ttl, record.timeToLive());
+        QXmppSrvCache::store(d->dns.name(), d->srvRecords, ttl);
+
         // take the first returned record
         d->connectToNextDNSHost();
     } else {
+        // remember that the domain has no SRV records
+        if (d->dns.error() == QDnsLookup::NoError ||
+            d->dns.error() == QDnsLookup::NotFoundError)
+            QXmppSrvCache::store(d->dns.name(), QList<QDnsServiceRecord>(), SRV_NEGATIVE_TTL);
+
         // as a fallback, use domain as the host name
         warning(QString("Lookup for domain %1 failed: %2")
                 .arg(d->dns.name(), d->dns.errorString()));
@@ -287,6 +344,13 @@ bool QXmppOutgoingClient::isAuthenticated() const
     return d->isAuthenticated;
 }
 
+/// Returns true if the server supports XEP-0237: Roster Versioning.
+
+bool QXmppOutgoingClient::isRosterVersioningSupported() const
+{
+    return d->rosterVersioningAvailable;
+}
+
 /// Returns true if the socket is connected and a session has been started.
 
 bool QXmppOutgoingClient::isConnected() const
@@ -298,6 +362,7 @@ void QXmppOutgoingClient::_q_socketDisconnected()
 {
     debug("Socket disconnected");
     d->isAuthenticated = false;
+    d->storeSessionTicket();
     if (!d->redirectHost.isEmpty() && d->redirectPort > 0) {
         d->connectToHost(d->redirectHost, d->redirectPort);
         d->redirectHost = QString();
@@ -326,7 +391,7 @@ void QXmppOutgoingClient::socketError(QAbstractSocket::SocketError socketError)
 {
     Q_UNUSED(socketError);
     if ( !d->sessionStarted &&
-         (d->dns.serviceRecords().count() > d->nextSrvRecordIdx) )
+         (d->srvRecords.count() > d->nextSrvRecordIdx) )
     {
         // some network error occured during startup -> try next available SRV record server
         d->connectToNextDNSHost();
@@ -340,6 +405,9 @@ void QXmppOutgoingClient::handleStart()
 {
     QXmppStream::handleStart();
 
+    if (socket()->isEncrypted())
+        d->storeSessionTicket();
+
     // reset stream information
     d->streamId.clear();
     d->streamFrom.clear();
@@ -504,6 +572,7 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
         d->sessionAvailable = (features.sessionMode() != QXmppStreamFeatures::Disabled);
         d->bindModeAvailable = (features.bindMode() != QXmppStreamFeatures::Disabled);
         d->streamManagementAvailable = (features.streamManagementMode() != QXmppStreamFeatures::Disabled);
+        d->rosterVersioningAvailable = (features.rosterVersioningMode() != QXmppStreamFeatures::Disabled);
 
         // chech whether the stream can be resumed
         if (d->streamManagementAvailable && d->canResume) {
@@ -22,7 +22,11 @@
  *
  */
 
+#include <QDataStream>
 #include <QDomElement>
+#include <QFile>
+#include <QSaveFile>
+#include <QTimer>
 
 #include "QXmppClient.h"
 #include "QXmppPresence.h"
@@ -30,16 +34,60 @@
 #include "QXmppRosterManager.h"
 #include "QXmppUtils.h"
 
+// roster cache file layout
+static const quint32 cacheMagic = 0x51585243;
+static const quint32 cacheVersion = 1;
+
+// delay before writing the roster cache, so that bursts of roster pushes
+// only cause a single write
+static const int cacheSaveDelay = 1000;
+
+// rank of the available status types, higher is more available
+static int availabilityRank(const QXmppPresence &presence)
+{
+    switch (presence.availableStatusType()) {
+    case QXmppPresence::Chat:
+        return 4;
+    case QXmppPresence::Online:
+        return 3;
+    case QXmppPresence::Away:
+        return 2;
+    case QXmppPresence::XA:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
 class QXmppRosterManagerPrivate
 {
 public:
+    struct PresenceEntry
+    {
+        QXmppPresence presence;
+        quint64 sequence;
+    };
+
     QXmppRosterManagerPrivate(QXmppRosterManager *qq);
 
+    void updateBestResource(const QString &bareJid);
+
     // map of bareJid and its rosterEntry
     QMap<QString, QXmppRosterIq::Item> entries;
 
-    // map of resources of the jid and map of resources and presences
-    QMap<QString, QMap<QString, QXmppPresence> > presences;
+    // presences indexed by bareJid then resource
+    QHash<QString, QHash<QString, PresenceEntry> > presences;
+
+    // best available resource for each bareJid
+    QHash<QString, QString> bestResources;
+
+    // order in which presences were received
+    quint64 presenceSequence;
+
+    // bareJids whose presence changed since presencesChanged() was emitted
+    QStringList changedJids;
+    QSet<QString> changedJidSet;
+    QTimer *presenceTimer;
 
     // flag to store that the roster has been populated
     bool isRosterReceived;
@@ -47,16 +95,56 @@ public:
     // id of the initial roster request
     QString rosterReqId;
 
+    // roster version, as defined by XEP-0237: Roster Versioning
+    QString version;
+
+    // roster cache
+    QString cachePath;
+    QString cacheJid;
+    QTimer *saveTimer;
+
 private:
     QXmppRosterManager *q;
 };
 
 QXmppRosterManagerPrivate::QXmppRosterManagerPrivate(QXmppRosterManager *qq)
-    : isRosterReceived(false),
+    : presenceSequence(0),
+    presenceTimer(0),
+    isRosterReceived(false),
+    saveTimer(0),
     q(qq)
 {
 }
 
+/// Selects the best resource of a bareJid by priority, then availability,
+/// then most recent presence.
+
+void QXmppRosterManagerPrivate::updateBestResource(const QString &bareJid)
+{
+    const QHash<QString, PresenceEntry> resources = presences.value(bareJid);
+    if (resources.isEmpty()) {
+        bestResources.remove(bareJid);
+        return;
+    }
+
+    QHash<QString, PresenceEntry>::const_iterator best = resources.constBegin();
+    QHash<QString, PresenceEntry>::const_iterator it = best;
+    for (++it; it != resources.constEnd(); ++it) {
+        const QXmppPresence &a = it.value().presence;
+        const QXmppPresence &b = best.value().presence;
+        if (a.priority() != b.priority()) {
+            if (a.priority() > b.priority())
+                best = it;
+        } else if (availabilityRank(a) != availabilityRank(b)) {
+            if (availabilityRank(a) > availabilityRank(b))
+                best = it;
+        } else if (it.value().sequence > best.value().sequence) {
+            best = it;
+        }
+    }
+    bestResources.insert(bareJid, best.key());
+}
+
 /// Constructs a roster manager.
 
 QXmppRosterManager::QXmppRosterManager(QXmppClient* client)
@@ -77,10 +165,27 @@ QXmppRosterManager::QXmppRosterManager(QXmppClient* client)
     check = connect(client, SIGNAL(presenceReceived(QXmppPresence)),
                     this, SLOT(_q_presenceReceived(QXmppPresence)));
     Q_ASSERT(check);
+
+    d->presenceTimer = new QTimer(this);
+    d->presenceTimer->setSingleShot(true);
+    d->presenceTimer->setInterval(0);
+    check = connect(d->presenceTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_presencesChanged()));
+    Q_ASSERT(check);
+
+    d->saveTimer = new QTimer(this);
+    d->saveTimer->setSingleShot(true);
+    d->saveTimer->setInterval(cacheSaveDelay);
+    check = connect(d->saveTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_saveCache()));
+    Q_ASSERT(check);
 }
 
 QXmppRosterManager::~QXmppRosterManager()
 {
+    // write pending changes
+    if (d->saveTimer->isActive())
+        _q_saveCache();
     delete d;
 }
 
@@ -101,9 +206,22 @@ bool QXmppRosterManager::acceptSubscription(const QString &bareJid, const QStrin
 ///
 void QXmppRosterManager::_q_connected()
 {
+    // discard a cached roster which belongs to another account
+    const QString jid = client()->configuration().jidBare();
+    if (jid != d->cacheJid) {
+        d->entries.clear();
+        d->version = QString();
+        d->cacheJid = jid;
+    }
+
     QXmppRosterIq roster;
     roster.setType(QXmppIq::Get);
     roster.setFrom(client()->configuration().jid());
+
+    // XEP-0237: send the cached version, or an empty one if the cache is empty
+    if (!d->cachePath.isEmpty() && client()->isRosterVersioningSupported())
+        roster.setVersion(d->version.isNull() ? QLatin1String("") : d->version);
+
     d->rosterReqId = roster.id();
     if (client()->isAuthenticated())
         client()->sendPacket(roster);
@@ -111,15 +229,21 @@ void QXmppRosterManager::_q_connected()
 
 void QXmppRosterManager::_q_disconnected()
 {
-    d->entries.clear();
+    // keep the cached roster available while offline
+    if (d->cachePath.isEmpty())
+        d->entries.clear();
     d->presences.clear();
+    d->bestResources.clear();
+    d->changedJids.clear();
+    d->changedJidSet.clear();
+    d->presenceTimer->stop();
     d->isRosterReceived = false;
 }
 
 /// \cond
 bool QXmppRosterManager::handleStanza(const QDomElement &element)
 {
-    if (element.tagName() != "iq" || !QXmppRosterIq::isRosterIq(element))
+    if (element.tagName() != "iq")
         return false;
 
     // Security check: only server should send this iq
@@ -128,6 +252,20 @@ bool QXmppRosterManager::handleStanza(const QDomElement &element)
     if (!fromJid.isEmpty() && QXmppUtils::jidToBareJid(fromJid) != client()->configuration().jidBare())
         return false;
 
+    // XEP-0237: an empty result means the cached roster is up to date,
+    // changes if any will follow as roster pushes
+    if (!d->rosterReqId.isEmpty() &&
+        element.attribute("id") == d->rosterReqId &&
+        element.attribute("type") == "result" &&
+        element.firstChildElement("query").isNull()) {
+        d->isRosterReceived = true;
+        emit rosterReceived();
+        return true;
+    }
+
+    if (!QXmppRosterIq::isRosterIq(element))
+        return false;
+
     QXmppRosterIq rosterIq;
     rosterIq.parse(element);
 
@@ -162,10 +300,20 @@ bool QXmppRosterManager::handleStanza(const QDomElement &element)
                     }
                 }
             }
+
+            if (!rosterIq.version().isNull())
+                d->version = rosterIq.version();
+            if (!d->cachePath.isEmpty())
+                d->saveTimer->start();
         }
         break;
     case QXmppIq::Result:
         {
+            // the full roster replaces the cached one
+            QMap<QString, QXmppRosterIq::Item> previous;
+            if (isInitial)
+                d->entries.swap(previous);
+
             const QList<QXmppRosterIq::Item> items = rosterIq.items();
             foreach (const QXmppRosterIq::Item &item, items) {
                 const QString bareJid = item.bareJid();
@@ -173,6 +321,17 @@ bool QXmppRosterManager::handleStanza(const QDomElement &element)
             }
             if (isInitial)
             {
+                // notify the user of the cached items which were removed
+                // while we were offline
+                foreach (const QString &bareJid, previous.keys()) {
+                    if (!d->entries.contains(bareJid))
+                        emit itemRemoved(bareJid);
+                }
+
+                d->version = rosterIq.version();
+                if (!d->cachePath.isEmpty())
+                    d->saveTimer->start();
+
                 d->isRosterReceived = true;
                 emit rosterReceived();
             }
@@ -198,11 +357,29 @@ void QXmppRosterManager::_q_presenceReceived(const QXmppPresence& presence)
     switch(presence.type())
     {
     case QXmppPresence::Available:
-        d->presences[bareJid][resource] = presence;
-        emit presenceChanged(bareJid, resource);
-        break;
     case QXmppPresence::Unavailable:
-        d->presences[bareJid].remove(resource);
+        if (presence.type() == QXmppPresence::Available) {
+            QXmppRosterManagerPrivate::PresenceEntry &entry = d->presences[bareJid][resource];
+            entry.presence = presence;
+            entry.sequence = ++d->presenceSequence;
+        } else {
+            QHash<QString, QHash<QString, QXmppRosterManagerPrivate::PresenceEntry> >::iterator it = d->presences.find(bareJid);
+            if (it != d->presences.end()) {
+                it.value().remove(resource);
+                if (it.value().isEmpty())
+                    d->presences.erase(it);
+            }
+        }
+        d->updateBestResource(bareJid);
+
+        // batch changes until control returns to the event loop
+        if (!d->changedJidSet.contains(bareJid)) {
+            d->changedJidSet.insert(bareJid);
+            d->changedJids << bareJid;
+        }
+        if (!d->presenceTimer->isActive())
+            d->presenceTimer->start();
+
         emit presenceChanged(bareJid, resource);
         break;
     case QXmppPresence::Subscribe:
@@ -222,6 +399,39 @@ void QXmppRosterManager::_q_presenceReceived(const QXmppPresence& presence)
     }
 }
 
+void QXmppRosterManager::_q_saveCache()
+{
+    d->saveTimer->stop();
+    if (d->cachePath.isEmpty())
+        return;
+
+    QSaveFile file(d->cachePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        warning(QString("Could not open roster cache %1").arg(d->cachePath));
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << cacheMagic << cacheVersion << d->cacheJid << d->version << quint32(d->entries.size());
+    foreach (const QXmppRosterIq::Item &item, d->entries) {
+        stream << item.bareJid() << item.name() << quint8(item.subscriptionType())
+               << item.subscriptionStatus() << item.groups();
+    }
+
+    if (stream.status() != QDataStream::Ok || !file.commit())
+        warning(QString("Could not write roster cache %1").arg(d->cachePath));
+}
+
+void QXmppRosterManager::_q_presencesChanged()
+{
+    const QStringList bareJids = d->changedJids;
+    d->changedJids.clear();
+    d->changedJidSet.clear();
+    if (!bareJids.isEmpty())
+        emit presencesChanged(bareJids);
+}
+
 /// Refuses a subscription request.
 ///
 /// You can call this method in reply to the subscriptionRequest() signal.
@@ -361,10 +571,7 @@ QXmppRosterIq::Item QXmppRosterManager::getRosterEntry(
 
 QStringList QXmppRosterManager::getResources(const QString& bareJid) const
 {
-    if(d->presences.contains(bareJid))
-        return d->presences[bareJid].keys();
-    else
-        return QStringList();
+    return d->presences.value(bareJid).keys();
 }
 
 /// Get all the presences of all the resources of the given bareJid. A bareJid
@@ -378,10 +585,11 @@ QStringList QXmppRosterManager::getResources(const QString& bareJid) const
 QMap<QString, QXmppPresence> QXmppRosterManager::getAllPresencesForBareJid(
         const QString& bareJid) const
 {
-    if(d->presences.contains(bareJid))
-        return d->presences[bareJid];
-    else
-        return QMap<QString, QXmppPresence>();
+    QMap<QString, QXmppPresence> result;
+    const QHash<QString, QXmppRosterManagerPrivate::PresenceEntry> resources = d->presences.value(bareJid);
+    for (QHash<QString, QXmppRosterManagerPrivate::PresenceEntry>::const_iterator it = resources.constBegin(); it != resources.constEnd(); ++it)
+        result.insert(it.key(), it.value().presence);
+    return result;
 }
 
 /// Get the presence of the given resource of the given bareJid.
@@ -394,8 +602,9 @@ QMap<QString, QXmppPresence> QXmppRosterManager::getAllPresencesForBareJid(
 QXmppPresence QXmppRosterManager::getPresence(const QString& bareJid,
                                        const QString& resource) const
 {
-    if(d->presences.contains(bareJid) && d->presences[bareJid].contains(resource))
-        return d->presences[bareJid][resource];
+    QHash<QString, QHash<QString, QXmppRosterManagerPrivate::PresenceEntry> >::const_iterator it = d->presences.constFind(bareJid);
+    if (it != d->presences.constEnd() && it.value().contains(resource))
+        return it.value().value(resource).presence;
     else
     {
         QXmppPresence presence;
@@ -404,6 +613,98 @@ QXmppPresence QXmppRosterManager::getPresence(const QString& bareJid,
     }
 }
 
+/// Returns the best available resource of the given bareJid, that is the
+/// one with the highest priority, then the most available status, then the
+/// most recent presence. Returns an empty string if no resource is
+/// available.
+///
+/// \param bareJid as a QString
+
+QString QXmppRosterManager::getBestResource(const QString& bareJid) const
+{
+    return d->bestResources.value(bareJid);
+}
+
+/// Returns the path of the roster cache.
+
+QString QXmppRosterManager::cachePath() const
+{
+    return d->cachePath;
+}
+
+/// Sets the path of the roster cache and reads the cached roster.
+///
+/// The cached roster entries are available immediately, and are replaced or
+/// updated once the roster has been received from the server.
+///
+/// \param path
+
+void QXmppRosterManager::setCachePath(const QString &path)
+{
+    if (path == d->cachePath)
+        return;
+
+    d->cachePath = path;
+    d->cacheJid = QString();
+    d->version = QString();
+    d->entries.clear();
+
+    QFile file(path);
+    if (path.isEmpty() || !file.exists())
+        return;
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        warning(QString("Could not open roster cache %1").arg(path));
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic, version, count;
+    QString jid, rosterVersion;
+    stream >> magic >> version >> jid >> rosterVersion >> count;
+    if (stream.status() != QDataStream::Ok || magic != cacheMagic || version != cacheVersion) {
+        warning(QString("Invalid roster cache %1").arg(path));
+        return;
+    }
+
+    QMap<QString, QXmppRosterIq::Item> entries;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        QString bareJid, name, status;
+        quint8 subscription;
+        QSet<QString> groups;
+        stream >> bareJid >> name >> subscription >> status >> groups;
+
+        QXmppRosterIq::Item item;
+        item.setBareJid(bareJid);
+        item.setName(name);
+        item.setSubscriptionType(static_cast<QXmppRosterIq::Item::SubscriptionType>(subscription));
+        item.setSubscriptionStatus(status);
+        item.setGroups(groups);
+        entries.insert(bareJid, item);
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        warning(QString("Invalid roster cache %1").arg(path));
+        return;
+    }
+
+    d->cacheJid = jid;
+    d->version = rosterVersion;
+    d->entries = entries;
+}
+
+/// Returns the version of the roster, as defined by XEP-0237: Roster
+/// Versioning.
+///
+/// This is empty if the server does not support roster versioning.
+
+QString QXmppRosterManager::rosterVersion() const
+{
+    return d->version;
+}
+
 /// Function to check whether the roster has been received or not.
 ///
 /// \return true if roster received else false
@@ -58,6 +58,13 @@ class QXmppRosterManagerPrivate;
 /// entries are added, changed or removed.
 ///
 /// The presenceChanged() signal is emitted whenever the presence for a roster item changes.
+/// The presencesChanged() signal reports the same changes in batches, which is
+/// cheaper to handle for the burst of presences received after login.
+///
+/// If you set a cache path using setCachePath(), the roster is stored locally
+/// and is available as soon as the cache has been read. If the server supports
+/// XEP-0237: Roster Versioning, only the changes since the cached version are
+/// then downloaded on login.
 ///
 /// \ingroup Managers
 
@@ -78,6 +85,11 @@ public:
             const QString& bareJid) const;
     QXmppPresence getPresence(const QString& bareJid,
                               const QString& resource) const;
+    QString getBestResource(const QString& bareJid) const;
+
+    QString cachePath() const;
+    void setCachePath(const QString &path);
+    QString rosterVersion() const;
 
     /// \cond
     bool handleStanza(const QDomElement &element);
@@ -102,6 +114,10 @@ signals:
     /// This signal is emitted when the presence of a particular bareJid and resource changes.
     void presenceChanged(const QString& bareJid, const QString& resource);
 
+    /// This signal is emitted once per event loop iteration with the bareJids
+    /// whose presence changed since the previous emission.
+    void presencesChanged(const QStringList& bareJids);
+
     /// This signal is emitted when a contact asks to subscribe to your presence.
     ///
     /// You can either accept the request by calling acceptSubscription() or refuse it
@@ -120,13 +136,16 @@ signals:
     void itemChanged(const QString& bareJid);
 
     /// This signal is emitted when the roster entry of a particular bareJid is
-    /// removed as a result of roster push.
+    /// removed as a result of roster push, or when a cached entry is missing
+    /// from the roster received after connecting.
     void itemRemoved(const QString& bareJid);
 
 private slots:
     void _q_connected();
     void _q_disconnected();
     void _q_presenceReceived(const QXmppPresence&);
+    void _q_presencesChanged();
+    void _q_saveCache();
 
 private:
     QXmppRosterManagerPrivate *d;
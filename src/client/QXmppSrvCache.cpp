@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Authors:
+ *  Manjeet Dahiya
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include "QXmppSrvCache_p.h"
+
+struct QXmppSrvCacheEntry
+{
+    QList<QDnsServiceRecord> records;
+    qint64 expiry;
+};
+
+static QMutex srvCacheMutex;
+static QHash<QString, QXmppSrvCacheEntry> srvCache;
+
+/// Looks up the cached records for the given SRV name.
+///
+/// Returns true if an entry has not expired yet, in which case \a records
+/// is set to its records. An empty list means the name has no records.
+///
+/// \param name
+/// \param records
+
+bool QXmppSrvCache::lookup(const QString &name, QList<QDnsServiceRecord> &records)
+{
+    QMutexLocker locker(&srvCacheMutex);
+    QHash<QString, QXmppSrvCacheEntry>::iterator it = srvCache.find(name);
+    if (it == srvCache.end())
+        return false;
+    if (it->expiry <= QDateTime::currentMSecsSinceEpoch()) {
+        srvCache.erase(it);
+        return false;
+    }
+    records = it->records;
+    return true;
+}
+
+/// Stores the records for the given SRV name.
+///
+/// \param name
+/// \param records The records, or an empty list if the name has none.
+/// \param ttl How long the entry is valid, in seconds.
+
+void QXmppSrvCache::store(const QString &name, const QList<QDnsServiceRecord> &records, quint32 ttl)
+{
+    QXmppSrvCacheEntry entry;
+    entry.records = records;
+    entry.expiry = QDateTime::currentMSecsSinceEpoch() + qint64(ttl) * 1000;
+
+    QMutexLocker locker(&srvCacheMutex);
+    srvCache.insert(name, entry);
+}
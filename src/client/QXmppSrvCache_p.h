@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSRVCACHE_P_H
+#define QXMPPSRVCACHE_P_H
+
+#include <algorithm>
+
+#include <QDnsServiceRecord>
+#include <QList>
+#include <QString>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppSrvCache class holds the results of SRV lookups, shared by all
+/// the clients of the process until they expire.
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppSrvCache
+{
+public:
+    static bool lookup(const QString &name, QList<QDnsServiceRecord> &records);
+    static void store(const QString &name, const QList<QDnsServiceRecord> &records, quint32 ttl);
+
+    template <typename T>
+    static QList<T> order(QList<T> records);
+};
+
+/// Orders SRV records by priority, and randomly by weight within a
+/// priority as described in RFC 2782, so that cached records spread
+/// clients over the servers like fresh lookups do.
+///
+/// \param records Records providing priority() and weight().
+
+template <typename T>
+QList<T> QXmppSrvCache::order(QList<T> records)
+{
+    // records with a zero weight come first, so they have a small chance
+    // of being picked
+    std::stable_sort(records.begin(), records.end(), [](const T &a, const T &b) {
+        if (a.priority() != b.priority())
+            return a.priority() < b.priority();
+        return a.weight() == 0 && b.weight() != 0;
+    });
+
+    QList<T> ordered;
+    while (!records.isEmpty()) {
+        const quint16 priority = records.first().priority();
+        int count = 0;
+        int totalWeight = 0;
+        while (count < records.size() && records.at(count).priority() == priority)
+            totalWeight += records.at(count++).weight();
+
+        // pick one record of the lowest priority
+        int chosen = 0;
+        if (totalWeight > 0) {
+            int pick = qrand() % (totalWeight + 1);
+            while (chosen < count - 1 && (pick -= records.at(chosen).weight()) > 0)
+                ++chosen;
+        }
+        ordered << records.takeAt(chosen);
+    }
+    return ordered;
+}
+
+#endif
@@ -34,6 +34,7 @@
 #include "QXmppSasl_p.h"
 #include "QXmppSessionIq.h"
 #include "QXmppStreamFeatures.h"
+#include "QXmppTimerWheel_p.h"
 #include "QXmppUtils.h"
 
 #include "QXmppIncomingClient.h"
@@ -42,7 +43,7 @@ class QXmppIncomingClientPrivate
 {
 public:
     QXmppIncomingClientPrivate(QXmppIncomingClient *qq);
-    QTimer *idleTimer;
+    QXmppCoarseTimer *idleTimer;
 
     QString domain;
     QString jid;
@@ -124,7 +125,7 @@ QXmppIncomingClient::QXmppIncomingClient(QSslSocket *socket, const QString &doma
     info(QString("Incoming client connection from %1").arg(d->origin()));
 
     // create inactivity timer
-    d->idleTimer = new QTimer(this);
+    d->idleTimer = new QXmppCoarseTimer(this);
     d->idleTimer->setSingleShot(true);
     check = connect(d->idleTimer, SIGNAL(timeout()),
                     this, SLOT(onTimeout()));
@@ -389,6 +390,40 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
         }
     }
 }
+
+bool QXmppIncomingClient::handleStanzaData(const QByteArray &data, const QString &tagName, const QXmlStreamAttributes &attributes)
+{
+    // stanzas for the server itself and stanzas received before the
+    // resource is bound are parsed
+    const QString to = attributes.value("to").toString();
+    if (to.isEmpty() || QXmppUtils::jidToResource(d->jid).isEmpty())
+        return false;
+
+    // stanzas from unexpected JIDs are rejected once parsed
+    const QString bareJid = QXmppUtils::jidToBareJid(d->jid);
+    const QString from = attributes.value("from").toString();
+    if (!from.isEmpty() && from != d->jid && from != bareJid)
+        return false;
+
+    if (d->idleTimer->interval())
+        d->idleTimer->start();
+
+    // if the sender is empty, set it to the appropriate JID
+    QByteArray stamped = data;
+    QXmlStreamAttributes stampedAttributes = attributes;
+    if (from.isEmpty()) {
+        const QString type = attributes.value("type").toString();
+        const QString sender = (tagName == QLatin1String("presence") &&
+            (type == QLatin1String("subscribe") || type == QLatin1String("subscribed"))) ? bareJid : d->jid;
+        stamped.insert(1 + tagName.toUtf8().size(), " from=\"" + sender.toHtmlEscaped().toUtf8() + "\"");
+        stampedAttributes.append("from", sender);
+    }
+
+    // offer stanza for routing by server
+    bool handled = false;
+    emit stanzaDataReceived(stamped, tagName, stampedAttributes, handled);
+    return handled;
+}
 /// \endcond
 
 void QXmppIncomingClient::onDigestReply()
@@ -54,10 +54,16 @@ signals:
     /// This signal is emitted when an element is received.
     void elementReceived(const QDomElement &element);
 
+    /// This signal is emitted when a stanza is received which may be routed
+    /// using its data. If \a handled is set to true, the stanza is not parsed
+    /// and elementReceived() is not emitted for it.
+    void stanzaDataReceived(const QByteArray &data, const QString &tagName, const QXmlStreamAttributes &attributes, bool &handled);
+
 protected:
     /// \cond
     void handleStream(const QDomElement &element);
     void handleStanza(const QDomElement &element);
+    bool handleStanzaData(const QByteArray &data, const QString &tagName, const QXmlStreamAttributes &attributes);
     /// \endcond
 
 private slots:
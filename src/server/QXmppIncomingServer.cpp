@@ -42,6 +42,7 @@ public:
     QSet<QString> authenticated;
     QString domain;
     QString localStreamId;
+    QString remoteDomain;
 
 private:
     QXmppIncomingServer *q;
@@ -103,6 +104,14 @@ QString QXmppIncomingServer::localStreamId() const
     return d->localStreamId;
 }
 
+/// Returns the first remote domain which was verified on this stream.
+///
+
+QString QXmppIncomingServer::remoteDomain() const
+{
+    return d->remoteDomain;
+}
+
 /// \cond
 void QXmppIncomingServer::handleStream(const QDomElement &streamElement)
 {
@@ -183,6 +192,18 @@ void QXmppIncomingServer::handleStanza(const QDomElement &stanza)
         disconnectFromHost();
     }
 }
+
+bool QXmppIncomingServer::handleStanzaData(const QByteArray &data, const QString &tagName, const QXmlStreamAttributes &attributes)
+{
+    // stanzas from unverified domains are rejected once parsed
+    if (!d->authenticated.contains(QXmppUtils::jidToDomain(attributes.value("from").toString())))
+        return false;
+
+    // offer stanza for routing by server
+    bool handled = false;
+    emit stanzaDataReceived(data, tagName, attributes, handled);
+    return handled;
+}
 /// \endcond
 
 /// Returns true if the socket is connected and the remote server is
@@ -222,8 +243,10 @@ void QXmppIncomingServer::slotDialbackResponseReceived(const QXmppDialback &dial
         info(QString("Verified incoming domain '%1' on %2").arg(dialback.from(), d->origin()));
         const bool wasConnected = !d->authenticated.isEmpty();
         d->authenticated.insert(dialback.from());
-        if (!wasConnected)
+        if (!wasConnected) {
+            d->remoteDomain = dialback.from();
             emit connected();
+        }
     } else {
         warning(QString("Failed to verify incoming domain '%1' on %2").arg(dialback.from(), d->origin()));
         disconnectFromHost();
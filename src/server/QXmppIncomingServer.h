@@ -44,6 +44,7 @@ public:
 
     bool isConnected() const;
     QString localStreamId() const;
+    QString remoteDomain() const;
 
 signals:
     /// This signal is emitted when a dialback verify request is received.
@@ -52,9 +53,15 @@ signals:
     /// This signal is emitted when an element is received.
     void elementReceived(const QDomElement &element);
 
+    /// This signal is emitted when a stanza is received which may be routed
+    /// using its data. If \a handled is set to true, the stanza is not parsed
+    /// and elementReceived() is not emitted for it.
+    void stanzaDataReceived(const QByteArray &data, const QString &tagName, const QXmlStreamAttributes &attributes, bool &handled);
+
 protected:
     /// \cond
     void handleStanza(const QDomElement &stanzaElement);
+    bool handleStanzaData(const QByteArray &data, const QString &tagName, const QXmlStreamAttributes &attributes);
     void handleStream(const QDomElement &streamElement);
     /// \endcond
 
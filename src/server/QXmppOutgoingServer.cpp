@@ -24,13 +24,13 @@
 #include <QDomElement>
 #include <QSslKey>
 #include <QSslSocket>
-#include <QTimer>
 #include <QDnsLookup>
 
 #include "QXmppConstants_p.h"
 #include "QXmppDialback.h"
 #include "QXmppOutgoingServer.h"
 #include "QXmppStreamFeatures.h"
+#include "QXmppTimerWheel_p.h"
 #include "QXmppUtils.h"
 
 class QXmppOutgoingServerPrivate
@@ -43,7 +43,7 @@ public:
     QString remoteDomain;
     QString verifyId;
     QString verifyKey;
-    QTimer *dialbackTimer;
+    QXmppCoarseTimer *dialbackTimer;
     bool ready;
 };
 
@@ -77,7 +77,7 @@ QXmppOutgoingServer::QXmppOutgoingServer(const QString &domain, QObject *parent)
                     this, SLOT(_q_dnsLookupFinished()));
     Q_ASSERT(check);
 
-    d->dialbackTimer = new QTimer(this);
+    d->dialbackTimer = new QXmppCoarseTimer(this);
     d->dialbackTimer->setInterval(5000);
     d->dialbackTimer->setSingleShot(true);
     check = connect(d->dialbackTimer, SIGNAL(timeout()),
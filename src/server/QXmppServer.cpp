@@ -23,11 +23,13 @@
 
 #include <QCoreApplication>
 #include <QDomElement>
+#include <QElapsedTimer>
 #include <QFileInfo>
 #include <QPluginLoader>
 #include <QSslCertificate>
 #include <QSslKey>
 #include <QSslSocket>
+#include <QTimer>
 
 #include "QXmppConstants_p.h"
 #include "QXmppDialback.h"
@@ -36,11 +38,19 @@
 #include "QXmppIncomingServer.h"
 #include "QXmppOutgoingServer.h"
 #include "QXmppPresence.h"
+#include "QXmppProfiler_p.h"
+#include "QXmppRateLimiter_p.h"
 #include "QXmppServer.h"
 #include "QXmppServerExtension.h"
 #include "QXmppServerPlugin.h"
 #include "QXmppUtils.h"
 
+// maximum number of bytes processed at once for each incoming stream
+static const int STREAM_READ_BUDGET = 16384;
+
+// interval at which the event loop lag is measured, in milliseconds
+static const int LAG_INTERVAL = 1000;
+
 static void helperToXmlAddDomElement(QXmlStreamWriter* stream, const QDomElement& element, const QStringList &omitNamespaces)
 {
     stream->writeStartElement(element.tagName());
@@ -71,12 +81,25 @@ static void helperToXmlAddDomElement(QXmlStreamWriter* stream, const QDomElement
     stream->writeEndElement();
 }
 
+static void appendStanza(QByteArray &batch, const QByteArray &prefix, const QByteArray &toAttribute, const QByteArray &suffix)
+{
+    if (batch.isEmpty())
+        batch.reserve(4 * (prefix.size() + toAttribute.size() + suffix.size()));
+    batch.append(prefix);
+    batch.append(toAttribute);
+    batch.append(suffix);
+}
+
 class QXmppServerPrivate
 {
 public:
     QXmppServerPrivate(QXmppServer *qq);
     void loadExtensions(QXmppServer *server);
+    void handleStanza(const QDomElement &element);
+    QList<QXmppIncomingClient*> localStreams(const QString &to) const;
     bool routeData(const QString &to, const QByteArray &data);
+    bool routeRemoteData(const QString &toDomain, const QByteArray &data);
+    bool routeStanzaData(const QByteArray &data, const QString &tagName, const QXmlStreamAttributes &attributes);
     void startExtensions();
     void stopExtensions();
 
@@ -94,11 +117,22 @@ public:
     QHash<QString, QSet<QXmppIncomingClient*> > incomingClientsByBareJid;
     QSet<QXmppSslServer*> serversForClients;
 
+    // inbound rate limits, per client session and per remote domain
+    qint64 clientBytesPerSecond;
+    qint64 clientStanzasPerSecond;
+    qint64 serverBytesPerSecond;
+    qint64 serverStanzasPerSecond;
+    QHash<QString, QWeakPointer<QXmppRateLimiter> > serverRateLimiters;
+
     // server-to-server
     QSet<QXmppIncomingServer*> incomingServers;
     QSet<QXmppOutgoingServer*> outgoingServers;
     QSet<QXmppSslServer*> serversForServers;
 
+    // event loop lag
+    QElapsedTimer lagClock;
+    QTimer *lagTimer;
+
     // ssl
     QList<QSslCertificate> caCertificates;
     QSslCertificate localCertificate;
@@ -113,12 +147,35 @@ private:
 QXmppServerPrivate::QXmppServerPrivate(QXmppServer *qq)
     : logger(0),
     passwordChecker(0),
+    clientBytesPerSecond(0),
+    clientStanzasPerSecond(0),
+    serverBytesPerSecond(0),
+    serverStanzasPerSecond(0),
+    lagTimer(0),
     loaded(false),
     started(false),
     q(qq)
 {
 }
 
+/// Returns the local client streams for the given recipient.
+///
+/// \param to
+
+QList<QXmppIncomingClient*> QXmppServerPrivate::localStreams(const QString &to) const
+{
+    QList<QXmppIncomingClient*> found;
+    if (QXmppUtils::jidToResource(to).isEmpty()) {
+        foreach (QXmppIncomingClient *conn, incomingClientsByBareJid.value(to))
+            found << conn;
+    } else {
+        QXmppIncomingClient *conn = incomingClientsByJid.value(to);
+        if (conn)
+            found << conn;
+    }
+    return found;
+}
+
 /// Routes XMPP data to the given recipient.
 ///
 /// \param to
@@ -135,22 +192,29 @@ bool QXmppServerPrivate::routeData(const QString &to, const QByteArray &data)
     if (toDomain == domain) {
 
         // look for a client connection
-        QList<QXmppIncomingClient*> found;
-        if (QXmppUtils::jidToResource(to).isEmpty()) {
-            foreach (QXmppIncomingClient *conn, incomingClientsByBareJid.value(to))
-                found << conn;
-        } else {
-            QXmppIncomingClient *conn = incomingClientsByJid.value(to);
-            if (conn)
-                found << conn;
-        }
+        const QList<QXmppIncomingClient*> found = localStreams(to);
 
         // send data
         foreach (QXmppStream *conn, found)
             QMetaObject::invokeMethod(conn, "sendData", Q_ARG(QByteArray, data));
         return !found.isEmpty();
 
-    } else if (!serversForServers.isEmpty()) {
+    } else {
+
+        return routeRemoteData(toDomain, data);
+
+    }
+}
+
+/// Routes XMPP data to the given remote domain.
+///
+/// \param toDomain
+/// \param data
+///
+
+bool QXmppServerPrivate::routeRemoteData(const QString &toDomain, const QByteArray &data)
+{
+    if (!serversForServers.isEmpty()) {
 
         bool check;
         Q_UNUSED(check);
@@ -192,21 +256,54 @@ bool QXmppServerPrivate::routeData(const QString &to, const QByteArray &data)
     }
 }
 
+/// Routes a received stanza using its data, without parsing it.
+///
+/// Returns false if the stanza needs to be parsed, because it is addressed
+/// to the server, an extension may handle it or an error must be sent back.
+///
+/// \param data
+/// \param tagName
+/// \param attributes
+
+bool QXmppServerPrivate::routeStanzaData(const QByteArray &data, const QString &tagName, const QXmlStreamAttributes &attributes)
+{
+    const QString to = attributes.value("to").toString();
+    if (to.isEmpty() || to == domain)
+        return false;
+
+    const QString type = attributes.value("type").toString();
+    const QString from = attributes.value("from").toString();
+    foreach (QXmppServerExtension *extension, q->extensions()) {
+        if (extension->acceptsStanza(tagName, type, from, to))
+            return false;
+    }
+
+    if (routeData(to, data)) {
+        q->updateCounter("router.raw");
+        return true;
+    }
+
+    // reply on behalf of missing peer
+    return tagName != QLatin1String("iq");
+}
+
 /// Handles an incoming XML element.
 ///
-/// \param server
-/// \param stream
 /// \param element
 
-static void handleStanza(QXmppServer *server, const QDomElement &element)
+void QXmppServerPrivate::handleStanza(const QDomElement &element)
 {
     // try extensions
-    foreach (QXmppServerExtension *extension, server->extensions())
-        if (extension->handleStanza(element))
+    QXmppProfilerSample sample;
+    foreach (QXmppServerExtension *extension, q->extensions()) {
+        const bool handled = extension->handleStanza(element);
+        if (sample.isActive())
+            sample.record(QLatin1String("server.handleStanza.") + extension->extensionName());
+        if (handled)
             return;
+    }
 
     // default handlers
-    const QString domain = server->domain();
     const QString to = element.attribute("to");
     if (to == domain) {
         if (element.tagName() == QLatin1String("iq")) {
@@ -222,14 +319,17 @@ static void handleStanza(QXmppServer *server, const QDomElement &element)
                 QXmppStanza::Error error(QXmppStanza::Error::Cancel,
                     QXmppStanza::Error::FeatureNotImplemented);
                 response.setError(error);
-                server->sendPacket(response);
+                q->sendPacket(response);
             }
         }
 
     } else {
 
-        // route element or reply on behalf of missing peer
-        if (!server->sendElement(element) && element.tagName() == QLatin1String("iq")) {
+        // route element
+        const bool routed = q->sendElement(element);
+
+        // reply on behalf of missing peer
+        if (!routed && element.tagName() == QLatin1String("iq")) {
             QXmppIq request;
             request.parse(element);
 
@@ -240,7 +340,7 @@ static void handleStanza(QXmppServer *server, const QDomElement &element)
             QXmppStanza::Error error(QXmppStanza::Error::Cancel,
                 QXmppStanza::Error::ServiceUnavailable);
             response.setError(error);
-            server->sendPacket(response);
+            q->sendPacket(response);
         }
     }
 }
@@ -309,7 +409,18 @@ QXmppServer::QXmppServer(QObject *parent)
     : QXmppLoggable(parent)
     , d(new QXmppServerPrivate(this))
 {
+    bool check;
+    Q_UNUSED(check);
+
     qRegisterMetaType<QDomElement>("QDomElement");
+
+    // measure how late the event loop fires timers
+    d->lagTimer = new QTimer(this);
+    d->lagTimer->setInterval(LAG_INTERVAL);
+    d->lagTimer->setTimerType(Qt::PreciseTimer);
+    check = connect(d->lagTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_lagTimeout()));
+    Q_ASSERT(check);
 }
 
 /// Destroys an XMPP server instance.
@@ -426,6 +537,36 @@ void QXmppServer::setPasswordChecker(QXmppPasswordChecker *checker)
     d->passwordChecker = checker;
 }
 
+/// Sets the maximum rate at which each client session may send data.
+///
+/// When a client exceeds the limit, reading from its socket is paused
+/// until the rate falls back under the limit, so that it cannot delay
+/// the processing of other sessions. This applies to new sessions.
+///
+/// \param bytesPerSecond The maximum number of bytes per second, or 0 for no limit.
+/// \param stanzasPerSecond The maximum number of stanzas per second, or 0 for no limit.
+
+void QXmppServer::setClientRateLimit(qint64 bytesPerSecond, qint64 stanzasPerSecond)
+{
+    d->clientBytesPerSecond = bytesPerSecond;
+    d->clientStanzasPerSecond = stanzasPerSecond;
+}
+
+/// Sets the maximum rate at which each remote domain may send data.
+///
+/// The limit is shared by all the incoming streams of a remote domain once
+/// it has been verified, and applies to each stream before that. This
+/// applies to new streams.
+///
+/// \param bytesPerSecond The maximum number of bytes per second, or 0 for no limit.
+/// \param stanzasPerSecond The maximum number of stanzas per second, or 0 for no limit.
+
+void QXmppServer::setServerRateLimit(qint64 bytesPerSecond, qint64 stanzasPerSecond)
+{
+    d->serverBytesPerSecond = bytesPerSecond;
+    d->serverStanzasPerSecond = stanzasPerSecond;
+}
+
 /// Returns the statistics for the server.
 
 QVariantMap QXmppServer::statistics() const
@@ -435,6 +576,8 @@ QVariantMap QXmppServer::statistics() const
     stats["incoming-clients"] = d->incomingClients.size();
     stats["incoming-servers"] = d->incomingServers.size();
     stats["outgoing-servers"] = d->outgoingServers.size();
+    if (QXmppProfiler::isEnabled())
+        stats["profiler"] = QXmppProfiler::snapshot();
     return stats;
 }
 
@@ -563,6 +706,12 @@ bool QXmppServer::listenForClients(const QHostAddress &address, quint16 port)
     }
     d->serversForClients.insert(server);
 
+    // measure the event loop lag while serving
+    if (!d->lagTimer->isActive()) {
+        d->lagTimer->start();
+        d->lagClock.start();
+    }
+
     // start extensions
     d->loadExtensions(this);
     d->startExtensions();
@@ -581,6 +730,7 @@ void QXmppServer::close()
     }
     d->serversForClients.clear();
     d->serversForServers.clear();
+    d->lagTimer->stop();
 
     // stop extensions
     d->stopExtensions();
@@ -626,6 +776,12 @@ bool QXmppServer::listenForServers(const QHostAddress &address, quint16 port)
     }
     d->serversForServers.insert(server);
 
+    // measure the event loop lag while serving
+    if (!d->lagTimer->isActive()) {
+        d->lagTimer->start();
+        d->lagClock.start();
+    }
+
     // start extensions
     d->loadExtensions(this);
     d->startExtensions();
@@ -648,6 +804,18 @@ bool QXmppServer::sendElement(const QDomElement &element)
     return d->routeData(element.attribute("to"), data);
 }
 
+/// Route raw XMPP data.
+///
+/// The data must be one or more serialized stanzas addressed to \a to.
+///
+/// \param to The JID of the recipient.
+/// \param data The serialized stanzas.
+
+bool QXmppServer::sendData(const QString &to, const QByteArray &data)
+{
+    return d->routeData(to, data);
+}
+
 /// Route an XMPP packet.
 ///
 /// \param packet
@@ -663,6 +831,73 @@ bool QXmppServer::sendPacket(const QXmppStanza &packet)
     return d->routeData(packet.to(), data);
 }
 
+/// Routes an XMPP packet to several recipients.
+///
+/// The packet is serialized once and only its 'to' attribute is rewritten
+/// for each recipient. Stanzas for the same stream, be it a local client or
+/// a remote domain, are written in a single batch.
+///
+/// Returns the number of recipients the packet was routed to.
+///
+/// \param packet The packet to route, its recipient is ignored.
+/// \param recipients The JIDs of the recipients.
+
+int QXmppServer::broadcastPacket(const QXmppStanza &packet, const QSet<QString> &recipients)
+{
+    // serialize data
+    QByteArray data;
+    QXmlStreamWriter xmlStream(&data);
+    packet.toXml(&xmlStream);
+
+    // split the data around the start tag's 'to' attribute
+    QByteArray prefix, suffix;
+    const int tagEnd = data.indexOf('>');
+    const int toStart = data.indexOf(" to=\"");
+    if (toStart > 0 && toStart < tagEnd) {
+        prefix = data.left(toStart);
+        suffix = data.mid(data.indexOf('"', toStart + 5) + 1);
+    } else {
+        int pos = 1;
+        while (pos < data.size() && data[pos] != ' ' && data[pos] != '/' && data[pos] != '>')
+            ++pos;
+        prefix = data.left(pos);
+        suffix = data.mid(pos);
+    }
+
+    QHash<QXmppIncomingClient*, QByteArray> localBatches;
+    QHash<QString, QByteArray> remoteBatches;
+    int routed = 0;
+
+    foreach (const QString &to, recipients) {
+        // refuse to route packets to empty destination, own domain or sub-domains
+        const QString toDomain = QXmppUtils::jidToDomain(to);
+        if (to.isEmpty() || to == d->domain || toDomain.endsWith("." + d->domain))
+            continue;
+
+        const QByteArray toAttribute = " to=\"" + to.toHtmlEscaped().toUtf8() + "\"";
+        if (toDomain == d->domain) {
+            const QList<QXmppIncomingClient*> found = d->localStreams(to);
+            if (found.isEmpty())
+                continue;
+            foreach (QXmppIncomingClient *conn, found)
+                appendStanza(localBatches[conn], prefix, toAttribute, suffix);
+        } else if (!d->serversForServers.isEmpty()) {
+            appendStanza(remoteBatches[toDomain], prefix, toAttribute, suffix);
+        } else {
+            continue;
+        }
+        routed++;
+    }
+
+    // send data
+    for (QHash<QXmppIncomingClient*, QByteArray>::const_iterator it = localBatches.constBegin(); it != localBatches.constEnd(); ++it)
+        QMetaObject::invokeMethod(it.key(), "sendData", Q_ARG(QByteArray, it.value()));
+    for (QHash<QString, QByteArray>::const_iterator it = remoteBatches.constBegin(); it != remoteBatches.constEnd(); ++it)
+        d->routeRemoteData(it.key(), it.value());
+
+    return routed;
+}
+
 /// Add a new incoming client \a stream.
 ///
 /// This method can be used for instance to implement BOSH support
@@ -674,11 +909,18 @@ void QXmppServer::addIncomingClient(QXmppIncomingClient *stream)
     Q_UNUSED(check);
 
     stream->setPasswordChecker(d->passwordChecker);
+    stream->setReadBudget(STREAM_READ_BUDGET);
+    if (d->clientBytesPerSecond || d->clientStanzasPerSecond)
+        stream->setRateLimiter(QSharedPointer<QXmppRateLimiter>(new QXmppRateLimiter(d->clientBytesPerSecond, d->clientStanzasPerSecond)));
 
     check = connect(stream, SIGNAL(connected()),
                     this, SLOT(_q_clientConnected()));
     Q_ASSERT(check);
 
+    check = connect(stream, SIGNAL(throttled()),
+                    this, SLOT(_q_streamThrottled()));
+    Q_ASSERT(check);
+
     check = connect(stream, SIGNAL(disconnected()),
                     this, SLOT(_q_clientDisconnected()));
     Q_ASSERT(check);
@@ -687,11 +929,27 @@ void QXmppServer::addIncomingClient(QXmppIncomingClient *stream)
                     this, SLOT(handleElement(QDomElement)));
     Q_ASSERT(check);
 
+    check = connect(stream, SIGNAL(stanzaDataReceived(QByteArray,QString,QXmlStreamAttributes,bool&)),
+                    this, SLOT(_q_stanzaDataReceived(QByteArray,QString,QXmlStreamAttributes,bool&)),
+                    Qt::DirectConnection);
+    Q_ASSERT(check);
+
     // add stream
     d->incomingClients.insert(stream);
     setGauge("incoming-client.count", d->incomingClients.size());
 }
 
+/// Reports how late the event loop fired the lag timer, which is how long
+/// events may wait before being processed.
+
+void QXmppServer::_q_lagTimeout()
+{
+    const qint64 lag = qMax(d->lagClock.restart() - LAG_INTERVAL, qint64(0));
+    setGauge("event-loop.lag", lag);
+    if (QXmppProfiler::isEnabled())
+        QXmppProfiler::record("server.event-loop.lag", lag * 1000);
+}
+
 /// Handle a new incoming TCP connection from a client.
 ///
 /// \param socket
@@ -799,7 +1057,7 @@ void QXmppServer::_q_dialbackRequestReceived(const QXmppDialback &dialback)
 
 void QXmppServer::handleElement(const QDomElement &element)
 {
-    handleStanza(this, element);
+    d->handleStanza(element);
 }
 
 /// Handle a stream disconnection for an outgoing server.
@@ -833,11 +1091,22 @@ void QXmppServer::_q_serverConnection(QSslSocket *socket)
 
     QXmppIncomingServer *stream = new QXmppIncomingServer(socket, d->domain, this);
     socket->setParent(stream);
+    stream->setReadBudget(STREAM_READ_BUDGET);
+    if (d->serverBytesPerSecond || d->serverStanzasPerSecond)
+        stream->setRateLimiter(QSharedPointer<QXmppRateLimiter>(new QXmppRateLimiter(d->serverBytesPerSecond, d->serverStanzasPerSecond)));
+
+    check = connect(stream, SIGNAL(connected()),
+                    this, SLOT(_q_serverConnected()));
+    Q_ASSERT(check);
 
     check = connect(stream, SIGNAL(disconnected()),
                     this, SLOT(_q_serverDisconnected()));
     Q_ASSERT(check);
 
+    check = connect(stream, SIGNAL(throttled()),
+                    this, SLOT(_q_streamThrottled()));
+    Q_ASSERT(check);
+
     check = connect(stream, SIGNAL(dialbackRequestReceived(QXmppDialback)),
                     this, SLOT(_q_dialbackRequestReceived(QXmppDialback)));
     Q_ASSERT(check);
@@ -846,11 +1115,34 @@ void QXmppServer::_q_serverConnection(QSslSocket *socket)
                     this, SLOT(handleElement(QDomElement)));
     Q_ASSERT(check);
 
+    check = connect(stream, SIGNAL(stanzaDataReceived(QByteArray,QString,QXmlStreamAttributes,bool&)),
+                    this, SLOT(_q_stanzaDataReceived(QByteArray,QString,QXmlStreamAttributes,bool&)),
+                    Qt::DirectConnection);
+    Q_ASSERT(check);
+
     // add stream
     d->incomingServers.insert(stream);
     setGauge("incoming-server.count", d->incomingServers.size());
 }
 
+/// Handle a successful stream connection for an incoming server.
+
+void QXmppServer::_q_serverConnected()
+{
+    QXmppIncomingServer *incoming = qobject_cast<QXmppIncomingServer *>(sender());
+    if (!incoming || !incoming->rateLimiter())
+        return;
+
+    // share the rate limit between all the streams of the remote domain
+    const QString domain = incoming->remoteDomain();
+    QSharedPointer<QXmppRateLimiter> limiter = d->serverRateLimiters.value(domain).toStrongRef();
+    if (!limiter) {
+        limiter = incoming->rateLimiter();
+        d->serverRateLimiters.insert(domain, limiter.toWeakRef());
+    }
+    incoming->setRateLimiter(limiter);
+}
+
 /// Handle a stream disconnection for an incoming server.
 
 void QXmppServer::_q_serverDisconnected()
@@ -860,11 +1152,35 @@ void QXmppServer::_q_serverDisconnected()
         return;
 
     if (d->incomingServers.remove(incoming)) {
+        QHash<QString, QWeakPointer<QXmppRateLimiter> >::iterator it = d->serverRateLimiters.find(incoming->remoteDomain());
+        if (it != d->serverRateLimiters.end() && it.value() == incoming->rateLimiter()) {
+            incoming->setRateLimiter(QSharedPointer<QXmppRateLimiter>());
+            if (it.value().isNull())
+                d->serverRateLimiters.erase(it);
+        }
         incoming->deleteLater();
         setGauge("incoming-server.count", d->incomingServers.size());
     }
 }
 
+/// Handles a stanza received by one of the incoming streams, before it
+/// is parsed.
+
+void QXmppServer::_q_stanzaDataReceived(const QByteArray &data, const QString &tagName, const QXmlStreamAttributes &attributes, bool &handled)
+{
+    handled = d->routeStanzaData(data, tagName, attributes);
+}
+
+/// Counts the streams whose reading was paused by their rate limiter.
+
+void QXmppServer::_q_streamThrottled()
+{
+    if (qobject_cast<QXmppIncomingClient*>(sender()))
+        updateCounter("incoming-client.throttled");
+    else if (qobject_cast<QXmppIncomingServer*>(sender()))
+        updateCounter("incoming-server.throttled");
+}
+
 class QXmppSslServerPrivate
 {
 public:
@@ -24,6 +24,7 @@
 #ifndef QXMPPSERVER_H
 #define QXMPPSERVER_H
 
+#include <QSet>
 #include <QTcpServer>
 #include <QVariantMap>
 
@@ -33,6 +34,7 @@ class QDomElement;
 class QSslCertificate;
 class QSslKey;
 class QSslSocket;
+class QXmlStreamAttributes;
 
 class QXmppDialback;
 class QXmppIncomingClient;
@@ -77,6 +79,9 @@ public:
     QXmppPasswordChecker *passwordChecker();
     void setPasswordChecker(QXmppPasswordChecker *checker);
 
+    void setClientRateLimit(qint64 bytesPerSecond, qint64 stanzasPerSecond);
+    void setServerRateLimit(qint64 bytesPerSecond, qint64 stanzasPerSecond);
+
     QVariantMap statistics() const;
 
     void addCaCertificates(const QString &caCertificates);
@@ -89,8 +94,10 @@ public:
     bool listenForClients(const QHostAddress &address = QHostAddress::Any, quint16 port = 5222);
     bool listenForServers(const QHostAddress &address = QHostAddress::Any, quint16 port = 5269);
 
+    bool sendData(const QString &to, const QByteArray &data);
     bool sendElement(const QDomElement &element);
     bool sendPacket(const QXmppStanza &stanza);
+    int broadcastPacket(const QXmppStanza &packet, const QSet<QString> &recipients);
 
     void addIncomingClient(QXmppIncomingClient *stream);
 
@@ -112,9 +119,13 @@ private slots:
     void _q_clientConnected();
     void _q_clientDisconnected();
     void _q_dialbackRequestReceived(const QXmppDialback &dialback);
+    void _q_lagTimeout();
     void _q_outgoingServerDisconnected();
+    void _q_serverConnected();
     void _q_serverConnection(QSslSocket *socket);
     void _q_serverDisconnected();
+    void _q_stanzaDataReceived(const QByteArray &data, const QString &tagName, const QXmlStreamAttributes &attributes, bool &handled);
+    void _q_streamThrottled();
 
 private:
     friend class QXmppServerPrivate;
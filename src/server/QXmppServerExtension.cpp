@@ -90,6 +90,9 @@ int QXmppServerExtension::extensionPriority() const
 ///
 /// Return true if no further processing should occur, false otherwise.
 ///
+/// Stanzas which are not handled by any extension are routed as they were
+/// left by the extensions.
+///
 /// \param stanza The received stanza.
 
 bool QXmppServerExtension::handleStanza(const QDomElement &stanza)
@@ -98,6 +101,33 @@ bool QXmppServerExtension::handleStanza(const QDomElement &stanza)
     return false;
 }
 
+/// Returns true if the extension may handle or modify the given stanza.
+///
+/// This is called before a stanza received from a client or a server is
+/// parsed. If no extension accepts it, the stanza is routed using the data
+/// it was received with and handleStanza() is not called for it.
+///
+/// Stanzas addressed to the server's domain or without a recipient, and
+/// requests which cannot be delivered, are always parsed and passed to
+/// handleStanza(). Reimplement this method if your extension also needs to
+/// see stanzas exchanged between other entities.
+///
+/// The default implementation returns false.
+///
+/// \param tagName The name of the stanza's element.
+/// \param type The stanza's type attribute.
+/// \param from The stanza's sender.
+/// \param to The stanza's recipient.
+
+bool QXmppServerExtension::acceptsStanza(const QString &tagName, const QString &type, const QString &from, const QString &to) const
+{
+    Q_UNUSED(tagName);
+    Q_UNUSED(type);
+    Q_UNUSED(from);
+    Q_UNUSED(to);
+    return false;
+}
+
 /// Returns the list of subscribers for the given JID.
 ///
 /// \param jid
@@ -43,6 +43,10 @@ class QXmppStream;
 /// and implement handleStanza(). You can then add your extension to the
 /// client instance using QXmppServer::addExtension().
 ///
+/// Stanzas which are addressed to another entity than the server are
+/// routed without being parsed, unless an extension claims them by
+/// reimplementing acceptsStanza().
+///
 /// \ingroup Core
 
 class QXMPP_EXPORT QXmppServerExtension : public QXmppLoggable
@@ -57,6 +61,7 @@ public:
 
     virtual QStringList discoveryFeatures() const;
     virtual QStringList discoveryItems() const;
+    virtual bool acceptsStanza(const QString &tagName, const QString &type, const QString &from, const QString &to) const;
     virtual bool handleStanza(const QDomElement &stanza);
     virtual QSet<QString> presenceSubscribers(const QString &jid);
     virtual QSet<QString> presenceSubscriptions(const QString &jid);
@@ -0,0 +1,905 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <algorithm>
+#include <limits>
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QDomElement>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSet>
+#include <QThread>
+#include <QUrl>
+#include <QXmlStreamWriter>
+
+#include "QXmppConstants_p.h"
+#include "QXmppDataForm.h"
+#include "QXmppMamIq.h"
+#include "QXmppMessage.h"
+#include "QXmppServer.h"
+#include "QXmppServerMessageArchive.h"
+#include "QXmppServerMessageArchive_p.h"
+#include "QXmppUtils.h"
+
+// add a sparse index entry every indexInterval records
+static const int indexInterval = 64;
+
+// version of the saved segment indexes
+static const quint32 indexVersion = 1;
+
+// maximum number of archives kept loaded
+static const int maximumArchives = 1024;
+
+// maximum number of segment files kept open
+static const int maximumOpenFiles = 64;
+
+// archive ids are the record's timestamp in milliseconds, shifted to make
+// room for a sequence number
+static const int idSequenceBits = 12;
+
+static qint64 idToMSecs(quint64 id)
+{
+    return qint64(id >> idSequenceBits);
+}
+
+static int idToSegment(quint64 id)
+{
+    const QDate date = QDateTime::fromMSecsSinceEpoch(idToMSecs(id), Qt::UTC).date();
+    return date.year() * 100 + date.month();
+}
+
+static QByteArray xmlAttribute(const QString &value)
+{
+    return value.toHtmlEscaped().toUtf8();
+}
+
+QXmppMessageArchiveWorker::Segment::Segment()
+    : size(0)
+    , count(0)
+    , lastId(0)
+    , dirty(false)
+{
+}
+
+QXmppMessageArchiveWorker::Archive::Archive()
+    : count(0)
+    , lastId(0)
+    , unindexed(0)
+    , lastUsed(0)
+{
+}
+
+QXmppMessageArchiveWorker::QXmppMessageArchiveWorker(const QString &path)
+    : m_path(path)
+    , m_useCount(0)
+{
+}
+
+QXmppMessageArchiveWorker::~QXmppMessageArchiveWorker()
+{
+    close();
+}
+
+/// Appends a message to a user's archive.
+///
+/// \param jid The user's bare JID.
+/// \param with The JID of the other party.
+/// \param id The archive id of the message.
+/// \param data The message stanza.
+/// \param create Whether to create the archive if the user has none yet.
+
+void QXmppMessageArchiveWorker::archive(const QString &jid, const QString &with, qlonglong id, const QByteArray &data, bool create)
+{
+    if (!create && !hasArchive(jid))
+        return;
+
+    Archive &archive = loadArchive(jid);
+
+    // keep ids increasing within an archive
+    quint64 recordId = quint64(id);
+    if (recordId <= archive.lastId)
+        recordId = archive.lastId + 1;
+
+    const int segment = idToSegment(recordId);
+    QFile *file = segmentFile(jid, segment);
+    if (!file)
+        return;
+
+    QByteArray payload;
+    QDataStream payloadStream(&payload, QIODevice::WriteOnly);
+    payloadStream.setVersion(QDataStream::Qt_5_0);
+    payloadStream << recordId << with << data;
+
+    QByteArray record;
+    QDataStream recordStream(&record, QIODevice::WriteOnly);
+    recordStream << quint32(payload.size());
+    record.append(payload);
+
+    const qint64 offset = file->size();
+    if (!file->seek(offset) || file->write(record) != record.size() || !file->flush()) {
+        emit error(QString("Could not write to message archive %1").arg(file->fileName()));
+        return;
+    }
+    addRecord(archive, recordId, with, segment, offset, offset + record.size());
+}
+
+/// Saves the index of all loaded archives and closes all open segment files.
+
+void QXmppMessageArchiveWorker::close()
+{
+    for (QHash<QString, Archive>::iterator it = m_archives.begin(); it != m_archives.end(); ++it)
+        saveIndex(it.key(), it.value());
+    closeFiles();
+}
+
+/// Runs an archive query and emits its results.
+///
+/// \param query
+
+void QXmppMessageArchiveWorker::query(const QVariantMap &query)
+{
+    const QString jid = query.value("jid").toString();
+    const QString with = query.value("with").toString();
+    const bool withBareJid = QXmppUtils::jidToResource(with).isEmpty();
+    const bool backward = query.value("backward").toBool();
+    const int max = query.value("max").toInt();
+
+    QVariantMap reply;
+    reply["to"] = query.value("to");
+    reply["id"] = query.value("id");
+
+    // determine the range of ids to return
+    quint64 lo = 0;
+    quint64 hi = std::numeric_limits<quint64>::max();
+    if (query.contains("start"))
+        lo = quint64(qMax(qlonglong(0), query.value("start").toLongLong())) << idSequenceBits;
+    if (query.contains("end"))
+        hi = ((quint64(qMax(qlonglong(0), query.value("end").toLongLong())) + 1) << idSequenceBits) - 1;
+
+    bool ok = true;
+    const QString after = query.value("after").toString();
+    if (!after.isEmpty()) {
+        const quint64 afterId = after.toULongLong(&ok);
+        lo = qMax(lo, afterId + 1);
+    }
+    const QString before = query.value("before").toString();
+    if (ok && !before.isEmpty()) {
+        const quint64 beforeId = before.toULongLong(&ok);
+        hi = qMin(hi, beforeId ? beforeId - 1 : 0);
+    }
+    if (!ok) {
+        reply["error"] = true;
+        emit queryFinished(reply);
+        return;
+    }
+
+    // do not load an archive for a user who has none, an empty one would
+    // stay cached and be appended to
+    const Archive none;
+    const Archive &archive = hasArchive(jid) ? loadArchive(jid) : none;
+    QList<Record> results;
+
+    // only read the blocks holding records exchanged with the requested peer
+    const QVector<int> peerBlocks = archive.peers.value(QXmppUtils::jidToBareJid(with));
+    const int blockCount = with.isEmpty() ? archive.index.size() : peerBlocks.size();
+    auto blockAt = [&](int i) { return with.isEmpty() ? i : peerBlocks.at(i); };
+
+    // read blocks of records in the requested direction until we have
+    // one more result than requested
+    if (backward) {
+        int i = findBlock(archive, hi);
+        if (!with.isEmpty())
+            i = int(std::upper_bound(peerBlocks.constBegin(), peerBlocks.constEnd(), i) - peerBlocks.constBegin()) - 1;
+        for (; i >= 0 && results.size() <= max; --i) {
+            const int block = blockAt(i);
+            QList<Record> matches;
+            foreach (const Record &record, readBlock(jid, archive, block)) {
+                if (record.id < lo || record.id > hi)
+                    continue;
+                if (!with.isEmpty() && (withBareJid ? QXmppUtils::jidToBareJid(record.with) : record.with) != with)
+                    continue;
+                matches << record;
+            }
+            results = matches + results;
+            if (archive.index.at(block).id <= lo)
+                break;
+        }
+    } else {
+        int i = qMax(0, findBlock(archive, lo));
+        if (!with.isEmpty())
+            i = int(std::lower_bound(peerBlocks.constBegin(), peerBlocks.constEnd(), i) - peerBlocks.constBegin());
+        for (; i < blockCount && results.size() <= max; ++i) {
+            const int block = blockAt(i);
+            if (archive.index.at(block).id > hi)
+                break;
+            foreach (const Record &record, readBlock(jid, archive, block)) {
+                if (record.id < lo)
+                    continue;
+                if (record.id > hi || results.size() > max)
+                    break;
+                if (!with.isEmpty() && (withBareJid ? QXmppUtils::jidToBareJid(record.with) : record.with) != with)
+                    continue;
+                results << record;
+            }
+        }
+    }
+
+    const bool complete = results.size() <= max;
+    if (!complete)
+        results = backward ? results.mid(results.size() - max) : results.mid(0, max);
+
+    // send results
+    const QString to = query.value("to").toString();
+    const QString queryId = query.value("queryid").toString();
+    foreach (const Record &record, results) {
+        const QDateTime stamp = QDateTime::fromMSecsSinceEpoch(idToMSecs(record.id), Qt::UTC);
+
+        QByteArray data;
+        data += "<message to=\"" + xmlAttribute(to) + "\" from=\"" + xmlAttribute(jid) + "\">";
+        data += "<result xmlns=\"" + QByteArray(ns_mam) + "\"";
+        if (!queryId.isEmpty())
+            data += " queryid=\"" + xmlAttribute(queryId) + "\"";
+        data += " id=\"" + QByteArray::number(record.id) + "\">";
+        data += "<forwarded xmlns=\"" + QByteArray(ns_forwarding) + "\">";
+        data += "<delay xmlns=\"" + QByteArray(ns_delayed_delivery) + "\" stamp=\"" + QXmppUtils::datetimeToString(stamp).toUtf8() + "\"/>";
+        data += record.data;
+        data += "</forwarded></result></message>";
+        emit resultReady(to, data);
+    }
+
+    if (!results.isEmpty()) {
+        reply["first"] = QString::number(results.first().id);
+        reply["last"] = QString::number(results.last().id);
+    }
+    if (with.isEmpty() && !query.contains("start") && !query.contains("end"))
+        reply["count"] = archive.count;
+    reply["complete"] = complete;
+    emit queryFinished(reply);
+}
+
+/// Records the position of a new record in the archive's index.
+
+void QXmppMessageArchiveWorker::addRecord(Archive &archive, quint64 id, const QString &with, int segment, qint64 offset, qint64 end)
+{
+    // the first record of each segment is always indexed, so that blocks
+    // never span segments
+    if (archive.index.isEmpty() ||
+        archive.index.last().segment != segment ||
+        archive.unindexed >= indexInterval) {
+        IndexEntry entry;
+        entry.id = id;
+        entry.segment = segment;
+        entry.offset = offset;
+        archive.index << entry;
+        archive.unindexed = 0;
+    }
+
+    const int block = archive.index.size() - 1;
+    QVector<int> &blocks = archive.peers[QXmppUtils::jidToBareJid(with)];
+    if (blocks.isEmpty() || blocks.last() != block)
+        blocks << block;
+
+    archive.unindexed++;
+    archive.count++;
+    archive.lastId = id;
+
+    Segment &info = archive.segments[segment];
+    info.size = end;
+    info.count++;
+    info.lastId = id;
+    info.dirty = true;
+}
+
+QString QXmppMessageArchiveWorker::archivePath(const QString &jid) const
+{
+    return QString("%1/%2").arg(m_path, QString::fromLatin1(QUrl::toPercentEncoding(jid)));
+}
+
+void QXmppMessageArchiveWorker::closeFiles()
+{
+    qDeleteAll(m_files);
+    m_files.clear();
+}
+
+/// Returns true if the given user has an archive, without loading it.
+///
+/// \param jid
+
+bool QXmppMessageArchiveWorker::hasArchive(const QString &jid) const
+{
+    return m_archives.contains(jid) || QFileInfo(archivePath(jid)).isDir();
+}
+
+/// Returns the index of the last block whose first id is lower or equal to
+/// \a id, or -1 if there is none.
+
+int QXmppMessageArchiveWorker::findBlock(const Archive &archive, quint64 id) const
+{
+    QVector<IndexEntry>::const_iterator it = std::upper_bound(
+        archive.index.constBegin(), archive.index.constEnd(), id,
+        [](quint64 id, const IndexEntry &entry) { return id < entry.id; });
+    return int(it - archive.index.constBegin()) - 1;
+}
+
+/// Returns the archive for the given user, loading its index if needed.
+///
+/// The least recently used archive is unloaded when too many are loaded.
+///
+/// \param jid
+
+QXmppMessageArchiveWorker::Archive &QXmppMessageArchiveWorker::loadArchive(const QString &jid)
+{
+    QHash<QString, Archive>::iterator it = m_archives.find(jid);
+    if (it != m_archives.end()) {
+        it.value().lastUsed = ++m_useCount;
+        return it.value();
+    }
+
+    if (m_archives.size() >= maximumArchives) {
+        QHash<QString, Archive>::iterator idle = m_archives.begin();
+        for (it = m_archives.begin(); it != m_archives.end(); ++it) {
+            if (it.value().lastUsed < idle.value().lastUsed)
+                idle = it;
+        }
+        saveIndex(idle.key(), idle.value());
+        m_archives.erase(idle);
+    }
+
+    Archive archive;
+    const QDir dir(archivePath(jid));
+    foreach (const QString &name, dir.entryList(QStringList() << "*.seg", QDir::Files, QDir::Name)) {
+        bool ok;
+        const int segment = name.left(name.size() - 4).toInt(&ok);
+        if (!ok)
+            continue;
+
+        // only read the records which were appended after the index was saved
+        const qint64 size = QFileInfo(dir.filePath(name)).size();
+        const qint64 offset = loadIndex(jid, archive, segment, size);
+        if (offset < size)
+            scanSegment(jid, archive, segment, offset);
+    }
+    archive.lastUsed = ++m_useCount;
+    return m_archives.insert(jid, archive).value();
+}
+
+/// Loads the saved index of a segment and returns the size of the segment
+/// it covers, or 0 if there is no usable index.
+///
+/// \param jid
+/// \param archive
+/// \param segment
+/// \param size The current size of the segment.
+
+qint64 QXmppMessageArchiveWorker::loadIndex(const QString &jid, Archive &archive, int segment, qint64 size)
+{
+    QFile file(segmentPath(jid, segment, QLatin1String("idx")));
+    if (!file.open(QIODevice::ReadOnly))
+        return 0;
+
+    quint32 version = 0;
+    Segment info;
+    qint32 unindexed;
+    QVector<QPair<quint64, qint64> > entries;
+    QHash<QString, QVector<qint32> > peers;
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream >> version;
+    if (version != indexVersion)
+        return 0;
+    stream >> info.size >> info.count >> info.lastId >> unindexed >> entries >> peers;
+    if (stream.status() != QDataStream::Ok || info.size > size || entries.isEmpty())
+        return 0;
+
+    const int base = archive.index.size();
+    for (int i = 0; i < entries.size(); ++i) {
+        IndexEntry entry;
+        entry.id = entries.at(i).first;
+        entry.segment = segment;
+        entry.offset = entries.at(i).second;
+        archive.index << entry;
+    }
+    for (QHash<QString, QVector<qint32> >::const_iterator it = peers.constBegin(); it != peers.constEnd(); ++it) {
+        QVector<int> &blocks = archive.peers[it.key()];
+        foreach (qint32 block, it.value())
+            blocks << base + block;
+    }
+    archive.count += info.count;
+    archive.lastId = info.lastId;
+    archive.unindexed = unindexed;
+    archive.segments.insert(segment, info);
+    return info.size;
+}
+
+/// Saves the index of the segments which changed since it was last saved.
+///
+/// \param jid
+/// \param archive
+
+void QXmppMessageArchiveWorker::saveIndex(const QString &jid, Archive &archive)
+{
+    for (QMap<int, Segment>::iterator it = archive.segments.begin(); it != archive.segments.end(); ++it) {
+        Segment &info = it.value();
+        if (!info.dirty)
+            continue;
+
+        // the segment's blocks are contiguous
+        int first = 0;
+        while (first < archive.index.size() && archive.index.at(first).segment != it.key())
+            ++first;
+        int last = first;
+        while (last < archive.index.size() && archive.index.at(last).segment == it.key())
+            ++last;
+
+        QVector<QPair<quint64, qint64> > entries;
+        for (int i = first; i < last; ++i)
+            entries << qMakePair(archive.index.at(i).id, archive.index.at(i).offset);
+
+        QHash<QString, QVector<qint32> > peers;
+        for (QHash<QString, QVector<int> >::const_iterator peer = archive.peers.constBegin(); peer != archive.peers.constEnd(); ++peer) {
+            QVector<int>::const_iterator block = std::lower_bound(peer.value().constBegin(), peer.value().constEnd(), first);
+            for (; block != peer.value().constEnd() && *block < last; ++block)
+                peers[peer.key()] << qint32(*block - first);
+        }
+
+        // only the last block of the last segment gets more records
+        const qint32 unindexed = (it.key() == archive.segments.lastKey()) ? archive.unindexed : indexInterval;
+
+        QSaveFile file(segmentPath(jid, it.key(), QLatin1String("idx")));
+        if (file.open(QIODevice::WriteOnly)) {
+            QDataStream stream(&file);
+            stream.setVersion(QDataStream::Qt_5_0);
+            stream << indexVersion << info.size << info.count << info.lastId << unindexed << entries << peers;
+        }
+        if (!file.commit()) {
+            emit error(QString("Could not write message archive index %1").arg(file.fileName()));
+            continue;
+        }
+        info.dirty = false;
+    }
+}
+
+/// Adds the records of a segment from \a offset onwards to the archive's
+/// index, only reading their headers.
+///
+/// \param jid
+/// \param archive
+/// \param segment
+/// \param offset
+
+void QXmppMessageArchiveWorker::scanSegment(const QString &jid, Archive &archive, int segment, qint64 offset)
+{
+    QFile *file = segmentFile(jid, segment);
+    if (!file)
+        return;
+
+    const qint64 size = file->size();
+    while (offset < size) {
+        quint32 length;
+        quint64 id;
+        QString with;
+        file->seek(offset);
+        QDataStream stream(file);
+        stream.setVersion(QDataStream::Qt_5_0);
+        stream >> length >> id >> with;
+        if (stream.status() != QDataStream::Ok || offset + 4 + length > size)
+            break;
+
+        addRecord(archive, id, with, segment, offset, offset + 4 + length);
+        offset += 4 + length;
+    }
+
+    if (offset < size) {
+        emit error(QString("Discarding truncated record in message archive %1").arg(file->fileName()));
+        file->resize(offset);
+    }
+}
+
+/// Returns an open segment file.
+///
+/// \param jid
+/// \param segment
+
+QFile *QXmppMessageArchiveWorker::segmentFile(const QString &jid, int segment)
+{
+    const QString path = segmentPath(jid, segment);
+    QFile *file = m_files.value(path);
+    if (file)
+        return file;
+
+    if (m_files.size() >= maximumOpenFiles)
+        closeFiles();
+
+    QDir().mkpath(QFileInfo(path).path());
+    file = new QFile(path);
+    if (!file->open(QIODevice::ReadWrite)) {
+        emit error(QString("Could not open message archive %1").arg(path));
+        delete file;
+        return 0;
+    }
+    m_files.insert(path, file);
+    return file;
+}
+
+QString QXmppMessageArchiveWorker::segmentPath(const QString &jid, int segment, const QString &suffix) const
+{
+    return QString("%1/%2.%3").arg(archivePath(jid), QString::number(segment), suffix);
+}
+
+/// Reads the records of the given block.
+///
+/// \param jid
+/// \param archive
+/// \param block
+
+QList<QXmppMessageArchiveWorker::Record> QXmppMessageArchiveWorker::readBlock(const QString &jid, const Archive &archive, int block)
+{
+    QList<Record> records;
+    const IndexEntry entry = archive.index.at(block);
+    QFile *file = segmentFile(jid, entry.segment);
+    if (!file)
+        return records;
+
+    qint64 end = file->size();
+    if (block + 1 < archive.index.size() && archive.index.at(block + 1).segment == entry.segment)
+        end = archive.index.at(block + 1).offset;
+
+    file->seek(entry.offset);
+    QDataStream stream(file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    while (file->pos() < end) {
+        quint32 length;
+        Record record;
+        stream >> length >> record.id >> record.with >> record.data;
+        if (stream.status() != QDataStream::Ok)
+            break;
+        records << record;
+    }
+    return records;
+}
+
+class QXmppServerMessageArchivePrivate
+{
+public:
+    QXmppServerMessageArchivePrivate(QXmppServerMessageArchive *qq);
+    bool hasAccount(const QString &jid) const;
+
+    // users who connected since the archive was started
+    QSet<QString> accounts;
+    quint64 lastId;
+    int maximumResults;
+    QString storagePath;
+    QThread *thread;
+    QXmppMessageArchiveWorker *worker;
+
+private:
+    QXmppServerMessageArchive *q;
+};
+
+QXmppServerMessageArchivePrivate::QXmppServerMessageArchivePrivate(QXmppServerMessageArchive *qq)
+    : lastId(0)
+    , maximumResults(100)
+    , thread(0)
+    , worker(0)
+    , q(qq)
+{
+}
+
+/// Returns true if the given local user has an account, that is if they
+/// connected or have a roster.
+///
+/// \param jid
+
+bool QXmppServerMessageArchivePrivate::hasAccount(const QString &jid) const
+{
+    if (accounts.contains(jid))
+        return true;
+    foreach (QXmppServerExtension *extension, q->server()->extensions()) {
+        if (!extension->presenceSubscriptions(jid).isEmpty() ||
+            !extension->presenceSubscribers(jid).isEmpty())
+            return true;
+    }
+    return false;
+}
+
+/// Constructs a new message archive extension.
+
+QXmppServerMessageArchive::QXmppServerMessageArchive()
+    : d(new QXmppServerMessageArchivePrivate(this))
+{
+}
+
+/// Destroys the message archive extension.
+
+QXmppServerMessageArchive::~QXmppServerMessageArchive()
+{
+    stop();
+    delete d;
+}
+
+/// Returns the path of the directory where archives are stored.
+
+QString QXmppServerMessageArchive::storagePath() const
+{
+    return d->storagePath;
+}
+
+/// Sets the path of the directory where archives are stored.
+///
+/// \param path
+
+void QXmppServerMessageArchive::setStoragePath(const QString &path)
+{
+    d->storagePath = path;
+}
+
+/// Returns the maximum number of results returned for a query.
+///
+/// The default value is 100.
+
+int QXmppServerMessageArchive::maximumResults() const
+{
+    return d->maximumResults;
+}
+
+/// Sets the maximum number of results returned for a query.
+///
+/// \param max
+
+void QXmppServerMessageArchive::setMaximumResults(int max)
+{
+    d->maximumResults = max;
+}
+
+/// \cond
+QStringList QXmppServerMessageArchive::discoveryFeatures() const
+{
+    return QStringList() << ns_mam;
+}
+
+bool QXmppServerMessageArchive::acceptsStanza(const QString &tagName, const QString &type, const QString &from, const QString &to) const
+{
+    if (!d->worker)
+        return false;
+
+    const QString domain = server()->domain();
+    const QString bareFrom = QXmppUtils::jidToBareJid(from);
+    const QString bareTo = QXmppUtils::jidToBareJid(to);
+
+    if (tagName == QLatin1String("iq"))
+        return QXmppUtils::jidToDomain(from) == domain && (to == domain || to == bareFrom);
+
+    if (tagName == QLatin1String("message")) {
+        if (!type.isEmpty() && type != QLatin1String("chat") && type != QLatin1String("normal"))
+            return false;
+        return (QXmppUtils::jidToDomain(bareFrom) == domain && !QXmppUtils::jidToUser(bareFrom).isEmpty()) ||
+               (QXmppUtils::jidToDomain(bareTo) == domain && !QXmppUtils::jidToUser(bareTo).isEmpty());
+    }
+    return false;
+}
+
+bool QXmppServerMessageArchive::handleStanza(const QDomElement &element)
+{
+    if (!d->worker)
+        return false;
+
+    const QString domain = server()->domain();
+    const QString from = element.attribute("from");
+    const QString to = element.attribute("to");
+    const QString bareFrom = QXmppUtils::jidToBareJid(from);
+
+    if (QXmppMamQueryIq::isMamQueryIq(element)) {
+        // only handle queries from local users for their own archive
+        if (QXmppUtils::jidToDomain(from) != domain || (to != domain && to != bareFrom))
+            return false;
+
+        QXmppMamQueryIq request;
+        request.parse(element);
+        if (request.type() != QXmppIq::Set) {
+            QXmppIq response(QXmppIq::Error);
+            response.setId(request.id());
+            response.setTo(from);
+            response.setError(QXmppStanza::Error(QXmppStanza::Error::Cancel,
+                QXmppStanza::Error::FeatureNotImplemented));
+            server()->sendPacket(response);
+            return true;
+        }
+
+        QVariantMap query;
+        query["jid"] = bareFrom;
+        query["to"] = from;
+        query["id"] = request.id();
+        query["queryid"] = request.queryId();
+        foreach (const QXmppDataForm::Field &field, request.form().fields()) {
+            if (field.key() == QLatin1String("with")) {
+                query["with"] = field.value().toString();
+            } else if (field.key() == QLatin1String("start") || field.key() == QLatin1String("end")) {
+                const QDateTime stamp = QXmppUtils::datetimeFromString(field.value().toString());
+                if (stamp.isValid())
+                    query[field.key()] = stamp.toMSecsSinceEpoch();
+            }
+        }
+
+        // an empty 'before' element requests the last page
+        const QXmppResultSetQuery resultSetQuery = request.resultSetQuery();
+        const QDomElement setElement = element.firstChildElement("query").firstChildElement("set");
+        int max = resultSetQuery.max();
+        if (max < 0 || max > d->maximumResults)
+            max = d->maximumResults;
+        query["max"] = max;
+        query["after"] = resultSetQuery.after();
+        query["before"] = resultSetQuery.before();
+        query["backward"] = !setElement.firstChildElement("before").isNull();
+
+        QMetaObject::invokeMethod(d->worker, "query", Qt::QueuedConnection,
+                                  Q_ARG(QVariantMap, query));
+        return true;
+    }
+
+    if (element.tagName() == QLatin1String("message")) {
+        const QString type = element.attribute("type");
+        if ((!type.isEmpty() && type != QLatin1String("chat") && type != QLatin1String("normal")) ||
+            element.firstChildElement("body").isNull())
+            return false;
+
+        const QString bareTo = QXmppUtils::jidToBareJid(to);
+        const bool archiveFrom = QXmppUtils::jidToDomain(bareFrom) == domain && !QXmppUtils::jidToUser(bareFrom).isEmpty();
+        const bool archiveTo = QXmppUtils::jidToDomain(bareTo) == domain && !QXmppUtils::jidToUser(bareTo).isEmpty();
+        if (!archiveFrom && !archiveTo)
+            return false;
+
+        // only create archives for users with an account, the sender was
+        // authenticated by the server
+        const bool createTo = archiveTo && d->hasAccount(bareTo);
+
+        // serialize the message as it will be forwarded
+        QXmppMessage message;
+        message.parse(element);
+        QByteArray data;
+        QXmlStreamWriter xmlStream(&data);
+        message.toXml(&xmlStream);
+        data.insert(int(qstrlen("<message")), QByteArray(" xmlns=\"") + ns_client + "\"");
+
+        quint64 id = quint64(QDateTime::currentMSecsSinceEpoch()) << idSequenceBits;
+        if (id <= d->lastId)
+            id = d->lastId + 1;
+        d->lastId = id;
+
+        if (archiveFrom)
+            QMetaObject::invokeMethod(d->worker, "archive", Qt::QueuedConnection,
+                                      Q_ARG(QString, bareFrom), Q_ARG(QString, to),
+                                      Q_ARG(qlonglong, qlonglong(id)), Q_ARG(QByteArray, data),
+                                      Q_ARG(bool, true));
+        if (archiveTo && bareTo != bareFrom)
+            QMetaObject::invokeMethod(d->worker, "archive", Qt::QueuedConnection,
+                                      Q_ARG(QString, bareTo), Q_ARG(QString, from),
+                                      Q_ARG(qlonglong, qlonglong(id)), Q_ARG(QByteArray, data),
+                                      Q_ARG(bool, createTo));
+    }
+
+    // let the stanza be routed
+    return false;
+}
+
+bool QXmppServerMessageArchive::start()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (d->worker)
+        return true;
+
+    if (d->storagePath.isEmpty()) {
+        warning("No storage path was specified for the message archive");
+        return false;
+    }
+
+    d->thread = new QThread(this);
+    d->worker = new QXmppMessageArchiveWorker(d->storagePath);
+    d->worker->moveToThread(d->thread);
+
+    check = connect(server(), SIGNAL(clientConnected(QString)),
+                    this, SLOT(_q_clientConnected(QString)));
+    Q_ASSERT(check);
+
+    check = connect(d->worker, SIGNAL(error(QString)),
+                    this, SLOT(_q_error(QString)));
+    Q_ASSERT(check);
+
+    check = connect(d->worker, SIGNAL(queryFinished(QVariantMap)),
+                    this, SLOT(_q_queryFinished(QVariantMap)));
+    Q_ASSERT(check);
+
+    check = connect(d->worker, SIGNAL(resultReady(QString,QByteArray)),
+                    this, SLOT(_q_resultReady(QString,QByteArray)));
+    Q_ASSERT(check);
+
+    d->thread->start();
+    return true;
+}
+
+void QXmppServerMessageArchive::stop()
+{
+    if (!d->worker)
+        return;
+
+    disconnect(server(), SIGNAL(clientConnected(QString)),
+               this, SLOT(_q_clientConnected(QString)));
+
+    // wait for pending messages to be written
+    QMetaObject::invokeMethod(d->worker, "close", Qt::BlockingQueuedConnection);
+
+    d->thread->quit();
+    d->thread->wait();
+    delete d->worker;
+    d->worker = 0;
+    delete d->thread;
+    d->thread = 0;
+}
+/// \endcond
+
+void QXmppServerMessageArchive::_q_clientConnected(const QString &jid)
+{
+    d->accounts.insert(QXmppUtils::jidToBareJid(jid));
+}
+
+void QXmppServerMessageArchive::_q_error(const QString &message)
+{
+    warning(message);
+}
+
+void QXmppServerMessageArchive::_q_queryFinished(const QVariantMap &reply)
+{
+    if (reply.value("error").toBool()) {
+        QXmppIq response(QXmppIq::Error);
+        response.setId(reply.value("id").toString());
+        response.setTo(reply.value("to").toString());
+        response.setError(QXmppStanza::Error(QXmppStanza::Error::Cancel,
+            QXmppStanza::Error::ItemNotFound));
+        server()->sendPacket(response);
+        return;
+    }
+
+    QXmppResultSetReply resultSetReply;
+    resultSetReply.setFirst(reply.value("first").toString());
+    resultSetReply.setLast(reply.value("last").toString());
+    if (reply.contains("count"))
+        resultSetReply.setCount(reply.value("count").toInt());
+
+    QXmppMamResultIq response;
+    response.setType(QXmppIq::Result);
+    response.setId(reply.value("id").toString());
+    response.setTo(reply.value("to").toString());
+    response.setResultSetReply(resultSetReply);
+    response.setComplete(reply.value("complete").toBool());
+    server()->sendPacket(response);
+}
+
+void QXmppServerMessageArchive::_q_resultReady(const QString &to, const QByteArray &data)
+{
+    server()->sendData(to, data);
+}
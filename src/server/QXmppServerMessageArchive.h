@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSERVERMESSAGEARCHIVE_H
+#define QXMPPSERVERMESSAGEARCHIVE_H
+
+#include <QVariantMap>
+
+#include "QXmppServerExtension.h"
+
+class QXmppServerMessageArchivePrivate;
+
+/// \brief The QXmppServerMessageArchive class provides server-side message
+/// archiving as defined by XEP-0313: Message Archive Management.
+///
+/// Chat and normal messages with a body which are sent to or by local users
+/// are archived in the user's archive. Users can then page through their
+/// archive using QXmppMamManager.
+///
+/// Archives are stored below storagePath(), with one append-only segment
+/// file per user and month. An archive is only created for users who
+/// connected to the server or have a roster. Storage and queries are performed in a separate
+/// thread so that routing is never blocked by disk access.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppServerMessageArchive : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "mam")
+
+public:
+    QXmppServerMessageArchive();
+    ~QXmppServerMessageArchive();
+
+    QString storagePath() const;
+    void setStoragePath(const QString &path);
+
+    int maximumResults() const;
+    void setMaximumResults(int max);
+
+    /// \cond
+    QStringList discoveryFeatures() const override;
+    bool acceptsStanza(const QString &tagName, const QString &type, const QString &from, const QString &to) const override;
+    bool handleStanza(const QDomElement &element) override;
+
+    bool start() override;
+    void stop() override;
+    /// \endcond
+
+private slots:
+    void _q_clientConnected(const QString &jid);
+    void _q_error(const QString &message);
+    void _q_queryFinished(const QVariantMap &reply);
+    void _q_resultReady(const QString &to, const QByteArray &data);
+
+private:
+    QXmppServerMessageArchivePrivate *d;
+};
+
+#endif
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSERVERMESSAGEARCHIVE_P_H
+#define QXMPPSERVERMESSAGEARCHIVE_P_H
+
+#include <QHash>
+#include <QMap>
+#include <QObject>
+#include <QStringList>
+#include <QVariantMap>
+#include <QVector>
+
+#include "QXmppGlobal.h"
+
+class QFile;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppServerMessageArchive class.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppMessageArchiveWorker class performs message archive storage
+/// and queries for QXmppServerMessageArchive, in a dedicated thread.
+///
+/// Each user's archive is stored in its own directory, as one append-only
+/// segment file per month. Each segment has a sparse index of its records
+/// and of the blocks holding each peer's records, which is saved next to it
+/// and brought up to date from the segment's tail when it is loaded.
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppMessageArchiveWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppMessageArchiveWorker(const QString &path);
+    ~QXmppMessageArchiveWorker();
+
+public slots:
+    void archive(const QString &jid, const QString &with, qlonglong id, const QByteArray &data, bool create);
+    void close();
+    void query(const QVariantMap &query);
+
+signals:
+    void error(const QString &message);
+    void queryFinished(const QVariantMap &reply);
+    void resultReady(const QString &to, const QByteArray &data);
+
+private:
+    struct IndexEntry
+    {
+        quint64 id;
+        int segment;
+        qint64 offset;
+    };
+
+    struct Segment
+    {
+        Segment();
+
+        qint64 size;
+        qint64 count;
+        quint64 lastId;
+        bool dirty;
+    };
+
+    struct Archive
+    {
+        Archive();
+
+        QVector<IndexEntry> index;
+        // blocks holding records exchanged with each peer, by bare JID
+        QHash<QString, QVector<int> > peers;
+        QMap<int, Segment> segments;
+        qint64 count;
+        quint64 lastId;
+        int unindexed;
+        quint64 lastUsed;
+    };
+
+    struct Record
+    {
+        quint64 id;
+        QString with;
+        QByteArray data;
+    };
+
+    void addRecord(Archive &archive, quint64 id, const QString &with, int segment, qint64 offset, qint64 end);
+    QString archivePath(const QString &jid) const;
+    void closeFiles();
+    int findBlock(const Archive &archive, quint64 id) const;
+    bool hasArchive(const QString &jid) const;
+    Archive &loadArchive(const QString &jid);
+    qint64 loadIndex(const QString &jid, Archive &archive, int segment, qint64 size);
+    void saveIndex(const QString &jid, Archive &archive);
+    void scanSegment(const QString &jid, Archive &archive, int segment, qint64 offset);
+    QFile *segmentFile(const QString &jid, int segment);
+    QString segmentPath(const QString &jid, int segment, const QString &suffix = QLatin1String("seg")) const;
+    QList<Record> readBlock(const QString &jid, const Archive &archive, int block);
+
+    QHash<QString, Archive> m_archives;
+    QHash<QString, QFile*> m_files;
+    QString m_path;
+    quint64 m_useCount;
+};
+
+#endif
@@ -0,0 +1,700 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDataStream>
+#include <QDomElement>
+#include <QFile>
+#include <QSaveFile>
+
+#include "QXmppPresence.h"
+#include "QXmppServer.h"
+#include "QXmppServerRoster.h"
+#include "QXmppUtils.h"
+
+// storage file layout: a header followed by a sequence of records
+static const quint32 storageMagic = 0x51585253;
+static const quint32 storageVersion = 1;
+
+// compact the log on start if it holds more than this many obsolete records
+static const qint64 compactThreshold = 1024;
+
+enum StorageRecord {
+    SetItemRecord = 1,
+    RemoveItemRecord = 2,
+    VersionRecord = 3
+};
+
+static bool hasFrom(QXmppRosterIq::Item::SubscriptionType type)
+{
+    return type == QXmppRosterIq::Item::From || type == QXmppRosterIq::Item::Both;
+}
+
+static bool hasTo(QXmppRosterIq::Item::SubscriptionType type)
+{
+    return type == QXmppRosterIq::Item::To || type == QXmppRosterIq::Item::Both;
+}
+
+static QXmppRosterIq::Item::SubscriptionType subscriptionType(bool from, bool to)
+{
+    if (from && to)
+        return QXmppRosterIq::Item::Both;
+    else if (from)
+        return QXmppRosterIq::Item::From;
+    else if (to)
+        return QXmppRosterIq::Item::To;
+    else
+        return QXmppRosterIq::Item::None;
+}
+
+class QXmppServerRosterPrivate
+{
+public:
+    QXmppServerRosterPrivate(QXmppServerRoster *qq);
+
+    void applyItem(const QString &jid, const QXmppRosterIq::Item &item);
+    void applyRemove(const QString &jid, const QString &contactJid);
+    void updateIndex(const QString &jid, const QString &contactJid,
+                     QXmppRosterIq::Item::SubscriptionType oldType,
+                     QXmppRosterIq::Item::SubscriptionType newType);
+
+    bool load();
+    bool openStorage();
+    void writeRecord(const QByteArray &record);
+    void push(const QString &jid, const QXmppRosterIq::Item &item);
+    void updateSubscription(const QString &jid, const QString &contactJid, const QString &type, bool outbound);
+
+    // roster items, indexed by user bare JID then contact bare JID
+    QHash<QString, QHash<QString, QXmppRosterIq::Item> > rosters;
+    QHash<QString, quint64> versions;
+
+    // adjacency index
+    QHash<QString, QSet<QString> > subscribers;
+    QHash<QString, QSet<QString> > subscriptions;
+
+    QString storagePath;
+    QFile *storage;
+    qint64 itemCount;
+    qint64 recordCount;
+
+private:
+    QXmppServerRoster *q;
+};
+
+QXmppServerRosterPrivate::QXmppServerRosterPrivate(QXmppServerRoster *qq)
+    : storage(0)
+    , itemCount(0)
+    , recordCount(0)
+    , q(qq)
+{
+}
+
+/// Stores an item in memory and updates the subscription index.
+
+void QXmppServerRosterPrivate::applyItem(const QString &jid, const QXmppRosterIq::Item &item)
+{
+    QHash<QString, QXmppRosterIq::Item> &roster = rosters[jid];
+    QHash<QString, QXmppRosterIq::Item>::iterator it = roster.find(item.bareJid());
+
+    QXmppRosterIq::Item::SubscriptionType oldType = QXmppRosterIq::Item::None;
+    if (it != roster.end()) {
+        oldType = it.value().subscriptionType();
+        it.value() = item;
+    } else {
+        it = roster.insert(item.bareJid(), item);
+        itemCount++;
+    }
+    if (item.subscriptionType() != QXmppRosterIq::Item::From &&
+        item.subscriptionType() != QXmppRosterIq::Item::To &&
+        item.subscriptionType() != QXmppRosterIq::Item::Both)
+        it.value().setSubscriptionType(QXmppRosterIq::Item::None);
+
+    updateIndex(jid, item.bareJid(), oldType, it.value().subscriptionType());
+    versions[jid]++;
+}
+
+/// Removes an item from memory and updates the subscription index.
+
+void QXmppServerRosterPrivate::applyRemove(const QString &jid, const QString &contactJid)
+{
+    QHash<QString, QHash<QString, QXmppRosterIq::Item> >::iterator roster = rosters.find(jid);
+    if (roster == rosters.end())
+        return;
+
+    QHash<QString, QXmppRosterIq::Item>::iterator it = roster.value().find(contactJid);
+    if (it == roster.value().end())
+        return;
+
+    updateIndex(jid, contactJid, it.value().subscriptionType(), QXmppRosterIq::Item::None);
+    roster.value().erase(it);
+    if (roster.value().isEmpty())
+        rosters.erase(roster);
+    itemCount--;
+    versions[jid]++;
+}
+
+void QXmppServerRosterPrivate::updateIndex(const QString &jid, const QString &contactJid,
+                                           QXmppRosterIq::Item::SubscriptionType oldType,
+                                           QXmppRosterIq::Item::SubscriptionType newType)
+{
+    if (hasFrom(oldType) != hasFrom(newType)) {
+        if (hasFrom(newType)) {
+            subscribers[jid].insert(contactJid);
+        } else {
+            QSet<QString> &set = subscribers[jid];
+            set.remove(contactJid);
+            if (set.isEmpty())
+                subscribers.remove(jid);
+        }
+    }
+
+    if (hasTo(oldType) != hasTo(newType)) {
+        if (hasTo(newType)) {
+            subscriptions[jid].insert(contactJid);
+        } else {
+            QSet<QString> &set = subscriptions[jid];
+            set.remove(contactJid);
+            if (set.isEmpty())
+                subscriptions.remove(jid);
+        }
+    }
+}
+
+/// Replays the storage log into memory.
+///
+/// A truncated record at the end of the log, for instance following a crash
+/// during a write, is discarded.
+
+bool QXmppServerRosterPrivate::load()
+{
+    rosters.clear();
+    versions.clear();
+    subscribers.clear();
+    subscriptions.clear();
+    itemCount = 0;
+    recordCount = 0;
+
+    QFile file(storagePath);
+    if (!file.exists())
+        return true;
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        q->warning(QString("Could not open roster storage %1").arg(storagePath));
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic, version;
+    stream >> magic >> version;
+    if (stream.status() != QDataStream::Ok || magic != storageMagic || version != storageVersion) {
+        q->warning(QString("Invalid roster storage %1").arg(storagePath));
+        return false;
+    }
+
+    qint64 validSize = file.pos();
+    while (!stream.atEnd()) {
+        quint8 type;
+        QString jid, contactJid;
+        stream >> type >> jid >> contactJid;
+
+        if (type == SetItemRecord) {
+            QString name, status;
+            quint8 subscription;
+            QSet<QString> groups;
+            stream >> name >> subscription >> status >> groups;
+            if (stream.status() != QDataStream::Ok)
+                break;
+
+            QXmppRosterIq::Item item;
+            item.setBareJid(contactJid);
+            item.setName(name);
+            item.setSubscriptionType(static_cast<QXmppRosterIq::Item::SubscriptionType>(subscription));
+            item.setSubscriptionStatus(status);
+            item.setGroups(groups);
+            applyItem(jid, item);
+        } else if (type == RemoveItemRecord) {
+            if (stream.status() != QDataStream::Ok)
+                break;
+            applyRemove(jid, contactJid);
+        } else if (type == VersionRecord) {
+            quint64 value;
+            stream >> value;
+            if (stream.status() != QDataStream::Ok)
+                break;
+            versions[jid] = value;
+        } else {
+            stream.setStatus(QDataStream::ReadCorruptData);
+            break;
+        }
+
+        recordCount++;
+        validSize = file.pos();
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        q->warning(QString("Discarding truncated roster storage record in %1").arg(storagePath));
+        file.close();
+        file.resize(validSize);
+    }
+    return true;
+}
+
+/// Opens the storage log for appending, creating it if needed.
+
+bool QXmppServerRosterPrivate::openStorage()
+{
+    delete storage;
+    storage = new QFile(storagePath);
+
+    const bool exists = storage->exists() && storage->size() > 0;
+    if (!storage->open(QIODevice::WriteOnly | QIODevice::Append)) {
+        q->warning(QString("Could not open roster storage %1").arg(storagePath));
+        delete storage;
+        storage = 0;
+        return false;
+    }
+
+    if (!exists) {
+        QDataStream stream(storage);
+        stream.setVersion(QDataStream::Qt_5_0);
+        stream << storageMagic << storageVersion;
+        storage->flush();
+    }
+    return true;
+}
+
+/// Appends a record to the storage log.
+///
+/// \param record
+
+void QXmppServerRosterPrivate::writeRecord(const QByteArray &record)
+{
+    if (!storage)
+        return;
+
+    if (storage->write(record) != record.size() || !storage->flush())
+        q->warning(QString("Could not write to roster storage %1").arg(storagePath));
+    recordCount++;
+}
+
+/// Sends a roster push to all the resources of the given user.
+
+void QXmppServerRosterPrivate::push(const QString &jid, const QXmppRosterIq::Item &item)
+{
+    QXmppServer *server = q->server();
+    if (!server)
+        return;
+
+    QXmppRosterIq iq;
+    iq.setType(QXmppIq::Set);
+    iq.setTo(jid);
+    iq.setVersion(QString::number(versions.value(jid)));
+    iq.addItem(item);
+    server->sendPacket(iq);
+}
+
+/// Updates subscription states following a presence subscription stanza,
+/// as described in RFC 6121 section 3.
+///
+/// \param jid The local user.
+/// \param contactJid The contact.
+/// \param type The type of the presence stanza.
+/// \param outbound True if the user sent the stanza, false if they received it.
+
+void QXmppServerRosterPrivate::updateSubscription(const QString &jid, const QString &contactJid, const QString &type, bool outbound)
+{
+    const bool exists = rosters.value(jid).contains(contactJid);
+    QXmppRosterIq::Item item = q->item(jid, contactJid);
+    bool from = hasFrom(item.subscriptionType());
+    bool to = hasTo(item.subscriptionType());
+    bool changed = false;
+
+    if (outbound) {
+        if (type == QLatin1String("subscribe")) {
+            if (!to && item.subscriptionStatus() != QLatin1String("subscribe")) {
+                item.setSubscriptionStatus("subscribe");
+                changed = true;
+            }
+        } else if (type == QLatin1String("subscribed")) {
+            changed = !from;
+            from = true;
+        } else if (exists && type == QLatin1String("unsubscribe")) {
+            changed = to || !item.subscriptionStatus().isEmpty();
+            to = false;
+            item.setSubscriptionStatus(QString());
+        } else if (exists && type == QLatin1String("unsubscribed")) {
+            changed = from;
+            from = false;
+        }
+    } else if (exists) {
+        if (type == QLatin1String("subscribed")) {
+            changed = !to;
+            to = true;
+            item.setSubscriptionStatus(QString());
+        } else if (type == QLatin1String("unsubscribed")) {
+            changed = to || !item.subscriptionStatus().isEmpty();
+            to = false;
+            item.setSubscriptionStatus(QString());
+        } else if (type == QLatin1String("unsubscribe")) {
+            changed = from;
+            from = false;
+        }
+    }
+
+    if (changed) {
+        item.setSubscriptionType(subscriptionType(from, to));
+        q->setItem(jid, item);
+    }
+}
+
+/// Constructs a new roster extension.
+
+QXmppServerRoster::QXmppServerRoster()
+    : d(new QXmppServerRosterPrivate(this))
+{
+}
+
+/// Destroys the roster extension.
+
+QXmppServerRoster::~QXmppServerRoster()
+{
+    delete d->storage;
+    delete d;
+}
+
+/// Returns the path of the file used to store rosters.
+///
+
+QString QXmppServerRoster::storagePath() const
+{
+    return d->storagePath;
+}
+
+/// Sets the path of the file used to store rosters.
+///
+/// If the path is empty, rosters are only kept in memory.
+/// The storage is loaded when the extension is started.
+///
+/// \param path
+
+void QXmppServerRoster::setStoragePath(const QString &path)
+{
+    d->storagePath = path;
+}
+
+/// Returns the roster items of the given user.
+///
+/// \param jid
+
+QList<QXmppRosterIq::Item> QXmppServerRoster::items(const QString &jid) const
+{
+    return d->rosters.value(QXmppUtils::jidToBareJid(jid)).values();
+}
+
+/// Returns the roster item for \a contactJid in the roster of the given user.
+///
+/// If there is no such item, a new item with no subscription is returned.
+///
+/// \param jid
+/// \param contactJid
+
+QXmppRosterIq::Item QXmppServerRoster::item(const QString &jid, const QString &contactJid) const
+{
+    const QString bareJid = QXmppUtils::jidToBareJid(contactJid);
+    QXmppRosterIq::Item item = d->rosters.value(QXmppUtils::jidToBareJid(jid)).value(bareJid);
+    if (item.bareJid().isEmpty()) {
+        item.setBareJid(bareJid);
+        item.setSubscriptionType(QXmppRosterIq::Item::None);
+    }
+    return item;
+}
+
+/// Returns the roster version of the given user (XEP-0237).
+///
+/// \param jid
+
+QString QXmppServerRoster::version(const QString &jid) const
+{
+    return QString::number(d->versions.value(QXmppUtils::jidToBareJid(jid)));
+}
+
+/// Adds or updates an item in the roster of the given user.
+///
+/// A roster push is sent to the user's connected resources.
+///
+/// \param jid
+/// \param item
+
+void QXmppServerRoster::setItem(const QString &jid, const QXmppRosterIq::Item &item)
+{
+    const QString bareJid = QXmppUtils::jidToBareJid(jid);
+    if (bareJid.isEmpty() || item.bareJid().isEmpty())
+        return;
+
+    d->applyItem(bareJid, item);
+    const QXmppRosterIq::Item stored = d->rosters.value(bareJid).value(item.bareJid());
+
+    QByteArray record;
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << quint8(SetItemRecord) << bareJid << stored.bareJid() << stored.name()
+           << quint8(stored.subscriptionType()) << stored.subscriptionStatus() << stored.groups();
+    d->writeRecord(record);
+
+    d->push(bareJid, stored);
+}
+
+/// Removes \a contactJid from the roster of the given user.
+///
+/// A roster push is sent to the user's connected resources.
+///
+/// \param jid
+/// \param contactJid
+
+void QXmppServerRoster::removeItem(const QString &jid, const QString &contactJid)
+{
+    const QString bareJid = QXmppUtils::jidToBareJid(jid);
+    const QString contactBareJid = QXmppUtils::jidToBareJid(contactJid);
+    if (!d->rosters.value(bareJid).contains(contactBareJid))
+        return;
+
+    d->applyRemove(bareJid, contactBareJid);
+
+    QByteArray record;
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << quint8(RemoveItemRecord) << bareJid << contactBareJid;
+    d->writeRecord(record);
+
+    QXmppRosterIq::Item item;
+    item.setBareJid(contactBareJid);
+    item.setSubscriptionType(QXmppRosterIq::Item::Remove);
+    d->push(bareJid, item);
+}
+
+/// Rewrites the storage log so that it only contains the current rosters.
+///
+/// Returns true if the storage was compacted, false otherwise.
+
+bool QXmppServerRoster::compact()
+{
+    if (d->storagePath.isEmpty())
+        return false;
+
+    QSaveFile file(d->storagePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        warning(QString("Could not compact roster storage %1").arg(d->storagePath));
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << storageMagic << storageVersion;
+
+    qint64 records = 0;
+    QHash<QString, quint64>::const_iterator version;
+    for (version = d->versions.constBegin(); version != d->versions.constEnd(); ++version) {
+        foreach (const QXmppRosterIq::Item &item, d->rosters.value(version.key())) {
+            stream << quint8(SetItemRecord) << version.key() << item.bareJid() << item.name()
+                   << quint8(item.subscriptionType()) << item.subscriptionStatus() << item.groups();
+            records++;
+        }
+        stream << quint8(VersionRecord) << version.key() << QString() << version.value();
+        records++;
+    }
+
+    // close the log before replacing it
+    delete d->storage;
+    d->storage = 0;
+
+    if (!file.commit()) {
+        warning(QString("Could not compact roster storage %1").arg(d->storagePath));
+        d->openStorage();
+        return false;
+    }
+
+    d->recordCount = records;
+    return d->openStorage();
+}
+
+/// \cond
+bool QXmppServerRoster::acceptsStanza(const QString &tagName, const QString &type, const QString &from, const QString &to) const
+{
+    const QString domain = server()->domain();
+    const QString bareFrom = QXmppUtils::jidToBareJid(from);
+
+    if (tagName == QLatin1String("iq"))
+        return QXmppUtils::jidToDomain(from) == domain && (to == domain || to == bareFrom);
+
+    return tagName == QLatin1String("presence") &&
+        (type == QLatin1String("subscribe") ||
+         type == QLatin1String("subscribed") ||
+         type == QLatin1String("unsubscribe") ||
+         type == QLatin1String("unsubscribed"));
+}
+
+bool QXmppServerRoster::handleStanza(const QDomElement &element)
+{
+    const QString domain = server()->domain();
+    const QString from = element.attribute("from");
+    const QString to = element.attribute("to");
+    const QString bareFrom = QXmppUtils::jidToBareJid(from);
+
+    if (element.tagName() == QLatin1String("iq") && QXmppRosterIq::isRosterIq(element)) {
+        // only handle requests from local users for their own roster
+        if (QXmppUtils::jidToDomain(from) != domain || (to != domain && to != bareFrom))
+            return false;
+
+        QXmppRosterIq request;
+        request.parse(element);
+
+        if (request.type() == QXmppIq::Get) {
+            const QString ver = version(bareFrom);
+            const bool versioning = element.firstChildElement("query").hasAttribute("ver");
+
+            if (versioning && request.version() == ver) {
+                // the client's roster is up to date
+                QXmppIq response(QXmppIq::Result);
+                response.setId(request.id());
+                response.setTo(from);
+                server()->sendPacket(response);
+            } else {
+                QXmppRosterIq response;
+                response.setType(QXmppIq::Result);
+                response.setId(request.id());
+                response.setTo(from);
+                if (versioning)
+                    response.setVersion(ver);
+                foreach (const QXmppRosterIq::Item &item, d->rosters.value(bareFrom))
+                    response.addItem(item);
+                server()->sendPacket(response);
+            }
+        } else if (request.type() == QXmppIq::Set) {
+            const QList<QXmppRosterIq::Item> requestItems = request.items();
+            const QString contactJid = requestItems.size() == 1 ? QXmppUtils::jidToBareJid(requestItems.first().bareJid()) : QString();
+
+            if (contactJid.isEmpty()) {
+                QXmppIq response(QXmppIq::Error);
+                response.setId(request.id());
+                response.setTo(from);
+                response.setError(QXmppStanza::Error(QXmppStanza::Error::Modify,
+                    QXmppStanza::Error::BadRequest));
+                server()->sendPacket(response);
+                return true;
+            }
+
+            const QXmppRosterIq::Item requestItem = requestItems.first();
+            if (requestItem.subscriptionType() == QXmppRosterIq::Item::Remove) {
+                // cancel subscriptions in both directions
+                const QXmppRosterIq::Item::SubscriptionType type = item(bareFrom, contactJid).subscriptionType();
+                removeItem(bareFrom, contactJid);
+
+                if (hasTo(type)) {
+                    QXmppPresence presence(QXmppPresence::Unsubscribe);
+                    presence.setFrom(bareFrom);
+                    presence.setTo(contactJid);
+                    server()->sendPacket(presence);
+                }
+                if (hasFrom(type)) {
+                    QXmppPresence presence(QXmppPresence::Unsubscribed);
+                    presence.setFrom(bareFrom);
+                    presence.setTo(contactJid);
+                    server()->sendPacket(presence);
+                }
+
+                // the presences are routed directly, so update a local
+                // contact's roster here
+                if (QXmppUtils::jidToDomain(contactJid) == domain) {
+                    if (hasTo(type))
+                        d->updateSubscription(contactJid, bareFrom, QLatin1String("unsubscribe"), false);
+                    if (hasFrom(type))
+                        d->updateSubscription(contactJid, bareFrom, QLatin1String("unsubscribed"), false);
+                }
+            } else {
+                // clients may only change the name and groups
+                QXmppRosterIq::Item updated = item(bareFrom, contactJid);
+                updated.setName(requestItem.name());
+                updated.setGroups(requestItem.groups());
+                setItem(bareFrom, updated);
+            }
+
+            QXmppIq response(QXmppIq::Result);
+            response.setId(request.id());
+            response.setTo(from);
+            server()->sendPacket(response);
+        }
+        return true;
+    }
+
+    if (element.tagName() == QLatin1String("presence")) {
+        const QString type = element.attribute("type");
+        if (type != QLatin1String("subscribe") &&
+            type != QLatin1String("subscribed") &&
+            type != QLatin1String("unsubscribe") &&
+            type != QLatin1String("unsubscribed"))
+            return false;
+
+        const QString bareTo = QXmppUtils::jidToBareJid(to);
+        if (bareFrom.isEmpty() || bareTo.isEmpty() || bareFrom == bareTo)
+            return false;
+
+        if (QXmppUtils::jidToDomain(bareFrom) == domain && !QXmppUtils::jidToUser(bareFrom).isEmpty())
+            d->updateSubscription(bareFrom, bareTo, type, true);
+        if (QXmppUtils::jidToDomain(bareTo) == domain && !QXmppUtils::jidToUser(bareTo).isEmpty())
+            d->updateSubscription(bareTo, bareFrom, type, false);
+    }
+
+    // let the stanza be routed
+    return false;
+}
+
+QSet<QString> QXmppServerRoster::presenceSubscribers(const QString &jid)
+{
+    return d->subscribers.value(QXmppUtils::jidToBareJid(jid));
+}
+
+QSet<QString> QXmppServerRoster::presenceSubscriptions(const QString &jid)
+{
+    return d->subscriptions.value(QXmppUtils::jidToBareJid(jid));
+}
+
+bool QXmppServerRoster::start()
+{
+    if (d->storagePath.isEmpty())
+        return true;
+
+    if (!d->load())
+        return false;
+
+    if (d->recordCount - d->itemCount - d->versions.size() > compactThreshold)
+        return compact();
+    return d->openStorage();
+}
+
+void QXmppServerRoster::stop()
+{
+    delete d->storage;
+    d->storage = 0;
+}
+/// \endcond
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSERVERROSTER_H
+#define QXMPPSERVERROSTER_H
+
+#include <QSet>
+
+#include "QXmppRosterIq.h"
+#include "QXmppServerExtension.h"
+
+class QXmppServerRosterPrivate;
+
+/// \brief The QXmppServerRoster class provides roster storage and presence
+/// subscription tracking for QXmppServer.
+///
+/// Rosters are kept in memory along with an index of each user's presence
+/// subscribers and subscriptions, so that presenceSubscribers() and
+/// presenceSubscriptions() do not need to look at the roster items.
+///
+/// If a storage path is set, every change is appended to a log file which
+/// is replayed when the extension starts. The log is compacted on start
+/// when it contains many obsolete records, or on demand using compact().
+///
+/// The extension answers roster get / set requests (RFC 6121 and XEP-0237
+/// roster versioning), sends roster pushes and updates subscription states
+/// as presence subscription stanzas are routed.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppServerRoster : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "roster")
+
+public:
+    QXmppServerRoster();
+    ~QXmppServerRoster();
+
+    QString storagePath() const;
+    void setStoragePath(const QString &path);
+
+    QList<QXmppRosterIq::Item> items(const QString &jid) const;
+    QXmppRosterIq::Item item(const QString &jid, const QString &contactJid) const;
+    QString version(const QString &jid) const;
+
+    void setItem(const QString &jid, const QXmppRosterIq::Item &item);
+    void removeItem(const QString &jid, const QString &contactJid);
+
+    bool compact();
+
+    /// \cond
+    bool acceptsStanza(const QString &tagName, const QString &type, const QString &from, const QString &to) const override;
+    bool handleStanza(const QDomElement &element) override;
+    QSet<QString> presenceSubscribers(const QString &jid) override;
+    QSet<QString> presenceSubscriptions(const QString &jid) override;
+
+    bool start() override;
+    void stop() override;
+    /// \endcond
+
+private:
+    QXmppServerRosterPrivate *d;
+    friend class QXmppServerRosterPrivate;
+};
+
+#endif
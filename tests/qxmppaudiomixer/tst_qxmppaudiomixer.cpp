@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QDataStream>
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppAudioMixer.h"
+#include "QXmppJingleIq.h"
+#include "QXmppRtpChannel.h"
+
+class tst_QXmppAudioMixer : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void testMix();
+    void testMaximumSpeakers();
+    void testRemoveChannel();
+    void testSaturation();
+    void testSpeechThreshold();
+
+private:
+    QXmppRtpAudioChannel *createChannel();
+    qint16 lastSample(QXmppRtpAudioChannel *channel);
+    void speak(QXmppRtpAudioChannel *channel, qint16 value);
+
+    // participants talk through the sources and listen through the sinks,
+    // the bridges are attached to the mixer
+    QList<QXmppRtpAudioChannel*> sources;
+    QList<QXmppRtpAudioChannel*> bridges;
+    QList<QXmppRtpAudioChannel*> sinks;
+};
+
+QXmppRtpAudioChannel *tst_QXmppAudioMixer::createChannel()
+{
+    QXmppJinglePayloadType payload;
+    payload.setId(0);
+    payload.setChannels(1);
+    payload.setName("PCMU");
+    payload.setClockrate(8000);
+
+    QXmppRtpAudioChannel *channel = new QXmppRtpAudioChannel(this);
+    channel->setRemotePayloadTypes(QList<QXmppJinglePayloadType>() << payload);
+    return channel;
+}
+
+qint16 tst_QXmppAudioMixer::lastSample(QXmppRtpAudioChannel *channel)
+{
+    const QByteArray data = channel->read(channel->bytesAvailable());
+    if (data.size() < 2)
+        return 0;
+
+    QDataStream stream(data.right(2));
+    stream.setByteOrder(QDataStream::LittleEndian);
+    qint16 sample;
+    stream >> sample;
+    return sample;
+}
+
+void tst_QXmppAudioMixer::speak(QXmppRtpAudioChannel *channel, qint16 value)
+{
+    // two seconds of a constant signal
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    for (int i = 0; i < 16000; ++i)
+        stream << value;
+    channel->write(data);
+}
+
+void tst_QXmppAudioMixer::init()
+{
+    for (int i = 0; i < 3; ++i) {
+        sources << createChannel();
+        bridges << createChannel();
+        sinks << createChannel();
+        connect(sources[i], SIGNAL(sendDatagram(QByteArray)),
+                bridges[i], SLOT(datagramReceived(QByteArray)));
+        connect(bridges[i], SIGNAL(sendDatagram(QByteArray)),
+                sinks[i], SLOT(datagramReceived(QByteArray)));
+    }
+}
+
+void tst_QXmppAudioMixer::cleanup()
+{
+    qDeleteAll(sources);
+    qDeleteAll(bridges);
+    qDeleteAll(sinks);
+    sources.clear();
+    bridges.clear();
+    sinks.clear();
+}
+
+void tst_QXmppAudioMixer::testMix()
+{
+    QXmppAudioMixer mixer;
+    QCOMPARE(mixer.interval(), 20);
+    QCOMPARE(mixer.maximumSpeakers(), 0);
+    QCOMPARE(mixer.speechThreshold(), 100);
+    foreach (QXmppRtpAudioChannel *bridge, bridges)
+        mixer.addChannel(bridge);
+    QCOMPARE(mixer.channels(), bridges);
+
+    speak(sources[0], 1000);
+    speak(sources[1], 2000);
+    speak(sources[2], 0);
+    QTest::qWait(1000);
+
+    // the silent participant is not a speaker
+    QCOMPARE(mixer.activeSpeakers(), QList<QXmppRtpAudioChannel*>() << bridges[1] << bridges[0]);
+
+    // each participant hears the others, allowing for G.711 quantization
+    QVERIFY(qAbs(lastSample(sinks[0]) - 2000) < 150);
+    QVERIFY(qAbs(lastSample(sinks[1]) - 1000) < 150);
+    QVERIFY(qAbs(lastSample(sinks[2]) - 3000) < 150);
+}
+
+void tst_QXmppAudioMixer::testMaximumSpeakers()
+{
+    QXmppAudioMixer mixer;
+    mixer.setMaximumSpeakers(1);
+    QCOMPARE(mixer.maximumSpeakers(), 1);
+    foreach (QXmppRtpAudioChannel *bridge, bridges)
+        mixer.addChannel(bridge);
+
+    speak(sources[0], 1000);
+    speak(sources[1], 2000);
+    speak(sources[2], 500);
+    QTest::qWait(1000);
+
+    // only the loudest participant is heard
+    QCOMPARE(mixer.activeSpeakers(), QList<QXmppRtpAudioChannel*>() << bridges[1]);
+    QVERIFY(qAbs(lastSample(sinks[0]) - 2000) < 150);
+    QVERIFY(qAbs(lastSample(sinks[1])) < 150);
+    QVERIFY(qAbs(lastSample(sinks[2]) - 2000) < 150);
+}
+
+void tst_QXmppAudioMixer::testRemoveChannel()
+{
+    QXmppAudioMixer mixer;
+    foreach (QXmppRtpAudioChannel *bridge, bridges)
+        mixer.addChannel(bridge);
+
+    // adding a channel twice has no effect
+    mixer.addChannel(bridges[0]);
+    QCOMPARE(mixer.channels().size(), 3);
+
+    mixer.removeChannel(bridges[0]);
+    QCOMPARE(mixer.channels(), QList<QXmppRtpAudioChannel*>() << bridges[1] << bridges[2]);
+
+    // destroyed channels are removed
+    delete bridges.takeLast();
+    QCOMPARE(mixer.channels(), QList<QXmppRtpAudioChannel*>() << bridges[1]);
+}
+
+void tst_QXmppAudioMixer::testSaturation()
+{
+    QXmppAudioMixer mixer;
+    foreach (QXmppRtpAudioChannel *bridge, bridges)
+        mixer.addChannel(bridge);
+
+    speak(sources[0], 30000);
+    speak(sources[1], 30000);
+    speak(sources[2], -30000);
+    QTest::qWait(1000);
+
+    // the mix saturates, but each speaker's own input is removed exactly
+    QCOMPARE(mixer.activeSpeakers().size(), 3);
+    QVERIFY(qAbs(lastSample(sinks[0])) < 150);
+    QVERIFY(qAbs(lastSample(sinks[1])) < 150);
+    QVERIFY(lastSample(sinks[2]) > 31000);
+}
+
+void tst_QXmppAudioMixer::testSpeechThreshold()
+{
+    QXmppAudioMixer mixer;
+    foreach (QXmppRtpAudioChannel *bridge, bridges)
+        mixer.addChannel(bridge);
+
+    speak(sources[0], 1000);
+    speak(sources[1], 50);
+    speak(sources[2], 0);
+    QTest::qWait(1000);
+
+    // background noise is not mixed
+    QCOMPARE(mixer.activeSpeakers(), QList<QXmppRtpAudioChannel*>() << bridges[0]);
+    QVERIFY(qAbs(lastSample(sinks[0])) < 20);
+    QVERIFY(qAbs(lastSample(sinks[1]) - 1000) < 150);
+
+    // unless the threshold is lowered
+    mixer.setSpeechThreshold(20);
+    QCOMPARE(mixer.speechThreshold(), 20);
+    QTest::qWait(100);
+    QCOMPARE(mixer.activeSpeakers(), QList<QXmppRtpAudioChannel*>() << bridges[0] << bridges[1]);
+
+    mixer.setSpeechThreshold(-1);
+    QCOMPARE(mixer.speechThreshold(), 0);
+}
+
+QTEST_MAIN(tst_QXmppAudioMixer)
+#include "tst_qxmppaudiomixer.moc"
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <cmath>
+
+#include "QXmppAudioResampler_p.h"
+#include "util.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846264338327950288
+#endif
+
+static QVector<qint16> sine(int rate, int frequency, int samples)
+{
+    QVector<qint16> data(samples);
+    for (int i = 0; i < samples; ++i)
+        data[i] = qRound(10000.0 * sin(2.0 * M_PI * frequency * i / rate));
+    return data;
+}
+
+static double rms(const QVector<qint16> &data, int start, int end)
+{
+    double sum = 0;
+    for (int i = start; i < end; ++i)
+        sum += double(data[i]) * data[i];
+    return sqrt(sum / (end - start));
+}
+
+class tst_QXmppAudioResampler : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testPassthrough();
+    void testRates_data();
+    void testRates();
+    void testInputSamples();
+};
+
+void tst_QXmppAudioResampler::testPassthrough()
+{
+    QXmppAudioResampler resampler;
+    QVERIFY(resampler.isPassthrough());
+
+    resampler.setRates(8000, 8000);
+    QVERIFY(resampler.isPassthrough());
+    QCOMPARE(resampler.inputSamples(160), 160);
+    QCOMPARE(resampler.outputSamples(160), 160);
+
+    const QVector<qint16> input = sine(8000, 1000, 160);
+    QVector<qint16> output(160);
+    QCOMPARE(resampler.process(input.constData(), 160, output.data(), 160), 160);
+    QCOMPARE(output, input);
+}
+
+void tst_QXmppAudioResampler::testRates_data()
+{
+    QTest::addColumn<int>("inputRate");
+    QTest::addColumn<int>("outputRate");
+    QTest::addColumn<int>("frequency");
+    QTest::addColumn<bool>("passed");
+
+    QTest::newRow("8000-16000") << 8000 << 16000 << 1000 << true;
+    QTest::newRow("8000-48000") << 8000 << 48000 << 1000 << true;
+    QTest::newRow("16000-8000") << 16000 << 8000 << 1000 << true;
+    QTest::newRow("48000-8000") << 48000 << 8000 << 1000 << true;
+    QTest::newRow("44100-48000") << 44100 << 48000 << 5000 << true;
+    QTest::newRow("48000-44100") << 48000 << 44100 << 5000 << true;
+    QTest::newRow("48000-8000-alias") << 48000 << 8000 << 6000 << false;
+}
+
+void tst_QXmppAudioResampler::testRates()
+{
+    QFETCH(int, inputRate);
+    QFETCH(int, outputRate);
+    QFETCH(int, frequency);
+    QFETCH(bool, passed);
+
+    QXmppAudioResampler resampler;
+    resampler.setRates(inputRate, outputRate);
+    QVERIFY(!resampler.isPassthrough());
+    QCOMPARE(resampler.inputRate(), inputRate);
+    QCOMPARE(resampler.outputRate(), outputRate);
+
+    // one second of audio, fed in chunks of varying sizes
+    const QVector<qint16> input = sine(inputRate, frequency, inputRate);
+    QVector<qint16> output;
+    int pos = 0;
+    for (int i = 0; pos < input.size(); ++i) {
+        const int samples = qMin((i * 37) % 500 + 1, input.size() - pos);
+        const int expected = resampler.outputSamples(samples);
+        QVector<qint16> chunk(expected);
+        QCOMPARE(resampler.process(input.constData() + pos, samples, chunk.data(), expected), expected);
+        output += chunk;
+        pos += samples;
+    }
+    QCOMPARE(output.size(), outputRate);
+
+    // the same audio in a single call
+    QXmppAudioResampler single;
+    single.setRates(inputRate, outputRate);
+    QVector<qint16> whole(single.outputSamples(input.size()));
+    QCOMPARE(single.process(input.constData(), input.size(), whole.data(), whole.size()), outputRate);
+    QCOMPARE(whole, output);
+
+    // tones below the lower Nyquist frequency keep their level
+    const double level = rms(output, outputRate / 10, outputRate - outputRate / 10);
+    if (passed)
+        QVERIFY(qAbs(level - 10000.0 / sqrt(2.0)) < 200);
+    else
+        QVERIFY(level < 200);
+
+    // constant signals keep their value
+    resampler.reset();
+    const QVector<qint16> constant(inputRate / 10, 12345);
+    QVector<qint16> result(resampler.outputSamples(constant.size()));
+    resampler.process(constant.constData(), constant.size(), result.data(), result.size());
+    for (int i = result.size() / 2; i < result.size(); ++i)
+        QCOMPARE(result[i], qint16(12345));
+}
+
+void tst_QXmppAudioResampler::testInputSamples()
+{
+    QXmppAudioResampler resampler;
+    resampler.setRates(48000, 8000);
+
+    // reading exact amounts of output consumes the input at the right pace
+    const QVector<qint16> input = sine(48000, 1000, 48000);
+    QVector<qint16> output(160);
+    int pos = 0;
+    for (int i = 0; i < 50; ++i) {
+        const int samples = resampler.inputSamples(160);
+        QCOMPARE(resampler.process(input.constData() + pos, samples, output.data(), 160), 160);
+        pos += samples;
+    }
+    QVERIFY(qAbs(pos - 48000) <= 6);
+
+    resampler.setRates(8000, 48000);
+    output.resize(960);
+    pos = 0;
+    for (int i = 0; i < 50; ++i) {
+        const int samples = resampler.inputSamples(960);
+        QCOMPARE(resampler.process(input.constData() + pos, samples, output.data(), 960), 960);
+        pos += samples;
+    }
+    QVERIFY(qAbs(pos - 8000) <= 1);
+}
+
+QTEST_MAIN(tst_QXmppAudioResampler)
+#include "tst_qxmppaudioresampler.moc"
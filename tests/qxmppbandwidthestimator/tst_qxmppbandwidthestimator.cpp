@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QObject>
+
+#include "QXmppBandwidthEstimator_p.h"
+#include "util.h"
+
+class tst_QXmppBandwidthEstimator : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testBounds();
+    void testLoss();
+    void testDelayConstant();
+    void testDelayIncreasing();
+};
+
+// Sends 10 packets of 1200 bytes every 10 ms, then reports their arrival
+// after a base delay of 50 ms plus the given queuing delay per packet.
+static void sendAndReport(QXmppBandwidthEstimator &estimator, quint16 &sequence, qint64 &time, int queuing)
+{
+    const quint16 base = sequence;
+    QList<qint64> arrivals;
+    for (int i = 0; i < 10; ++i) {
+        estimator.packetSent(sequence, 1200, time);
+        arrivals << time + 50000 + qint64(sequence) * queuing;
+        sequence++;
+        time += 10000;
+    }
+    estimator.feedbackReceived(base, arrivals, time + 50000);
+}
+
+void tst_QXmppBandwidthEstimator::testBounds()
+{
+    QXmppBandwidthEstimator estimator;
+    estimator.setBitrate(500000);
+    QCOMPARE(estimator.bitrate(), 500000);
+    QCOMPARE(estimator.usage(), QXmppBandwidthEstimator::Normal);
+
+    estimator.setMaximumBitrate(400000);
+    QCOMPARE(estimator.maximumBitrate(), 400000);
+    QCOMPARE(estimator.bitrate(), 400000);
+
+    estimator.setMaximumBitrate(2000000);
+    estimator.setMinimumBitrate(600000);
+    QCOMPARE(estimator.minimumBitrate(), 600000);
+    QCOMPARE(estimator.bitrate(), 600000);
+}
+
+void tst_QXmppBandwidthEstimator::testLoss()
+{
+    QXmppBandwidthEstimator estimator;
+    estimator.setBitrate(1000000);
+
+    // too few packets to act upon
+    estimator.lossReported(5, 10, 0);
+    QCOMPARE(estimator.bitrate(), 1000000);
+
+    // 30% loss over 20 packets reduces the bitrate by 15%
+    estimator.lossReported(1, 10, 0);
+    QCOMPARE(estimator.bitrate(), 850000);
+
+    // low loss increases the bitrate at most once per second
+    estimator.lossReported(0, 100, 500000);
+    QCOMPARE(estimator.bitrate(), 850000);
+    estimator.lossReported(0, 100, 1000000);
+    QCOMPARE(estimator.bitrate(), 918000);
+
+    // moderate loss holds the bitrate
+    estimator.lossReported(5, 100, 3000000);
+    QCOMPARE(estimator.bitrate(), 918000);
+}
+
+void tst_QXmppBandwidthEstimator::testDelayConstant()
+{
+    QXmppBandwidthEstimator estimator;
+    estimator.setBitrate(300000);
+
+    quint16 sequence = 65500;
+    qint64 time = 0;
+    for (int i = 0; i < 30; ++i)
+        sendAndReport(estimator, sequence, time, 0);
+
+    QCOMPARE(estimator.usage(), QXmppBandwidthEstimator::Normal);
+    QVERIFY(estimator.bitrate() > 330000);
+}
+
+void tst_QXmppBandwidthEstimator::testDelayIncreasing()
+{
+    QXmppBandwidthEstimator estimator;
+    estimator.setBitrate(1000000);
+
+    // each packet is delayed by one more millisecond
+    quint16 sequence = 0;
+    qint64 time = 0;
+    for (int i = 0; i < 10; ++i)
+        sendAndReport(estimator, sequence, time, 1000);
+
+    // the bitrate falls below the 960 kb/s which were acknowledged
+    QCOMPARE(estimator.usage(), QXmppBandwidthEstimator::Overuse);
+    QVERIFY(estimator.bitrate() < 850000);
+}
+
+QTEST_MAIN(tst_QXmppBandwidthEstimator)
+#include "tst_qxmppbandwidthestimator.moc"
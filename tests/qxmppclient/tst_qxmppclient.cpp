@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDomElement>
+#include <QSignalSpy>
+
+#include "QXmppClient.h"
+#include "QXmppClient_p.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppServer.h"
+#include "QXmppServerExtension.h"
+#include "util.h"
+
+static const QString testDomain("localhost");
+static const QHostAddress testHost(QHostAddress::LocalHost);
+static const quint16 testPort = 12345;
+
+// swallows the requests sent to an entity which never answers
+class TestSilentExtension : public QXmppServerExtension
+{
+public:
+    bool acceptsStanza(const QString &tagName, const QString &type, const QString &from, const QString &to) const
+    {
+        Q_UNUSED(type);
+        Q_UNUSED(from);
+        return tagName == QLatin1String("iq") && to.startsWith(QLatin1String("ghost@"));
+    }
+
+    bool handleStanza(const QDomElement &stanza)
+    {
+        return stanza.tagName() == QLatin1String("iq") &&
+               stanza.attribute("to").startsWith(QLatin1String("ghost@"));
+    }
+};
+
+class tst_QXmppClient : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void testSendIqInvalid();
+    void testSendIqResult();
+    void testSendIqError();
+    void testSendIqTimeout();
+    void testSendIqDisconnect();
+    void testReconnectTime();
+
+private:
+    bool connectClient(QXmppClient *client, const QString &user);
+
+    TestPasswordChecker *m_passwordChecker;
+    QXmppServer *m_server;
+    QXmppClient *m_alice;
+    QXmppClient *m_bob;
+};
+
+bool tst_QXmppClient::connectClient(QXmppClient *client, const QString &user)
+{
+    QEventLoop loop;
+    connect(client, SIGNAL(connected()),
+            &loop, SLOT(quit()));
+    connect(client, SIGNAL(disconnected()),
+            &loop, SLOT(quit()));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser(user);
+    config.setPassword("testpwd");
+    client->connectToServer(config);
+    loop.exec();
+    return client->isConnected();
+}
+
+void tst_QXmppClient::init()
+{
+    m_passwordChecker = new TestPasswordChecker;
+    m_passwordChecker->addCredentials("alice", "testpwd");
+    m_passwordChecker->addCredentials("bob", "testpwd");
+
+    m_server = new QXmppServer;
+    m_server->setDomain(testDomain);
+    m_server->setPasswordChecker(m_passwordChecker);
+    m_server->addExtension(new TestSilentExtension);
+    QVERIFY(m_server->listenForClients(testHost, testPort));
+
+    m_alice = new QXmppClient;
+    m_bob = new QXmppClient;
+    QVERIFY(connectClient(m_alice, "alice"));
+    QVERIFY(connectClient(m_bob, "bob"));
+}
+
+void tst_QXmppClient::cleanup()
+{
+    delete m_alice;
+    delete m_bob;
+    delete m_server;
+    delete m_passwordChecker;
+}
+
+void tst_QXmppClient::testSendIqInvalid()
+{
+    // responses are not requests
+    QXmppIq result(QXmppIq::Result);
+    result.setTo("bob@localhost/QXmpp");
+    QFuture<QDomElement> future = m_alice->sendIq(result);
+    QVERIFY(future.isFinished());
+    QVERIFY(future.isCanceled());
+
+    // ids must be unique among pending requests
+    QXmppIq request(QXmppIq::Get);
+    request.setTo("ghost@localhost/QXmpp");
+    future = m_alice->sendIq(request);
+    QVERIFY(!future.isFinished());
+
+    QFuture<QDomElement> duplicate = m_alice->sendIq(request);
+    QVERIFY(duplicate.isFinished());
+    QVERIFY(duplicate.isCanceled());
+    QVERIFY(!future.isFinished());
+}
+
+void tst_QXmppClient::testSendIqResult()
+{
+    QXmppDiscoveryIq request;
+    request.setQueryType(QXmppDiscoveryIq::InfoQuery);
+    request.setTo("bob@localhost/QXmpp");
+
+    QSignalSpy iqSpy(m_alice, SIGNAL(iqReceived(QXmppIq)));
+    QFuture<QDomElement> future = m_alice->sendIq(request);
+    QTRY_VERIFY(future.isFinished());
+    QVERIFY(!future.isCanceled());
+
+    const QDomElement response = future.result();
+    QCOMPARE(response.attribute("type"), QString("result"));
+    QCOMPARE(response.attribute("id"), request.id());
+    QCOMPARE(response.attribute("from"), QString("bob@localhost/QXmpp"));
+    QVERIFY(QXmppDiscoveryIq::isDiscoveryIq(response));
+
+    // the response is not delivered to the iqReceived() signal
+    QCOMPARE(iqSpy.count(), 0);
+}
+
+void tst_QXmppClient::testSendIqError()
+{
+    // bob's client does not understand an empty request
+    QXmppIq request(QXmppIq::Get);
+    request.setTo("bob@localhost/QXmpp");
+
+    QFuture<QDomElement> future = m_alice->sendIq(request);
+    QTRY_VERIFY(future.isFinished());
+    QVERIFY(!future.isCanceled());
+
+    QXmppIq response;
+    response.parse(future.result());
+    QCOMPARE(response.type(), QXmppIq::Error);
+    QCOMPARE(response.id(), request.id());
+    QCOMPARE(response.error().condition(), QXmppStanza::Error::FeatureNotImplemented);
+
+    // the server answers for resources which are not connected
+    request = QXmppIq(QXmppIq::Get);
+    request.setTo("nobody@localhost/QXmpp");
+
+    future = m_alice->sendIq(request);
+    QTRY_VERIFY(future.isFinished());
+    QVERIFY(!future.isCanceled());
+
+    response.parse(future.result());
+    QCOMPARE(response.type(), QXmppIq::Error);
+    QCOMPARE(response.error().condition(), QXmppStanza::Error::ServiceUnavailable);
+}
+
+void tst_QXmppClient::testSendIqTimeout()
+{
+    QXmppIq request(QXmppIq::Get);
+    request.setTo("ghost@localhost/QXmpp");
+
+    QFuture<QDomElement> future = m_alice->sendIq(request, 200);
+    QTest::qWait(100);
+    QVERIFY(!future.isFinished());
+    QTRY_VERIFY(future.isFinished());
+    QVERIFY(future.isCanceled());
+
+    // the id can be used again once the request expired
+    future = m_alice->sendIq(request, 200);
+    QVERIFY(!future.isFinished());
+}
+
+void tst_QXmppClient::testSendIqDisconnect()
+{
+    QXmppIq request(QXmppIq::Get);
+    request.setTo("ghost@localhost/QXmpp");
+
+    QFuture<QDomElement> future = m_alice->sendIq(request, -1);
+    QTest::qWait(100);
+    QVERIFY(!future.isFinished());
+
+    QSignalSpy disconnectedSpy(m_alice, SIGNAL(disconnected()));
+    m_alice->disconnectFromServer();
+    QTRY_COMPARE(disconnectedSpy.count(), 1);
+    QVERIFY(future.isFinished());
+    QVERIFY(future.isCanceled());
+
+    // requests can not be sent while disconnected
+    request = QXmppIq(QXmppIq::Get);
+    request.setTo("bob@localhost/QXmpp");
+    future = m_alice->sendIq(request);
+    QVERIFY(future.isFinished());
+    QVERIFY(future.isCanceled());
+}
+
+void tst_QXmppClient::testReconnectTime()
+{
+    // the delay doubles after each attempt, up to one minute, and is
+    // spread over the second half of that range
+    for (int tries = 0; tries < 8; ++tries) {
+        const int delay = qMin(5000 << tries, 60000);
+        int minimum = delay;
+        int maximum = 0;
+        for (int i = 0; i < 100; ++i) {
+            const int value = QXmppClientPrivate::getNextReconnectTime(tries);
+            QVERIFY(value >= delay / 2);
+            QVERIFY(value <= delay);
+            minimum = qMin(minimum, value);
+            maximum = qMax(maximum, value);
+        }
+        QVERIFY(minimum < maximum);
+    }
+}
+
+QTEST_MAIN(tst_QXmppClient)
+#include "tst_qxmppclient.moc"
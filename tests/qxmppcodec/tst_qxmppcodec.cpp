@@ -24,16 +24,120 @@
 #include <QObject>
 #include <QtTest>
 #include "QXmppCodec_p.h"
+#include "QXmppRtpPacket.h"
+#include "QXmppVideoConverter_p.h"
 
 class tst_QXmppCodec : public QObject
 {
     Q_OBJECT
 
 private slots:
+    void testOpusControls();
+    void testOpusDtx();
     void testTheoraDecoder();
     void testTheoraEncoder();
+    void testVpxEncoder();
+    void testVpxNack();
+    void testVpxReordering_data();
+    void testVpxReordering();
+    void testVpxReorderTimeout();
+    void testVpxReorderWindow();
+    void testVpxTemporalLayers();
 };
 
+#ifdef QXMPP_USE_VPX
+// encodes blank frames, returning the payloads of each frame
+static QList<QList<QByteArray> > vpxEncode(QXmppVpxEncoder &encoder, int count)
+{
+    const QXmppVideoFrame frame = QXmppVideoConverter::createFrame(QSize(320, 240), QXmppVideoFrame::Format_YUV420P);
+    QList<QList<QByteArray> > frames;
+    for (int i = 0; i < count; ++i)
+        frames << encoder.handleFrame(frame);
+    return frames;
+}
+
+// returns the number of frames decoded after receiving the payload
+static int vpxDecode(QXmppVpxDecoder &decoder, const QByteArray &payload, quint16 sequence)
+{
+    QXmppRtpPacket packet;
+    packet.setType(96);
+    packet.setSequence(sequence);
+    packet.setPayload(payload);
+
+    // the view refers to the datagram, which must outlive it
+    const QByteArray datagram = packet.encode();
+    QXmppRtpPacketView view;
+    if (!view.decode(datagram))
+        return -1;
+    return decoder.handlePacket(view).size();
+}
+
+static QXmppVpxEncoder *vpxEncoder()
+{
+    QXmppVideoFormat format;
+    format.setFrameSize(QSize(320, 240));
+    format.setPixelFormat(QXmppVideoFrame::Format_YUV420P);
+
+    QXmppVpxEncoder *encoder = new QXmppVpxEncoder(256000);
+    encoder->setFormat(format);
+    return encoder;
+}
+#endif
+
+void tst_QXmppCodec::testOpusControls()
+{
+#ifdef QXMPP_USE_OPUS
+    QXmppOpusCodec codec(8000, 1);
+    QVERIFY(codec.isDtxEnabled());
+    QVERIFY(codec.isFecEnabled());
+
+    codec.setBitrate(12000);
+    QCOMPARE(codec.bitrate(), 12000);
+
+    codec.setComplexity(3);
+    QCOMPARE(codec.complexity(), 3);
+
+    codec.setDtxEnabled(false);
+    QVERIFY(!codec.isDtxEnabled());
+
+    codec.setFecEnabled(false);
+    QVERIFY(!codec.isFecEnabled());
+
+    codec.setPacketLoss(5);
+    QCOMPARE(codec.packetLoss(), 5);
+    codec.setPacketLoss(150);
+    QCOMPARE(codec.packetLoss(), 100);
+#else
+    QSKIP("QXmpp was built without Opus support");
+#endif
+}
+
+void tst_QXmppCodec::testOpusDtx()
+{
+#ifdef QXMPP_USE_OPUS
+    QXmppOpusCodec codec(8000, 1);
+
+    // 20ms of silence
+    const QByteArray silence(160 * 2, 0);
+    qint64 samples = 0;
+    int sent = 0;
+    for (int i = 0; i < 50; ++i) {
+        QDataStream input(silence);
+        QByteArray payload;
+        QDataStream output(&payload, QIODevice::WriteOnly);
+        samples += codec.encode(input, output);
+        if (!payload.isEmpty())
+            sent++;
+    }
+
+    // the stream advances, but most silent frames are not sent
+    QCOMPARE(samples, qint64(50 * 160));
+    QVERIFY(sent < 25);
+#else
+    QSKIP("QXmpp was built without Opus support");
+#endif
+}
+
 void tst_QXmppCodec::testTheoraDecoder()
 {
 #ifdef QXMPP_USE_THEORA
@@ -47,6 +151,8 @@ void tst_QXmppCodec::testTheoraDecoder()
     QXmppVideoFormat format = decoder.format();
     QCOMPARE(format.frameSize(), QSize(320, 240));
     QCOMPARE(format.pixelFormat(), QXmppVideoFrame::Format_YUV420P);
+#else
+    QSKIP("QXmpp was built without Theora support");
 #endif
 }
 
@@ -63,6 +169,253 @@ void tst_QXmppCodec::testTheoraEncoder()
     QMap<QString, QString> params = encoder.parameters();
     QCOMPARE(params.value("delivery-method"), QLatin1String("inline"));
     QCOMPARE(params.value("configuration"), QLatin1String("AAAAAcNFrgzoAio6gHRoZW9yYQMCAQAUAA8AAUAAAPAAAAAAAB4AAAABAAAAAAAAAAAAAMDAgXRoZW9yYSsAAABYaXBoLk9yZyBsaWJ0aGVvcmEgMS4xIDIwMDkwODIyIChUaHVzbmVsZGEpAAAAAIJ0aGVvcmG+zSj3uc1rGLWpSUoQc5zmMYxSlKQhCDGMYhCEIQhAAAAAAAAAAAAAEW2uU2eSyPxWEvx4OVts5ir1aKtUKBMpJFoQ/nk5m41mUwl4slUpk4kkghkIfDwdjgajQYC8VioUCQRiIQh8PBwMhgLBQIg4FRba5TZ5LI/FYS/Hg5W2zmKvVoq1QoEykkWhD+eTmbjWZTCXiyVSmTiSSCGQh8PB2OBqNBgLxWKhQJBGIhCHw8HAyGAsFAiDgUCw8PDw8PDw8PDw8PDw8PDw8PDw8PDw8PDw8PDw8PDw8PDw8PDw8PDw8PDw8PDw8PDw8PDw8PDw8PDw8PDw8PDw8PDAwPEhQUFQ0NDhESFRUUDg4PEhQVFRUOEBETFBUVFRARFBUVFRUVEhMUFRUVFRUUFRUVFRUVFRUVFRUVFRUVEAwLEBQZGxwNDQ4SFRwcGw4NEBQZHBwcDhATFhsdHRwRExkcHB4eHRQYGxwdHh4dGxwdHR4eHh4dHR0dHh4eHRALChAYKDM9DAwOExo6PDcODRAYKDlFOA4RFh0zV1A+EhYlOkRtZ00YIzdAUWhxXDFATldneXhlSFxfYnBkZ2MTExMTExMTExMTExMTExMTExMTExMTExMTExMTExMTExMTExMTExMTExMTExMTExMTExMTExMTExMTExMTExMTEhIVGRoaGhoSFBYaGhoaGhUWGRoaGhoaGRoaGhoaGhoaGhoaGhoaGhoaGhoaGhoaGhoaGhoaGhoaGhoaGhoaGhESFh8kJCQkEhQYIiQkJCQWGCEkJCQkJB8iJCQkJCQkJCQkJCQkJCQkJCQkJCQkJCQkJCQkJCQkJCQkJCQkJCQREhgvY2NjYxIVGkJjY2NjGBo4Y2NjY2MvQmNjY2NjY2NjY2NjY2NjY2NjY2NjY2NjY2NjY2NjY2NjY2NjY2NjFRUVFRUVFRUVFRUVFRUVFRUVFRUVFRUVFRUVFRUVFRUVFRUVFRUVFRUVFRUVFRUVFRUVFRUVFRUVFRUVFRUVFRISEhUXGBkbEhIVFxgZGxwSFRcYGRscHRUXGBkbHB0dFxgZGxwdHR0YGRscHR0dHhkbHB0dHR4eGxwdHR0eHh4REREUFxocIBERFBcaHCAiERQXGhwgIiUUFxocICIlJRcaHCAiJSUlGhwgIiUlJSkcICIlJSUpKiAiJSUlKSoqEBAQFBgcICgQEBQYHCAoMBAUGBwgKDBAFBgcICgwQEAYHCAoMEBAQBwgKDBAQEBgICgwQEBAYIAoMEBAQGCAgAfF5cdH1e3Ow/L66wGmYnfIUbwdUTe3LMRbqON8B+5RJEvcGxkvrVUjTMrsXYhAnIwe0dTJfOYbWrDYyqUrz7dw/JO4hpmV2LsQQvkUeGq1BsZLx+cu5iV0e0eScJ91VIQYrmqfdVSK7GgjOU0oPaPOu5IcDK1mNvnD+K8LwS87f8Jx2mHtHnUkTGAurWZlNQa74ZLSFH9oF6FPGxzLsjQO5Qe0edcpttd7BXBSqMCL4k/4tFrHIPuEQ7m1/uIWkbDMWVoDdOSuRQ9286kvVUlQjzOE6VrNguN4oRXYGkgcnih7t13/9kxvLYKQezwLTrO44sVmMPgMqORo1E0sm1/9SludkcWHwfJwTSybR4LeAz6ugWVgRaY8mV/9SluQmtHrzsBtRF/wPY+X0JuYTs+ltgrXAmlk10xQHmTu9VSIAk1+vcvU4ml2oNzrNhEtQ3CysNP8UeR35wqpKUBdGdZMSjX4WVi8nJpdpHnbhzEIdx7mwf6W1FKAiucMXrWUWVjyRf23chNtR9mIzDoT/6ZLYailAjhFlZuvPtSeZ+2oREubDoWmT3TguY+JHPdRVSLKxfKH3vgNqJ/9emeEYikGXDFNzaLjvTeGAL61mogOoeG3y6oU4rW55ydoj0lUTSR/mmRhPmF86uwIfzp3FtiufQCmppaHDlGE0r2iTzXIw3zBq5hvaTldjG4CPb9wdxAme0SyedVKczJ9AtYbgPOzYKJvZZImsN7ecrxWZg5dR6ZLj/j4qpWsIA+vYwE+Tca9ounMIsrXMB4Stiib2SPQtZv+FVIpfEbzv8ncZoLBXc3YBqTG1HsskTTotZOYTG+oVUjLk6zhP8bg4RhMUNtfZdO7FdpBuXzhJ5Fh8IKlJG7wtD9ik8rWOJxy6iQ3NwzBpQ219mlyv+FLicYs2iJGSE0u2txzed++D61ZWCiHD/cZdQVCqkO2gJpdpNaObhnDfAPrT89RxdWFZ5hO3MseBSIlANppdZNIV/Rwe5eLTDvkfWKzFnH+QJ7m9QWV1KdwnuIwTNtZdJMoXBf74OhRnh2t+OTGL+AVUnIkyYY+QG7g9itHXyF3OIygG2s2kud679ZWKqSFa9n3IHD6MeLv1lZ0XyduRhiDRtrNnKoyiFVLcBm0ba5Yy3fQkDh4XsFE34isVpOzpa9nR8iCpS4HoxG2rJpnRhf3YboVa1PcRouh5LIJv/uQcPNd095ickTaiGBnWLKVWRc0OnYTSyex/n2FofEPnDG8y3PztHrzOLK1xo6RAml2k9owKajOC0Wr4D5x+3nA0UEhK2m198wuBHF3zlWWVKWLN1CHzLClUfuoYBcx4b1llpeBKmbayaR58njtE9onD66lUcsg0Spm2snsb+8HaJRn4dYcLbCuBuYwziB8/5U1C1DOOz2gZjSZtrLJk6vrLF3hwY4Io9xuT/ruUFRSBkNtUzTOWhjh26irLEPx4jPZL3Fo3QrReoGTTM21xYTT9oFdhTUIvjqTkfkvt0bzgVUjq/hOYY8j60IaO/0AzRBtqkTS6R5ellZd5uKdzzhb8BFlDdAcrwkE0rbXTOPB+7Y0FlZO96qFL4Ykg21StJs8qIW7h16H5hGiv8V2Cflau7QVDepTAHa6Lgt6feiEvJDM21StJsmOH/hynURrKxvUpQ8BH0JF7BiyG2qZpnL/7AOU66gt+reLEXY8pVOCQvSsBtqZTNM8bk9ohRcwD18o/WVkbvrceVKRb9I59IEKysjBeTMmmbA21xu/6iHadLRxuIzkLpi8wZYmmbbWi32RVAUjruxWlJ//iFxE38FI9hNKOoCdhwf5fDe4xZ81lgREhK2m1j78vW1CqkuMu/AjBNK210kzRUX/B+69cMMUG5bYrIeZxVSEZISmkzbXOi9yxwIfPgdsov7R71xuJ7rFcACjG/9PzApqFq7wEgzNJm2suWESPuwrQvejj7cbnQxMkxpm21lUYJL0fKmogPPqywn7e3FvB/FCNxPJ85iVUkCE9/tLKx31G4CgNtWTTPFhMvlu8G4/TrgaZttTChljfNJGgOT2X6EqpETy2tYd9cCBI4lIXJ1/3uVUllZEJz4baqGF64yxaZ+zPLYwde8Uqn1oKANtUrSaTOPHkhvuQP3bBlEJ/LFe4pqQOHUI8T8q7AXx3fLVBgSCVpMba55YxN3rv8U1Dv51bAPSOLlZWebkL8vSMGI21lJmmeVxPRwFlZF1CpqCN8uLwymaZyjbXHCRytogPN3o/n74CNykfT+qqRv5AQlHcRxYrC5KvGmbbUwmZY/29BvF6C1/93x4WVglXDLFpmbapmF89HKTogRwqqSlGbu+oiAkcWFbklC6Zhf+NtTLFpn8oWz+HsNRVSgIxZWON+yVyJlE5tq/+GWLTMutYX9ekTySEQPLVNQQ3OfycwJBM0zNtZcse7CvcKI0V/zh16Dr9OSA21MpmmcrHC+6pTAPHPwoit3LHHqs7jhFNRD6W8+EBGoSEoaZttTCZljfduH/fFisn+dRBGAZYtMzbVMwvul/T/crK1NQh8gN0SRRa9cOux6clC0/mDLFpmbarmF8/e6CopeOLCNW6S/IUUg3jJIYiAcDoMcGeRbOvuTPjXR/tyo79LK3kqqkbxkkMRAOB0GODPItnX3Jnxro/25Ud+llbyVVSN4ySGIgHA6DHBnkWzr7kz410f7cqO/Syt5KqpFVJwn6gBEvBM0zNtZcpGOEPiysW8vvRd2R0f7gtjhqUvXL+gWVwHm4XJDBiMpmmZtrLfPwd/IugP5+fKVSysH1EXreFAcEhelGmbbUmZY4Xdo1vQWVnK19P4RuEnbf0gQnR+lDCZlivNM22t1ESmopPIgfT0duOfQrsjgG4tPxli0zJmF5trdL1JDUIUT1ZXSqQDeR4B8mX3TrRro/2McGeUvLtwo6jIEKMkCUXWsLyZROd9P/rFYNtXPBli0z398iVUlVKAjFlY437JXImUTm2r/4ZYtMy61hf16RPJIQ=="));
+#else
+    QSKIP("QXmpp was built without Theora support");
+#endif
+}
+
+void tst_QXmppCodec::testVpxEncoder()
+{
+#ifdef QXMPP_USE_VPX
+    QXmppVideoFormat format;
+    format.setFrameSize(QSize(320, 240));
+    format.setPixelFormat(QXmppVideoFrame::Format_YUV420P);
+
+    QXmppVpxEncoder encoder(256000);
+    encoder.setThreadCount(2);
+    QCOMPARE(encoder.threadCount(), 2);
+    encoder.setCpuUsed(-6);
+    QCOMPARE(encoder.cpuUsed(), -6);
+    encoder.setTokenPartitions(2);
+    QCOMPARE(encoder.tokenPartitions(), 2);
+    encoder.setTokenPartitions(5);
+    QCOMPARE(encoder.tokenPartitions(), 3);
+    QVERIFY(encoder.setFormat(format));
+
+    const QXmppVideoFrame frame = QXmppVideoConverter::createFrame(format.frameSize(), format.pixelFormat());
+    QList<QByteArray> packets = encoder.handleFrame(frame);
+    QVERIFY(!packets.isEmpty());
+
+    // the bitrate and a smaller size apply to the running encoder
+    encoder.setBitrate(128000);
+    format.setFrameSize(QSize(160, 120));
+    QVERIFY(encoder.setFormat(format));
+    packets = encoder.handleFrame(QXmppVideoConverter::createFrame(format.frameSize(), format.pixelFormat()));
+    QVERIFY(!packets.isEmpty());
+
+    // a larger size initialises the codec again
+    format.setFrameSize(QSize(640, 480));
+    QVERIFY(encoder.setFormat(format));
+    packets = encoder.handleFrame(QXmppVideoConverter::createFrame(format.frameSize(), format.pixelFormat()));
+    QVERIFY(!packets.isEmpty());
+#else
+    QSKIP("QXmpp was built without VPX support");
+#endif
+}
+
+void tst_QXmppCodec::testVpxNack()
+{
+#ifdef QXMPP_USE_VPX
+    QScopedPointer<QXmppVpxEncoder> encoder(vpxEncoder());
+    QList<QByteArray> payloads;
+    while (payloads.size() < 8) {
+        foreach (const QList<QByteArray> &frame, vpxEncode(*encoder, 1))
+            payloads << frame;
+    }
+
+    // the sequence number wraps around after the first three packets
+    const quint16 base = 65533;
+    QXmppVpxDecoder decoder;
+    vpxDecode(decoder, payloads[0], base);
+    QVERIFY(decoder.takeLostSequences().isEmpty());
+
+    // each gap is requested once
+    vpxDecode(decoder, payloads[3], quint16(base + 3));
+    QCOMPARE(decoder.takeLostSequences(), QList<quint16>() << 65534 << 65535);
+    vpxDecode(decoder, payloads[4], quint16(base + 4));
+    QVERIFY(decoder.takeLostSequences().isEmpty());
+    vpxDecode(decoder, payloads[6], quint16(base + 6));
+    QCOMPARE(decoder.takeLostSequences(), QList<quint16>() << 2);
+
+    // late and duplicate packets do not trigger requests
+    vpxDecode(decoder, payloads[1], quint16(base + 1));
+    vpxDecode(decoder, payloads[4], quint16(base + 4));
+    vpxDecode(decoder, payloads[7], quint16(base + 7));
+    QVERIFY(decoder.takeLostSequences().isEmpty());
+#else
+    QSKIP("QXmpp was built without VPX support");
+#endif
+}
+
+void tst_QXmppCodec::testVpxReordering_data()
+{
+    QTest::addColumn<int>("base");
+
+    QTest::newRow("plain") << 1000;
+    QTest::newRow("wraparound") << 65530;
+}
+
+void tst_QXmppCodec::testVpxReordering()
+{
+#ifdef QXMPP_USE_VPX
+    QFETCH(int, base);
+
+    QScopedPointer<QXmppVpxEncoder> encoder(vpxEncoder());
+    const QList<QList<QByteArray> > frames = vpxEncode(*encoder, 8);
+    QList<QByteArray> payloads;
+    foreach (const QList<QByteArray> &frame, frames)
+        payloads << frame;
+
+    // swap each pair of packets after the first one
+    QList<int> order;
+    order << 0;
+    for (int i = 1; i + 1 < payloads.size(); i += 2)
+        order << i + 1 << i;
+    if (order.size() < payloads.size())
+        order << payloads.size() - 1;
+
+    QXmppVpxDecoder decoder;
+    int decoded = 0;
+    foreach (int i, order)
+        decoded += vpxDecode(decoder, payloads[i], quint16(base + i));
+    QCOMPARE(decoded, frames.size());
+    QVERIFY(!decoder.takeKeyFrameRequest());
+#else
+    QSKIP("QXmpp was built without VPX support");
+#endif
+}
+
+void tst_QXmppCodec::testVpxReorderTimeout()
+{
+#ifdef QXMPP_USE_VPX
+    QScopedPointer<QXmppVpxEncoder> encoder(vpxEncoder());
+    QList<QList<QByteArray> > frames = vpxEncode(*encoder, 3);
+    encoder->requestKeyFrame();
+    frames << vpxEncode(*encoder, 1);
+
+    QXmppVpxDecoder decoder;
+    quint16 sequence = 1;
+    int decoded = 0;
+    foreach (const QByteArray &payload, frames[0])
+        decoded += vpxDecode(decoder, payload, sequence++);
+    QCOMPARE(decoded, 1);
+
+    // the second frame is lost, the third one waits for it
+    sequence += frames[1].size();
+    foreach (const QByteArray &payload, frames[2])
+        decoded += vpxDecode(decoder, payload, sequence++);
+    QCOMPARE(decoded, 1);
+    QVERIFY(!decoder.takeKeyFrameRequest());
+
+    // well within the reordering window, the decoder gives up on the lost
+    // frame after a while and resumes with a key frame
+    QTest::qWait(300);
+    foreach (const QByteArray &payload, frames[3])
+        decoded += vpxDecode(decoder, payload, sequence++);
+    QCOMPARE(decoded, 2);
+    QVERIFY(decoder.takeKeyFrameRequest());
+#else
+    QSKIP("QXmpp was built without VPX support");
+#endif
+}
+
+void tst_QXmppCodec::testVpxReorderWindow()
+{
+#ifdef QXMPP_USE_VPX
+    QScopedPointer<QXmppVpxEncoder> encoder(vpxEncoder());
+    const QList<QList<QByteArray> > frames = vpxEncode(*encoder, 80);
+    encoder->requestKeyFrame();
+    const QList<QByteArray> keyFrame = vpxEncode(*encoder, 1).first();
+
+    QXmppVpxDecoder decoder;
+    quint16 sequence = 65500;
+    int decoded = 0;
+    foreach (const QByteArray &payload, frames[0])
+        decoded += vpxDecode(decoder, payload, sequence++);
+    QCOMPARE(decoded, 1);
+
+    // the second frame is lost, the next packets wait for it within the
+    // window
+    const quint16 lost = sequence;
+    sequence += frames[1].size();
+    QList<QByteArray> payloads;
+    for (int i = 2; i < frames.size(); ++i)
+        payloads << frames[i];
+    QVERIFY(payloads.size() > 64);
+    while (quint16(sequence - lost) < 64)
+        decoded += vpxDecode(decoder, payloads.takeFirst(), sequence++);
+    QCOMPARE(decoded, 1);
+    QVERIFY(!decoder.takeKeyFrameRequest());
+
+    // beyond the window, the decoder gives up on the lost frame
+    decoded += vpxDecode(decoder, payloads.takeFirst(), sequence++);
+    QVERIFY(decoder.takeKeyFrameRequest());
+
+    // and resumes with a key frame
+    const int skipped = decoded;
+    foreach (const QByteArray &payload, keyFrame)
+        decoded += vpxDecode(decoder, payload, sequence++);
+    QCOMPARE(decoded, skipped + 1);
+#else
+    QSKIP("QXmpp was built without VPX support");
+#endif
+}
+
+void tst_QXmppCodec::testVpxTemporalLayers()
+{
+#ifdef QXMPP_USE_VPX
+    QXmppVideoFormat format;
+    format.setFrameSize(QSize(320, 240));
+    format.setPixelFormat(QXmppVideoFrame::Format_YUV420P);
+
+    QXmppVpxEncoder encoder(256000);
+    QCOMPARE(encoder.temporalLayers(), 1);
+    encoder.setTemporalLayers(3);
+    QCOMPARE(encoder.temporalLayers(), 3);
+    QVERIFY(encoder.setFormat(format));
+
+    // a relay only forwards the base layer
+    QXmppVpxDecoder decoder;
+    QXmppRtpPacket packet;
+    packet.setType(96);
+    packet.setSequence(1);
+    int decoded = 0;
+
+    const QXmppVideoFrame frame = QXmppVideoConverter::createFrame(format.frameSize(), format.pixelFormat());
+    const int layers[] = {0, 2, 1, 2, 0, 2, 1, 2};
+    for (int i = 0; i < 8; ++i) {
+        const QList<QByteArray> packets = encoder.handleFrame(frame);
+        QVERIFY(!packets.isEmpty());
+        foreach (const QByteArray &payload, packets) {
+            QCOMPARE(QXmppVpxDecoder::temporalLayerId(payload), layers[i]);
+
+            // the frames of the upper layer are not referenced
+            QCOMPARE((payload.at(0) & 0x08) != 0, layers[i] == 2);
+
+            if (layers[i] == 0) {
+                packet.setPayload(payload);
+                // the view refers to the datagram, which must outlive it
+                const QByteArray datagram = packet.encode();
+                QXmppRtpPacketView view;
+                QVERIFY(view.decode(datagram));
+                decoded += decoder.handlePacket(view).size();
+                packet.setSequence(packet.sequence() + 1);
+            }
+        }
+    }
+    QCOMPARE(decoded, 2);
+    QVERIFY(decoder.takeLostSequences().isEmpty());
+    QVERIFY(!decoder.takeKeyFrameRequest());
+
+    // a requested key frame restarts the pattern
+    encoder.handleFrame(frame);
+    encoder.requestKeyFrame();
+    const QList<QByteArray> packets = encoder.handleFrame(frame);
+    QVERIFY(!packets.isEmpty());
+    QCOMPARE(QXmppVpxDecoder::temporalLayerId(packets.first()), 0);
+    QCOMPARE(QXmppVpxDecoder::temporalLayerId(QByteArray()), -1);
+#else
+    QSKIP("QXmpp was built without VPX support");
 #endif
 }
 
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDomElement>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+
+#include "QXmppClient.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppDiscoveryManager.h"
+#include "QXmppPresence.h"
+#include "QXmppServer.h"
+#include "QXmppServerExtension.h"
+#include "util.h"
+
+static const QString testDomain("localhost");
+static const QHostAddress testHost(QHostAddress::LocalHost);
+static const quint16 testPort = 12345;
+
+// swallows the requests sent to an entity which never answers
+class TestSilentExtension : public QXmppServerExtension
+{
+public:
+    TestSilentExtension()
+        : requests(0)
+    {
+    }
+
+    bool acceptsStanza(const QString &tagName, const QString &type, const QString &from, const QString &to) const
+    {
+        Q_UNUSED(type);
+        Q_UNUSED(from);
+        return tagName == QLatin1String("iq") && to.startsWith(QLatin1String("ghost@"));
+    }
+
+    bool handleStanza(const QDomElement &stanza)
+    {
+        if (stanza.tagName() == QLatin1String("iq") &&
+            stanza.attribute("to").startsWith(QLatin1String("ghost@"))) {
+            requests++;
+            return true;
+        }
+        return false;
+    }
+
+    int requests;
+};
+
+class tst_QXmppDiscoveryManager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testCapabilities();
+
+private:
+    bool connectClient(QXmppClient *client, const QString &user);
+};
+
+static QXmppPresence capabilitiesPresence(const QString &from, const QString &node, const QByteArray &ver)
+{
+    QXmppPresence presence;
+    presence.setFrom(from);
+    presence.setCapabilityHash("sha-1");
+    presence.setCapabilityNode(node);
+    presence.setCapabilityVer(ver);
+    return presence;
+}
+
+bool tst_QXmppDiscoveryManager::connectClient(QXmppClient *client, const QString &user)
+{
+    QEventLoop loop;
+    connect(client, SIGNAL(connected()),
+            &loop, SLOT(quit()));
+    connect(client, SIGNAL(disconnected()),
+            &loop, SLOT(quit()));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser(user);
+    config.setPassword("testpwd");
+    client->connectToServer(config);
+    loop.exec();
+    return client->isConnected();
+}
+
+void tst_QXmppDiscoveryManager::testCapabilities()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + "/caps.dat";
+
+    // prepare server
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("alice", "testpwd");
+    passwordChecker.addCredentials("bob", "testpwd");
+
+    TestSilentExtension *silent = new TestSilentExtension;
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(silent);
+    server.listenForClients(testHost, testPort);
+
+    QXmppClient alice;
+    QXmppClient bob;
+    QVERIFY(connectClient(&alice, "alice"));
+    QVERIFY(connectClient(&bob, "bob"));
+
+    QXmppDiscoveryManager *manager = alice.findExtension<QXmppDiscoveryManager>();
+    QVERIFY(manager);
+    manager->setCapabilitiesCachePath(path);
+
+    QStringList received;
+    QList<QXmppDiscoveryIq> infos;
+    connect(manager, &QXmppDiscoveryManager::capabilitiesReceived,
+            [&](const QString &jid, const QXmppDiscoveryIq &info) {
+        received << jid;
+        infos << info;
+    });
+
+    QXmppDiscoveryManager *bobManager = bob.findExtension<QXmppDiscoveryManager>();
+    const QString node = bobManager->clientCapabilitiesNode();
+    const QByteArray ver = bobManager->capabilitiesVer();
+
+    // a cache miss sends a request
+    QVERIFY(!manager->hasCachedCapabilities("sha-1", ver));
+    QVERIFY(!manager->requestCapabilities(capabilitiesPresence("bob@localhost/QXmpp", node, ver)).isEmpty());
+    QTRY_COMPARE(received.size(), 1);
+    QCOMPARE(received.last(), QString("bob@localhost/QXmpp"));
+    QVERIFY(infos.last().features().contains("http://jabber.org/protocol/disco#info"));
+    QVERIFY(manager->hasCachedCapabilities("sha-1", ver));
+
+    // a cache hit is reported immediately
+    QCOMPARE(manager->requestCapabilities(capabilitiesPresence("bob@localhost/other", node, ver)), QString());
+    QCOMPARE(received.size(), 2);
+    QCOMPARE(received.last(), QString("bob@localhost/other"));
+    QCOMPARE(infos.last().features(), infos.first().features());
+
+    // a reply which does not match its verification string is not cached
+    QVERIFY(!manager->requestCapabilities(capabilitiesPresence("bob@localhost/QXmpp", node, "bogus")).isEmpty());
+    QTRY_COMPARE(received.size(), 3);
+    QVERIFY(!manager->hasCachedCapabilities("sha-1", "bogus"));
+
+    // the cache persists across sessions
+    QXmppDiscoveryManager reloaded;
+    reloaded.setCapabilitiesCachePath(path);
+    QVERIFY(reloaded.hasCachedCapabilities("sha-1", ver));
+    QVERIFY(!reloaded.hasCachedCapabilities("sha-1", "bogus"));
+    QCOMPARE(reloaded.cachedCapabilities("sha-1", ver).features(), infos.first().features());
+
+    // an unanswered request is sent again once, then dropped
+    manager->setCapabilitiesTimeout(200);
+    const QString ghostId = manager->requestCapabilities(capabilitiesPresence("ghost@localhost/QXmpp", node, "ghost1"));
+    QVERIFY(!ghostId.isEmpty());
+    QCOMPARE(manager->requestCapabilities(capabilitiesPresence("ghost@localhost/other", node, "ghost1")), ghostId);
+    QTRY_COMPARE(silent->requests, 3);
+    QTest::qWait(500);
+    QCOMPARE(silent->requests, 4);
+    QTest::qWait(500);
+    QCOMPARE(silent->requests, 4);
+    QCOMPARE(received.size(), 3);
+
+    // pending requests are dropped on disconnection
+    manager->setCapabilitiesTimeout(10000);
+    QVERIFY(!manager->requestCapabilities(capabilitiesPresence("ghost@localhost/QXmpp", node, "ghost2")).isEmpty());
+    QTRY_COMPARE(silent->requests, 5);
+    QSignalSpy disconnectedSpy(&alice, SIGNAL(disconnected()));
+    alice.disconnectFromServer();
+    QTRY_COMPARE(disconnectedSpy.size(), 1);
+    QCOMPARE(manager->requestCapabilities(capabilitiesPresence("ghost@localhost/QXmpp", node, "ghost2")), QString());
+}
+
+QTEST_MAIN(tst_QXmppDiscoveryManager)
+#include "tst_qxmppdiscoverymanager.moc"
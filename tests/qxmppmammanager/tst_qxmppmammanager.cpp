@@ -22,6 +22,9 @@
  */
 
 #include <QObject>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include "QXmppClient.h"
 #include "QXmppMessage.h"
 #include "QXmppMamManager.h"
 #include "util.h"
@@ -58,6 +61,8 @@ private slots:
     void testHandleResultIq_data();
     void testHandleResultIq();
 
+    void testCache();
+
 private:
     QXmppMamTestHelper m_helper;
     QXmppMamManager m_manager;
@@ -225,6 +230,147 @@ void tst_QXmppMamManager::testHandleResultIq()
     QCOMPARE(m_helper.m_signalTriggered, accept);
 }
 
+static QDomElement parseElement(QDomDocument &doc, const QByteArray &xml)
+{
+    doc.setContent(xml, true);
+    return doc.documentElement();
+}
+
+void tst_QXmppMamManager::testCache()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + "/mam.dat";
+
+    QXmppClient client;
+    client.configuration().setJid("juliet@capulet.lit/balcony");
+    QXmppMamManager *manager = new QXmppMamManager;
+    client.addExtension(manager);
+
+    // without a cache nothing is synchronized
+    QCOMPARE(manager->synchronizeArchive("romeo@montague.lit"), QString());
+
+    manager->setCachePath(path);
+    QCOMPARE(manager->cachedMessages("romeo@montague.lit").size(), 0);
+
+    // a live message is cached but not consumed
+    QDomDocument doc;
+    QCOMPARE(manager->handleStanza(parseElement(doc,
+        "<message xmlns='jabber:client' type='chat' id='msg1' from='romeo@montague.lit/orchard' to='juliet@capulet.lit/balcony'>"
+          "<body>Hail to thee</body>"
+          "<delay xmlns='urn:xmpp:delay' stamp='2010-07-10T23:08:25Z'/>"
+        "</message>")), false);
+    QCOMPARE(manager->cachedMessages("romeo@montague.lit").size(), 1);
+
+    // so is a carbon copy of a message sent by another resource
+    QCOMPARE(manager->handleStanza(parseElement(doc,
+        "<message xmlns='jabber:client' from='juliet@capulet.lit' to='juliet@capulet.lit/balcony'>"
+          "<sent xmlns='urn:xmpp:carbons:2'>"
+            "<forwarded xmlns='urn:xmpp:forward:0'>"
+              "<message xmlns='jabber:client' type='chat' id='msg2' from='juliet@capulet.lit/chamber' to='romeo@montague.lit/orchard'>"
+                "<body>Art thou not Romeo</body>"
+                "<delay xmlns='urn:xmpp:delay' stamp='2010-07-10T23:09:00Z'/>"
+              "</message>"
+            "</forwarded>"
+          "</sent>"
+        "</message>")), false);
+    QCOMPARE(manager->cachedMessages("romeo@montague.lit").size(), 2);
+
+    // but a carbon copy sent by anybody else is forged
+    QCOMPARE(manager->handleStanza(parseElement(doc,
+        "<message xmlns='jabber:client' from='tybalt@capulet.lit/street' to='juliet@capulet.lit/balcony'>"
+          "<received xmlns='urn:xmpp:carbons:2'>"
+            "<forwarded xmlns='urn:xmpp:forward:0'>"
+              "<message xmlns='jabber:client' type='chat' id='forged' from='romeo@montague.lit/orchard' to='juliet@capulet.lit/balcony'>"
+                "<body>I do not love thee</body>"
+              "</message>"
+            "</forwarded>"
+          "</received>"
+        "</message>")), false);
+    QCOMPARE(manager->cachedMessages("romeo@montague.lit").size(), 2);
+
+    // synchronize, the archive holds the live message and an older one
+    QSignalSpy syncSpy(manager, SIGNAL(archiveSynchronized(QString)));
+    const QString queryId = manager->synchronizeArchive("romeo@montague.lit");
+    QVERIFY(!queryId.isEmpty());
+
+    QCOMPARE(manager->handleStanza(parseElement(doc,
+        "<message xmlns='jabber:client' to='juliet@capulet.lit/balcony'>"
+          "<result xmlns='urn:xmpp:mam:1' queryid='" + queryId.toUtf8() + "' id='28482-98726-73623'>"
+            "<forwarded xmlns='urn:xmpp:forward:0'>"
+              "<delay xmlns='urn:xmpp:delay' stamp='2010-07-10T23:00:00Z'/>"
+              "<message xmlns='jabber:client' type='chat' id='msg0' from='romeo@montague.lit/orchard' to='juliet@capulet.lit/balcony'>"
+                "<body>Soft, what light</body>"
+              "</message>"
+            "</forwarded>"
+          "</result>"
+        "</message>")), true);
+    QCOMPARE(manager->handleStanza(parseElement(doc,
+        "<message xmlns='jabber:client' to='juliet@capulet.lit/balcony'>"
+          "<result xmlns='urn:xmpp:mam:1' queryid='" + queryId.toUtf8() + "' id='09af3-cc343-b409f'>"
+            "<forwarded xmlns='urn:xmpp:forward:0'>"
+              "<delay xmlns='urn:xmpp:delay' stamp='2010-07-10T23:08:25Z'/>"
+              "<message xmlns='jabber:client' type='chat' id='msg1' from='romeo@montague.lit/orchard' to='juliet@capulet.lit/balcony'>"
+                "<body>Hail to thee</body>"
+              "</message>"
+            "</forwarded>"
+          "</result>"
+        "</message>")), true);
+    QCOMPARE(manager->handleStanza(parseElement(doc,
+        "<iq xmlns='jabber:client' type='result' id='" + queryId.toUtf8() + "'>"
+          "<fin xmlns='urn:xmpp:mam:1' complete='true'>"
+            "<set xmlns='http://jabber.org/protocol/rsm'>"
+              "<first index='0'>28482-98726-73623</first>"
+              "<last>09af3-cc343-b409f</last>"
+            "</set>"
+          "</fin>"
+        "</iq>")), true);
+    QCOMPARE(syncSpy.size(), 1);
+    QCOMPARE(syncSpy.first().at(0).toString(), QString("romeo@montague.lit"));
+    QCOMPARE(manager->lastArchiveId("romeo@montague.lit"), QString("09af3-cc343-b409f"));
+
+    // an error ends the synchronization
+    QStringList failedJids;
+    QXmppStanza::Error::Condition failedCondition = QXmppStanza::Error::UndefinedCondition;
+    connect(manager, &QXmppMamManager::archiveSynchronizationFailed,
+            [&](const QString &jid, const QXmppStanza::Error &error) {
+        failedJids << jid;
+        failedCondition = error.condition();
+    });
+    const QString failedId = manager->synchronizeArchive("romeo@montague.lit");
+    QCOMPARE(manager->handleStanza(parseElement(doc,
+        "<iq xmlns='jabber:client' type='error' id='" + failedId.toUtf8() + "'>"
+          "<error type='cancel'>"
+            "<item-not-found xmlns='urn:ietf:params:xml:ns:xmpp-stanzas'/>"
+          "</error>"
+        "</iq>")), true);
+    QCOMPARE(failedJids, QStringList() << "romeo@montague.lit");
+    QCOMPARE(failedCondition, QXmppStanza::Error::ItemNotFound);
+    QCOMPARE(syncSpy.size(), 1);
+    QCOMPARE(manager->lastArchiveId("romeo@montague.lit"), QString("09af3-cc343-b409f"));
+
+    // the query is no longer pending
+    QCOMPARE(manager->handleStanza(parseElement(doc,
+        "<iq xmlns='jabber:client' type='error' id='" + failedId.toUtf8() + "'/>")), false);
+
+    // reload the cache
+    QXmppMamManager reloaded;
+    reloaded.setCachePath(path);
+    QCOMPARE(reloaded.lastArchiveId("romeo@montague.lit"), QString("09af3-cc343-b409f"));
+
+    const QList<QXmppMessage> messages = reloaded.cachedMessages("romeo@montague.lit");
+    QCOMPARE(messages.size(), 3);
+    QCOMPARE(messages.at(0).body(), QString("Soft, what light"));
+    QCOMPARE(messages.at(1).body(), QString("Hail to thee"));
+    QCOMPARE(messages.at(2).body(), QString("Art thou not Romeo"));
+    QCOMPARE(messages.at(2).stamp(), QDateTime(QDate(2010, 7, 10), QTime(23, 9, 0), Qt::UTC));
+
+    // read older history
+    const QList<QXmppMessage> older = reloaded.cachedMessages("romeo@montague.lit", 1, messages.at(2).stamp());
+    QCOMPARE(older.size(), 1);
+    QCOMPARE(older.at(0).body(), QString("Hail to thee"));
+}
+
 void QXmppMamTestHelper::archivedMessageReceived(const QString &queryId, const QXmppMessage &message)
 {
     m_signalTriggered = true;
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QObject>
+#include <QSignalSpy>
+#include <QtTest>
+
+#include "QXmppClient.h"
+#include "QXmppMucManager.h"
+#include "QXmppPresence.h"
+
+class tst_QXmppMucManager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testJoinBurst_data();
+    void testJoinBurst();
+};
+
+static QXmppPresence occupantPresence(const QString &from, QXmppPresence::Type type = QXmppPresence::Available)
+{
+    QXmppPresence presence(type);
+    presence.setFrom(from);
+    return presence;
+}
+
+void tst_QXmppMucManager::testJoinBurst_data()
+{
+    QTest::addColumn<bool>("batching");
+
+    QTest::newRow("signals") << false;
+    QTest::newRow("batching") << true;
+}
+
+void tst_QXmppMucManager::testJoinBurst()
+{
+    QFETCH(bool, batching);
+
+    QXmppClient client;
+    QXmppMucManager *manager = new QXmppMucManager;
+    client.addExtension(manager);
+
+    QXmppMucRoom *room = manager->addRoom("coven@chat.shakespeare.lit");
+    room->setNickName("thirdwitch");
+    QCOMPARE(room->isJoinBatchingEnabled(), false);
+    room->setJoinBatchingEnabled(batching);
+    QCOMPARE(room->isJoinBatchingEnabled(), batching);
+
+    QSignalSpy addedSpy(room, SIGNAL(participantAdded(QString)));
+    QSignalSpy changedSpy(room, SIGNAL(participantChanged(QString)));
+    QSignalSpy removedSpy(room, SIGNAL(participantRemoved(QString)));
+    QSignalSpy listSpy(room, SIGNAL(participantsChanged()));
+    QSignalSpy receivedSpy(room, SIGNAL(participantsReceived()));
+    QSignalSpy joinedSpy(room, SIGNAL(joined()));
+
+    // the occupants already in the room, then our own presence
+    emit client.presenceReceived(occupantPresence("coven@chat.shakespeare.lit/secondwitch"));
+    emit client.presenceReceived(occupantPresence("coven@chat.shakespeare.lit/firstwitch"));
+    emit client.presenceReceived(occupantPresence("coven@chat.shakespeare.lit/hag"));
+    emit client.presenceReceived(occupantPresence("coven@chat.shakespeare.lit/firstwitch"));
+    emit client.presenceReceived(occupantPresence("coven@chat.shakespeare.lit/hag", QXmppPresence::Unavailable));
+    QVERIFY(!room->isJoined());
+    emit client.presenceReceived(occupantPresence("coven@chat.shakespeare.lit/thirdwitch"));
+    QVERIFY(room->isJoined());
+    QCOMPARE(receivedSpy.size(), 1);
+    QCOMPARE(joinedSpy.size(), 1);
+
+    if (batching) {
+        QCOMPARE(addedSpy.size(), 0);
+        QCOMPARE(changedSpy.size(), 0);
+        QCOMPARE(removedSpy.size(), 0);
+        QCOMPARE(listSpy.size(), 1);
+    } else {
+        QCOMPARE(addedSpy.size(), 4);
+        QCOMPARE(addedSpy.at(0).at(0).toString(), QString("coven@chat.shakespeare.lit/secondwitch"));
+        QCOMPARE(addedSpy.at(3).at(0).toString(), QString("coven@chat.shakespeare.lit/thirdwitch"));
+        QCOMPARE(changedSpy.size(), 1);
+        QCOMPARE(changedSpy.at(0).at(0).toString(), QString("coven@chat.shakespeare.lit/firstwitch"));
+        QCOMPARE(removedSpy.size(), 1);
+        QCOMPARE(listSpy.size(), 5);
+    }
+
+    // participants are sorted
+    QCOMPARE(room->participants(), QStringList()
+        << "coven@chat.shakespeare.lit/firstwitch"
+        << "coven@chat.shakespeare.lit/secondwitch"
+        << "coven@chat.shakespeare.lit/thirdwitch");
+
+    // once joined, changes are reported for each occupant
+    addedSpy.clear();
+    changedSpy.clear();
+    emit client.presenceReceived(occupantPresence("coven@chat.shakespeare.lit/fourthwitch"));
+    emit client.presenceReceived(occupantPresence("coven@chat.shakespeare.lit/firstwitch"));
+    QCOMPARE(addedSpy.size(), 1);
+    QCOMPARE(addedSpy.at(0).at(0).toString(), QString("coven@chat.shakespeare.lit/fourthwitch"));
+    QCOMPARE(changedSpy.size(), 1);
+    QCOMPARE(changedSpy.at(0).at(0).toString(), QString("coven@chat.shakespeare.lit/firstwitch"));
+}
+
+QTEST_MAIN(tst_QXmppMucManager)
+#include "tst_qxmppmucmanager.moc"
@@ -37,6 +37,7 @@ private slots:
     void testPresence_data();
     void testPresenceWithCapability();
     void testPresenceWithExtendedAddresses();
+    void testPresenceWithMucHistory();
     void testPresenceWithMucItem();
     void testPresenceWithMucPassword();
     void testPresenceWithMucSupport();
@@ -191,6 +192,28 @@ void tst_QXmppPresence::testPresenceWithMucItem()
     serializePacket(presence, xml);
 }
 
+void tst_QXmppPresence::testPresenceWithMucHistory()
+{
+    const QByteArray xml(
+        "<presence "
+        "to=\"coven@chat.shakespeare.lit/thirdwitch\" "
+        "from=\"hag66@shakespeare.lit/pda\">"
+            "<x xmlns=\"http://jabber.org/protocol/muc\">"
+                "<history maxstanzas=\"20\" since=\"1970-01-01T00:00:00Z\"/>"
+            "</x>"
+        "</presence>");
+
+    QXmppPresence presence;
+    QCOMPARE(presence.mucHistoryMaxStanzas(), -1);
+    QVERIFY(!presence.mucHistorySince().isValid());
+
+    parsePacket(presence, xml);
+    QCOMPARE(presence.isMucSupported(), true);
+    QCOMPARE(presence.mucHistoryMaxStanzas(), 20);
+    QCOMPARE(presence.mucHistorySince(), QDateTime(QDate(1970, 1, 1), QTime(0, 0, 0), Qt::UTC));
+    serializePacket(presence, xml);
+}
+
 void tst_QXmppPresence::testPresenceWithMucPassword()
 {
     const QByteArray xml(
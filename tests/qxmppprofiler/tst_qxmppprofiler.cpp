@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include "QXmppProfiler_p.h"
+#include "util.h"
+
+class tst_QXmppProfiler : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void cleanup();
+    void testDisabled();
+    void testHistogram();
+    void testSampling();
+};
+
+void tst_QXmppProfiler::cleanup()
+{
+    QXmppProfiler::setEnabled(false);
+    QXmppProfiler::setSamplingInterval(100);
+    QXmppProfiler::reset();
+}
+
+void tst_QXmppProfiler::testDisabled()
+{
+    QVERIFY(!QXmppProfiler::isEnabled());
+
+    QXmppProfilerSample sample;
+    QVERIFY(!sample.isActive());
+    sample.record("test");
+    QVERIFY(QXmppProfiler::snapshot().isEmpty());
+}
+
+void tst_QXmppProfiler::testHistogram()
+{
+    QXmppProfiler::record("test", 0);
+    QXmppProfiler::record("test", 3);
+    QXmppProfiler::record("test", 3);
+    QXmppProfiler::record("test", 100);
+
+    const QVariantMap histogram = QXmppProfiler::snapshot().value("test").toMap();
+    QCOMPARE(histogram.value("count").toLongLong(), qint64(4));
+    QCOMPARE(histogram.value("total").toLongLong(), qint64(106));
+    QCOMPARE(histogram.value("mean").toLongLong(), qint64(26));
+    QCOMPARE(histogram.value("max").toLongLong(), qint64(100));
+    QCOMPARE(histogram.value("p50").toLongLong(), qint64(4));
+    QCOMPARE(histogram.value("p99").toLongLong(), qint64(100));
+    QCOMPARE(histogram.value("buckets").toList(), QVariantList() << 1 << 0 << 2 << 0 << 0 << 0 << 0 << 1);
+}
+
+void tst_QXmppProfiler::testSampling()
+{
+    QXmppProfiler::setEnabled(true);
+    QXmppProfiler::setSamplingInterval(10);
+    QCOMPARE(QXmppProfiler::samplingInterval(), 10);
+
+    int active = 0;
+    for (int i = 0; i < 100; ++i) {
+        QXmppProfilerSample sample;
+        if (sample.isActive())
+            ++active;
+        sample.record("test");
+    }
+    QCOMPARE(active, 10);
+    QCOMPARE(QXmppProfiler::snapshot().value("test").toMap().value("count").toLongLong(), qint64(10));
+}
+
+QTEST_MAIN(tst_QXmppProfiler)
+#include "tst_qxmppprofiler.moc"
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppRateLimiter_p.h"
+#include "util.h"
+
+class tst_QXmppRateLimiter : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testBytes();
+    void testStanzas();
+    void testUnlimited();
+};
+
+void tst_QXmppRateLimiter::testBytes()
+{
+    QXmppRateLimiter limiter(1000, 0);
+    QCOMPARE(limiter.bytesPerSecond(), qint64(1000));
+
+    // the bucket starts full
+    QCOMPARE(limiter.availableBytes(), qint64(1000));
+    QCOMPARE(limiter.delay(), 0);
+
+    // going into debt
+    limiter.consume(2000, 0);
+    QCOMPARE(limiter.availableBytes(), qint64(0));
+    QVERIFY(limiter.delay() > 900);
+    QVERIFY(limiter.delay() <= 1001);
+
+    // the bucket refills over time
+    QTest::qWait(200);
+    QVERIFY(limiter.delay() <= 801);
+}
+
+void tst_QXmppRateLimiter::testStanzas()
+{
+    QXmppRateLimiter limiter(0, 10);
+    QCOMPARE(limiter.stanzasPerSecond(), qint64(10));
+
+    limiter.consume(100000, 9);
+    QCOMPARE(limiter.delay(), 0);
+
+    // one token is needed to resume reading
+    limiter.consume(0, 6);
+    QVERIFY(limiter.delay() > 500);
+    QVERIFY(limiter.delay() <= 600);
+}
+
+void tst_QXmppRateLimiter::testUnlimited()
+{
+    QXmppRateLimiter limiter(0, 0);
+    limiter.consume(1000000, 1000);
+    QCOMPARE(limiter.delay(), 0);
+    QVERIFY(limiter.availableBytes() > 1000000);
+}
+
+QTEST_MAIN(tst_QXmppRateLimiter)
+#include "tst_qxmppratelimiter.moc"
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QSignalSpy>
+#include <QTemporaryDir>
+
+#include "QXmppClient.h"
+#include "QXmppRosterManager.h"
+#include "util.h"
+
+class tst_QXmppRosterManager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testBestResource();
+    void testCache();
+};
+
+static bool handleXml(QXmppRosterManager &manager, const QByteArray &xml)
+{
+    QDomDocument doc;
+    if (!doc.setContent(xml, true))
+        return false;
+    return manager.handleStanza(doc.documentElement());
+}
+
+static QXmppPresence availablePresence(const QString &from, int priority, QXmppPresence::AvailableStatusType status = QXmppPresence::Online)
+{
+    QXmppPresence presence;
+    presence.setFrom(from);
+    presence.setPriority(priority);
+    presence.setAvailableStatusType(status);
+    return presence;
+}
+
+void tst_QXmppRosterManager::testBestResource()
+{
+    QXmppClient client;
+    QXmppRosterManager &manager = client.rosterManager();
+    QSignalSpy changedSpy(&manager, SIGNAL(presenceChanged(QString,QString)));
+    QSignalSpy batchSpy(&manager, SIGNAL(presencesChanged(QStringList)));
+
+    QCOMPARE(manager.getBestResource("romeo@example.net"), QString());
+
+    // highest priority wins
+    emit client.presenceReceived(availablePresence("romeo@example.net/orchard", 5));
+    emit client.presenceReceived(availablePresence("romeo@example.net/garden", 10));
+    emit client.presenceReceived(availablePresence("nurse@example.com/kitchen", 0));
+    QCOMPARE(manager.getBestResource("romeo@example.net"), QString("garden"));
+    QCOMPARE(manager.getBestResource("nurse@example.com"), QString("kitchen"));
+
+    // then availability
+    emit client.presenceReceived(availablePresence("romeo@example.net/orchard", 10, QXmppPresence::Chat));
+    QCOMPARE(manager.getBestResource("romeo@example.net"), QString("orchard"));
+
+    // then the most recent presence
+    emit client.presenceReceived(availablePresence("romeo@example.net/orchard", 10, QXmppPresence::Away));
+    emit client.presenceReceived(availablePresence("romeo@example.net/balcony", 10, QXmppPresence::Online));
+    QCOMPARE(manager.getBestResource("romeo@example.net"), QString("balcony"));
+
+    // unavailable resources are removed
+    QXmppPresence unavailable(QXmppPresence::Unavailable);
+    unavailable.setFrom("romeo@example.net/balcony");
+    emit client.presenceReceived(unavailable);
+    QCOMPARE(manager.getBestResource("romeo@example.net"), QString("garden"));
+    QCOMPARE(manager.getResources("romeo@example.net").size(), 2);
+
+    // changes are reported one by one and in a single batch
+    QCOMPARE(changedSpy.size(), 7);
+    QCOMPARE(batchSpy.size(), 0);
+    QTRY_COMPARE(batchSpy.size(), 1);
+    QCOMPARE(batchSpy.first().at(0).toStringList(),
+             QStringList() << "romeo@example.net" << "nurse@example.com");
+}
+
+void tst_QXmppRosterManager::testCache()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + "/roster.dat";
+
+    {
+        QXmppClient client;
+        client.configuration().setJid("juliet@example.com/balcony");
+        QXmppRosterManager &manager = client.rosterManager();
+        manager.setCachePath(path);
+        QCOMPARE(manager.getRosterBareJids(), QStringList());
+
+        QVERIFY(handleXml(manager,
+            "<iq xmlns='jabber:client' type='set' id='push1'>"
+              "<query xmlns='jabber:iq:roster' ver='ver1'>"
+                "<item jid='nurse@example.com' name='Nurse' subscription='both'><group>Servants</group></item>"
+              "</query>"
+            "</iq>"));
+        QVERIFY(handleXml(manager,
+            "<iq xmlns='jabber:client' type='set' id='push2'>"
+              "<query xmlns='jabber:iq:roster' ver='ver2'>"
+                "<item jid='romeo@example.net' subscription='to'/>"
+              "</query>"
+            "</iq>"));
+        QCOMPARE(manager.rosterVersion(), QString("ver2"));
+
+        // pushes from other entities are ignored
+        QVERIFY(!handleXml(manager,
+            "<iq xmlns='jabber:client' type='set' id='push3' from='tybalt@example.com'>"
+              "<query xmlns='jabber:iq:roster' ver='ver3'>"
+                "<item jid='tybalt@example.com' subscription='both'/>"
+              "</query>"
+            "</iq>"));
+    }
+
+    // the cached roster is available before connecting
+    QXmppClient client;
+    client.configuration().setJid("juliet@example.com/balcony");
+    QXmppRosterManager &manager = client.rosterManager();
+    manager.setCachePath(path);
+    QCOMPARE(manager.rosterVersion(), QString("ver2"));
+    QCOMPARE(manager.getRosterBareJids(), QStringList() << "nurse@example.com" << "romeo@example.net");
+    QCOMPARE(manager.isRosterReceived(), false);
+
+    const QXmppRosterIq::Item item = manager.getRosterEntry("nurse@example.com");
+    QCOMPARE(item.name(), QString("Nurse"));
+    QCOMPARE(item.groups(), QSet<QString>() << "Servants");
+    QCOMPARE(item.subscriptionType(), QXmppRosterIq::Item::Both);
+    QCOMPARE(manager.getRosterEntry("romeo@example.net").subscriptionType(), QXmppRosterIq::Item::To);
+
+    // the roster received on connection replaces the cached one, the
+    // roster request takes the next stanza id
+    QSignalSpy removedSpy(&manager, SIGNAL(itemRemoved(QString)));
+    const QXmppIq probe;
+    const QString requestId = "qxmpp" + QString::number(probe.id().mid(5).toInt() + 1);
+    QVERIFY(QMetaObject::invokeMethod(&manager, "_q_connected"));
+    QVERIFY(handleXml(manager,
+        "<iq xmlns='jabber:client' type='result' id='" + requestId.toUtf8() + "'>"
+          "<query xmlns='jabber:iq:roster' ver='ver4'>"
+            "<item jid='nurse@example.com' name='Nurse' subscription='both'><group>Servants</group></item>"
+          "</query>"
+        "</iq>"));
+    QCOMPARE(manager.isRosterReceived(), true);
+    QCOMPARE(manager.rosterVersion(), QString("ver4"));
+    QCOMPARE(manager.getRosterBareJids(), QStringList() << "nurse@example.com");
+    QCOMPARE(removedSpy.size(), 1);
+    QCOMPARE(removedSpy.first().at(0).toString(), QString("romeo@example.net"));
+
+    // disabling the cache clears the roster
+    manager.setCachePath(QString());
+    QCOMPARE(manager.getRosterBareJids(), QStringList());
+    QCOMPARE(manager.rosterVersion(), QString());
+}
+
+QTEST_MAIN(tst_QXmppRosterManager)
+#include "tst_qxmpprostermanager.moc"
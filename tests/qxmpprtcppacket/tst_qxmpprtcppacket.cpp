@@ -33,10 +33,13 @@ private slots:
     void testBad();
     void testGoodbye();
     void testGoodbyeWithReason();
+    void testNack();
+    void testPictureLoss();
     void testReceiverReport();
     void testSenderReport();
     void testSenderReportWithReceiverReport();
     void testSourceDescription();
+    void testTransportFeedback();
 };
 
 void tst_QXmppRtcpPacket::testBad()
@@ -91,6 +94,48 @@ void tst_QXmppRtcpPacket::testGoodbyeWithReason()
     QCOMPARE(packet.encode(), data);
 }
 
+void tst_QXmppRtcpPacket::testNack()
+{
+    const QByteArray data = QByteArray::fromHex("81cd00033342561927a6e4c100640005");
+
+    QXmppRtcpPacket packet;
+    QVERIFY(packet.decode(data));
+
+    QCOMPARE(packet.feedbackFormat(), quint8(QXmppRtcpPacket::GenericNack));
+    QCOMPARE(packet.mediaSsrc(), quint32(665248961));
+    QCOMPARE(packet.nackSequences(), QList<quint16>() << 100 << 101 << 103);
+    QCOMPARE(packet.receiverReports().size(), 0);
+    QCOMPARE(packet.ssrc(), quint32(859985433));
+    QCOMPARE(packet.type(), quint8(QXmppRtcpPacket::RtpFeedback));
+
+    QCOMPARE(packet.encode(), data);
+
+    // sequences spanning several entries
+    QXmppRtcpPacket nack;
+    nack.setType(QXmppRtcpPacket::RtpFeedback);
+    nack.setFeedbackFormat(QXmppRtcpPacket::GenericNack);
+    nack.setSsrc(859985433);
+    nack.setMediaSsrc(665248961);
+    nack.setNackSequences(QList<quint16>() << 65535 << 0 << 16 << 17);
+    QCOMPARE(nack.encode(), QByteArray::fromHex("81cd00043342561927a6e4c1ffff000100100001"));
+}
+
+void tst_QXmppRtcpPacket::testPictureLoss()
+{
+    const QByteArray data = QByteArray::fromHex("81ce00023342561927a6e4c1");
+
+    QXmppRtcpPacket packet;
+    QVERIFY(packet.decode(data));
+
+    QCOMPARE(packet.feedbackFormat(), quint8(QXmppRtcpPacket::PictureLossIndication));
+    QCOMPARE(packet.mediaSsrc(), quint32(665248961));
+    QCOMPARE(packet.nackSequences().size(), 0);
+    QCOMPARE(packet.ssrc(), quint32(859985433));
+    QCOMPARE(packet.type(), quint8(QXmppRtcpPacket::PayloadFeedback));
+
+    QCOMPARE(packet.encode(), data);
+}
+
 void tst_QXmppRtcpPacket::testReceiverReport()
 {
     const QByteArray data = QByteArray::fromHex("81c9000741f3bca22886dfa00000000000005eb90000001000000000fffbdae2");
@@ -190,5 +235,31 @@ void tst_QXmppRtcpPacket::testSourceDescription()
     QCOMPARE(packet.encode(), data);
 }
 
+void tst_QXmppRtcpPacket::testTransportFeedback()
+{
+    const QByteArray data = QByteArray::fromHex("8fcd00063342561927a6e4c10064000500000f03d1a0a0010117fec0");
+
+    QXmppRtcpPacket packet;
+    QVERIFY(packet.decode(data));
+
+    QCOMPARE(packet.feedbackFormat(), quint8(QXmppRtcpPacket::TransportFeedback));
+    QCOMPARE(packet.mediaSsrc(), quint32(665248961));
+    QCOMPARE(packet.ssrc(), quint32(859985433));
+    QCOMPARE(packet.type(), quint8(QXmppRtcpPacket::RtpFeedback));
+    QCOMPARE(packet.transportBaseSequence(), quint16(100));
+    QCOMPARE(packet.transportFeedbackCount(), quint8(3));
+    QCOMPARE(packet.transportArrivalTimes(), QList<qint64>() << 1000000 << -1 << 1000250 << 1070000 << 990000);
+
+    QCOMPARE(packet.encode(), data);
+
+    // run length chunk
+    QVERIFY(packet.decode(QByteArray::fromHex("8fcd00063342561927a6e4c100000003000000002003040404000000")));
+    QCOMPARE(packet.transportArrivalTimes(), QList<qint64>() << 1000 << 2000 << 3000);
+
+    // status vector chunk with one-bit symbols
+    QVERIFY(packet.decode(QByteArray::fromHex("8fcd00053342561927a6e4c10000000300000000a8000808")));
+    QCOMPARE(packet.transportArrivalTimes(), QList<qint64>() << 2000 << -1 << 4000);
+}
+
 QTEST_MAIN(tst_QXmppRtcpPacket)
 #include "tst_qxmpprtcppacket.moc"
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <cmath>
+
+#include <QDataStream>
+#include <QObject>
+#include <QtTest>
+
+#include "QXmppJingleIq.h"
+#include "QXmppRtpChannel.h"
+#include "QXmppRtpPacket.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846264338327950288
+#endif
+
+class tst_QXmppRtpAudioChannel : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testOpusRecovery();
+    void testVoiceActivity();
+};
+
+void tst_QXmppRtpAudioChannel::testOpusRecovery()
+{
+#ifdef QXMPP_USE_OPUS
+    QXmppJinglePayloadType opus;
+    opus.setId(96);
+    opus.setChannels(1);
+    opus.setName("opus");
+    opus.setClockrate(8000);
+
+    QXmppRtpAudioChannel sender;
+    sender.setRemotePayloadTypes(QList<QXmppJinglePayloadType>() << opus);
+
+    QList<QByteArray> datagrams;
+    connect(&sender, &QXmppRtpAudioChannel::sendDatagram, [&datagrams](const QByteArray &ba) {
+        datagrams << ba;
+    });
+
+    // ten packets of tone
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    for (int i = 0; i < 1600; ++i)
+        stream << qint16(qRound(8000.0 * sin(2.0 * M_PI * 440 * i / 8000)));
+    sender.write(data);
+    QTest::qWait(500);
+    QVERIFY(datagrams.size() >= 10);
+
+    // drop a single packet
+    QXmppRtpAudioChannel receiver;
+    receiver.setRemotePayloadTypes(QList<QXmppJinglePayloadType>() << opus);
+    for (int i = 0; i < 10; ++i) {
+        if (i != 5)
+            receiver.datagramReceived(datagrams[i]);
+    }
+
+    // the gap is filled from the next packet instead of playing silence
+    const QByteArray received = receiver.read(1600 * 2);
+    QCOMPARE(received.size(), 1600 * 2);
+    QDataStream input(received.mid(5 * 160 * 2, 160 * 2));
+    input.setByteOrder(QDataStream::LittleEndian);
+    qint64 energy = 0;
+    for (int i = 0; i < 160; ++i) {
+        qint16 sample;
+        input >> sample;
+        energy += qAbs(sample);
+    }
+    QVERIFY(energy > 160 * 1000);
+#else
+    QSKIP("QXmpp was built without Opus support");
+#endif
+}
+
+void tst_QXmppRtpAudioChannel::testVoiceActivity()
+{
+    QXmppJinglePayloadType pcmu;
+    pcmu.setId(0);
+    pcmu.setChannels(1);
+    pcmu.setName("PCMU");
+    pcmu.setClockrate(8000);
+
+    QXmppJinglePayloadType cn;
+    cn.setId(13);
+    cn.setChannels(1);
+    cn.setName("CN");
+    cn.setClockrate(8000);
+
+    QXmppRtpAudioChannel channel;
+    channel.setRemotePayloadTypes(QList<QXmppJinglePayloadType>() << pcmu << cn);
+    QVERIFY(!channel.isVoiceActivityDetectionEnabled());
+    channel.setVoiceActivityDetectionEnabled(true);
+    QVERIFY(channel.isVoiceActivityDetectionEnabled());
+    QCOMPARE(channel.suppressedPackets(), qint64(0));
+
+    QList<QByteArray> datagrams;
+    connect(&channel, &QXmppRtpAudioChannel::sendDatagram, [&datagrams](const QByteArray &ba) {
+        datagrams << ba;
+    });
+
+    // half a second of silence, half a second of tone, half a second of silence
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    for (int i = 0; i < 12000; ++i) {
+        const bool speaking = i >= 4000 && i < 8000;
+        stream << qint16(speaking ? qRound(8000.0 * sin(2.0 * M_PI * 440 * i / 8000)) : 0);
+    }
+    channel.write(data);
+    QTest::qWait(2000);
+
+    int audio = 0;
+    int comfortNoise = 0;
+    for (int i = 0; i < datagrams.size(); ++i) {
+        QXmppRtpPacketView packet;
+        QVERIFY(packet.decode(datagrams[i]));
+        if (packet.type() == 13) {
+            QCOMPARE(packet.payloadSize(), 1);
+            QCOMPARE(quint8(packet.payloadData()[0]), quint8(90));
+            QVERIFY(!packet.marker());
+            comfortNoise++;
+        } else {
+            QCOMPARE(packet.type(), quint8(0));
+
+            // the talkspurt starts with the tone, and is marked
+            QCOMPARE(packet.marker(), audio == 0);
+            if (!audio)
+                QCOMPARE(packet.stamp(), quint32(4000));
+            audio++;
+        }
+    }
+
+    // the tone is sent, with a hangover of 200 ms
+    QVERIFY(audio >= 25 && audio <= 36);
+
+    // the silence before and after it is described by comfort noise
+    QVERIFY(comfortNoise >= 2);
+    QVERIFY(channel.suppressedPackets() >= 50 - 11);
+}
+
+QTEST_MAIN(tst_QXmppRtpAudioChannel)
+#include "tst_qxmpprtpaudiochannel.moc"
@@ -31,7 +31,10 @@ class tst_QXmppRtpPacket : public QObject
 
 private slots:
     void testBad();
+    void testEncodeInto();
+    void testExtension();
     void testSimple();
+    void testView();
     void testWithCsrc();
 };
 
@@ -48,6 +51,49 @@ void tst_QXmppRtpPacket::testBad()
     QCOMPARE(packet.decode(QByteArray("\x40\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e", 12)), false);
 }
 
+void tst_QXmppRtpPacket::testEncodeInto()
+{
+    QXmppRtpPacket packet;
+    packet.setMarker(true);
+    packet.setType(96);
+    packet.setSequence(16082);
+    packet.setStamp(144);
+    packet.setSsrc(1606227614);
+    packet.setPayload(QByteArray("\x12\x34\x56", 3));
+    QCOMPARE(packet.headerSize(), 12);
+
+    char buffer[32];
+    QCOMPARE(packet.encode(buffer, 14), -1);
+    QCOMPARE(packet.encodeHeader(buffer, 11), -1);
+    QCOMPARE(packet.encode(buffer, sizeof(buffer)), 15);
+    QCOMPARE(QByteArray(buffer, 15), QByteArray("\x80\xe0\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\x12\x34\x56", 15));
+    QCOMPARE(QByteArray(buffer, 15), packet.encode());
+}
+
+void tst_QXmppRtpPacket::testExtension()
+{
+    QXmppRtpPacket packet;
+    QCOMPARE(packet.hasExtension(), false);
+    packet.setType(96);
+    packet.setSequence(16082);
+    packet.setStamp(144);
+    packet.setSsrc(1606227614);
+    packet.setExtension(0xbede, QByteArray("\x11\x01\x02", 3));
+    packet.setPayload(QByteArray("\x12\x34\x56", 3));
+    QCOMPARE(packet.hasExtension(), true);
+    QCOMPARE(packet.headerSize(), 20);
+
+    // the extension is padded to a multiple of 4 bytes
+    const QByteArray data = packet.encode();
+    QCOMPARE(data, QByteArray("\x90\x60\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\xbe\xde\x00\x01\x11\x01\x02\x00\x12\x34\x56", 23));
+
+    QXmppRtpPacketView view;
+    QCOMPARE(view.decode(data), true);
+    QCOMPARE(view.extensionProfile(), quint16(0xbede));
+    QCOMPARE(view.extension(), QByteArray("\x11\x01\x02\x00", 4));
+    QCOMPARE(view.payload(), QByteArray("\x12\x34\x56", 3));
+}
+
 void tst_QXmppRtpPacket::testSimple()
 {
     QByteArray data("\x80\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\x12\x34\x56", 15);
@@ -63,6 +109,47 @@ void tst_QXmppRtpPacket::testSimple()
     QCOMPARE(packet.encode(), data);
 }
 
+void tst_QXmppRtpPacket::testView()
+{
+    // header extension and padding
+    QByteArray data("\xb1\x80\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\xab\xcd\xef\x01\xbe\xde\x00\x01\x10\xff\x00\x00\x12\x34\x56\x00\x00\x03", 30);
+    QXmppRtpPacketView view;
+    QVERIFY(!view.isValid());
+    QCOMPARE(view.decode(data), true);
+    QVERIFY(view.isValid());
+    QCOMPARE(view.marker(), true);
+    QCOMPARE(view.type(), quint8(0));
+    QCOMPARE(view.sequence(), quint16(16082));
+    QCOMPARE(view.stamp(), quint32(144));
+    QCOMPARE(view.ssrc(), quint32(1606227614));
+    QCOMPARE(view.csrcCount(), 1);
+    QCOMPARE(view.csrc(0), quint32(0xabcdef01));
+    QCOMPARE(view.hasExtension(), true);
+    QCOMPARE(view.extensionProfile(), quint16(0xbede));
+    QCOMPARE(view.extension(), QByteArray("\x10\xff\x00\x00", 4));
+    QCOMPARE(view.payload(), QByteArray("\x12\x34\x56", 3));
+
+    // the payload is not copied
+    QVERIFY(view.payloadData() == data.constData() + 24);
+    QCOMPARE(view.payloadSize(), 3);
+
+    // the packet keeps the extension and skips the padding
+    QXmppRtpPacket packet;
+    QCOMPARE(packet.decode(data), true);
+    QCOMPARE(packet.hasExtension(), true);
+    QCOMPARE(packet.extensionProfile(), quint16(0xbede));
+    QCOMPARE(packet.extension(), QByteArray("\x10\xff\x00\x00", 4));
+    QCOMPARE(packet.payload(), QByteArray("\x12\x34\x56", 3));
+
+    // truncated extension
+    QCOMPARE(view.decode(data.left(22)), false);
+    QVERIFY(!view.isValid());
+
+    // invalid padding
+    data[29] = 8;
+    QCOMPARE(view.decode(data), false);
+}
+
 void tst_QXmppRtpPacket::testWithCsrc()
 {
     QByteArray data("\x82\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\xab\xcd\xef\x01\xde\xad\xbe\xef\x12\x34\x56", 23);
@@ -21,10 +21,52 @@
  *
  */
 
+#include <QDomElement>
+#include <QElapsedTimer>
+
 #include "QXmppClient.h"
+#include "QXmppMessage.h"
 #include "QXmppServer.h"
+#include "QXmppServerExtension.h"
+#include "QXmppUtils.h"
 #include "util.h"
 
+static const QString testDomain("localhost");
+static const QHostAddress testHost(QHostAddress::LocalHost);
+static const quint16 testPort = 12345;
+
+class TestCounterLogger : public QXmppLogger
+{
+public:
+    void updateCounter(const QString &counter, qint64 amount)
+    {
+        counters[counter] += amount;
+    }
+
+    QMap<QString, qint64> counters;
+};
+
+class TestRewriteExtension : public QXmppServerExtension
+{
+public:
+    bool acceptsStanza(const QString &tagName, const QString &type, const QString &from, const QString &to) const
+    {
+        Q_UNUSED(type);
+        Q_UNUSED(from);
+        Q_UNUSED(to);
+        return tagName == QLatin1String("message");
+    }
+
+    bool handleStanza(const QDomElement &stanza)
+    {
+        if (stanza.tagName() == QLatin1String("message")) {
+            QDomElement element(stanza);
+            element.setAttribute("type", "headline");
+        }
+        return false;
+    }
+};
+
 class tst_QXmppServer : public QObject
 {
     Q_OBJECT
@@ -32,8 +74,52 @@ class tst_QXmppServer : public QObject
 private slots:
     void testConnect_data();
     void testConnect();
+    void testRoute_data();
+    void testRoute();
+    void testBroadcast();
+    void testFairness();
+    void testRateLimit();
+
+    void logMessage(QXmppLogger::MessageType type, const QString &text);
+    void messageReceived(const QXmppMessage &message);
+
+private:
+    bool connectClient(QXmppClient *client, const QString &user, const QString &resource = QString("QXmpp"));
+    QMap<QObject*, QStringList> m_logs;
+    QList<QXmppMessage> m_messages;
 };
 
+bool tst_QXmppServer::connectClient(QXmppClient *client, const QString &user, const QString &resource)
+{
+    QEventLoop loop;
+    connect(client, SIGNAL(connected()),
+            &loop, SLOT(quit()));
+    connect(client, SIGNAL(disconnected()),
+            &loop, SLOT(quit()));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser(user);
+    config.setPassword("testpwd");
+    config.setResource(resource);
+    client->connectToServer(config);
+    loop.exec();
+    return client->isConnected();
+}
+
+void tst_QXmppServer::logMessage(QXmppLogger::MessageType type, const QString &text)
+{
+    if (type == QXmppLogger::ReceivedMessage && text.startsWith("<message"))
+        m_logs[sender()] << text;
+}
+
+void tst_QXmppServer::messageReceived(const QXmppMessage &message)
+{
+    m_messages << message;
+}
+
 void tst_QXmppServer::testConnect_data()
 {
     QTest::addColumn<QString>("username");
@@ -57,10 +143,6 @@ void tst_QXmppServer::testConnect()
     QFETCH(QString, mechanism);
     QFETCH(bool, connected);
 
-    const QString testDomain("localhost");
-    const QHostAddress testHost(QHostAddress::LocalHost);
-    const quint16 testPort = 12345;
-
     QXmppLogger logger;
     //logger.setLoggingType(QXmppLogger::StdoutLogging);
 
@@ -96,5 +178,261 @@ void tst_QXmppServer::testConnect()
     QCOMPARE(client.isConnected(), connected);
 }
 
+void tst_QXmppServer::testRoute_data()
+{
+    QTest::addColumn<QString>("from");
+    QTest::addColumn<bool>("rewrite");
+    QTest::addColumn<QString>("expectedFrom");
+    QTest::addColumn<int>("expectedType");
+    QTest::addColumn<qint64>("expectedRaw");
+
+    // stanzas no extension accepts are routed using their data
+    QTest::newRow("raw-stamped") << QString() << false << "sender@localhost/QXmpp" << int(QXmppMessage::Chat) << qint64(1);
+    QTest::newRow("raw-bare") << "sender@localhost" << false << "sender@localhost" << int(QXmppMessage::Chat) << qint64(1);
+
+    // stanzas an extension accepts are routed as the extension left them
+    QTest::newRow("dom-stamped") << QString() << true << "sender@localhost/QXmpp" << int(QXmppMessage::Headline) << qint64(0);
+    QTest::newRow("dom-bare") << "sender@localhost" << true << "sender@localhost" << int(QXmppMessage::Headline) << qint64(0);
+}
+
+void tst_QXmppServer::testRoute()
+{
+    QFETCH(QString, from);
+    QFETCH(bool, rewrite);
+    QFETCH(QString, expectedFrom);
+    QFETCH(int, expectedType);
+    QFETCH(qint64, expectedRaw);
+
+    TestCounterLogger logger;
+
+    // prepare server
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("sender", "testpwd");
+    passwordChecker.addCredentials("receiver", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setLogger(&logger);
+    server.setPasswordChecker(&passwordChecker);
+    if (rewrite)
+        server.addExtension(new TestRewriteExtension);
+    server.listenForClients(testHost, testPort);
+
+    // prepare clients
+    QXmppClient sender;
+    QVERIFY(connectClient(&sender, "sender"));
+
+    QXmppClient receiver;
+    QVERIFY(connectClient(&receiver, "receiver"));
+    connect(&receiver, SIGNAL(messageReceived(QXmppMessage)),
+            this, SLOT(messageReceived(QXmppMessage)));
+    m_messages.clear();
+
+    // send message
+    QXmppMessage message;
+    message.setFrom(from);
+    message.setTo("receiver@localhost/QXmpp");
+    message.setType(QXmppMessage::Chat);
+    message.setBody("Hello & <welcome>");
+    QVERIFY(sender.sendPacket(message));
+
+    QEventLoop loop;
+    connect(&receiver, SIGNAL(messageReceived(QXmppMessage)),
+            &loop, SLOT(quit()));
+    QTimer::singleShot(5000, &loop, SLOT(quit()));
+    loop.exec();
+
+    QCOMPARE(m_messages.size(), 1);
+    QCOMPARE(m_messages[0].from(), expectedFrom);
+    QCOMPARE(m_messages[0].to(), QString("receiver@localhost/QXmpp"));
+    QCOMPARE(int(m_messages[0].type()), expectedType);
+    QCOMPARE(m_messages[0].body(), QString("Hello & <welcome>"));
+    QCOMPARE(logger.counters.value("router.raw"), expectedRaw);
+}
+
+void tst_QXmppServer::testBroadcast()
+{
+    const QString aliceJid = QString("alice@localhost/a&b\"<'>");
+    const QString bobJid = QString("bob@localhost/QXmpp");
+
+    // prepare server
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("alice", "testpwd");
+    passwordChecker.addCredentials("bob", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.listenForClients(testHost, testPort);
+
+    // prepare clients, logging the data they receive
+    QXmppLogger aliceLogger;
+    aliceLogger.setLoggingType(QXmppLogger::SignalLogging);
+    connect(&aliceLogger, SIGNAL(message(QXmppLogger::MessageType,QString)),
+            this, SLOT(logMessage(QXmppLogger::MessageType,QString)));
+    QXmppClient alice;
+    alice.setLogger(&aliceLogger);
+    QVERIFY(connectClient(&alice, "alice", QXmppUtils::jidToResource(aliceJid)));
+    QCOMPARE(alice.configuration().jid(), aliceJid);
+
+    QXmppLogger bobLogger;
+    bobLogger.setLoggingType(QXmppLogger::SignalLogging);
+    connect(&bobLogger, SIGNAL(message(QXmppLogger::MessageType,QString)),
+            this, SLOT(logMessage(QXmppLogger::MessageType,QString)));
+    QXmppClient bob;
+    bob.setLogger(&bobLogger);
+    QVERIFY(connectClient(&bob, "bob"));
+
+    connect(&alice, SIGNAL(messageReceived(QXmppMessage)),
+            this, SLOT(messageReceived(QXmppMessage)));
+    connect(&bob, SIGNAL(messageReceived(QXmppMessage)),
+            this, SLOT(messageReceived(QXmppMessage)));
+    m_logs.clear();
+    m_messages.clear();
+
+    // broadcast message, its recipient is replaced
+    QXmppMessage message;
+    message.setFrom(testDomain);
+    message.setTo("ignored@localhost");
+    message.setBody("Hello & <welcome>");
+
+    QSet<QString> recipients;
+    recipients << aliceJid << bobJid << "carol@localhost/QXmpp" << testDomain;
+    QCOMPARE(server.broadcastPacket(message, recipients), 2);
+
+    // each recipient gets the message addressed to itself
+    QTRY_COMPARE(m_messages.size(), 2);
+    QStringList to;
+    foreach (const QXmppMessage &received, m_messages) {
+        QCOMPARE(received.from(), testDomain);
+        QCOMPARE(received.body(), QString("Hello & <welcome>"));
+        to << received.to();
+    }
+    to.sort();
+    QCOMPARE(to, QStringList() << aliceJid << bobJid);
+
+    // and apart from the recipient, the data is the same
+    QCOMPARE(m_logs.value(&aliceLogger).size(), 1);
+    QCOMPARE(m_logs.value(&bobLogger).size(), 1);
+    const QString aliceData = m_logs.value(&aliceLogger).first();
+    const QString bobData = m_logs.value(&bobLogger).first();
+    QVERIFY(aliceData.contains(" to=\"alice@localhost/a&amp;b&quot;&lt;'&gt;\""));
+    QVERIFY(bobData.contains(" to=\"bob@localhost/QXmpp\""));
+    QCOMPARE(QString(aliceData).remove(QRegExp(" to=\"[^\"]*\"")),
+             QString(bobData).remove(QRegExp(" to=\"[^\"]*\"")));
+}
+
+void tst_QXmppServer::testFairness()
+{
+    const int count = 2000;
+
+    // prepare server
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("alice", "testpwd");
+    passwordChecker.addCredentials("bob", "testpwd");
+    passwordChecker.addCredentials("carol", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.listenForClients(testHost, testPort);
+
+    // prepare clients
+    QXmppClient alice;
+    QVERIFY(connectClient(&alice, "alice"));
+    QXmppClient bob;
+    QVERIFY(connectClient(&bob, "bob"));
+    QXmppClient carol;
+    QVERIFY(connectClient(&carol, "carol"));
+
+    connect(&bob, SIGNAL(messageReceived(QXmppMessage)),
+            this, SLOT(messageReceived(QXmppMessage)));
+    m_messages.clear();
+
+    // alice sends far more data than a stream may process in one go
+    QXmppMessage message;
+    message.setTo("bob@localhost/QXmpp");
+    message.setBody(QString(100, QLatin1Char('x')));
+    for (int i = 0; i < count; ++i)
+        QVERIFY(alice.sendPacket(message));
+
+    // carol's message must not wait for alice's burst to be processed
+    message.setBody("Hello");
+    QVERIFY(carol.sendPacket(message));
+
+    QTRY_COMPARE_WITH_TIMEOUT(m_messages.size(), count + 1, 10000);
+    int carolIndex = -1;
+    for (int i = 0; i < m_messages.size(); ++i) {
+        if (m_messages[i].from() == QLatin1String("carol@localhost/QXmpp")) {
+            QCOMPARE(m_messages[i].body(), QString("Hello"));
+            carolIndex = i;
+        }
+    }
+    QVERIFY(carolIndex >= 0);
+
+    // each turn of alice's stream reads 16 KiB, about a hundred of her
+    // messages, so carol is served long before the burst is drained
+    QVERIFY(carolIndex < count / 2);
+}
+
+void tst_QXmppServer::testRateLimit()
+{
+    const int count = 100;
+    TestCounterLogger logger;
+
+    // prepare server
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("alice", "testpwd");
+    passwordChecker.addCredentials("bob", "testpwd");
+    passwordChecker.addCredentials("carol", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setLogger(&logger);
+    server.setPasswordChecker(&passwordChecker);
+    server.setClientRateLimit(4000, 0);
+    server.listenForClients(testHost, testPort);
+
+    // prepare clients
+    QXmppClient alice;
+    QVERIFY(connectClient(&alice, "alice"));
+    QXmppClient bob;
+    QVERIFY(connectClient(&bob, "bob"));
+    QXmppClient carol;
+    QVERIFY(connectClient(&carol, "carol"));
+
+    connect(&bob, SIGNAL(messageReceived(QXmppMessage)),
+            this, SLOT(messageReceived(QXmppMessage)));
+    m_messages.clear();
+    QCOMPARE(logger.counters.value("incoming-client.throttled"), qint64(0));
+
+    int carolIndex = -1;
+    connect(&bob, &QXmppClient::messageReceived, [&](const QXmppMessage &received) {
+        if (received.from() == QLatin1String("carol@localhost/QXmpp"))
+            carolIndex = m_messages.size() - 1;
+    });
+
+    // alice sends several times her rate limit
+    QElapsedTimer timer;
+    timer.start();
+    QXmppMessage message;
+    message.setTo("bob@localhost/QXmpp");
+    message.setBody(QString(100, QLatin1Char('x')));
+    for (int i = 0; i < count; ++i)
+        QVERIFY(alice.sendPacket(message));
+
+    // carol is served while alice is throttled
+    message.setBody("Hello");
+    QVERIFY(carol.sendPacket(message));
+
+    QTRY_VERIFY(logger.counters.value("incoming-client.throttled") > 0);
+    QTRY_VERIFY(carolIndex >= 0);
+    QVERIFY(carolIndex < count / 2);
+
+    // alice's messages are delayed, not dropped
+    QTRY_COMPARE_WITH_TIMEOUT(m_messages.size(), count + 1, 10000);
+    QVERIFY(timer.elapsed() >= 2000);
+}
+
 QTEST_MAIN(tst_QXmppServer)
 #include "tst_qxmppserver.moc"
@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QSignalSpy>
+#include <QTemporaryDir>
+
+#include "QXmppServerMessageArchive_p.h"
+#include "util.h"
+
+class tst_QXmppServerMessageArchive : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void testPaging();
+    void testFilter();
+    void testInvalidId();
+    void testIndex();
+    void testCreate();
+    void testQueryUnknown();
+
+private:
+    QTemporaryDir m_dir;
+    QList<qlonglong> m_ids;
+};
+
+static QByteArray messageData(int i)
+{
+    return QByteArray("<message xmlns=\"jabber:client\"><body>") + QByteArray::number(i) + "</body></message>";
+}
+
+static QVariantMap runQuery(QXmppMessageArchiveWorker &worker, QVariantMap query, QList<QByteArray> *results)
+{
+    QSignalSpy resultSpy(&worker, SIGNAL(resultReady(QString,QByteArray)));
+    QSignalSpy finishedSpy(&worker, SIGNAL(queryFinished(QVariantMap)));
+
+    query["jid"] = "alice@example.com";
+    query["to"] = "alice@example.com/resource";
+    query["id"] = "q1";
+    worker.query(query);
+
+    results->clear();
+    for (const QList<QVariant> &args : resultSpy)
+        *results << args.at(1).toByteArray();
+    if (finishedSpy.size() != 1)
+        return QVariantMap();
+    return finishedSpy.first().at(0).toMap();
+}
+
+void tst_QXmppServerMessageArchive::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+
+    // 200 messages spanning two monthly segments
+    const qint64 start = QDateTime(QDate(2017, 1, 31), QTime(23, 0), Qt::UTC).toMSecsSinceEpoch();
+    QXmppMessageArchiveWorker worker(m_dir.path());
+    for (int i = 0; i < 200; ++i) {
+        const qlonglong id = qlonglong(start + i * 60000) << 12;
+        const QString with = (i % 2) ? "bob@example.com/a" : "carol@example.com/b";
+        worker.archive("alice@example.com", with, id, messageData(i), true);
+        m_ids << id;
+    }
+    worker.close();
+
+    // each segment's index is saved next to it
+    QCOMPARE(QDir(m_dir.path() + "/alice%40example.com").entryList(QDir::Files),
+             QStringList() << "201701.idx" << "201701.seg" << "201702.idx" << "201702.seg");
+}
+
+void tst_QXmppServerMessageArchive::testPaging()
+{
+    QXmppMessageArchiveWorker worker(m_dir.path());
+    QList<QByteArray> results;
+
+    // first page
+    QVariantMap query;
+    query["max"] = 50;
+    QVariantMap reply = runQuery(worker, query, &results);
+    QCOMPARE(results.size(), 50);
+    QVERIFY(results.first().contains("<body>0</body>"));
+    QVERIFY(results.last().contains("<body>49</body>"));
+    QVERIFY(results.first().contains("<delay xmlns=\"urn:xmpp:delay\" stamp=\"2017-01-31T23:00:00Z\"/>"));
+    QCOMPARE(reply.value("first").toString(), QString::number(m_ids.at(0)));
+    QCOMPARE(reply.value("last").toString(), QString::number(m_ids.at(49)));
+    QCOMPARE(reply.value("count").toInt(), 200);
+    QCOMPARE(reply.value("complete").toBool(), false);
+
+    // next page, across a block boundary
+    query["after"] = reply.value("last");
+    reply = runQuery(worker, query, &results);
+    QCOMPARE(results.size(), 50);
+    QVERIFY(results.first().contains("<body>50</body>"));
+    QCOMPARE(reply.value("last").toString(), QString::number(m_ids.at(99)));
+
+    // last page
+    query.remove("after");
+    query["before"] = QString();
+    query["backward"] = true;
+    reply = runQuery(worker, query, &results);
+    QCOMPARE(results.size(), 50);
+    QVERIFY(results.first().contains("<body>150</body>"));
+    QVERIFY(results.last().contains("<body>199</body>"));
+    QCOMPARE(reply.value("complete").toBool(), false);
+
+    // previous page
+    query["before"] = QString::number(m_ids.at(30));
+    reply = runQuery(worker, query, &results);
+    QCOMPARE(results.size(), 30);
+    QVERIFY(results.first().contains("<body>0</body>"));
+    QCOMPARE(reply.value("complete").toBool(), true);
+}
+
+void tst_QXmppServerMessageArchive::testFilter()
+{
+    QXmppMessageArchiveWorker worker(m_dir.path());
+    QList<QByteArray> results;
+
+    // filter by bare JID and time
+    QVariantMap query;
+    query["max"] = 100;
+    query["with"] = "bob@example.com";
+    query["start"] = m_ids.at(60) >> 12;
+    query["end"] = m_ids.at(70) >> 12;
+    QVariantMap reply = runQuery(worker, query, &results);
+    QCOMPARE(results.size(), 5);
+    QVERIFY(results.first().contains("<body>61</body>"));
+    QVERIFY(results.last().contains("<body>69</body>"));
+    QVERIFY(!reply.contains("count"));
+    QCOMPARE(reply.value("complete").toBool(), true);
+
+    // filter by full JID
+    query.remove("start");
+    query.remove("end");
+    query["with"] = "carol@example.com/b";
+    reply = runQuery(worker, query, &results);
+    QCOMPARE(results.size(), 100);
+    QVERIFY(results.last().contains("<body>198</body>"));
+
+    // unknown user
+    query.remove("with");
+    QSignalSpy finishedSpy(&worker, SIGNAL(queryFinished(QVariantMap)));
+    query["jid"] = "bob@example.com";
+    query["to"] = "bob@example.com/resource";
+    worker.query(query);
+    QCOMPARE(finishedSpy.size(), 1);
+    QCOMPARE(finishedSpy.first().at(0).toMap().value("count").toInt(), 0);
+}
+
+void tst_QXmppServerMessageArchive::testInvalidId()
+{
+    QXmppMessageArchiveWorker worker(m_dir.path());
+    QList<QByteArray> results;
+
+    QVariantMap query;
+    query["max"] = 10;
+    query["after"] = "not-an-id";
+    QVariantMap reply = runQuery(worker, query, &results);
+    QCOMPARE(results.size(), 0);
+    QCOMPARE(reply.value("error").toBool(), true);
+}
+
+void tst_QXmppServerMessageArchive::testIndex()
+{
+    const QString path = m_dir.path() + "/dave%40example.com/";
+    const qint64 start = QDateTime(QDate(2017, 3, 1), QTime(12, 0), Qt::UTC).toMSecsSinceEpoch();
+    QList<QByteArray> results;
+
+    // an index which misses the last records
+    {
+        QXmppMessageArchiveWorker worker(m_dir.path());
+        for (int i = 0; i < 100; ++i)
+            worker.archive("dave@example.com", "bob@example.com/a", qlonglong(start + i * 1000) << 12, messageData(i), true);
+        worker.close();
+        QVERIFY(QFile::copy(path + "201703.idx", path + "201703.old"));
+        for (int i = 100; i < 150; ++i)
+            worker.archive("dave@example.com", "carol@example.com/b", qlonglong(start + i * 1000) << 12, messageData(i), true);
+    }
+    QVERIFY(QFile::remove(path + "201703.idx"));
+    QVERIFY(QFile::rename(path + "201703.old", path + "201703.idx"));
+
+    // the records after the saved index are read from the segment
+    QXmppMessageArchiveWorker worker(m_dir.path());
+    QVariantMap query;
+    query["jid"] = "dave@example.com";
+    query["to"] = "dave@example.com/resource";
+    query["max"] = 10;
+    query["before"] = QString();
+    query["backward"] = true;
+    QSignalSpy resultSpy(&worker, SIGNAL(resultReady(QString,QByteArray)));
+    QSignalSpy finishedSpy(&worker, SIGNAL(queryFinished(QVariantMap)));
+    worker.query(query);
+    QCOMPARE(finishedSpy.size(), 1);
+    QCOMPARE(finishedSpy.first().at(0).toMap().value("count").toInt(), 150);
+    QCOMPARE(resultSpy.size(), 10);
+    QVERIFY(resultSpy.last().at(1).toByteArray().contains("<body>149</body>"));
+
+    // records are found through the peer's blocks
+    query["with"] = "bob@example.com";
+    resultSpy.clear();
+    worker.query(query);
+    QCOMPARE(resultSpy.size(), 10);
+    QVERIFY(resultSpy.first().at(1).toByteArray().contains("<body>90</body>"));
+    QVERIFY(resultSpy.last().at(1).toByteArray().contains("<body>99</body>"));
+
+    query["with"] = "carol@example.com";
+    query.remove("before");
+    query.remove("backward");
+    resultSpy.clear();
+    worker.query(query);
+    QCOMPARE(resultSpy.size(), 10);
+    QVERIFY(resultSpy.first().at(1).toByteArray().contains("<body>100</body>"));
+
+    query["with"] = "eve@example.com";
+    resultSpy.clear();
+    worker.query(query);
+    QCOMPARE(resultSpy.size(), 0);
+}
+
+void tst_QXmppServerMessageArchive::testCreate()
+{
+    const qlonglong id = qlonglong(QDateTime(QDate(2017, 4, 1), QTime(12, 0), Qt::UTC).toMSecsSinceEpoch()) << 12;
+    const QDir dir(m_dir.path() + "/frank%40example.com");
+    QXmppMessageArchiveWorker worker(m_dir.path());
+
+    // no archive is created for an unknown user
+    worker.archive("frank@example.com", "bob@example.com/a", id, messageData(0), false);
+    QVERIFY(!dir.exists());
+
+    worker.archive("frank@example.com", "bob@example.com/a", id, messageData(1), true);
+    QVERIFY(dir.exists());
+
+    // an existing archive is appended to
+    worker.archive("frank@example.com", "bob@example.com/a", id, messageData(2), false);
+
+    QSignalSpy finishedSpy(&worker, SIGNAL(queryFinished(QVariantMap)));
+    QVariantMap query;
+    query["jid"] = "frank@example.com";
+    query["to"] = "frank@example.com/resource";
+    query["max"] = 10;
+    worker.query(query);
+    QCOMPARE(finishedSpy.size(), 1);
+    QCOMPARE(finishedSpy.first().at(0).toMap().value("count").toInt(), 2);
+}
+
+void tst_QXmppServerMessageArchive::testQueryUnknown()
+{
+    const qlonglong id = qlonglong(QDateTime(QDate(2017, 4, 1), QTime(12, 0), Qt::UTC).toMSecsSinceEpoch()) << 12;
+    const QDir dir(m_dir.path() + "/grace%40example.com");
+    QXmppMessageArchiveWorker worker(m_dir.path());
+
+    // querying a user without an archive returns an empty result
+    QSignalSpy resultSpy(&worker, SIGNAL(resultReady(QString,QByteArray)));
+    QSignalSpy finishedSpy(&worker, SIGNAL(queryFinished(QVariantMap)));
+    QVariantMap query;
+    query["jid"] = "grace@example.com";
+    query["to"] = "grace@example.com/resource";
+    query["max"] = 10;
+    worker.query(query);
+    QCOMPARE(resultSpy.size(), 0);
+    QCOMPARE(finishedSpy.size(), 1);
+    const QVariantMap reply = finishedSpy.first().at(0).toMap();
+    QCOMPARE(reply.value("count").toInt(), 0);
+    QCOMPARE(reply.value("complete").toBool(), true);
+    QVERIFY(!reply.contains("first"));
+
+    // the query did not leave an archive behind to append to
+    worker.archive("grace@example.com", "bob@example.com/a", id, messageData(0), false);
+    QVERIFY(!dir.exists());
+}
+
+QTEST_MAIN(tst_QXmppServerMessageArchive)
+#include "tst_qxmppservermessagearchive.moc"
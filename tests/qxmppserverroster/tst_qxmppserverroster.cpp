@@ -0,0 +1,437 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDomElement>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+
+#include "QXmppClient.h"
+#include "QXmppPresence.h"
+#include "QXmppRosterManager.h"
+#include "QXmppServer.h"
+#include "QXmppServerRoster.h"
+#include "QXmppUtils.h"
+#include "util.h"
+
+static const QString testDomain("localhost");
+static const QHostAddress testHost(QHostAddress::LocalHost);
+static const quint16 testPort = 12345;
+
+class tst_QXmppServerRoster : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testIndex();
+    void testStorage();
+    void testTruncatedStorage();
+    void testRosterGet();
+    void testRosterSet();
+    void testRosterRemove();
+    void testSubscription();
+
+private:
+    bool connectClient(QXmppClient *client, const QString &user, const QString &resource = QString("QXmpp"));
+    void startServer(QXmppServer *server, QXmppServerRoster *roster);
+
+    TestPasswordChecker m_passwordChecker;
+};
+
+bool tst_QXmppServerRoster::connectClient(QXmppClient *client, const QString &user, const QString &resource)
+{
+    QEventLoop loop;
+    connect(client, SIGNAL(connected()),
+            &loop, SLOT(quit()));
+    connect(client, SIGNAL(disconnected()),
+            &loop, SLOT(quit()));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser(user);
+    config.setPassword("testpwd");
+    config.setResource(resource);
+    client->connectToServer(config);
+    loop.exec();
+    return client->isConnected();
+}
+
+void tst_QXmppServerRoster::startServer(QXmppServer *server, QXmppServerRoster *roster)
+{
+    m_passwordChecker.addCredentials("alice", "testpwd");
+    m_passwordChecker.addCredentials("bob", "testpwd");
+
+    server->setDomain(testDomain);
+    server->setPasswordChecker(&m_passwordChecker);
+    server->addExtension(roster);
+    QVERIFY(server->listenForClients(testHost, testPort));
+}
+
+static QXmppRosterIq::Item rosterItem(const QString &jid, QXmppRosterIq::Item::SubscriptionType type)
+{
+    QXmppRosterIq::Item item;
+    item.setBareJid(jid);
+    item.setName(QXmppUtils::jidToUser(jid));
+    item.setSubscriptionType(type);
+    return item;
+}
+
+void tst_QXmppServerRoster::testIndex()
+{
+    QXmppServerRoster roster;
+    QVERIFY(roster.start());
+
+    roster.setItem("alice@example.com", rosterItem("bob@example.com", QXmppRosterIq::Item::Both));
+    roster.setItem("alice@example.com", rosterItem("carol@example.com", QXmppRosterIq::Item::From));
+    roster.setItem("alice@example.com", rosterItem("dave@example.com", QXmppRosterIq::Item::To));
+    roster.setItem("alice@example.com", rosterItem("eve@example.com", QXmppRosterIq::Item::None));
+
+    QCOMPARE(roster.items("alice@example.com/resource").size(), 4);
+    QCOMPARE(roster.presenceSubscribers("alice@example.com/resource"),
+             QSet<QString>() << "bob@example.com" << "carol@example.com");
+    QCOMPARE(roster.presenceSubscriptions("alice@example.com"),
+             QSet<QString>() << "bob@example.com" << "dave@example.com");
+
+    // downgrade a subscription
+    roster.setItem("alice@example.com", rosterItem("bob@example.com", QXmppRosterIq::Item::To));
+    QCOMPARE(roster.presenceSubscribers("alice@example.com"),
+             QSet<QString>() << "carol@example.com");
+    QCOMPARE(roster.presenceSubscriptions("alice@example.com"),
+             QSet<QString>() << "bob@example.com" << "dave@example.com");
+
+    // remove items
+    roster.removeItem("alice@example.com", "carol@example.com");
+    roster.removeItem("alice@example.com", "dave@example.com");
+    QCOMPARE(roster.items("alice@example.com").size(), 2);
+    QCOMPARE(roster.presenceSubscribers("alice@example.com"), QSet<QString>());
+    QCOMPARE(roster.presenceSubscriptions("alice@example.com"),
+             QSet<QString>() << "bob@example.com");
+
+    // unknown item
+    QXmppRosterIq::Item item = roster.item("alice@example.com", "zoe@example.com");
+    QCOMPARE(item.bareJid(), QString("zoe@example.com"));
+    QCOMPARE(item.subscriptionType(), QXmppRosterIq::Item::None);
+}
+
+void tst_QXmppServerRoster::testStorage()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + "/roster.dat";
+
+    QString version;
+    {
+        QXmppServerRoster roster;
+        roster.setStoragePath(path);
+        QVERIFY(roster.start());
+
+        QXmppRosterIq::Item item = rosterItem("bob@example.com", QXmppRosterIq::Item::Both);
+        item.setGroups(QSet<QString>() << "Friends" << "Work");
+        roster.setItem("alice@example.com", item);
+        roster.setItem("alice@example.com", rosterItem("carol@example.com", QXmppRosterIq::Item::From));
+        roster.setItem("bob@example.com", rosterItem("alice@example.com", QXmppRosterIq::Item::Both));
+        roster.removeItem("alice@example.com", "carol@example.com");
+        version = roster.version("alice@example.com");
+        roster.stop();
+    }
+
+    // reload from log
+    {
+        QXmppServerRoster roster;
+        roster.setStoragePath(path);
+        QVERIFY(roster.start());
+
+        QCOMPARE(roster.version("alice@example.com"), version);
+        QCOMPARE(roster.items("alice@example.com").size(), 1);
+        QXmppRosterIq::Item item = roster.item("alice@example.com", "bob@example.com");
+        QCOMPARE(item.name(), QString("bob"));
+        QCOMPARE(item.groups(), QSet<QString>() << "Friends" << "Work");
+        QCOMPARE(item.subscriptionType(), QXmppRosterIq::Item::Both);
+        QCOMPARE(roster.presenceSubscribers("bob@example.com"),
+                 QSet<QString>() << "alice@example.com");
+
+        // compact, then make sure version and items survive
+        QVERIFY(roster.compact());
+        roster.setItem("alice@example.com", rosterItem("dave@example.com", QXmppRosterIq::Item::To));
+        version = roster.version("alice@example.com");
+        roster.stop();
+    }
+
+    {
+        QXmppServerRoster roster;
+        roster.setStoragePath(path);
+        QVERIFY(roster.start());
+
+        QCOMPARE(roster.version("alice@example.com"), version);
+        QCOMPARE(roster.items("alice@example.com").size(), 2);
+        QCOMPARE(roster.presenceSubscriptions("alice@example.com"),
+                 QSet<QString>() << "bob@example.com" << "dave@example.com");
+        roster.stop();
+    }
+}
+
+void tst_QXmppServerRoster::testTruncatedStorage()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + "/roster.dat";
+
+    {
+        QXmppServerRoster roster;
+        roster.setStoragePath(path);
+        QVERIFY(roster.start());
+        roster.setItem("alice@example.com", rosterItem("bob@example.com", QXmppRosterIq::Item::Both));
+        roster.setItem("alice@example.com", rosterItem("carol@example.com", QXmppRosterIq::Item::Both));
+        roster.stop();
+    }
+
+    // simulate a partial write
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    QVERIFY(file.resize(file.size() - 3));
+    file.close();
+
+    QXmppServerRoster roster;
+    roster.setStoragePath(path);
+    QVERIFY(roster.start());
+    QCOMPARE(roster.items("alice@example.com").size(), 1);
+
+    // new records are appended after the last valid one
+    roster.setItem("alice@example.com", rosterItem("dave@example.com", QXmppRosterIq::Item::Both));
+    roster.stop();
+
+    QVERIFY(roster.start());
+    QCOMPARE(roster.items("alice@example.com").size(), 2);
+    roster.stop();
+}
+
+void tst_QXmppServerRoster::testRosterGet()
+{
+    QXmppServer server;
+    QXmppServerRoster *roster = new QXmppServerRoster;
+    startServer(&server, roster);
+    roster->setItem("alice@localhost", rosterItem("bob@localhost", QXmppRosterIq::Item::Both));
+    roster->setItem("alice@localhost", rosterItem("carol@localhost", QXmppRosterIq::Item::To));
+
+    QXmppClient alice;
+    QVERIFY(connectClient(&alice, "alice"));
+
+    // without versioning, the whole roster is returned
+    QXmppRosterIq request;
+    QFuture<QDomElement> future = alice.sendIq(request);
+    QTRY_VERIFY(future.isFinished());
+    QXmppRosterIq response;
+    response.parse(future.result());
+    QCOMPARE(response.type(), QXmppIq::Result);
+    QVERIFY(response.version().isNull());
+    QCOMPARE(response.items().size(), 2);
+
+    // with an outdated version, the whole roster and its version
+    const QString ver = roster->version("alice@localhost");
+    request = QXmppRosterIq();
+    request.setVersion("");
+    future = alice.sendIq(request);
+    QTRY_VERIFY(future.isFinished());
+    response = QXmppRosterIq();
+    response.parse(future.result());
+    QCOMPARE(response.type(), QXmppIq::Result);
+    QCOMPARE(response.version(), ver);
+    QCOMPARE(response.items().size(), 2);
+
+    // with the current version, an empty result
+    request = QXmppRosterIq();
+    request.setVersion(ver);
+    future = alice.sendIq(request);
+    QTRY_VERIFY(future.isFinished());
+    QCOMPARE(future.result().attribute("type"), QString("result"));
+    QVERIFY(future.result().firstChildElement("query").isNull());
+}
+
+void tst_QXmppServerRoster::testRosterSet()
+{
+    QXmppServer server;
+    QXmppServerRoster *roster = new QXmppServerRoster;
+    startServer(&server, roster);
+    roster->setItem("alice@localhost", rosterItem("bob@localhost", QXmppRosterIq::Item::Both));
+
+    QXmppClient alice;
+    QVERIFY(connectClient(&alice, "alice", "a"));
+    QXmppClient alice2;
+    QVERIFY(connectClient(&alice2, "alice", "b"));
+    QXmppRosterManager *manager = alice2.findExtension<QXmppRosterManager>();
+    QTRY_VERIFY(manager->isRosterReceived());
+    QSignalSpy addedSpy(manager, SIGNAL(itemAdded(QString)));
+    QSignalSpy changedSpy(manager, SIGNAL(itemChanged(QString)));
+
+    // add an item, the other resource gets a push
+    const QString ver = roster->version("alice@localhost");
+    QXmppRosterIq::Item item;
+    item.setBareJid("carol@localhost/ignored");
+    item.setName("Carol");
+    item.setGroups(QSet<QString>() << "Friends");
+    QXmppRosterIq request;
+    request.setType(QXmppIq::Set);
+    request.addItem(item);
+    QFuture<QDomElement> future = alice.sendIq(request);
+    QTRY_VERIFY(future.isFinished());
+    QCOMPARE(future.result().attribute("type"), QString("result"));
+
+    QXmppRosterIq::Item stored = roster->item("alice@localhost", "carol@localhost");
+    QCOMPARE(stored.name(), QString("Carol"));
+    QCOMPARE(stored.groups(), QSet<QString>() << "Friends");
+    QCOMPARE(stored.subscriptionType(), QXmppRosterIq::Item::None);
+    QVERIFY(roster->version("alice@localhost") != ver);
+    QTRY_COMPARE(addedSpy.count(), 1);
+    QCOMPARE(addedSpy.first().at(0).toString(), QString("carol@localhost"));
+
+    // clients may not change the subscription
+    item.setBareJid("bob@localhost");
+    item.setName("Bob");
+    item.setSubscriptionType(QXmppRosterIq::Item::None);
+    request = QXmppRosterIq();
+    request.setType(QXmppIq::Set);
+    request.addItem(item);
+    future = alice.sendIq(request);
+    QTRY_VERIFY(future.isFinished());
+    QCOMPARE(future.result().attribute("type"), QString("result"));
+    stored = roster->item("alice@localhost", "bob@localhost");
+    QCOMPARE(stored.name(), QString("Bob"));
+    QCOMPARE(stored.subscriptionType(), QXmppRosterIq::Item::Both);
+    QTRY_COMPARE(changedSpy.count(), 1);
+    QCOMPARE(manager->getRosterEntry("bob@localhost").name(), QString("Bob"));
+
+    // a set must contain exactly one item
+    request.addItem(rosterItem("dave@localhost", QXmppRosterIq::Item::None));
+    future = alice.sendIq(request);
+    QTRY_VERIFY(future.isFinished());
+    QXmppIq response;
+    response.parse(future.result());
+    QCOMPARE(response.type(), QXmppIq::Error);
+    QCOMPARE(response.error().condition(), QXmppStanza::Error::BadRequest);
+    QCOMPARE(roster->items("alice@localhost").size(), 2);
+}
+
+void tst_QXmppServerRoster::testRosterRemove()
+{
+    QXmppServer server;
+    QXmppServerRoster *roster = new QXmppServerRoster;
+    startServer(&server, roster);
+    roster->setItem("alice@localhost", rosterItem("bob@localhost", QXmppRosterIq::Item::Both));
+    roster->setItem("bob@localhost", rosterItem("alice@localhost", QXmppRosterIq::Item::Both));
+
+    QXmppClient alice;
+    QVERIFY(connectClient(&alice, "alice", "a"));
+    QXmppClient alice2;
+    QVERIFY(connectClient(&alice2, "alice", "b"));
+    QXmppRosterManager *manager = alice2.findExtension<QXmppRosterManager>();
+    QTRY_VERIFY(manager->isRosterReceived());
+    QSignalSpy removedSpy(manager, SIGNAL(itemRemoved(QString)));
+
+    QXmppRosterIq::Item item;
+    item.setBareJid("bob@localhost");
+    item.setSubscriptionType(QXmppRosterIq::Item::Remove);
+    QXmppRosterIq request;
+    request.setType(QXmppIq::Set);
+    request.addItem(item);
+    QFuture<QDomElement> future = alice.sendIq(request);
+    QTRY_VERIFY(future.isFinished());
+    QCOMPARE(future.result().attribute("type"), QString("result"));
+
+    // the item is removed and the other resource gets a push
+    QVERIFY(roster->items("alice@localhost").isEmpty());
+    QCOMPARE(roster->presenceSubscribers("alice@localhost"), QSet<QString>());
+    QCOMPARE(roster->presenceSubscriptions("alice@localhost"), QSet<QString>());
+    QTRY_COMPARE(removedSpy.count(), 1);
+    QCOMPARE(removedSpy.first().at(0).toString(), QString("bob@localhost"));
+
+    // the subscriptions are cancelled in both directions
+    QCOMPARE(roster->item("bob@localhost", "alice@localhost").subscriptionType(), QXmppRosterIq::Item::None);
+    QCOMPARE(roster->presenceSubscribers("bob@localhost"), QSet<QString>());
+    QCOMPARE(roster->presenceSubscriptions("bob@localhost"), QSet<QString>());
+}
+
+void tst_QXmppServerRoster::testSubscription()
+{
+    QXmppServer server;
+    QXmppServerRoster *roster = new QXmppServerRoster;
+    startServer(&server, roster);
+
+    QXmppClient alice;
+    QVERIFY(connectClient(&alice, "alice"));
+    QXmppClient bob;
+    QVERIFY(connectClient(&bob, "bob"));
+
+    // alice asks bob for a subscription: pending out for alice, the
+    // pending in request is not stored in bob's roster
+    QXmppPresence presence(QXmppPresence::Subscribe);
+    presence.setTo("bob@localhost");
+    QVERIFY(alice.sendPacket(presence));
+    QTRY_COMPARE(roster->item("alice@localhost", "bob@localhost").subscriptionStatus(), QString("subscribe"));
+    QCOMPARE(roster->item("alice@localhost", "bob@localhost").subscriptionType(), QXmppRosterIq::Item::None);
+    QVERIFY(roster->items("bob@localhost").isEmpty());
+
+    // bob approves: from for bob, to for alice
+    presence = QXmppPresence(QXmppPresence::Subscribed);
+    presence.setTo("alice@localhost");
+    QVERIFY(bob.sendPacket(presence));
+    QTRY_COMPARE(roster->item("alice@localhost", "bob@localhost").subscriptionType(), QXmppRosterIq::Item::To);
+    QCOMPARE(roster->item("alice@localhost", "bob@localhost").subscriptionStatus(), QString());
+    QCOMPARE(roster->item("bob@localhost", "alice@localhost").subscriptionType(), QXmppRosterIq::Item::From);
+    QCOMPARE(roster->presenceSubscriptions("alice@localhost"), QSet<QString>() << "bob@localhost");
+    QCOMPARE(roster->presenceSubscribers("bob@localhost"), QSet<QString>() << "alice@localhost");
+
+    // bob asks alice in return and she approves: both
+    presence = QXmppPresence(QXmppPresence::Subscribe);
+    presence.setTo("alice@localhost");
+    QVERIFY(bob.sendPacket(presence));
+    QTRY_COMPARE(roster->item("bob@localhost", "alice@localhost").subscriptionStatus(), QString("subscribe"));
+    QCOMPARE(roster->item("bob@localhost", "alice@localhost").subscriptionType(), QXmppRosterIq::Item::From);
+
+    presence = QXmppPresence(QXmppPresence::Subscribed);
+    presence.setTo("bob@localhost");
+    QVERIFY(alice.sendPacket(presence));
+    QTRY_COMPARE(roster->item("bob@localhost", "alice@localhost").subscriptionType(), QXmppRosterIq::Item::Both);
+    QCOMPARE(roster->item("bob@localhost", "alice@localhost").subscriptionStatus(), QString());
+    QCOMPARE(roster->item("alice@localhost", "bob@localhost").subscriptionType(), QXmppRosterIq::Item::Both);
+
+    // alice unsubscribes from bob: from for alice, to for bob
+    presence = QXmppPresence(QXmppPresence::Unsubscribe);
+    presence.setTo("bob@localhost");
+    QVERIFY(alice.sendPacket(presence));
+    QTRY_COMPARE(roster->item("alice@localhost", "bob@localhost").subscriptionType(), QXmppRosterIq::Item::From);
+    QCOMPARE(roster->item("bob@localhost", "alice@localhost").subscriptionType(), QXmppRosterIq::Item::To);
+    QCOMPARE(roster->presenceSubscribers("bob@localhost"), QSet<QString>());
+
+    // alice cancels bob's subscription: none on both sides
+    presence = QXmppPresence(QXmppPresence::Unsubscribed);
+    presence.setTo("bob@localhost");
+    QVERIFY(alice.sendPacket(presence));
+    QTRY_COMPARE(roster->item("alice@localhost", "bob@localhost").subscriptionType(), QXmppRosterIq::Item::None);
+    QCOMPARE(roster->item("bob@localhost", "alice@localhost").subscriptionType(), QXmppRosterIq::Item::None);
+    QCOMPARE(roster->presenceSubscribers("alice@localhost"), QSet<QString>());
+    QCOMPARE(roster->presenceSubscriptions("bob@localhost"), QSet<QString>());
+}
+
+QTEST_MAIN(tst_QXmppServerRoster)
+#include "tst_qxmppserverroster.moc"
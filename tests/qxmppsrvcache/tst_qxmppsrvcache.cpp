@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2008-2014 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppSrvCache_p.h"
+#include "util.h"
+
+// stands in for QDnsServiceRecord, which can only be filled by QDnsLookup
+class TestSrvRecord
+{
+public:
+    TestSrvRecord(const QString &target = QString(), quint16 priority = 0, quint16 weight = 0)
+        : m_target(target), m_priority(priority), m_weight(weight)
+    {
+    }
+
+    QString target() const { return m_target; }
+    quint16 priority() const { return m_priority; }
+    quint16 weight() const { return m_weight; }
+
+private:
+    QString m_target;
+    quint16 m_priority;
+    quint16 m_weight;
+};
+
+static QStringList targets(const QList<TestSrvRecord> &records)
+{
+    QStringList targets;
+    foreach (const TestSrvRecord &record, records)
+        targets << record.target();
+    return targets;
+}
+
+class tst_QXmppSrvCache : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testOrderPriority();
+    void testOrderWeight();
+    void testOrderZeroWeight();
+    void testLookup();
+    void testLookupNegative();
+    void testExpiry();
+};
+
+void tst_QXmppSrvCache::testOrderPriority()
+{
+    QList<TestSrvRecord> records;
+    records << TestSrvRecord("c", 30, 10);
+    records << TestSrvRecord("a", 10, 10);
+    records << TestSrvRecord("b", 20, 10);
+
+    // lower priorities always come first
+    for (int i = 0; i < 10; ++i)
+        QCOMPARE(targets(QXmppSrvCache::order(records)), QStringList() << "a" << "b" << "c");
+}
+
+void tst_QXmppSrvCache::testOrderWeight()
+{
+    QList<TestSrvRecord> records;
+    records << TestSrvRecord("a", 10, 10);
+    records << TestSrvRecord("b", 10, 30);
+    records << TestSrvRecord("c", 10, 60);
+    records << TestSrvRecord("d", 20, 0);
+
+    // within a priority, records are picked in proportion to their weight
+    qsrand(1);
+    QMap<QString, int> first;
+    for (int i = 0; i < 10000; ++i) {
+        const QStringList ordered = targets(QXmppSrvCache::order(records));
+        QCOMPARE(ordered.size(), 4);
+        QCOMPARE(QStringList(ordered.mid(0, 3)).toSet(), QSet<QString>() << "a" << "b" << "c");
+        QCOMPARE(ordered.last(), QString("d"));
+        first[ordered.first()]++;
+    }
+    QVERIFY(first.value("a") > 700 && first.value("a") < 1300);
+    QVERIFY(first.value("b") > 2700 && first.value("b") < 3300);
+    QVERIFY(first.value("c") > 5700 && first.value("c") < 6300);
+}
+
+void tst_QXmppSrvCache::testOrderZeroWeight()
+{
+    QList<TestSrvRecord> records;
+    records << TestSrvRecord("a", 10, 100);
+    records << TestSrvRecord("b", 10, 0);
+
+    // a record without weight is seldom, but not never, picked first
+    qsrand(1);
+    int zeroFirst = 0;
+    for (int i = 0; i < 10000; ++i) {
+        const QStringList ordered = targets(QXmppSrvCache::order(records));
+        QCOMPARE(ordered.size(), 2);
+        if (ordered.first() == QLatin1String("b"))
+            zeroFirst++;
+    }
+    QVERIFY(zeroFirst > 0);
+    QVERIFY(zeroFirst < 500);
+
+    // when no record has a weight, their order is kept
+    records.clear();
+    records << TestSrvRecord("a", 10, 0);
+    records << TestSrvRecord("b", 10, 0);
+    QCOMPARE(targets(QXmppSrvCache::order(records)), QStringList() << "a" << "b");
+}
+
+void tst_QXmppSrvCache::testLookup()
+{
+    const QString name("_xmpp-client._tcp.lookup.example.com");
+    QList<QDnsServiceRecord> records;
+    QVERIFY(!QXmppSrvCache::lookup(name, records));
+
+    QXmppSrvCache::store(name, QList<QDnsServiceRecord>() << QDnsServiceRecord() << QDnsServiceRecord(), 60);
+    QVERIFY(QXmppSrvCache::lookup(name, records));
+    QCOMPARE(records.size(), 2);
+
+    // other names are not affected
+    records.clear();
+    QVERIFY(!QXmppSrvCache::lookup("_xmpp-client._tcp.other.example.com", records));
+    QVERIFY(records.isEmpty());
+}
+
+void tst_QXmppSrvCache::testLookupNegative()
+{
+    const QString name("_xmpp-client._tcp.negative.example.com");
+    QList<QDnsServiceRecord> records;
+    records << QDnsServiceRecord();
+
+    // a name without records is remembered as such
+    QXmppSrvCache::store(name, QList<QDnsServiceRecord>(), 60);
+    QVERIFY(QXmppSrvCache::lookup(name, records));
+    QVERIFY(records.isEmpty());
+}
+
+void tst_QXmppSrvCache::testExpiry()
+{
+    const QString name("_xmpp-client._tcp.expiry.example.com");
+    const QString negativeName("_xmpp-client._tcp.expiry-negative.example.com");
+    QList<QDnsServiceRecord> records;
+
+    // an entry without TTL is never used
+    QXmppSrvCache::store(name, QList<QDnsServiceRecord>() << QDnsServiceRecord(), 0);
+    QVERIFY(!QXmppSrvCache::lookup(name, records));
+
+    // entries expire once their TTL has elapsed
+    QXmppSrvCache::store(name, QList<QDnsServiceRecord>() << QDnsServiceRecord(), 1);
+    QXmppSrvCache::store(negativeName, QList<QDnsServiceRecord>(), 1);
+    QVERIFY(QXmppSrvCache::lookup(name, records));
+    QVERIFY(QXmppSrvCache::lookup(negativeName, records));
+
+    QTest::qWait(1100);
+    QVERIFY(!QXmppSrvCache::lookup(name, records));
+    QVERIFY(!QXmppSrvCache::lookup(negativeName, records));
+
+    // and can be stored again
+    QXmppSrvCache::store(name, QList<QDnsServiceRecord>() << QDnsServiceRecord(), 60);
+    QVERIFY(QXmppSrvCache::lookup(name, records));
+    QCOMPARE(records.size(), 1);
+}
+
+QTEST_MAIN(tst_QXmppSrvCache)
+#include "tst_qxmppsrvcache.moc"
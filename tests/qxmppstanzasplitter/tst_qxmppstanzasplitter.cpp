@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include "QXmppStanzaSplitter_p.h"
+#include "util.h"
+
+static const QByteArray streamStart = "<?xml version='1.0'?><stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' to='example.com' version='1.0'>";
+
+class tst_QXmppStanzaSplitter : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testStream();
+    void testStanza_data();
+    void testStanza();
+    void testInvalid_data();
+    void testInvalid();
+    void testWhitespace();
+    void testClear();
+};
+
+void tst_QXmppStanzaSplitter::testStream()
+{
+    const QByteArray message = "<message to='b@example.com'><body>hi</body></message>";
+    const QByteArray presence = "<presence/>";
+    const QByteArray streamEnd = "</stream:stream>";
+    const QByteArray data = streamStart + message + presence + streamEnd;
+
+    // the tokens are the same however the data is split
+    foreach (int chunkSize, QList<int>() << 1 << 7 << data.size()) {
+        QXmppStanzaSplitter splitter;
+        QList<QXmppStanzaSplitter::TokenType> types;
+        QList<QByteArray> tokens;
+        for (int i = 0; i < data.size(); i += chunkSize) {
+            splitter.append(data.mid(i, chunkSize));
+            QXmppStanzaSplitter::TokenType type;
+            while ((type = splitter.readNext()) != QXmppStanzaSplitter::NoToken) {
+                types << type;
+                tokens << splitter.data();
+            }
+        }
+
+        QCOMPARE(types, QList<QXmppStanzaSplitter::TokenType>()
+            << QXmppStanzaSplitter::StreamStart
+            << QXmppStanzaSplitter::Stanza
+            << QXmppStanzaSplitter::Stanza
+            << QXmppStanzaSplitter::StreamEnd);
+        QCOMPARE(tokens, QList<QByteArray>() << streamStart << message << presence << streamEnd);
+        QCOMPARE(splitter.pendingBytes(), 0);
+    }
+}
+
+void tst_QXmppStanzaSplitter::testStanza_data()
+{
+    QTest::addColumn<QByteArray>("xml");
+    QTest::addColumn<QString>("tagName");
+    QTest::addColumn<QString>("to");
+    QTest::addColumn<bool>("standalone");
+
+    QTest::newRow("empty")
+        << QByteArray("<presence/>")
+        << "presence" << QString() << true;
+    QTest::newRow("attributes")
+        << QByteArray("<message to=\"a&amp;b@example.com/r&#x41;\" type='chat' xml:lang='en'><body>1 &lt; 2</body></message>")
+        << "message" << "a&b@example.com/rA" << true;
+    QTest::newRow("markup in attribute")
+        << QByteArray("<message to='b@example.com'><x a='/>' b=\"'>\"/></message>")
+        << "message" << "b@example.com" << true;
+    QTest::newRow("markup in cdata")
+        << QByteArray("<message to='b@example.com'><body><![CDATA[</message>]]></body></message>")
+        << "message" << "b@example.com" << true;
+    QTest::newRow("markup in comment")
+        << QByteArray("<message to='b@example.com'><!-- </message> --></message>")
+        << "message" << "b@example.com" << true;
+    QTest::newRow("child namespace")
+        << QByteArray("<iq to='b@example.com' type='get'><query xmlns='jabber:iq:version'/></iq>")
+        << "iq" << "b@example.com" << true;
+    QTest::newRow("stanza namespace")
+        << QByteArray("<iq xmlns='jabber:server' to='b@example.com' type='get'/>")
+        << "iq" << "b@example.com" << false;
+    QTest::newRow("stream prefix")
+        << QByteArray("<stream:features><bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'/></stream:features>")
+        << "stream:features" << QString() << false;
+    QTest::newRow("child prefix")
+        << QByteArray("<message to='b@example.com'><stream:error/></message>")
+        << "message" << "b@example.com" << false;
+}
+
+void tst_QXmppStanzaSplitter::testStanza()
+{
+    QFETCH(QByteArray, xml);
+    QFETCH(QString, tagName);
+    QFETCH(QString, to);
+    QFETCH(bool, standalone);
+
+    QXmppStanzaSplitter splitter;
+    splitter.append(streamStart);
+    QCOMPARE(splitter.readNext(), QXmppStanzaSplitter::StreamStart);
+
+    // incomplete stanza
+    splitter.append(xml.left(xml.size() - 1));
+    QCOMPARE(splitter.readNext(), QXmppStanzaSplitter::NoToken);
+    QCOMPARE(splitter.data(), QByteArray());
+
+    // complete stanza
+    splitter.append(xml.right(1));
+    QCOMPARE(splitter.readNext(), QXmppStanzaSplitter::Stanza);
+    QCOMPARE(splitter.data(), xml);
+    QCOMPARE(splitter.tagName(), tagName);
+    QCOMPARE(splitter.attributes().value("to").toString(), to);
+    QCOMPARE(splitter.isStandalone(), standalone);
+    QCOMPARE(splitter.readNext(), QXmppStanzaSplitter::NoToken);
+}
+
+void tst_QXmppStanzaSplitter::testInvalid_data()
+{
+    QTest::addColumn<QByteArray>("xml");
+
+    QTest::newRow("text") << QByteArray("hello");
+    QTest::newRow("doctype") << QByteArray("<message><!DOCTYPE foo></message>");
+    QTest::newRow("cdata") << QByteArray("<![CDATA[foo]]>");
+}
+
+void tst_QXmppStanzaSplitter::testInvalid()
+{
+    QFETCH(QByteArray, xml);
+
+    QXmppStanzaSplitter splitter;
+    splitter.append(streamStart);
+    QCOMPARE(splitter.readNext(), QXmppStanzaSplitter::StreamStart);
+
+    splitter.append(xml);
+    QCOMPARE(splitter.readNext(), QXmppStanzaSplitter::Invalid);
+    QCOMPARE(splitter.readNext(), QXmppStanzaSplitter::Invalid);
+}
+
+void tst_QXmppStanzaSplitter::testWhitespace()
+{
+    QXmppStanzaSplitter splitter;
+
+    // whitespace before the stream is ignored
+    splitter.append(" \n");
+    QCOMPARE(splitter.readNext(), QXmppStanzaSplitter::NoToken);
+    splitter.append(streamStart);
+    QCOMPARE(splitter.readNext(), QXmppStanzaSplitter::StreamStart);
+
+    // whitespace pings
+    splitter.append(" ");
+    QCOMPARE(splitter.readNext(), QXmppStanzaSplitter::Whitespace);
+    QCOMPARE(splitter.data(), QByteArray(" "));
+    QCOMPARE(splitter.readNext(), QXmppStanzaSplitter::NoToken);
+
+    // whitespace before a stanza
+    splitter.append("\n<presence/>");
+    QCOMPARE(splitter.readNext(), QXmppStanzaSplitter::Stanza);
+    QCOMPARE(splitter.data(), QByteArray("<presence/>"));
+    QCOMPARE(splitter.readNext(), QXmppStanzaSplitter::NoToken);
+}
+
+void tst_QXmppStanzaSplitter::testClear()
+{
+    QXmppStanzaSplitter splitter;
+    splitter.append(streamStart);
+    QCOMPARE(splitter.readNext(), QXmppStanzaSplitter::StreamStart);
+    splitter.append("<message><body>");
+    QCOMPARE(splitter.readNext(), QXmppStanzaSplitter::NoToken);
+    QCOMPARE(splitter.pendingBytes(), 15);
+
+    // after a stream restart, a new stream start is expected
+    splitter.clear();
+    QCOMPARE(splitter.pendingBytes(), 0);
+    splitter.append(streamStart);
+    QCOMPARE(splitter.readNext(), QXmppStanzaSplitter::StreamStart);
+    QCOMPARE(splitter.data(), streamStart);
+}
+
+QTEST_MAIN(tst_QXmppStanzaSplitter)
+#include "tst_qxmppstanzasplitter.moc"
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QElapsedTimer>
+#include <QSignalSpy>
+
+#include "QXmppTimerWheel_p.h"
+#include "util.h"
+
+class tst_QXmppTimerWheel : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testSingleShot();
+    void testRepeat();
+    void testStop();
+    void testMany();
+};
+
+void tst_QXmppTimerWheel::testSingleShot()
+{
+    QXmppCoarseTimer timer;
+    timer.setSingleShot(true);
+    QSignalSpy spy(&timer, SIGNAL(timeout()));
+
+    QElapsedTimer clock;
+    clock.start();
+    timer.start(250);
+    QVERIFY(timer.isActive());
+    QCOMPARE(QXmppTimerWheel::instance()->count(), 1);
+
+    QVERIFY(spy.wait(1000));
+    QVERIFY(clock.elapsed() >= 250);
+    QVERIFY(!timer.isActive());
+    QCOMPARE(QXmppTimerWheel::instance()->count(), 0);
+
+    QTest::qWait(300);
+    QCOMPARE(spy.size(), 1);
+}
+
+void tst_QXmppTimerWheel::testRepeat()
+{
+    QXmppCoarseTimer timer;
+    QSignalSpy spy(&timer, SIGNAL(timeout()));
+
+    timer.start(100);
+    QTRY_VERIFY(spy.size() >= 3);
+    QVERIFY(timer.isActive());
+
+    timer.stop();
+    QVERIFY(!timer.isActive());
+}
+
+void tst_QXmppTimerWheel::testStop()
+{
+    QXmppCoarseTimer *timer = new QXmppCoarseTimer;
+    timer->setSingleShot(true);
+    QSignalSpy spy(timer, SIGNAL(timeout()));
+
+    // restarting postpones the timeout
+    timer->start(300);
+    QTest::qWait(200);
+    timer->start();
+    QTest::qWait(200);
+    QCOMPARE(spy.size(), 0);
+
+    timer->stop();
+    QTest::qWait(300);
+    QCOMPARE(spy.size(), 0);
+
+    // deleting an active timer unschedules it
+    timer->start(100);
+    delete timer;
+    QCOMPARE(QXmppTimerWheel::instance()->count(), 0);
+    QTest::qWait(200);
+}
+
+void tst_QXmppTimerWheel::testMany()
+{
+    // intervals spanning several levels of the wheel
+    const int resolution = QXmppTimerWheel::instance()->resolution();
+    const int maxInterval = 70 * resolution;
+
+    QList<QXmppCoarseTimer*> timers;
+    QList<int> fired;
+    QElapsedTimer clock;
+    clock.start();
+    for (int i = 0; i < 500; ++i) {
+        QXmppCoarseTimer *timer = new QXmppCoarseTimer(this);
+        timer->setSingleShot(true);
+        const int interval = (i * 7919) % maxInterval;
+        connect(timer, &QXmppCoarseTimer::timeout, [&fired, &clock, interval]() {
+            QVERIFY(clock.elapsed() >= interval);
+            fired << interval;
+        });
+        timer->start(interval);
+        timers << timer;
+    }
+    QCOMPARE(QXmppTimerWheel::instance()->count(), 500);
+
+    QTRY_COMPARE_WITH_TIMEOUT(fired.size(), 500, maxInterval + 1000);
+    QCOMPARE(QXmppTimerWheel::instance()->count(), 0);
+
+    // timers fire in order, within one tick
+    for (int i = 1; i < fired.size(); ++i)
+        QVERIFY(fired.at(i) >= fired.at(i - 1) - resolution);
+
+    qDeleteAll(timers);
+}
+
+QTEST_MAIN(tst_QXmppTimerWheel)
+#include "tst_qxmpptimerwheel.moc"
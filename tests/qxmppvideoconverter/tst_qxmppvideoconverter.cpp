@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppVideoConverter_p.h"
+#include "util.h"
+
+Q_DECLARE_METATYPE(QXmppVideoFrame::PixelFormat)
+
+// planes with padding at the end of each row
+class Image
+{
+public:
+    Image(const QSize &size, int chromaHeight)
+    {
+        const int widths[3] = { size.width(), size.width() / 2, size.width() / 2 };
+        const int heights[3] = { size.height(), chromaHeight, chromaHeight };
+        for (int i = 0; i < 3; ++i) {
+            m_widths[i] = widths[i];
+            m_heights[i] = heights[i];
+            m_data[i] = QByteArray((widths[i] + 5) * heights[i], 0);
+            planes.data[i] = (uchar*) m_data[i].data();
+            planes.stride[i] = widths[i] + 5;
+        }
+    }
+
+    QByteArray plane(int i) const
+    {
+        QByteArray data;
+        for (int row = 0; row < m_heights[i]; ++row)
+            data += m_data[i].mid(row * planes.stride[i], m_widths[i]);
+        return data;
+    }
+
+    QXmppYuvPlanes planes;
+
+private:
+    QByteArray m_data[3];
+    int m_heights[3];
+    int m_widths[3];
+};
+
+class tst_QXmppVideoConverter : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void cleanup();
+    void testInstructionSets_data();
+    void testInstructionSets();
+    void testRgb();
+    void testRoundTrip_data();
+    void testRoundTrip();
+    void testUnsupported();
+};
+
+static QXmppVideoFrame randomFrame(const QSize &size, QXmppVideoFrame::PixelFormat format)
+{
+    QXmppVideoFrame frame = QXmppVideoConverter::createFrame(size, format);
+    for (int i = 0; i < frame.mappedBytes(); ++i)
+        frame.bits()[i] = qrand();
+    return frame;
+}
+
+static void addFormats()
+{
+    QTest::addColumn<QXmppVideoFrame::PixelFormat>("format");
+
+    QTest::newRow("YUV420P") << QXmppVideoFrame::Format_YUV420P;
+    QTest::newRow("NV12") << QXmppVideoFrame::Format_NV12;
+    QTest::newRow("YUYV") << QXmppVideoFrame::Format_YUYV;
+    QTest::newRow("UYVY") << QXmppVideoFrame::Format_UYVY;
+    QTest::newRow("RGB32") << QXmppVideoFrame::Format_RGB32;
+}
+
+void tst_QXmppVideoConverter::cleanup()
+{
+    QXmppVideoConverter::setInstructionSet(QXmppVideoConverter::supportedInstructionSet());
+}
+
+void tst_QXmppVideoConverter::testInstructionSets_data()
+{
+    addFormats();
+}
+
+void tst_QXmppVideoConverter::testInstructionSets()
+{
+    QFETCH(QXmppVideoFrame::PixelFormat, format);
+
+    // the width is not a multiple of the vector sizes
+    const QSize size(102, 6);
+    const QXmppVideoFrame frame = randomFrame(size, format);
+
+    QXmppVideoConverter::setInstructionSet(QXmppVideoConverter::Scalar);
+    QCOMPARE(QXmppVideoConverter::instructionSet(), QXmppVideoConverter::Scalar);
+    Image expected(size, size.height() / 2);
+    QVERIFY(QXmppVideoConverter::toI420(frame, expected.planes));
+    QXmppVideoFrame expectedFrame = QXmppVideoConverter::createFrame(size, format);
+    QVERIFY(QXmppVideoConverter::fromI420(expected.planes, &expectedFrame));
+
+    // all the instruction sets produce the same output
+    for (int set = QXmppVideoConverter::SSE2; set <= QXmppVideoConverter::supportedInstructionSet(); ++set) {
+        QXmppVideoConverter::setInstructionSet(QXmppVideoConverter::InstructionSet(set));
+        QCOMPARE(int(QXmppVideoConverter::instructionSet()), set);
+
+        Image image(size, size.height() / 2);
+        QVERIFY(QXmppVideoConverter::toI420(frame, image.planes));
+        for (int i = 0; i < 3; ++i)
+            QCOMPARE(image.plane(i), expected.plane(i));
+
+        QXmppVideoFrame output = QXmppVideoConverter::createFrame(size, format);
+        QVERIFY(QXmppVideoConverter::fromI420(expected.planes, &output));
+        QCOMPARE(QByteArray((const char*) output.bits(), output.mappedBytes()),
+                 QByteArray((const char*) expectedFrame.bits(), expectedFrame.mappedBytes()));
+    }
+}
+
+void tst_QXmppVideoConverter::testRgb()
+{
+    const QSize size(2, 2);
+    QXmppVideoFrame frame = QXmppVideoConverter::createFrame(size, QXmppVideoFrame::Format_RGB32);
+    quint32 *pixels = reinterpret_cast<quint32*>(frame.bits());
+    for (int i = 0; i < 4; ++i)
+        pixels[i] = 0xffff0000;
+
+    // BT.601 red
+    Image image(size, 1);
+    QVERIFY(QXmppVideoConverter::toI420(frame, image.planes));
+    QCOMPARE(image.plane(0), QByteArray(4, char(82)));
+    QCOMPARE(image.plane(1), QByteArray(1, char(90)));
+    QCOMPARE(image.plane(2), QByteArray(1, char(240)));
+
+    QVERIFY(QXmppVideoConverter::fromI420(image.planes, &frame));
+    QCOMPARE(pixels[0], quint32(0xffff0100));
+}
+
+void tst_QXmppVideoConverter::testRoundTrip_data()
+{
+    addFormats();
+}
+
+void tst_QXmppVideoConverter::testRoundTrip()
+{
+    QFETCH(QXmppVideoFrame::PixelFormat, format);
+    if (format == QXmppVideoFrame::Format_RGB32)
+        QSKIP("RGB conversions are lossy");
+
+    const QSize size(36, 4);
+    Image image(size, size.height() / 2);
+    const QXmppVideoFrame source = randomFrame(size, QXmppVideoFrame::Format_YUV420P);
+    QVERIFY(QXmppVideoConverter::toI420(source, image.planes));
+
+    QXmppVideoFrame frame = QXmppVideoConverter::createFrame(size, format);
+    QVERIFY(QXmppVideoConverter::fromI420(image.planes, &frame));
+
+    Image output(size, size.height() / 2);
+    QVERIFY(QXmppVideoConverter::toI420(frame, output.planes));
+    for (int i = 0; i < 3; ++i)
+        QCOMPARE(output.plane(i), image.plane(i));
+
+    // packed formats also round trip through 4:2:2
+    if (format == QXmppVideoFrame::Format_UYVY || format == QXmppVideoFrame::Format_YUYV) {
+        Image planar(size, size.height());
+        QVERIFY(QXmppVideoConverter::toYuv422P(frame, planar.planes));
+        QXmppVideoFrame packed = QXmppVideoConverter::createFrame(size, format);
+        QVERIFY(QXmppVideoConverter::fromYuv422P(planar.planes, &packed));
+        QCOMPARE(QByteArray((const char*) packed.bits(), packed.mappedBytes()),
+                 QByteArray((const char*) frame.bits(), frame.mappedBytes()));
+    }
+}
+
+void tst_QXmppVideoConverter::testUnsupported()
+{
+    Image image(QSize(4, 4), 2);
+
+    // unsupported format
+    QVERIFY(!QXmppVideoConverter::isSupported(QXmppVideoFrame::Format_RGB24));
+    QXmppVideoFrame frame(48, QSize(4, 4), 12, QXmppVideoFrame::Format_RGB24);
+    QVERIFY(!QXmppVideoConverter::toI420(frame, image.planes));
+    QVERIFY(!QXmppVideoConverter::fromI420(image.planes, &frame));
+
+    // odd size
+    frame = QXmppVideoConverter::createFrame(QSize(3, 4), QXmppVideoFrame::Format_YUYV);
+    QVERIFY(!QXmppVideoConverter::toI420(frame, image.planes));
+
+    // truncated frame
+    frame = QXmppVideoFrame(16, QSize(4, 4), 8, QXmppVideoFrame::Format_YUYV);
+    QVERIFY(!QXmppVideoConverter::toI420(frame, image.planes));
+
+    // 4:2:2 planes are only used with packed formats
+    frame = QXmppVideoConverter::createFrame(QSize(4, 4), QXmppVideoFrame::Format_NV12);
+    QVERIFY(!QXmppVideoConverter::toYuv422P(frame, image.planes));
+}
+
+QTEST_MAIN(tst_QXmppVideoConverter)
+#include "tst_qxmppvideoconverter.moc"
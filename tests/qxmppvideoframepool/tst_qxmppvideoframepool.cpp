@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2008-2017 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppVideoFramePool_p.h"
+#include "util.h"
+
+class tst_QXmppVideoFramePool : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testExternal();
+    void testOutlivePool();
+    void testRecycle();
+    void testResize();
+};
+
+void tst_QXmppVideoFramePool::testExternal()
+{
+    QByteArray data(64, 'a');
+    QXmppVideoFrame frame((uchar*) data.data(), data.size(), QSize(4, 8), 8, QXmppVideoFrame::Format_YUYV);
+    QVERIFY(frame.isValid());
+    QCOMPARE(frame.bits(), (uchar*) data.data());
+    QCOMPARE(frame.mappedBytes(), 64);
+
+    // writes go to the external data
+    QXmppVideoFrame copy = frame;
+    copy.bits()[0] = 'b';
+    QCOMPARE(data.at(0), 'b');
+    QCOMPARE(frame.bits(), copy.bits());
+}
+
+void tst_QXmppVideoFramePool::testOutlivePool()
+{
+    QXmppVideoFrame frame;
+    {
+        QXmppVideoFramePool pool;
+        frame = pool.createFrame(QSize(4, 4), QXmppVideoFrame::Format_YUV420P);
+    }
+    QVERIFY(frame.isValid());
+    memset(frame.bits(), 0, frame.mappedBytes());
+    frame = QXmppVideoFrame();
+}
+
+void tst_QXmppVideoFramePool::testRecycle()
+{
+    QXmppVideoFramePool pool(2);
+    QCOMPARE(pool.freeCount(), 0);
+
+    QXmppVideoFrame frame = pool.createFrame(QSize(320, 240), QXmppVideoFrame::Format_YUV420P);
+    QVERIFY(frame.isValid());
+    QCOMPARE(frame.size(), QSize(320, 240));
+    QCOMPARE(frame.bytesPerLine(), 320);
+    QCOMPARE(frame.mappedBytes(), 320 * 240 * 3 / 2);
+    QCOMPARE(quintptr(frame.bits()) % 32, quintptr(0));
+    const uchar *bits = frame.bits();
+
+    // the buffer is recycled when the last copy is destroyed
+    QXmppVideoFrame copy = frame;
+    frame = QXmppVideoFrame();
+    QCOMPARE(pool.freeCount(), 0);
+    copy = QXmppVideoFrame();
+    QCOMPARE(pool.freeCount(), 1);
+
+    frame = pool.createFrame(QSize(320, 240), QXmppVideoFrame::Format_YUV420P);
+    QCOMPARE(pool.freeCount(), 0);
+    QCOMPARE((const uchar*) frame.bits(), bits);
+
+    // at most two buffers are kept
+    QList<QXmppVideoFrame> frames;
+    for (int i = 0; i < 4; ++i)
+        frames << pool.createFrame(QSize(320, 240), QXmppVideoFrame::Format_YUV420P);
+    frames.clear();
+    QCOMPARE(pool.freeCount(), 2);
+}
+
+void tst_QXmppVideoFramePool::testResize()
+{
+    QXmppVideoFramePool pool;
+    pool.createFrame(QSize(320, 240), QXmppVideoFrame::Format_YUYV);
+    QCOMPARE(pool.freeCount(), 1);
+
+    // smaller frames reuse the buffer
+    QXmppVideoFrame frame = pool.createFrame(QSize(160, 120), QXmppVideoFrame::Format_YUYV);
+    QCOMPARE(frame.mappedBytes(), 160 * 120 * 2);
+    QCOMPARE(pool.freeCount(), 0);
+    frame = QXmppVideoFrame();
+
+    // larger frames drop it
+    frame = pool.createFrame(QSize(640, 480), QXmppVideoFrame::Format_YUYV);
+    QCOMPARE(frame.mappedBytes(), 640 * 480 * 2);
+    QCOMPARE(pool.freeCount(), 0);
+
+    // unsupported formats
+    QVERIFY(!pool.createFrame(QSize(640, 480), QXmppVideoFrame::Format_RGB24).isValid());
+}
+
+QTEST_MAIN(tst_QXmppVideoFramePool)
+#include "tst_qxmppvideoframepool.moc"